@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,14 +32,20 @@
 #include <time.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
 
 #ifndef LIBSENTINEL_H
 #define LIBSENTINEL_H
 
 /* Constants */
 #define SENTINEL_TIME_START 694137600
+#define SENTINEL_MAX_FIELDS 48 // More fields than any log line has: 16 fixed, 3 notes, 8 tempstick and 7 more
 static const char default_format[] = "%F %T %Z%z";
 static const int SENTINEL_LOOP_SLEEP_MS = 5;
+static const int SENTINEL_RESPONSE_TIMEOUT_MS = 5000; // Silence after which a response is given up
+static const int SENTINEL_RESPONSE_WAIT_BYTES = 20; // Wait bytes after a command before it is given up
+static const int SENTINEL_READ_CHUNK = 4096;
+static const int SENTINEL_MAX_LINE = 1024; // Longest log line accepted when resuming a download
 /* Commands */
 static const char SENTINEL_LIST_CMD[1]  = {0x4d}; // d command to list the dive headers
 static const char SENTINEL_WAIT_BYTE[1] = {0x50}; // P the rebreather prints this when it is waiting for a command
@@ -63,6 +70,39 @@ static const char SENTINEL_PROFILE_END[5] = {0x45, 0x6e, 0x64, 0x0d, 0x0a}; // E
 
 #define eprint(format, ...) printf(BOLD KRED "ERROR: %s: %s: %d:" RESET " " format "\n", __FILE__, __func__, __LINE__, __VA_ARGS__)
 
+/* Logging of the library. Messages above SENTINEL_LOG_MAX_LEVEL are removed at compile
+ * time, the rest are checked against the runtime level before any formatting is done */
+#define SENTINEL_LOG_NONE  0
+#define SENTINEL_LOG_ERROR 1
+#define SENTINEL_LOG_WARN  2
+#define SENTINEL_LOG_INFO  3
+#define SENTINEL_LOG_DEBUG 4
+#define SENTINEL_LOG_TRACE 5
+
+#ifndef SENTINEL_LOG_MAX_LEVEL
+#ifdef NDEBUG
+#define SENTINEL_LOG_MAX_LEVEL SENTINEL_LOG_INFO
+#else
+#define SENTINEL_LOG_MAX_LEVEL SENTINEL_LOG_TRACE
+#endif
+#endif
+
+#define sentinel_log(level, ...) \
+    do { \
+        if ((level) <= SENTINEL_LOG_MAX_LEVEL && (level) <= sentinel_log_level) \
+            sentinel_log_write((level), __FILE__, __func__, __LINE__, __VA_ARGS__); \
+    } while (0)
+
+#define sentinel_error(...) sentinel_log(SENTINEL_LOG_ERROR, __VA_ARGS__)
+#define sentinel_warn(...)  sentinel_log(SENTINEL_LOG_WARN, __VA_ARGS__)
+#define sentinel_info(...)  sentinel_log(SENTINEL_LOG_INFO, __VA_ARGS__)
+#define sentinel_debug(...) sentinel_log(SENTINEL_LOG_DEBUG, __VA_ARGS__)
+#define sentinel_trace(...) sentinel_log(SENTINEL_LOG_TRACE, __VA_ARGS__)
+
+typedef void (*sentinel_log_sink_t)(int level, const char* file, const char* func, int line, const char* message, void* data);
+
+extern int sentinel_log_level;
+
 /* Structs */
 typedef struct sentinel_gas {
     int n2; /* Nitrogen percentage */
@@ -83,6 +123,41 @@ typedef struct sentinel_note {
     char* description; /* Longer description */
 } sentinel_note_t;
 
+/* A known note, the code of the note is its index + 1 in SENTINEL_NOTES */
+typedef struct sentinel_note_info {
+    const char* note;
+    int type;
+    const char* description;
+} sentinel_note_info_t;
+
+/* The notes of the log lines as X(note, type, description), the type is taken from Subsurface */
+#define SENTINEL_NOTE_TABLE(X) \
+    X("ASCENT", 3, "Ascent") \
+    X("ASCENT FAST", 3, "High ascent rate") \
+    X("CELLmV ERROR", 20, "Cell voltage error") \
+    X("DECO ALARM", 1, "Deco alarm") \
+    X("FILTERREDDIFF", 20, "Filter reading difference") \
+    X("HPRATE HI", 20, "High pressure rate") \
+    X("PPO2 <HIGH", 20, "PO2 very high") \
+    X("PPO2 FAIL", 20, "PO2 reading failed") \
+    X("PPO2 HIGH", 20, "PO2 high") \
+    X("PPO2 LOW", 20, "PO2 low") \
+    X("PPO2 mHIGH", 20, "PO2 medium high") \
+    X("PPO2 mLOW", 20, "PO2 medium low") \
+    X("PPO2 OFF", 20, "No pO2-reading") \
+    X("PPO2 OK", 20, "PO2 back to normal") \
+    X("PPO2 SPINC", 20, "SP change") \
+    X("PPO2 VHIGH", 20, "PO2 very high") \
+    X("PREDIVE ABORT", 20, "No predive check done") \
+    X("VALVE", 20, "Valve issue detected")
+
+#define SENTINEL_NOTE_ONE(note, type, description) + 1
+#define SENTINEL_NOTE_UNKNOWN 0xff
+#define SENTINEL_NOTE_KINDS (0 SENTINEL_NOTE_TABLE(SENTINEL_NOTE_ONE)) /* Entries in SENTINEL_NOTES */
+
+extern const sentinel_note_info_t SENTINEL_NOTES[SENTINEL_NOTE_KINDS];
+extern const int SENTINEL_NOTE_COUNT;
+
 typedef struct sentinel_dive_log_line {
     int time_idx; /* Time index */
     int time_s; /* Seconds since start of dive, equal to time_idx * record_interval */
@@ -103,25 +178,184 @@ typedef struct sentinel_dive_log_line {
     double co2; /* Converted from millibar to bar */
 } sentinel_dive_log_line_t;
 
-const sentinel_dive_log_line_t DEFAULT_LOG_LINE = {
-    0,
-    0,
-    NULL,
-    0.0,
-    0.0,
-    0,
-    0.0,
-    0.0,
-    0.0,
-    0,
-    0,
-    {0.0,0.0,0.0},
-    0.0,
-    0,
-    NULL,
-    {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0},
-    0.0
-};
+extern const sentinel_dive_log_line_t DEFAULT_LOG_LINE;
+
+/* Compact log line with the values in the units of the rebreather, about a quarter of the size of
+ * sentinel_dive_log_line_t without any allocations. Use the sentinel_record_* accessors for the
+ * converted values */
+typedef struct sentinel_record {
+    uint16_t time_idx;
+    uint16_t depth; /* Pressure reading, depth in meters is depth * 6 / 64 */
+    uint16_t po2; /* Centibar */
+    int16_t temperature; /* Celsius */
+    int16_t scrubber; /* Promille */
+    uint16_t battery[2]; /* Centivolt, primary and secondary handset */
+    int16_t diluent_pressure;
+    int16_t o2_pressure;
+    uint16_t cell_o2[3]; /* Centibar */
+    uint16_t setpoint; /* Centibar */
+    int16_t ceiling; /* Meters */
+    int16_t tempstick[8]; /* Decicelsius */
+    uint16_t co2;
+    uint8_t note[3]; /* Note codes, 0 for none, see SENTINEL_NOTES */
+} sentinel_record_t;
+
+/* Where the fields after the 16 fixed ones are in the log lines of a firmware, resolved once per
+ * dive with sentinel_record_layout for parse_sentinel_record */
+typedef struct sentinel_record_layout {
+    bool tempstick; /* The notes end at the first of the eight tempstick fields, which starts with S */
+    int co2; /* Field of the co2 counted from the first tempstick field */
+} sentinel_record_layout_t;
+
+/* Summary of a dive accumulated record by record while the profile is parsed, in the units of
+ * sentinel_record_t. All zero until the first record, see sentinel_summary_add */
+typedef struct sentinel_summary {
+    int records;
+    uint16_t min_depth; /* Pressure reading, see sentinel_summary_min_depth */
+    uint16_t max_depth;
+    uint64_t depth_sum; /* For sentinel_summary_mean_depth */
+    uint16_t min_po2; /* Centibar */
+    uint16_t max_po2;
+    uint16_t min_cell_o2[3]; /* Centibar */
+    uint16_t min_battery[2]; /* Centivolt, primary and secondary handset */
+    int16_t diluent_pressure[2]; /* First and last reading, see sentinel_summary_diluent_drop */
+    int16_t o2_pressure[2];
+    uint16_t max_co2;
+    uint16_t note_count[SENTINEL_NOTE_KINDS + 1]; /* Records with each note by code - 1, the unknown notes last */
+} sentinel_summary_t;
+
+/* Header of a dive for the zero-heap API, the strings are in place and truncated to fit */
+typedef struct sentinel_fixed_header {
+    char version[16];
+    int record_interval;
+    char serial_number[32];
+    int log_lines;
+    int start_s;
+    int end_s;
+    int length_s;
+    double max_depth;
+    int status;
+    int otu;
+    int atm;
+    int stack;
+    int usage;
+    double cns;
+    double safety;
+    int expert;
+    int tpm;
+    char decoalg[16];
+    double vgm_max_safety;
+    double vgm_stop_safety;
+    double vgm_mid_safety;
+    int filter_type;
+    int cell_health[3];
+    sentinel_gas_t gas[10];
+    sentinel_tissue_t tissue[16];
+    uint64_t content_hash; /* Same as the content_hash of sentinel_header_t */
+    sentinel_summary_t summary; /* Of all of the records, also the ones which did not fit */
+} sentinel_fixed_header_t;
+
+typedef enum sentinel_fixed_status {
+    SENTINEL_FIXED_OK = 0,
+    SENTINEL_FIXED_TRUNCATED, /* More records than room, the rest are counted in dropped */
+    SENTINEL_FIXED_OVERFLOW, /* The header or a log line did not fit in the receive window */
+    SENTINEL_FIXED_FAILED /* The transfer failed, the dive has no profile or its firmware is not supported */
+} sentinel_fixed_status_t;
+
+/* Called with each record of a dive as soon as it is parsed, see sentinel_fixed_dive_t */
+typedef void (*sentinel_record_callback_t)(const sentinel_record_t* record, void* data);
+
+/* Caller supplied buffers of a dive, nothing is allocated while downloading or parsing into them */
+typedef struct sentinel_fixed_dive {
+    char* window; /* Receive window, has to hold the whole header and then a few log lines at a time */
+    size_t window_size;
+    sentinel_fixed_header_t* header;
+    sentinel_record_t* records; /* NULL only counts the records */
+    int max_records; /* Room in records */
+    int count; /* Records stored */
+    int dropped; /* Records which did not fit */
+    int rejected; /* Log lines which did not parse */
+    bool in_profile;
+    bool ended; /* The End line has been seen */
+    bool overflow; /* The window filled up, the rest of the dive was read but not parsed */
+    int out_fd; /* -1, or the dive is written to it as it arrives, see sentinel_fixed_stream */
+    bool out_failed;
+    const sentinel_record_layout_t* layout; /* Of the firmware of the header, NULL if it is not supported */
+    sentinel_record_callback_t record_callback; /* NULL, or called with every record parsed, also the dropped ones */
+    void* record_data;
+} sentinel_fixed_dive_t;
+
+/* Profile pyramid for plotting long dives, each level has the min, max and mean of twice as many
+ * records in a bucket as the level below it */
+typedef enum sentinel_pyramid_column {
+    SENTINEL_PYRAMID_DEPTH = 0, /* Meters */
+    SENTINEL_PYRAMID_PO2, /* Bar */
+    SENTINEL_PYRAMID_CELL1, /* Bar */
+    SENTINEL_PYRAMID_CELL2,
+    SENTINEL_PYRAMID_CELL3,
+    SENTINEL_PYRAMID_SETPOINT, /* Bar */
+    SENTINEL_PYRAMID_TEMPERATURE, /* Celsius */
+    SENTINEL_PYRAMID_COLUMNS
+} sentinel_pyramid_column_t;
+
+typedef struct sentinel_bucket {
+    float min;
+    float max;
+    float mean;
+} sentinel_bucket_t;
+
+typedef struct sentinel_pyramid_level {
+    int bucket_size; /* Records in a bucket, the last bucket may have fewer */
+    int count; /* Buckets */
+    sentinel_bucket_t* bucket[SENTINEL_PYRAMID_COLUMNS];
+} sentinel_pyramid_level_t;
+
+typedef struct sentinel_pyramid {
+    int records;
+    int record_interval;
+    int levels;
+    sentinel_pyramid_level_t* level; /* Bucket sizes 2, 4, 8 ... up to a single bucket */
+} sentinel_pyramid_t;
+
+/* An anomaly of the oxygen cells or the loop found while the records stream in, with the code of
+ * the matching note in SENTINEL_NOTES. Each anomaly is reported when raised and when cleared */
+typedef struct sentinel_anomaly {
+    int time_idx; /* Record at which the anomaly was raised or cleared */
+    int cell; /* 0-2, -1 for the loop PO2 */
+    uint8_t code; /* CELLmV ERROR diverging cell, PPO2 FAIL stuck cell, PPO2 mLOW or mHIGH loop away from
+                     the setpoint, PPO2 OFF no PO2 reading */
+    bool cleared;
+    double value; /* Bar, the reading of the cell or the loop */
+} sentinel_anomaly_t;
+
+typedef void (*sentinel_anomaly_callback_t)(const sentinel_anomaly_t* anomaly, void* data);
+
+typedef struct sentinel_detector_cell {
+    uint16_t last; /* Centibar */
+    int stuck; /* Records with the same reading while the other cells changed */
+    int diverging; /* Records in a row with the divergence other than raised */
+    bool stuck_raised;
+    bool diverging_raised;
+} sentinel_detector_cell_t;
+
+/* Incremental detector, the state is fixed in size so a whole archive can be scanned with one */
+typedef struct sentinel_detector {
+    int divergence; /* Centibar, how far a cell may read from the other two */
+    int setpoint_margin; /* Centibar, how far the loop may read from the setpoint */
+    int hold; /* Records in a row before a divergence or the setpoint anomaly is raised or cleared */
+    int stuck_records; /* Records with an unchanged reading before a cell is stuck */
+    sentinel_detector_cell_t cell[3];
+    int off_setpoint; /* Records in a row with the setpoint anomaly other than raised */
+    uint8_t setpoint_code; /* Raised loop anomaly, 0 for none */
+    bool off;
+    int records;
+    int time_idx; /* Of the last record */
+    int anomalies; /* Raised so far */
+    sentinel_anomaly_callback_t callback;
+    void* data;
+} sentinel_detector_t;
+
+extern const sentinel_detector_t DEFAULT_DETECTOR;
 
 typedef struct sentinel_dive_header {
     char* version;
@@ -153,39 +387,422 @@ typedef struct sentinel_dive_header {
     sentinel_gas_t gas[10]; /* Configured gasses */
     sentinel_tissue_t tissue[16]; /* Not yet clear what these are */
     sentinel_dive_log_line_t** log; /* Allocate this based on the log_lines */
+    uint64_t content_hash; /* Of the header and the profile, set when the dive is parsed, see sentinel_dive_hash */
+    sentinel_summary_t summary; /* Of the log, set when the dive is parsed */
 } sentinel_header_t;
 
-const sentinel_header_t DEFAULT_HEADER = {
-    NULL,
-    0,
-    NULL,
-    0,
-    0,
-    0,
-    0,
-    NULL,
-    NULL,
-    NULL,
-    0.0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0.0,
-    0.0,
-    0,
-    0,
-    NULL,
-    0.0,
-    0.0,
-    0.0,
-    0,
-    {0,0,0},
-    {{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0}},
-    {{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0}},
-    NULL
-};
+extern const sentinel_header_t DEFAULT_HEADER;
+
+/* Index over a header list, which is ordered by the dive number, ie. from the newest to the oldest */
+typedef struct sentinel_header_table {
+    sentinel_header_t** headers; /* The indexed list, not owned by the table */
+    int count; /* Number of dives */
+    int* by_time; /* Dive numbers sorted by start_s, the oldest first */
+} sentinel_header_table_t;
+
+extern const sentinel_header_table_t DEFAULT_HEADER_TABLE;
+
+/* Decompression */
+#define SENTINEL_DECO_TISSUES 16
+
+typedef struct sentinel_deco_params {
+    double gf_low; /* Gradient factor low, 0.0 - 1.0 */
+    double gf_high; /* Gradient factor high, 0.0 - 1.0 */
+    double surface_pressure; /* Surface pressure in bar, 0.0 means use the DAtmos of the header */
+    double ceiling_tolerance; /* Allowed difference in meters to the ceiling reported by the device */
+} sentinel_deco_params_t;
+
+extern const sentinel_deco_params_t DEFAULT_DECO_PARAMS;
+
+typedef struct sentinel_deco_state {
+    double p_n2[SENTINEL_DECO_TISSUES]; /* N2 partial pressure per compartment, bar */
+    double p_he[SENTINEL_DECO_TISSUES]; /* He partial pressure per compartment, bar */
+    double k_n2[SENTINEL_DECO_TISSUES]; /* N2 saturation factor for one record interval */
+    double k_he[SENTINEL_DECO_TISSUES]; /* He saturation factor for one record interval */
+    int interval; /* Record interval the factors were computed for, 0 if not yet computed */
+    double surface_pressure; /* bar */
+    double f_n2; /* N2 fraction of the diluent */
+    double f_he; /* He fraction of the diluent */
+    double gf_low;
+    double gf_high;
+    double first_stop; /* Deepest tolerated ambient pressure seen with gf_low, bar */
+} sentinel_deco_state_t;
+
+typedef struct sentinel_deco_result {
+    int records; /* Number of log lines replayed */
+    double max_ceiling; /* Deepest computed ceiling during the dive, m */
+    double final_ceiling; /* Computed ceiling at the last log line, m */
+    int ceiling_mismatches; /* Log lines where the device ceiling differs more than the tolerance */
+    double tissue_percentage[SENTINEL_DECO_TISSUES]; /* Loading at the end of the dive, % of surface M-value */
+    double* ceiling; /* Optional caller allocated list of computed ceilings, one per log line */
+} sentinel_deco_result_t;
+
+extern const sentinel_deco_result_t DEFAULT_DECO_RESULT;
+
+/* Oxygen exposure */
+#define SENTINEL_OXTOX_TABLE_SIZE 301 /* pO2 from 0.00 to 3.00 bar in hundredths */
+
+typedef struct sentinel_oxtox {
+    int interval; /* Record interval in seconds */
+    double cns; /* Running CNS, % */
+    double otu; /* Running OTU */
+    double cns_decay; /* CNS elimination factor for one record interval below 0.5 bar */
+    int records; /* Number of records added */
+} sentinel_oxtox_t;
+
+/* Firmware versions with a known layout of the header and log lines */
+typedef enum sentinel_firmware {
+    SENTINEL_FW_UNKNOWN = 0,
+    SENTINEL_FW_V30C, /* Oldest version, no cell health nor tempstick */
+    SENTINEL_FW_V009A, /* Tempstick, co2 and four additional fields */
+    SENTINEL_FW_V009B, /* Tempstick and co2 */
+    SENTINEL_FW_COUNT
+} sentinel_firmware_t;
+
+extern const char* SENTINEL_FIRMWARE_NAME[SENTINEL_FW_COUNT];
+
+/* Parser of a single log line in the layout of one firmware, see sentinel_log_parser */
+typedef bool (*sentinel_log_parser_t)(int interval, sentinel_dive_log_line_t* line, char* linestr);
+
+/* Synthetic dive generator */
+typedef struct sentinel_generator {
+    sentinel_firmware_t firmware; /* Layout of the header and log lines */
+    int records; /* Number of log lines */
+    int record_interval; /* Seconds */
+    double note_density; /* Probability of a log line having a note, 0.0 - 1.0 */
+    double max_depth; /* Meters */
+    unsigned int seed; /* The same seed always generates the same dive */
+    int start; /* Start of the dive in Sentinel time */
+} sentinel_generator_t;
+
+extern const sentinel_generator_t DEFAULT_GENERATOR;
+
+/* Session statistics, collected per thread */
+typedef struct sentinel_stats {
+    long bytes_read; /* Bytes read from the device */
+    long bytes_written; /* Bytes written to the device */
+    long read_calls; /* read() syscalls */
+    long empty_reads; /* read() syscalls which returned no data */
+    long wakeups; /* Sleeps done while polling the device */
+    long long slept_ns; /* Time spent in those sleeps */
+    long flushed_bytes; /* Bytes discarded while waiting for the device to be idle */
+    long idle_retries; /* Failed reads while waiting for the device to be idle */
+    long long connect_ns; /* Time spent in connect_sentinel */
+    long long receive_ns; /* Time spent receiving responses */
+    long bytes_received; /* Bytes read while receiving responses, the wait bytes before them included */
+    long long parse_ns; /* Time spent parsing headers and log lines */
+    long allocations; /* Memory allocations done by the library */
+    double effective_baud; /* Bits per second of bytes_received in receive_ns, counting 10 bits per byte */
+} sentinel_stats_t;
+
+/* Faults the emulator can inject into its responses, can be combined */
+#define SENTINEL_FAULT_NONE          0x00
+#define SENTINEL_FAULT_TRUNCATE      0x01 /* Response stops and the wait bytes start again */
+#define SENTINEL_FAULT_OUT_OF_MEMORY 0x02 /* Response stops with ,,, like a rebreather out of memory */
+#define SENTINEL_FAULT_DROP          0x04 /* A single byte is lost */
+#define SENTINEL_FAULT_CORRUPT       0x08 /* A single byte is replaced */
+
+typedef struct sentinel_emulator_config {
+    char** dump_files; /* NULL-terminated list of D<n> responses, dive 0 first. NULL generates the dives */
+    int generated_dives; /* Number of dives generated when there are no dump files */
+    sentinel_generator_t generator; /* Dive n uses seed + n and starts n days before start */
+    int line_rate; /* Bytes per second, 0 sends as fast as the reader takes them */
+    int idle_interval_ms; /* Interval of the wait byte while there are no commands */
+    double fault_rate; /* Probability of a response getting a fault, 0.0 - 1.0 */
+    int faults; /* SENTINEL_FAULT_* flags to choose from */
+} sentinel_emulator_config_t;
+
+extern const sentinel_emulator_config_t DEFAULT_EMULATOR_CONFIG;
+
+typedef struct sentinel_emulator {
+    sentinel_emulator_config_t config;
+    int fd; /* Device end */
+    int client_fd; /* Library end, the slave of the pty or the other half of the socket pair */
+    char client_path[64]; /* Path of the pty slave, empty for the socket pair */
+    char** dives; /* D<n> responses */
+    int dive_count;
+    char* list; /* M response */
+    pthread_t thread;
+    bool running; /* Shared with the thread, only accessed with __atomic_load_n and __atomic_store_n */
+    bool started;
+    int stop_pipe[2];
+    unsigned int rnd;
+    long bytes_sent;
+    long commands;
+    long faults_injected;
+} sentinel_emulator_t;
+
+/* Allocator of a context, data is given to every call */
+typedef struct sentinel_allocator {
+    void* (*malloc)(size_t size, void* data);
+    void* (*calloc)(size_t nmemb, size_t size, void* data);
+    void* (*realloc)(void* ptr, size_t size, void* data);
+    void  (*free)(void* ptr, void* data);
+    void* data;
+} sentinel_allocator_t;
+
+extern const sentinel_allocator_t DEFAULT_ALLOCATOR;
+
+/* How a context reads from and writes to its device, data is given to every call */
+typedef struct sentinel_transport {
+    ssize_t (*read)(int fd, void* buf, size_t count, void* data);
+    ssize_t (*write)(int fd, const void* buf, size_t count, void* data);
+    void* data;
+} sentinel_transport_t;
+
+extern const sentinel_transport_t DEFAULT_TRANSPORT;
+
+/* Everything one session needs. Contexts share nothing, so each thread can run its own */
+typedef struct sentinel_ctx {
+    int fd; /* Device, -1 when not connected */
+    sentinel_transport_t transport;
+    sentinel_allocator_t allocator;
+    sentinel_log_sink_t log_sink; /* NULL uses the sink of the library */
+    void* log_sink_data;
+    sentinel_stats_t stats;
+    sentinel_header_t** header_list; /* Dives listed and downloaded, freed with the context */
+    sentinel_header_table_t table; /* Index of header_list, rebuilt whenever the dives are listed */
+    bool busy; /* An operation is in flight, the rebreather handles one command at a time */
+} sentinel_ctx_t;
+
+/* Receiver of a single response, fed with whatever the device sends */
+typedef enum sentinel_rx_state {
+    SENTINEL_RX_WAIT_START = 0, /* Skipping wait bytes until the start of the response */
+    SENTINEL_RX_BODY, /* Collecting until the end of the response */
+    SENTINEL_RX_DONE,
+    SENTINEL_RX_FAILED
+} sentinel_rx_state_t;
+
+typedef struct sentinel_receiver {
+    const char* start;
+    int start_len;
+    const char* end;
+    int end_len;
+    sentinel_rx_state_t state;
+    int matched; /* Bytes of start matched so far */
+    int wait_bytes; /* Wait bytes received before the start */
+    char* buffer; /* Response, starting after start and ending with end */
+    size_t len;
+    size_t size;
+    bool fixed; /* The buffer is the caller's and is never grown, see sentinel_receiver_init_fixed */
+} sentinel_receiver_t;
+
+typedef void (*sentinel_rx_hook_t)(sentinel_receiver_t* rx, void* data);
+
+typedef enum sentinel_op_kind {
+    SENTINEL_OP_IDLE = 0, /* Wait for the rebreather to be idle, like is_sentinel_idle */
+    SENTINEL_OP_LIST, /* Fetch the list of dives into ctx->header_list */
+    SENTINEL_OP_DOWNLOAD /* Fetch a dive into ctx->header_list */
+} sentinel_op_kind_t;
+
+typedef enum sentinel_op_status {
+    SENTINEL_OP_RUNNING = 0,
+    SENTINEL_OP_DONE,
+    SENTINEL_OP_FAILED
+} sentinel_op_status_t;
+
+struct sentinel_op;
+typedef void (*sentinel_op_callback_t)(struct sentinel_op* op, void* data);
+
+/* Returns the start of the newest known dive of the rebreather with the serial number, -1 for none */
+typedef int (*sentinel_list_anchor_t)(const char* serial_number, void* data);
+
+/* An operation in flight. Poll sentinel_op_fd() for POLLIN with sentinel_op_timeout() and
+ * call sentinel_op_process() whenever either fires */
+typedef struct sentinel_op {
+    sentinel_ctx_t* ctx;
+    sentinel_op_kind_t kind;
+    sentinel_op_status_t status;
+    int dive_num;
+    int tries; /* Idle: silent intervals left */
+    int idle_matched; /* Idle: consecutive wait bytes */
+    sentinel_receiver_t rx;
+    long long deadline_ns;
+    long long start_ns;
+    sentinel_op_callback_t callback;
+    void* callback_data;
+} sentinel_op_t;
+
+/* Outcome of download_sentinel_dive_resumable */
+typedef struct sentinel_download_report {
+    int expected; /* Records announced by the Mem line of the header */
+    int received; /* Distinct records kept */
+    int attempts; /* Times the dive was requested */
+    int duplicates; /* Records received again on a retry */
+    int rejected; /* Lines which were not a valid record */
+    int first_missing; /* Time index of the first record not received, -1 if none */
+    bool complete;
+} sentinel_download_report_t;
+
+extern const sentinel_download_report_t DEFAULT_DOWNLOAD_REPORT;
+
+/* A dive being downloaded with retries, the records are kept as received until the end */
+typedef struct sentinel_resume {
+    char* header_text; /* The header as received, up to Profile */
+    char** lines; /* The records without the line separator, indexed by time_idx */
+    int size; /* Of lines */
+    bool done; /* Some attempt received the whole response */
+} sentinel_resume_t;
+
+/* A note in the profile of a stored dive, the postings of a note are sorted by dive and time_idx */
+typedef struct sentinel_posting {
+    int dive; /* Index of the entry in the store */
+    int time_idx;
+} sentinel_posting_t;
+
+typedef struct sentinel_posting_list {
+    sentinel_posting_t* postings;
+    int count;
+    int size;
+} sentinel_posting_list_t;
+
+typedef struct sentinel_event {
+    int dive; /* Index of the entry in the store */
+    int time_idx;
+    uint8_t code; /* Of the note in SENTINEL_NOTES, or SENTINEL_NOTE_UNKNOWN */
+} sentinel_event_t;
+
+typedef enum sentinel_event_match {
+    SENTINEL_EVENTS_ANY = 0, /* Union, the events of any of the notes */
+    SENTINEL_EVENTS_ALL /* Intersection, the events of the dives which have all of the notes */
+} sentinel_event_match_t;
+
+/* Dive store, a directory with one file per dive named by the content hash and an index */
+typedef struct sentinel_store_entry {
+    uint64_t hash;
+    char serial_number[32];
+    int start_s;
+    int log_lines;
+    sentinel_summary_t summary; /* Of the profile, kept in the summaries file of the store */
+} sentinel_store_entry_t;
+
+typedef struct sentinel_store {
+    char* path;
+    char* index_path;
+    sentinel_store_entry_t* entries; /* In the order they were added */
+    int count;
+    int size;
+    int* slots; /* Hash table of entry index + 1, 0 is empty */
+    int slot_count; /* Power of two */
+    bool ascending; /* The entries are in the order the dives started, see sentinel_store_events */
+    bool descending; /* In the reverse order, as the rebreather lists them */
+    char* events_path;
+    sentinel_posting_list_t* events; /* By note code - 1, the unknown notes last, see sentinel_store_events */
+    char* summaries_path;
+    sentinel_ctx_t* ctx; /* Current when the store was opened, the memory of the store is in it */
+} sentinel_store_t;
+
+typedef enum sentinel_store_result {
+    SENTINEL_STORE_ERROR = 0,
+    SENTINEL_STORE_ADDED,
+    SENTINEL_STORE_DUPLICATE
+} sentinel_store_result_t;
+
+typedef enum sentinel_export_format {
+    SENTINEL_EXPORT_CSV = 0, /* A row per record, the dives are told apart by their hash */
+    SENTINEL_EXPORT_JSON, /* An array of the dives, each with an array of its records */
+    SENTINEL_EXPORT_XML /* Subsurface divelog */
+} sentinel_export_format_t;
+
+/* Shared memory segment with the published dives, a ring of announcements and a data area in
+ * which each dive is laid out by column. Mapped by other processes, see sentinel_shm_open */
+#define SENTINEL_SHM_MAGIC "SNTLSHM1"
+#define SENTINEL_SHM_DIVE_MAGIC "DIVE"
+
+typedef enum sentinel_column_type {
+    SENTINEL_COLUMN_U8 = 1,
+    SENTINEL_COLUMN_U16,
+    SENTINEL_COLUMN_S16
+} sentinel_column_type_t;
+
+typedef struct sentinel_shm_column {
+    char name[16]; /* Named after the field of sentinel_record_t, eg. po2 or cell_o2_1 */
+    uint32_t type; /* sentinel_column_type_t */
+    uint32_t offset; /* Of the first value from the start of the dive, one value per record */
+} sentinel_shm_column_t;
+
+typedef struct sentinel_shm_dive {
+    char magic[4];
+    uint32_t length; /* Bytes, including the columns and their values */
+    uint64_t content_hash;
+    char serial_number[24];
+    char version[8];
+    int32_t start_s;
+    int32_t end_s;
+    int32_t record_interval;
+    uint32_t records;
+    double max_depth;
+    uint32_t columns;
+    uint32_t reserved;
+    sentinel_shm_column_t column[];
+} sentinel_shm_dive_t;
+
+typedef struct sentinel_shm_slot {
+    uint64_t seq; /* Announcement number + 1, 0 while the slot is being written */
+    uint64_t position; /* Of the dive, counted in bytes ever reserved in the data area */
+    uint64_t length;
+    uint64_t content_hash;
+} sentinel_shm_slot_t;
+
+typedef struct sentinel_shm_segment {
+    char magic[8]; /* Written last when the segment is created */
+    uint32_t slots;
+    uint32_t reserved;
+    uint64_t data_offset; /* From the start of the segment */
+    uint64_t data_size;
+    uint64_t published; /* Number of announcements */
+    uint64_t reserved_end; /* Position up to which the data area has been reserved, advanced before writing */
+    sentinel_shm_slot_t slot[];
+} sentinel_shm_segment_t;
+
+/* Mapping of a segment, allocated in the current context and closed in the same one */
+typedef struct sentinel_shm {
+    int fd;
+    sentinel_shm_segment_t* segment;
+    size_t size; /* Of the mapping */
+    bool writer;
+    uint64_t next; /* Next announcement to read */
+    uint64_t position; /* Of the dive returned last by sentinel_shm_next */
+} sentinel_shm_t;
+
+/* Server sharing one rebreather with the clients of a Unix socket. A request is a line, list or
+ * dive <n>, the reply is OK <bytes> and a line break followed by the response of the rebreather,
+ * or ERR and the reason on one line */
+#define SENTINEL_SERVER_LIST -1 /* The list of dives instead of a dive number */
+
+typedef struct sentinel_server_client {
+    int fd;
+    char request[64]; /* Line being received */
+    size_t request_len;
+    char* reply; /* Being sent */
+    size_t reply_len;
+    size_t reply_sent;
+    int waiting; /* Dive number or SENTINEL_SERVER_LIST being waited for, -2 for none */
+} sentinel_server_client_t;
+
+typedef struct sentinel_server {
+    sentinel_ctx_t* ctx;
+    int listen_fd;
+    char* path;
+    sentinel_server_client_t** clients;
+    int client_count;
+    char* list_text; /* Response to the list command, NULL until listed */
+    size_t list_len;
+    char** dive_text; /* Responses to the download command, by dive number */
+    size_t* dive_len;
+    int dive_count;
+    int* queue; /* Transfers waiting for the device, each dive number once */
+    int queue_len;
+    sentinel_op_t* op; /* Transfer in flight */
+    int op_dive;
+    int prefetch; /* Newest dives fetched in the background after listing, 0 for none */
+    int prefetch_next; /* Next dive to prefetch */
+    long long transfers; /* Done with the device */
+    long long prefetched; /* Transfers started by the prefetch */
+    long long served; /* Replies sent */
+    struct pollfd* pfd; /* Descriptors of sentinel_server_process */
+    int pfd_size;
+} sentinel_server_t;
 
 /* External functions */
 extern int connect_sentinel(char* devicex);
@@ -215,6 +832,147 @@ extern sentinel_header_t** resize_sentinel_header_list(sentinel_header_t** old_l
 extern void free_sentinel_header_list(sentinel_header_t** h_list);
 extern bool get_sentinel_note(sentinel_note_t* note, char* note_str);
 extern bool download_sentinel_dive(int device, int dive_num, sentinel_header_t** header_item);
+extern void sentinel_deco_diluent(const sentinel_header_t* header, double* f_n2, double* f_he);
+extern void sentinel_deco_set_interval(sentinel_deco_state_t* state, const int interval);
+extern bool sentinel_deco_init(sentinel_deco_state_t* state, const sentinel_header_t* header, const sentinel_deco_params_t* params);
+extern void sentinel_deco_step(sentinel_deco_state_t* state, const double depth, const double po2);
+extern double sentinel_deco_ceiling(sentinel_deco_state_t* state);
+extern void sentinel_deco_tissue_percentage(const sentinel_deco_state_t* state, double* percentage);
+extern bool sentinel_deco_replay(const sentinel_header_t* header, const sentinel_deco_params_t* params, sentinel_deco_result_t* result);
+extern int sentinel_deco_replay_batch(sentinel_header_t** header_list, const sentinel_deco_params_t* params, sentinel_deco_result_t* results);
+extern void sentinel_oxtox_init(sentinel_oxtox_t* oxtox, const int interval);
+extern void sentinel_oxtox_update_raw(sentinel_oxtox_t* oxtox, int po2_cbar);
+extern void sentinel_oxtox_update(sentinel_oxtox_t* oxtox, const double po2);
+extern bool sentinel_oxtox_dive(const sentinel_header_t* header, sentinel_oxtox_t* oxtox, double* cns, double* otu);
+extern bool sentinel_oxtox_matches_header(const sentinel_header_t* header, const sentinel_oxtox_t* oxtox,
+                                          const double cns_tolerance, const double otu_tolerance);
+extern char* sentinel_generate_dive(const sentinel_generator_t* gen);
+extern char* sentinel_generate_header(const sentinel_generator_t* gen);
+extern sentinel_stats_t* sentinel_get_stats(void);
+extern void sentinel_reset_stats(void);
+extern void print_sentinel_stats_json(FILE* out, const sentinel_stats_t* stats);
+extern void sentinel_set_log_level(const int level);
+extern void sentinel_set_log_sink(sentinel_log_sink_t sink, void* data);
+extern void sentinel_log_write(int level, const char* file, const char* func, int line, const char* format, ...)
+    __attribute__ ((format (printf, 5, 6)));
+extern sentinel_emulator_t* sentinel_emulator_start_pty(const sentinel_emulator_config_t* config);
+extern sentinel_emulator_t* sentinel_emulator_start_socketpair(const sentinel_emulator_config_t* config);
+extern void sentinel_emulator_free(sentinel_emulator_t* emu);
+extern sentinel_ctx_t* sentinel_ctx_new(const sentinel_allocator_t* allocator);
+extern void sentinel_ctx_free(sentinel_ctx_t* ctx);
+extern void sentinel_ctx_set_log_sink(sentinel_ctx_t* ctx, sentinel_log_sink_t sink, void* data);
+extern void sentinel_ctx_attach(sentinel_ctx_t* ctx, int fd, const sentinel_transport_t* transport);
+extern bool sentinel_ctx_connect(sentinel_ctx_t* ctx, char* device, const int tries);
+extern bool sentinel_ctx_disconnect(sentinel_ctx_t* ctx);
+extern bool sentinel_ctx_list(sentinel_ctx_t* ctx);
+extern bool sentinel_ctx_download(sentinel_ctx_t* ctx, const int dive_num);
+extern sentinel_stats_t* sentinel_ctx_stats(sentinel_ctx_t* ctx);
+extern bool parse_sentinel_dive_list(char** buffer, sentinel_header_t*** header_list);
+extern bool parse_sentinel_dive(char** buffer, sentinel_header_t** header_item);
+extern sentinel_op_t* sentinel_op_idle(sentinel_ctx_t* ctx, const int tries, sentinel_op_callback_t callback, void* data);
+extern sentinel_op_t* sentinel_op_list(sentinel_ctx_t* ctx, sentinel_op_callback_t callback, void* data);
+extern sentinel_op_t* sentinel_op_download(sentinel_ctx_t* ctx, const int dive_num, sentinel_op_callback_t callback, void* data);
+extern int sentinel_op_fd(const sentinel_op_t* op);
+extern int sentinel_op_timeout(const sentinel_op_t* op);
+extern sentinel_op_status_t sentinel_op_process(sentinel_op_t* op);
+extern int sentinel_op_run(sentinel_op_t** ops, const int count);
+extern void sentinel_op_free(sentinel_op_t* op);
+extern bool download_sentinel_dive_resumable(int fd, int dive_num, sentinel_header_t** header_item, const int attempts,
+                                             sentinel_download_report_t* report);
+extern bool sentinel_ctx_download_resumable(sentinel_ctx_t* ctx, const int dive_num, const int attempts,
+                                            sentinel_download_report_t* report);
+extern bool get_sentinel_dive_list_since(int fd, const char* serial_number, const int start_s,
+                                         sentinel_header_t*** header_list);
+extern bool sentinel_ctx_list_since(sentinel_ctx_t* ctx, const char* serial_number, const int start_s);
+extern bool get_sentinel_dive_list_anchored(int fd, sentinel_list_anchor_t anchor, void* data,
+                                            sentinel_header_t*** header_list);
+extern bool sentinel_ctx_list_anchored(sentinel_ctx_t* ctx, sentinel_list_anchor_t anchor, void* data);
+extern const sentinel_store_entry_t* sentinel_store_newest(const sentinel_store_t* store, const char* serial_number);
+extern bool sentinel_store_list_new(sentinel_ctx_t* ctx, const sentinel_store_t* store);
+extern int sentinel_note_code(const char* note_str, size_t len);
+extern bool sentinel_header_table_build(sentinel_header_table_t* table, sentinel_header_t** header_list);
+extern void sentinel_header_table_clear(sentinel_header_table_t* table);
+extern sentinel_header_t* sentinel_header_table_get(const sentinel_header_table_t* table, const int dive_num);
+extern const int* sentinel_header_table_range(const sentinel_header_table_t* table, const int from_s, const int to_s,
+                                              int* count);
+extern sentinel_shm_t* sentinel_shm_create(const char* name, const size_t data_size, const int slots);
+extern sentinel_shm_t* sentinel_shm_open(const char* name);
+extern sentinel_shm_t* sentinel_shm_attach(int fd);
+extern int sentinel_shm_fd(const sentinel_shm_t* shm);
+extern bool sentinel_shm_publish(sentinel_shm_t* shm, const sentinel_header_t* header);
+extern const sentinel_shm_dive_t* sentinel_shm_next(sentinel_shm_t* shm, uint64_t* lost);
+extern bool sentinel_shm_valid(const sentinel_shm_t* shm);
+extern const void* sentinel_shm_column(const sentinel_shm_dive_t* dive, const char* name, sentinel_column_type_t* type);
+extern void sentinel_shm_close(sentinel_shm_t* shm);
+extern bool sentinel_shm_unlink(const char* name);
+extern sentinel_server_t* sentinel_server_new(sentinel_ctx_t* ctx, const char* path);
+extern bool sentinel_server_process(sentinel_server_t* server, const int timeout_ms);
+extern void sentinel_server_free(sentinel_server_t* server);
+extern bool sentinel_server_query(const char* path, const char* request, char** reply, size_t* len);
+extern sentinel_pyramid_t* sentinel_pyramid_build(const sentinel_record_t* records, const int count, const int interval);
+extern sentinel_pyramid_t* sentinel_pyramid_dive(const sentinel_header_t* header);
+extern const sentinel_pyramid_level_t* sentinel_pyramid_level(const sentinel_pyramid_t* pyramid, const int max_buckets);
+extern void sentinel_pyramid_free(sentinel_pyramid_t* pyramid);
+extern void sentinel_detector_init(sentinel_detector_t* detector, sentinel_anomaly_callback_t callback, void* data);
+extern void sentinel_detector_feed(sentinel_detector_t* detector, const sentinel_record_t* record);
+extern void sentinel_detector_finish(sentinel_detector_t* detector);
+extern int sentinel_detector_scan(sentinel_detector_t* detector, const char* text, size_t len);
+extern bool sentinel_store_scan(const sentinel_store_t* store, const sentinel_store_entry_t* entry,
+                                sentinel_detector_t* detector);
+extern void sentinel_fixed_init(sentinel_fixed_dive_t* dive, char* window, size_t window_size,
+                                sentinel_fixed_header_t* header, sentinel_record_t* records, const int max_records);
+extern size_t sentinel_fixed_feed(sentinel_fixed_dive_t* dive, const char* text, size_t len);
+extern sentinel_fixed_status_t sentinel_fixed_parse(sentinel_fixed_dive_t* dive, const char* text, size_t len);
+extern sentinel_fixed_status_t sentinel_fixed_download(int fd, int dive_num, sentinel_fixed_dive_t* dive);
+extern sentinel_fixed_status_t sentinel_fixed_stream(int fd, int dive_num, sentinel_fixed_dive_t* dive, int out_fd);
+extern bool sentinel_export_store(const sentinel_store_t* store, int out_fd, const sentinel_export_format_t format,
+                                  int threads);
+extern int sentinel_store_events(const sentinel_store_t* store, const uint8_t* codes, const int code_count,
+                                 const sentinel_event_match_t match, const int from_s, const int to_s,
+                                 sentinel_event_t** events);
+extern void sentinel_summary_add(sentinel_summary_t* summary, const sentinel_record_t* record);
+extern void sentinel_summary_add_line(sentinel_summary_t* summary, const sentinel_dive_log_line_t* line);
+extern double sentinel_summary_min_depth(const sentinel_summary_t* summary);
+extern double sentinel_summary_max_depth(const sentinel_summary_t* summary);
+extern double sentinel_summary_mean_depth(const sentinel_summary_t* summary);
+extern int sentinel_summary_diluent_drop(const sentinel_summary_t* summary);
+extern int sentinel_summary_o2_drop(const sentinel_summary_t* summary);
+extern int sentinel_summary_events(const sentinel_summary_t* summary);
+extern sentinel_firmware_t sentinel_firmware_from_version(const char* version);
+extern sentinel_log_parser_t sentinel_log_parser(const sentinel_firmware_t firmware);
+extern const sentinel_record_layout_t* sentinel_record_layout(const sentinel_firmware_t firmware);
+extern bool parse_sentinel_log_line_v30c(int interval, sentinel_dive_log_line_t* line, char* linestr);
+extern bool parse_sentinel_log_line_v009(int interval, sentinel_dive_log_line_t* line, char* linestr);
+extern uint16_t sentinel_clamp_u16(const long value);
+extern int16_t sentinel_clamp_s16(const long value);
+extern const sentinel_record_layout_t* sentinel_dive_layout(const char* header, size_t len);
+extern bool parse_sentinel_record(const sentinel_record_layout_t* layout, sentinel_record_t* record, const char* linestr, size_t len);
+extern const char* sentinel_profile_next_line(const char** line, const char* end, size_t* len);
+extern int parse_sentinel_dive_records(const char* text, size_t len, sentinel_record_t** records);
+extern void sentinel_record_from_log_line(sentinel_record_t* record, const sentinel_dive_log_line_t* line);
+extern bool sentinel_record_to_log_line(const sentinel_record_t* record, const int interval, sentinel_dive_log_line_t* line);
+extern int sentinel_records_from_log(sentinel_dive_log_line_t** log, sentinel_record_t** records);
+extern sentinel_dive_log_line_t** sentinel_records_to_log(const sentinel_record_t* records, const int count, const int interval);
+extern int sentinel_record_time_s(const sentinel_record_t* record, const int interval);
+extern double sentinel_record_depth(const sentinel_record_t* record);
+extern double sentinel_record_po2(const sentinel_record_t* record);
+extern double sentinel_record_scrubber_left(const sentinel_record_t* record);
+extern double sentinel_record_battery_V(const sentinel_record_t* record, const int handset);
+extern double sentinel_record_cell_o2(const sentinel_record_t* record, const int cell);
+extern double sentinel_record_setpoint(const sentinel_record_t* record);
+extern double sentinel_record_tempstick(const sentinel_record_t* record, const int sensor);
+extern bool sentinel_valid_log_line(const char* line, const size_t len);
+extern uint64_t sentinel_dive_hash(const char* text, size_t len);
+extern sentinel_store_t* sentinel_store_open(const char* path);
+extern void sentinel_store_close(sentinel_store_t* store);
+extern const sentinel_store_entry_t* sentinel_store_find(const sentinel_store_t* store, const uint64_t hash);
+extern sentinel_store_result_t sentinel_store_ingest(sentinel_store_t* store, const char* text, size_t len, uint64_t* hash);
+extern sentinel_store_result_t sentinel_store_download(sentinel_ctx_t* ctx, sentinel_store_t* store, const int dive_num,
+                                                       const int attempts, sentinel_download_report_t* report);
+extern sentinel_store_result_t sentinel_store_stream(sentinel_store_t* store, int fd, const int dive_num,
+                                                     sentinel_fixed_dive_t* dive);
+extern bool sentinel_store_load(const sentinel_store_t* store, const sentinel_store_entry_t* entry,
+                                sentinel_header_t** header_item);
 
 /* Internal functions */
 char** str_cut(char** orig_string, const char* delim);
@@ -226,4 +984,40 @@ char* resize_string(char* old_str, int len);
 char** resize_string_array(char** old_arr, int len);
 void free_string_array(char** str_arr);
 char* restring(const char* old_str, const int old_len);
+long long sentinel_time_ns(void);
+ssize_t sentinel_read(int fd, void* buf, size_t count);
+ssize_t sentinel_write(int fd, const void* buf, size_t count);
+void* sentinel_malloc(size_t size);
+void* sentinel_calloc(size_t nmemb, size_t size);
+void* sentinel_realloc(void* ptr, size_t size);
+char* sentinel_strdup(const char* str);
+void sentinel_free(void* ptr);
+sentinel_ctx_t* sentinel_ctx_enter(sentinel_ctx_t* ctx);
+void sentinel_ctx_leave(sentinel_ctx_t* prev);
+sentinel_ctx_t* sentinel_ctx_current(void);
+bool sentinel_receiver_init(sentinel_receiver_t* rx, const char* start, int start_len, const char* end, int end_len);
+void sentinel_receiver_init_fixed(sentinel_receiver_t* rx, const char* start, int start_len, const char* end, int end_len,
+                                  char* buffer, size_t size);
+sentinel_rx_state_t sentinel_receiver_feed(sentinel_receiver_t* rx, const char* data, size_t len);
+int sentinel_dive_command(char* command, size_t size, const int dive_num);
+sentinel_rx_state_t receive_sentinel_response(int fd, sentinel_receiver_t* rx);
+sentinel_rx_state_t receive_sentinel_response_hook(int fd, sentinel_receiver_t* rx, sentinel_rx_hook_t hook, void* data);
+bool sentinel_ctx_check_dive(const sentinel_ctx_t* ctx, const int dive_num);
+bool sentinel_resume_receive(int fd, int dive_num, sentinel_header_t** header_item, const int attempts,
+                             sentinel_resume_t* resume, sentinel_download_report_t* report);
+bool sentinel_resume_parse(const sentinel_resume_t* resume, sentinel_header_t* header);
+uint64_t sentinel_resume_hash(const sentinel_resume_t* resume);
+void sentinel_resume_free(sentinel_resume_t* resume);
+uint64_t sentinel_hash_header(const char* header, size_t len);
+uint64_t sentinel_hash_line(uint64_t hash, const char* line, size_t len);
+char* sentinel_store_file(const sentinel_store_t* store, const char* name);
+ssize_t sentinel_store_getline(char** line, size_t* size, FILE* in);
+char* sentinel_store_dive_path(const sentinel_store_t* store, const uint64_t hash);
+char* sentinel_store_read(const sentinel_store_t* store, const sentinel_store_entry_t* entry, size_t* len);
+bool sentinel_events_open(sentinel_store_t* store, bool* missing);
+bool sentinel_events_index(sentinel_store_t* store, const int dive, const sentinel_record_t* records, const int count);
+void sentinel_events_free(sentinel_store_t* store);
+bool sentinel_summary_open(sentinel_store_t* store, bool* missing);
+bool sentinel_summary_index(sentinel_store_t* store, const int dive, const sentinel_record_t* records, const int count);
+void sentinel_summary_free(sentinel_store_t* store);
 #endif  // LIBSENTINEL_H
@@ -0,0 +1,281 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include "libsentinel.h"
+
+const sentinel_detector_t DEFAULT_DETECTOR = {
+    20, /* divergence */
+    30, /* setpoint_margin */
+    6, /* hold */
+    30, /* stuck_records */
+    {{0, 0, 0, false, false}, {0, 0, 0, false, false}, {0, 0, 0, false, false}}, /* cell */
+    0, /* off_setpoint */
+    0, /* setpoint_code */
+    false, /* off */
+    0, /* records */
+    0, /* time_idx */
+    0, /* anomalies */
+    NULL, /* callback */
+    NULL /* data */
+};
+
+/**
+ * sentinel_detector_code: Returns the code of the note, the notes are only looked up when an anomaly
+ *                         is raised or cleared
+ **/
+
+static uint8_t sentinel_detector_code(const char* note) {
+    return(sentinel_note_code(note, strlen(note)));
+}
+
+/**
+ * sentinel_detector_emit: Reports an anomaly to the callback
+ **/
+
+static void sentinel_detector_emit(sentinel_detector_t* detector, const int cell, const uint8_t code,
+                                   const bool cleared, const int centibar) {
+    sentinel_anomaly_t anomaly;
+
+    anomaly.time_idx = detector->time_idx;
+    anomaly.cell     = cell;
+    anomaly.code     = code;
+    anomaly.cleared  = cleared;
+    anomaly.value    = centibar / 100.0;
+
+    if (!cleared)
+        detector->anomalies++;
+
+    if (detector->callback != NULL)
+        detector->callback(&anomaly, detector->data);
+}
+
+/**
+ * sentinel_detector_is_off: Whether the record has no PO2 reading, either a zero PO2 or a PPO2 OFF
+ *                           note from the rebreather
+ **/
+
+static bool sentinel_detector_is_off(const sentinel_record_t* record) {
+    int i = 0;
+
+    if (record->po2 == 0)
+        return(true);
+
+    for (i = 0; i < 3 && record->note[i] != 0; i++) {
+        if (record->note[i] != SENTINEL_NOTE_UNKNOWN && strcmp(SENTINEL_NOTES[record->note[i] - 1].note, "PPO2 OFF") == 0)
+            return(true);
+    }
+
+    return(false);
+}
+
+/**
+ * sentinel_detector_clear_cells: Clears the raised anomalies of the cells and the loop, eg. when the
+ *                                PO2 reading goes off
+ **/
+
+static void sentinel_detector_clear_cells(sentinel_detector_t* detector, const sentinel_record_t* record) {
+    int i = 0;
+
+    for (i = 0; i < 3; i++) {
+        sentinel_detector_cell_t* cell = &detector->cell[i];
+        const int value = (record != NULL) ? record->cell_o2[i] : cell->last;
+
+        if (cell->diverging_raised)
+            sentinel_detector_emit(detector, i, sentinel_detector_code("CELLmV ERROR"), true, value);
+
+        if (cell->stuck_raised)
+            sentinel_detector_emit(detector, i, sentinel_detector_code("PPO2 FAIL"), true, value);
+
+        cell->stuck            = 0;
+        cell->diverging        = 0;
+        cell->stuck_raised     = false;
+        cell->diverging_raised = false;
+    }
+
+    if (detector->setpoint_code != 0)
+        sentinel_detector_emit(detector, -1, detector->setpoint_code, true, (record != NULL) ? record->po2 : 0);
+
+    detector->off_setpoint  = 0;
+    detector->setpoint_code = 0;
+}
+
+/**
+ * sentinel_detector_init: Sets the default thresholds, the anomalies are reported to the callback.
+ *                         The thresholds can be changed before the first record
+ **/
+
+void sentinel_detector_init(sentinel_detector_t* detector, sentinel_anomaly_callback_t callback, void* data) {
+    *detector = DEFAULT_DETECTOR;
+    detector->callback = callback;
+    detector->data     = data;
+}
+
+/**
+ * sentinel_detector_feed: Checks the next record of the dive. A cell is diverging when it reads more
+ *                         than the divergence from both of the other two, which agree, for hold
+ *                         records in a row, and stuck when its reading does not change for stuck_records records
+ *                         while the other cells change. The loop is away from the setpoint when the
+ *                         PO2 is more than setpoint_margin from it for hold records in a row. An
+ *                         anomaly is cleared likewise after hold records in a row without it
+ **/
+
+void sentinel_detector_feed(sentinel_detector_t* detector, const sentinel_record_t* record) {
+    const bool off = sentinel_detector_is_off(record);
+    int i = 0;
+
+    detector->time_idx = record->time_idx;
+    detector->records++;
+
+    if (off != detector->off) {
+        if (off)
+            sentinel_detector_clear_cells(detector, record);
+
+        sentinel_detector_emit(detector, -1, sentinel_detector_code("PPO2 OFF"), !off, record->po2);
+        detector->off = off;
+    }
+
+    if (off) {
+        for (i = 0; i < 3; i++) {
+            detector->cell[i].last = record->cell_o2[i];
+        }
+
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        sentinel_detector_cell_t* cell = &detector->cell[i];
+        const int value = record->cell_o2[i];
+        const int a = record->cell_o2[(i + 1) % 3];
+        const int b = record->cell_o2[(i + 2) % 3];
+        const bool others_changed = (a != detector->cell[(i + 1) % 3].last || b != detector->cell[(i + 2) % 3].last);
+
+        /* Only the odd one out diverges, the other two have to agree with each other */
+        const bool diverging = (abs(value - a) > detector->divergence && abs(value - b) > detector->divergence &&
+                                abs(a - b) <= detector->divergence);
+
+        if (diverging == cell->diverging_raised) {
+            cell->diverging = 0;
+        } else if (++cell->diverging >= detector->hold) {
+            cell->diverging        = 0;
+            cell->diverging_raised = diverging;
+            sentinel_detector_emit(detector, i, sentinel_detector_code("CELLmV ERROR"), !diverging, value);
+        }
+
+        if (detector->records > 1 && value == cell->last) {
+            if (others_changed && ++cell->stuck >= detector->stuck_records && !cell->stuck_raised) {
+                cell->stuck_raised = true;
+                sentinel_detector_emit(detector, i, sentinel_detector_code("PPO2 FAIL"), false, value);
+            }
+        } else {
+            cell->stuck = 0;
+
+            if (cell->stuck_raised) {
+                cell->stuck_raised = false;
+                sentinel_detector_emit(detector, i, sentinel_detector_code("PPO2 FAIL"), true, value);
+            }
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        detector->cell[i].last = record->cell_o2[i];
+    }
+
+    if (record->setpoint == 0)
+        return;
+
+    const int diff = record->po2 - record->setpoint;
+    uint8_t code = 0;
+
+    if (diff < -detector->setpoint_margin)
+        code = sentinel_detector_code("PPO2 mLOW");
+    else if (diff > detector->setpoint_margin)
+        code = sentinel_detector_code("PPO2 mHIGH");
+
+    if (code == detector->setpoint_code) {
+        detector->off_setpoint = 0;
+    } else if (++detector->off_setpoint >= detector->hold) {
+        if (detector->setpoint_code != 0)
+            sentinel_detector_emit(detector, -1, detector->setpoint_code, true, record->po2);
+
+        if (code != 0)
+            sentinel_detector_emit(detector, -1, code, false, record->po2);
+
+        detector->off_setpoint  = 0;
+        detector->setpoint_code = code;
+    }
+}
+
+/**
+ * sentinel_detector_finish: Clears the anomalies still raised at the end of the dive and resets the
+ *                           state of the dive, so that the detector can be fed the next dive
+ **/
+
+void sentinel_detector_finish(sentinel_detector_t* detector) {
+    sentinel_detector_clear_cells(detector, NULL);
+
+    if (detector->off)
+        sentinel_detector_emit(detector, -1, sentinel_detector_code("PPO2 OFF"), true, 0);
+
+    detector->off     = false;
+    detector->records = 0;
+}
+
+/**
+ * sentinel_detector_scan: Feeds the profile of a dive, as received or read from a dump file, to the
+ *                         detector one record at a time and finishes the dive. Nothing is
+ *                         allocated, returns the number of records or -1 if there is no profile
+ *                         or the firmware is not supported
+ **/
+
+int sentinel_detector_scan(sentinel_detector_t* detector, const char* text, size_t len) {
+    const char* profile = memmem(text, len, "Profile\r\n", 9);
+    sentinel_record_t record;
+    int count = 0;
+
+    if (profile == NULL) {
+        sentinel_error("%s", "Received dive without a profile");
+        return(-1);
+    }
+
+    const sentinel_record_layout_t* layout = sentinel_dive_layout(text, profile - text);
+
+    if (layout == NULL)
+        return(-1);
+
+    const char* line = profile + 9;
+    const char* end  = text + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    while ((next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        if (parse_sentinel_record(layout, &record, line, line_len)) {
+            sentinel_detector_feed(detector, &record);
+            count++;
+        }
+
+        line = next;
+    }
+
+    sentinel_detector_finish(detector);
+
+    return(count);
+}
@@ -0,0 +1,497 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include <poll.h>
+
+#include "libsentinel.h"
+
+static const int SENTINEL_IDLE_INTERVAL_MS = 500; /* Same as the sleep of is_sentinel_idle */
+
+/**
+ * sentinel_receiver_init: Prepares the receiver for a response between start and end
+ **/
+
+bool sentinel_receiver_init(sentinel_receiver_t* rx, const char* start, int start_len, const char* end, int end_len) {
+    memset(rx, 0, sizeof(sentinel_receiver_t));
+
+    rx->start     = start;
+    rx->start_len = start_len;
+    rx->end       = end;
+    rx->end_len   = end_len;
+    rx->state     = SENTINEL_RX_WAIT_START;
+    rx->size      = SENTINEL_READ_CHUNK;
+    rx->buffer    = sentinel_calloc(rx->size, sizeof(char));
+
+    return(rx->buffer != NULL);
+}
+
+/**
+ * sentinel_receiver_init_fixed: Like sentinel_receiver_init, but the response is collected into the
+ *                               given buffer, which is never grown. A response which does not fit
+ *                               fails the receiver
+ **/
+
+void sentinel_receiver_init_fixed(sentinel_receiver_t* rx, const char* start, int start_len, const char* end, int end_len,
+                                  char* buffer, size_t size) {
+    memset(rx, 0, sizeof(sentinel_receiver_t));
+
+    rx->start     = start;
+    rx->start_len = start_len;
+    rx->end       = end;
+    rx->end_len   = end_len;
+    rx->state     = SENTINEL_RX_WAIT_START;
+    rx->size      = size;
+    rx->buffer    = buffer;
+    rx->fixed     = true;
+    rx->buffer[0] = 0;
+}
+
+/**
+ * sentinel_receiver_append: Appends to the buffer of the receiver, keeping it null-terminated
+ **/
+
+static bool sentinel_receiver_append(sentinel_receiver_t* rx, const char* data, size_t len) {
+    if (rx->len + len + 1 > rx->size && rx->fixed) {
+        sentinel_error("The response does not fit in the buffer of %zu bytes", rx->size);
+        return(false);
+    }
+
+    if (rx->len + len + 1 > rx->size) {
+        size_t size = rx->size * 2;
+
+        while (rx->len + len + 1 > size) {
+            size *= 2;
+        }
+
+        char* tmp = sentinel_realloc(rx->buffer, size);
+
+        if (tmp == NULL) {
+            sentinel_error("%s", "Failed to reallocate the receive buffer");
+            return(false);
+        }
+
+        rx->buffer = tmp;
+        rx->size   = size;
+    }
+
+    memcpy(rx->buffer + rx->len, data, len);
+    rx->len += len;
+    rx->buffer[rx->len] = 0;
+
+    return(true);
+}
+
+/**
+ * sentinel_receiver_feed: Feeds the bytes read from the device to the receiver. Everything
+ *                         before the start is skipped, everything after the end is dropped
+ **/
+
+sentinel_rx_state_t sentinel_receiver_feed(sentinel_receiver_t* rx, const char* data, size_t len) {
+    size_t i = 0;
+
+    while (rx->state == SENTINEL_RX_WAIT_START && i < len) {
+        const char c = data[i++];
+
+        if (c == SENTINEL_WAIT_BYTE[0])
+            rx->wait_bytes++;
+
+        if (c == rx->start[rx->matched])
+            rx->matched++;
+        else
+            rx->matched = (c == rx->start[0]) ? 1 : 0;
+
+        if (rx->matched == rx->start_len)
+            rx->state = SENTINEL_RX_BODY;
+    }
+
+    if (rx->state != SENTINEL_RX_BODY || i == len)
+        return(rx->state);
+
+    /* The end may have been split between this and the previous read */
+    const size_t from = (rx->len >= (size_t) rx->end_len) ? rx->len - rx->end_len + 1 : 0;
+
+    if (!sentinel_receiver_append(rx, data + i, len - i)) {
+        rx->state = SENTINEL_RX_FAILED;
+        return(rx->state);
+    }
+
+    char* found = memmem(rx->buffer + from, rx->len - from, rx->end, rx->end_len);
+
+    if (found != NULL) {
+        rx->len = found + rx->end_len - rx->buffer;
+        rx->buffer[rx->len] = 0;
+        rx->state = SENTINEL_RX_DONE;
+    } else if (memmem(rx->buffer + from, rx->len - from, "PPP", 3) != NULL ||
+               memmem(rx->buffer + from, rx->len - from, ",,,", 3) != NULL) {
+        /* The rebreather went back to waiting, or it is out of memory */
+        sentinel_error("Somehow we missed the end string after %zu bytes and see a lot of wait bytes or end-of-memory", rx->len);
+        rx->state = SENTINEL_RX_FAILED;
+    }
+
+    return(rx->state);
+}
+
+/**
+ * sentinel_dive_command: Writes the command to download the given dive, returns its length
+ **/
+
+int sentinel_dive_command(char* command, size_t size, const int dive_num) {
+    /* TODO: This is not how the dive number is formed. It is actually just the ascii character,
+     *       so eg. first dive is 0x30 (0) and the commad is D0, 12th dive is 0x3C (<) and the
+     *       command is D< */
+    return(snprintf(command, size, "D%d", dive_num));
+}
+
+/**
+ * sentinel_op_new: Allocates an operation on the context, only one can be in flight per context
+ **/
+
+static sentinel_op_t* sentinel_op_new(sentinel_ctx_t* ctx, const sentinel_op_kind_t kind,
+                                      sentinel_op_callback_t callback, void* data) {
+    if (ctx->fd < 0) {
+        sentinel_error("%s", "The context is not connected");
+        return(NULL);
+    }
+
+    if (ctx->busy) {
+        sentinel_error("%s", "The context already has an operation in flight");
+        return(NULL);
+    }
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    sentinel_op_t* op = sentinel_calloc(1, sizeof(sentinel_op_t));
+    sentinel_ctx_leave(prev);
+
+    if (op == NULL)
+        return(NULL);
+
+    op->ctx           = ctx;
+    op->kind          = kind;
+    op->status        = SENTINEL_OP_RUNNING;
+    op->callback      = callback;
+    op->callback_data = data;
+    op->start_ns      = sentinel_time_ns();
+    op->deadline_ns   = op->start_ns + SENTINEL_RESPONSE_TIMEOUT_MS * 1000000LL;
+    ctx->busy         = true;
+
+    return(op);
+}
+
+/**
+ * sentinel_op_send: Starts the receiver and sends the command of a list or download
+ **/
+
+static sentinel_op_t* sentinel_op_send(sentinel_op_t* op, const char* command, size_t size) {
+    sentinel_ctx_t* prev = sentinel_ctx_enter(op->ctx);
+    bool res = sentinel_receiver_init(&op->rx, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
+                                      SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END)) &&
+               send_sentinel_command(op->ctx->fd, command, size);
+    sentinel_ctx_leave(prev);
+
+    if (!res) {
+        sentinel_op_free(op);
+        return(NULL);
+    }
+
+    return(op);
+}
+
+/**
+ * sentinel_op_idle: Starts waiting for the rebreather to be idle, like is_sentinel_idle
+ **/
+
+sentinel_op_t* sentinel_op_idle(sentinel_ctx_t* ctx, const int tries, sentinel_op_callback_t callback, void* data) {
+    sentinel_op_t* op = sentinel_op_new(ctx, SENTINEL_OP_IDLE, callback, data);
+
+    if (op == NULL)
+        return(NULL);
+
+    op->tries       = tries;
+    op->deadline_ns = op->start_ns + SENTINEL_IDLE_INTERVAL_MS * 1000000LL;
+
+    return(op);
+}
+
+/**
+ * sentinel_op_list: Starts fetching the list of dives into ctx->header_list
+ **/
+
+sentinel_op_t* sentinel_op_list(sentinel_ctx_t* ctx, sentinel_op_callback_t callback, void* data) {
+    sentinel_op_t* op = sentinel_op_new(ctx, SENTINEL_OP_LIST, callback, data);
+
+    if (op == NULL)
+        return(NULL);
+
+    return(sentinel_op_send(op, SENTINEL_LIST_CMD, sizeof(SENTINEL_LIST_CMD)));
+}
+
+/**
+ * sentinel_op_download: Starts fetching the given dive into ctx->header_list, list the dives first
+ **/
+
+sentinel_op_t* sentinel_op_download(sentinel_ctx_t* ctx, const int dive_num, sentinel_op_callback_t callback, void* data) {
+    char command[16];
+
+    if (ctx->header_list == NULL) {
+        sentinel_error("%s", "No list of dives, list the dives first");
+        return(NULL);
+    }
+
+    if (sentinel_header_table_get(&ctx->table, dive_num) == NULL) {
+        sentinel_error("Non-existing dive: %d", dive_num);
+        return(NULL);
+    }
+
+    sentinel_op_t* op = sentinel_op_new(ctx, SENTINEL_OP_DOWNLOAD, callback, data);
+
+    if (op == NULL)
+        return(NULL);
+
+    op->dive_num = dive_num;
+
+    return(sentinel_op_send(op, command, sentinel_dive_command(command, sizeof(command), dive_num)));
+}
+
+/**
+ * sentinel_op_fd: Returns the descriptor to poll for POLLIN
+ **/
+
+int sentinel_op_fd(const sentinel_op_t* op) {
+    return(op->ctx->fd);
+}
+
+/**
+ * sentinel_op_timeout: Returns the milliseconds after which sentinel_op_process has to be called
+ *                      even if there is nothing to read, 0 when the operation has finished
+ **/
+
+int sentinel_op_timeout(const sentinel_op_t* op) {
+    if (op->status != SENTINEL_OP_RUNNING)
+        return(0);
+
+    const long long left = op->deadline_ns - sentinel_time_ns();
+
+    return((left > 0) ? (int) ((left + 999999) / 1000000) : 0);
+}
+
+/**
+ * sentinel_op_idle_feed: Looks for three consecutive wait bytes
+ **/
+
+static void sentinel_op_idle_feed(sentinel_op_t* op, const char* data, const ssize_t len) {
+    ssize_t i = 0;
+
+    for (i = 0; i < len && op->status == SENTINEL_OP_RUNNING; i++) {
+        op->idle_matched = (data[i] == SENTINEL_WAIT_BYTE[0]) ? op->idle_matched + 1 : 0;
+
+        if (op->idle_matched == 3)
+            op->status = SENTINEL_OP_DONE;
+    }
+
+    sentinel_get_stats()->flushed_bytes += len;
+}
+
+/**
+ * sentinel_op_finish: Parses the response into the context once it has been received
+ **/
+
+static void sentinel_op_finish(sentinel_op_t* op) {
+    sentinel_ctx_t* ctx = op->ctx;
+    bool res = false;
+
+    sentinel_debug("Read bytes: %zu", op->rx.len);
+
+    if (op->kind == SENTINEL_OP_LIST) {
+        sentinel_trace("Received dive list:\n%s", op->rx.buffer);
+
+        sentinel_header_table_clear(&ctx->table);
+
+        if (ctx->header_list != NULL) {
+            free_sentinel_header_list(ctx->header_list);
+            ctx->header_list = NULL;
+        }
+
+        res = parse_sentinel_dive_list(&op->rx.buffer, &ctx->header_list);
+        res &= sentinel_header_table_build(&ctx->table, ctx->header_list);
+    } else {
+        sentinel_trace("Received dive:\n%s", op->rx.buffer);
+        res = parse_sentinel_dive(&op->rx.buffer, &ctx->header_list[op->dive_num]);
+    }
+
+    op->status = res ? SENTINEL_OP_DONE : SENTINEL_OP_FAILED;
+}
+
+/**
+ * sentinel_op_process: Reads whatever the device has sent and advances the operation. The
+ *                      callback is called once, when the operation finishes
+ **/
+
+sentinel_op_status_t sentinel_op_process(sentinel_op_t* op) {
+    char chunk[SENTINEL_READ_CHUNK];
+    bool progress = false;
+
+    if (op->status != SENTINEL_OP_RUNNING)
+        return(op->status);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(op->ctx);
+
+    while (op->status == SENTINEL_OP_RUNNING) {
+        ssize_t n = sentinel_read(op->ctx->fd, chunk, sizeof(chunk));
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            sentinel_error("%s", "The device was closed");
+            op->status = SENTINEL_OP_FAILED;
+            break;
+        }
+
+        if (n < 0)
+            break;
+
+        progress = true;
+
+        if (op->kind != SENTINEL_OP_IDLE)
+            sentinel_get_stats()->bytes_received += n;
+
+        if (op->kind == SENTINEL_OP_IDLE) {
+            sentinel_op_idle_feed(op, chunk, n);
+        } else {
+            const sentinel_rx_state_t state = sentinel_receiver_feed(&op->rx, chunk, n);
+
+            if (state == SENTINEL_RX_DONE) {
+                sentinel_op_finish(op);
+            } else if (state == SENTINEL_RX_FAILED) {
+                op->status = SENTINEL_OP_FAILED;
+            } else if (op->rx.wait_bytes > SENTINEL_RESPONSE_WAIT_BYTES) {
+                sentinel_error("No response after %d wait bytes", op->rx.wait_bytes);
+                op->status = SENTINEL_OP_FAILED;
+            }
+        }
+    }
+
+    if (op->status == SENTINEL_OP_RUNNING) {
+        const long long now = sentinel_time_ns();
+
+        if (op->kind == SENTINEL_OP_IDLE) {
+            if (progress) {
+                op->deadline_ns = now + SENTINEL_IDLE_INTERVAL_MS * 1000000LL;
+            } else if (now >= op->deadline_ns) {
+                sentinel_get_stats()->idle_retries++;
+
+                if (--op->tries < 1)
+                    op->status = SENTINEL_OP_FAILED;
+                else
+                    op->deadline_ns = now + SENTINEL_IDLE_INTERVAL_MS * 1000000LL;
+            }
+        } else if (progress) {
+            op->deadline_ns = now + SENTINEL_RESPONSE_TIMEOUT_MS * 1000000LL;
+        } else if (now >= op->deadline_ns) {
+            sentinel_error("No data from the device in %d ms", SENTINEL_RESPONSE_TIMEOUT_MS);
+            op->status = SENTINEL_OP_FAILED;
+        }
+    }
+
+    /* A failed response counts too, its bytes already do */
+    if (op->status != SENTINEL_OP_RUNNING && op->kind != SENTINEL_OP_IDLE)
+        sentinel_get_stats()->receive_ns += sentinel_time_ns() - op->start_ns;
+
+    sentinel_ctx_leave(prev);
+
+    if (op->status != SENTINEL_OP_RUNNING) {
+        op->ctx->busy = false;
+
+        if (op->callback != NULL)
+            op->callback(op, op->callback_data);
+    }
+
+    return(op->status);
+}
+
+/**
+ * sentinel_op_run: Drives the given operations until all of them have finished, for callers
+ *                  without an event loop of their own. Returns the number of successful ones.
+ *                  The callbacks must not free the operations
+ **/
+
+int sentinel_op_run(sentinel_op_t** ops, const int count) {
+    int done = 0;
+    int i = 0;
+
+    if (count <= 0)
+        return(0);
+
+    struct pollfd pfd[count];
+
+    while (true) {
+        int running = 0;
+        int timeout = -1;
+
+        for (i = 0; i < count; i++) {
+            if (ops[i] == NULL || ops[i]->status != SENTINEL_OP_RUNNING)
+                continue;
+
+            const int t = sentinel_op_timeout(ops[i]);
+
+            pfd[running].fd     = sentinel_op_fd(ops[i]);
+            pfd[running].events = POLLIN;
+            timeout = (timeout < 0 || t < timeout) ? t : timeout;
+            running++;
+        }
+
+        if (running == 0)
+            break;
+
+        if (poll(pfd, running, timeout) < 0 && errno != EINTR) {
+            sentinel_error("%s", "poll() failed");
+            break;
+        }
+
+        /* Processing an operation with nothing to read is cheap, so all of them are processed */
+        for (i = 0; i < count; i++) {
+            if (ops[i] != NULL)
+                sentinel_op_process(ops[i]);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (ops[i] != NULL && ops[i]->status == SENTINEL_OP_DONE)
+            done++;
+    }
+
+    return(done);
+}
+
+/**
+ * sentinel_op_free: Frees the operation, an operation still in flight is abandoned
+ **/
+
+void sentinel_op_free(sentinel_op_t* op) {
+    if (op == NULL)
+        return;
+
+    if (op->status == SENTINEL_OP_RUNNING)
+        op->ctx->busy = false;
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(op->ctx);
+    sentinel_free(op->rx.buffer);
+    sentinel_free(op);
+    sentinel_ctx_leave(prev);
+}
@@ -0,0 +1,337 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "libsentinel.h"
+
+/* The benchmark is linked against the library objects with the allocation functions
+ * wrapped (-Wl,--wrap), so that we can count the allocations done by each stage */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+char* __real_strdup(const char* str);
+
+static long allocations = 0;
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return(__real_malloc(size));
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size) {
+    allocations++;
+    return(__real_calloc(nmemb, size));
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocations++;
+    return(__real_realloc(ptr, size));
+}
+
+char* __wrap_strdup(const char* str) {
+    allocations++;
+    return(__real_strdup(str));
+}
+
+enum {
+    STAGE_RECEIVE = 0,
+    STAGE_STR_CUT,
+    STAGE_HEADER,
+    STAGE_LOG_LINE,
+    STAGE_RECORD,
+    STAGE_PRINT,
+    STAGE_FREE,
+    STAGE_COUNT
+};
+
+static const char* STAGE_NAME[STAGE_COUNT] = {
+    "transport receive",
+    "str_cut",
+    "parse_sentinel_header",
+    "parse_sentinel_log_line",
+    "parse_sentinel_record",
+    "print",
+    "free"
+};
+
+typedef struct bench_stage {
+    double seconds;
+    long allocations;
+    bool run;
+} bench_stage_t;
+
+typedef struct bench_writer {
+    int fd;
+    const char* data;
+    size_t len;
+} bench_writer_t;
+
+void print_help()
+{
+    printf("Usage:\n");
+    printf("benchmark [-n <num>] [-i <num>] [-d <density>] [-V <version>] [-r] | -h\n");
+    printf("-n <num> Number of log lines in the generated dive, default %d\n", DEFAULT_GENERATOR.records);
+    printf("-i <num> Number of iterations, default 10\n");
+    printf("-d <density> Probability of a log line having notes, 0.0 - 1.0, default %.2lf\n", DEFAULT_GENERATOR.note_density);
+    printf("-V <version> Firmware version of the generated dive: V3.0C, V009A or V009B, default V009A\n");
+    printf("-r Include the transport receive stage, this reads the dive over a socket pair and is slow\n");
+    printf("-h This help\n");
+    printf("\n");
+}
+
+/**
+ * bench_now: Monotonic time in seconds
+ **/
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/**
+ * bench_writer_thread: Writes the whole generated dive to the device end of the socket pair
+ **/
+
+static void* bench_writer_thread(void* arg) {
+    bench_writer_t* writer = arg;
+    size_t written = 0;
+
+    while (written < writer->len) {
+        ssize_t n = write(writer->fd, writer->data + written, writer->len - written);
+
+        if (n < 1)
+            break;
+
+        written += n;
+    }
+
+    return(NULL);
+}
+
+/**
+ * bench_receive: Receives the dive through read_sentinel_response as it would be from the device
+ **/
+
+static bool bench_receive(const char* dive, char** buffer) {
+    int sv[2];
+    pthread_t thread;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        eprint("%s", "Unable to create socket pair");
+        return(false);
+    }
+
+    bench_writer_t writer = {sv[1], dive, strlen(dive)};
+    pthread_create(&thread, NULL, bench_writer_thread, &writer);
+
+    bool res = read_sentinel_response(sv[0], buffer, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
+                                      SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END));
+
+    pthread_join(thread, NULL);
+    close(sv[0]);
+    close(sv[1]);
+
+    return(res);
+}
+
+/**
+ * bench_iteration: Runs each stage once over the given dive, in the same order as
+ *                  download_sentinel_dive does, and adds up the time spent in each
+ **/
+
+static bool bench_iteration(const char* dive, bench_stage_t* stage, int* records) {
+    char* buffer = NULL;
+    double start = 0.0;
+    long alloc_start = 0;
+    int i = 0;
+
+#define STAGE_BEGIN() do { start = bench_now(); alloc_start = allocations; } while (0)
+#define STAGE_END(idx) do { stage[idx].seconds += bench_now() - start; \
+                            stage[idx].allocations += allocations - alloc_start; \
+                            stage[idx].run = true; } while (0)
+
+    if (stage[STAGE_RECEIVE].run) {
+        STAGE_BEGIN();
+        bool res = bench_receive(dive, &buffer);
+        STAGE_END(STAGE_RECEIVE);
+
+        if (!res) return(false);
+    } else {
+        buffer = strdup(strstr(dive, "d\r\n") + 3);
+    }
+
+    STAGE_BEGIN();
+    char** header_and_profile = str_cut(&buffer, "Profile\r\n");
+    char** log_lines = str_cut(&header_and_profile[1], "\r\n");
+    STAGE_END(STAGE_STR_CUT);
+
+    STAGE_BEGIN();
+    sentinel_header_t* header = alloc_sentinel_header();
+    *header = DEFAULT_HEADER;
+    bool res = parse_sentinel_header(&header, &header_and_profile[0]);
+    STAGE_END(STAGE_HEADER);
+
+    if (!res) return(false);
+
+    STAGE_BEGIN();
+    sentinel_log_parser_t parser = sentinel_log_parser(sentinel_firmware_from_version(header->version));
+
+    while (parser != NULL && log_lines[i] != NULL && strncmp(log_lines[i], "End", 3) != 0) {
+        header->log = resize_sentinel_log_list(header->log, i + 1);
+        header->log[i] = alloc_sentinel_dive_log_line();
+        parser(header->record_interval, header->log[i], log_lines[i]);
+        i++;
+    }
+    STAGE_END(STAGE_LOG_LINE);
+
+    *records += i;
+
+    /* The compact records straight from the received text, for comparison with the above */
+    const char* text = strstr(dive, "d\r\n") + 3;
+    sentinel_record_t* compact = NULL;
+
+    STAGE_BEGIN();
+    int count = parse_sentinel_dive_records(text, strlen(text), &compact);
+    free(compact);
+    STAGE_END(STAGE_RECORD);
+
+    if (count != i) {
+        eprint("Parsed %d compact records instead of %d", count, i);
+        return(false);
+    }
+
+    /* Printing goes to /dev/null, we want to measure the formatting, not the terminal */
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    STAGE_BEGIN();
+    full_print_sentinel_dive(header);
+    fflush(stdout);
+    STAGE_END(STAGE_PRINT);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(null_fd);
+
+    STAGE_BEGIN();
+    free_sentinel_header(header);
+    free_string_array(log_lines);
+    free_string_array(header_and_profile);
+    free(buffer);
+    STAGE_END(STAGE_FREE);
+
+#undef STAGE_BEGIN
+#undef STAGE_END
+
+    return(true);
+}
+
+int main(int argc, char **argv) {
+    sentinel_generator_t gen = DEFAULT_GENERATOR;
+    bench_stage_t stage[STAGE_COUNT];
+    int iterations = 10;
+    int records = 0;
+    int c = 0;
+    int i = 0;
+
+    memset(stage, 0, sizeof(stage));
+    opterr = 0;
+
+    while ((c = getopt (argc, argv, "d:hi:n:rV:")) != -1)
+        switch (c) {
+        case 'd': /* Note density */
+            gen.note_density = atof(optarg);
+            break;
+        case 'i': /* Iterations */
+            iterations = atoi(optarg);
+            break;
+        case 'n': /* Log lines per dive */
+            gen.records = atoi(optarg);
+            break;
+        case 'r': /* Include the receive stage */
+            stage[STAGE_RECEIVE].run = true;
+            break;
+        case 'V': /* Firmware version */
+            gen.firmware = SENTINEL_FW_UNKNOWN;
+
+            for (i = SENTINEL_FW_UNKNOWN + 1; i < SENTINEL_FW_COUNT; i++) {
+                if (strcmp(optarg, SENTINEL_FIRMWARE_NAME[i]) == 0)
+                    gen.firmware = i;
+            }
+
+            break;
+        case 'h': /* Print help and exit */
+        default:
+            print_help();
+            exit(0);
+        }
+
+    if (gen.firmware == SENTINEL_FW_UNKNOWN || gen.records < 1 || iterations < 1) {
+        eprint("%s", "Invalid firmware version, number of log lines or iterations");
+        print_help();
+        exit(1);
+    }
+
+    char* dive = sentinel_generate_dive(&gen);
+
+    if (dive == NULL) {
+        eprint("%s", "Failed to generate the dive");
+        exit(1);
+    }
+
+    printf("Firmware: %s log lines: %d note density: %.2lf bytes: %zu iterations: %d\n",
+           SENTINEL_FIRMWARE_NAME[gen.firmware], gen.records, gen.note_density, strlen(dive), iterations);
+
+    for (i = 0; i < iterations; i++) {
+        if (!bench_iteration(dive, stage, &records)) {
+            eprint("Iteration %d failed", i);
+            free(dive);
+            exit(1);
+        }
+    }
+
+    double total = 0.0;
+
+    printf("%-24s %12s %14s %14s %14s\n", "stage", "total ms", "ms/iteration", "records/s", "allocs/record");
+
+    for (i = 0; i < STAGE_COUNT; i++) {
+        if (!stage[i].run) continue;
+
+        total += stage[i].seconds;
+        printf("%-24s %12.3lf %14.3lf %14.0lf %14.2lf\n", STAGE_NAME[i],
+               stage[i].seconds * 1000.0, stage[i].seconds * 1000.0 / iterations,
+               (stage[i].seconds > 0.0) ? records / stage[i].seconds : 0.0,
+               (double) stage[i].allocations / records);
+    }
+
+    printf("%-24s %12.3lf %14.3lf %14.0lf\n", "total", total * 1000.0, total * 1000.0 / iterations,
+           (total > 0.0) ? records / total : 0.0);
+
+    free(dive);
+    exit(0);
+}
@@ -0,0 +1,345 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+/* The context of the call in progress on this thread. The sentinel_ctx_* functions set it
+ * for their duration, so that the allocations, reads, writes, log messages and counters
+ * deep in the parsers end up in the context without passing it through every function */
+static __thread sentinel_ctx_t* current_ctx = NULL;
+
+static void* sentinel_libc_malloc(size_t size, void* data) {
+    (void) data;
+    return(malloc(size));
+}
+
+static void* sentinel_libc_calloc(size_t nmemb, size_t size, void* data) {
+    (void) data;
+    return(calloc(nmemb, size));
+}
+
+static void* sentinel_libc_realloc(void* ptr, size_t size, void* data) {
+    (void) data;
+    return(realloc(ptr, size));
+}
+
+static void sentinel_libc_free(void* ptr, void* data) {
+    (void) data;
+    free(ptr);
+}
+
+static ssize_t sentinel_fd_read(int fd, void* buf, size_t count, void* data) {
+    (void) data;
+    return(read(fd, buf, count));
+}
+
+static ssize_t sentinel_fd_write(int fd, const void* buf, size_t count, void* data) {
+    (void) data;
+    return(write(fd, buf, count));
+}
+
+const sentinel_allocator_t DEFAULT_ALLOCATOR = {
+    sentinel_libc_malloc,
+    sentinel_libc_calloc,
+    sentinel_libc_realloc,
+    sentinel_libc_free,
+    NULL
+};
+
+const sentinel_transport_t DEFAULT_TRANSPORT = {
+    sentinel_fd_read,
+    sentinel_fd_write,
+    NULL
+};
+
+/**
+ * sentinel_ctx_new: Allocates a new context with the given allocator, NULL uses malloc and free.
+ *                   The context itself is allocated with the allocator too
+ **/
+
+sentinel_ctx_t* sentinel_ctx_new(const sentinel_allocator_t* allocator) {
+    if (allocator == NULL)
+        allocator = &DEFAULT_ALLOCATOR;
+
+    sentinel_ctx_t* ctx = allocator->calloc(1, sizeof(sentinel_ctx_t), allocator->data);
+
+    if (ctx == NULL)
+        return(NULL);
+
+    ctx->fd        = -1;
+    ctx->transport = DEFAULT_TRANSPORT;
+    ctx->allocator = *allocator;
+
+    return(ctx);
+}
+
+/**
+ * sentinel_ctx_free: Disconnects if still connected, frees the dives held by the context and
+ *                    the context itself
+ **/
+
+void sentinel_ctx_free(sentinel_ctx_t* ctx) {
+    if (ctx == NULL)
+        return;
+
+    if (ctx->fd >= 0)
+        sentinel_ctx_disconnect(ctx);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+
+    sentinel_header_table_clear(&ctx->table);
+
+    if (ctx->header_list != NULL)
+        free_sentinel_header_list(ctx->header_list);
+
+    sentinel_ctx_leave(prev);
+
+    ctx->allocator.free(ctx, ctx->allocator.data);
+}
+
+/**
+ * sentinel_ctx_set_log_sink: Sends the log messages of this context to the given sink instead of
+ *                            the one set with sentinel_set_log_sink
+ **/
+
+void sentinel_ctx_set_log_sink(sentinel_ctx_t* ctx, sentinel_log_sink_t sink, void* data) {
+    ctx->log_sink      = sink;
+    ctx->log_sink_data = data;
+}
+
+/**
+ * sentinel_ctx_attach: Uses an already open descriptor as the device, eg. the client end of the
+ *                      emulator socket pair. NULL transport uses read() and write()
+ **/
+
+void sentinel_ctx_attach(sentinel_ctx_t* ctx, int fd, const sentinel_transport_t* transport) {
+    ctx->fd        = fd;
+    ctx->transport = (transport != NULL) ? *transport : DEFAULT_TRANSPORT;
+}
+
+/**
+ * sentinel_ctx_connect: Opens the serial device and waits until the rebreather is idle. A context
+ *                       which is already connected is disconnected first
+ **/
+
+bool sentinel_ctx_connect(sentinel_ctx_t* ctx, char* device, const int tries) {
+    if (ctx->busy) {
+        sentinel_error("%s", "The context is busy");
+        return(false);
+    }
+
+    if (ctx->fd >= 0)
+        sentinel_ctx_disconnect(ctx);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    bool res = false;
+
+    ctx->fd = connect_sentinel(device);
+
+    if (ctx->fd <= 0) {
+        ctx->fd = -1;
+    } else {
+        res = is_sentinel_idle(ctx->fd, tries);
+
+        if (!res)
+            sentinel_error("Could not connect to Sentinel after %d tries", tries);
+    }
+
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_ctx_disconnect: Closes the device
+ **/
+
+bool sentinel_ctx_disconnect(sentinel_ctx_t* ctx) {
+    if (ctx->fd < 0)
+        return(false);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    bool res = disconnect_sentinel(ctx->fd);
+
+    ctx->fd = -1;
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_ctx_run: Runs a single operation to completion
+ **/
+
+static bool sentinel_ctx_run(sentinel_op_t* op) {
+    if (op == NULL)
+        return(false);
+
+    bool res = (sentinel_op_run(&op, 1) == 1);
+    sentinel_op_free(op);
+
+    return(res);
+}
+
+/**
+ * sentinel_ctx_list: Fetches the list of dives into ctx->header_list, the previous list is freed
+ **/
+
+bool sentinel_ctx_list(sentinel_ctx_t* ctx) {
+    return(sentinel_ctx_run(sentinel_op_list(ctx, NULL, NULL)));
+}
+
+/**
+ * sentinel_ctx_list_known: Fetches the headers newer than the known one into ctx->header_list, the
+ *                          known one given or from the anchor
+ **/
+
+static bool sentinel_ctx_list_known(sentinel_ctx_t* ctx, const char* serial_number, const int start_s,
+                                    sentinel_list_anchor_t anchor, void* data) {
+    if (ctx->fd < 0 || ctx->busy) {
+        sentinel_error("%s", "The context is not connected or busy");
+        return(false);
+    }
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    ctx->busy = true;
+    sentinel_header_table_clear(&ctx->table);
+
+    if (ctx->header_list != NULL)
+        free_sentinel_header_list(ctx->header_list);
+
+    ctx->header_list = NULL;
+
+    bool res = (anchor != NULL) ? get_sentinel_dive_list_anchored(ctx->fd, anchor, data, &ctx->header_list)
+                                : get_sentinel_dive_list_since(ctx->fd, serial_number, start_s, &ctx->header_list);
+    res &= sentinel_header_table_build(&ctx->table, ctx->header_list);
+
+    ctx->busy = false;
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_ctx_list_since: Fetches only the headers newer than the given known one into
+ *                          ctx->header_list, see get_sentinel_dive_list_since. The dive numbers of
+ *                          the new dives are the same as in the full list
+ **/
+
+bool sentinel_ctx_list_since(sentinel_ctx_t* ctx, const char* serial_number, const int start_s) {
+    return(sentinel_ctx_list_known(ctx, serial_number, start_s, NULL, NULL));
+}
+
+/**
+ * sentinel_ctx_list_anchored: Like sentinel_ctx_list_since, with the known header from the anchor,
+ *                             see get_sentinel_dive_list_anchored
+ **/
+
+bool sentinel_ctx_list_anchored(sentinel_ctx_t* ctx, sentinel_list_anchor_t anchor, void* data) {
+    return(sentinel_ctx_list_known(ctx, NULL, 0, anchor, data));
+}
+
+/**
+ * sentinel_ctx_download: Downloads the given dive into ctx->header_list, list the dives first
+ **/
+
+bool sentinel_ctx_download(sentinel_ctx_t* ctx, const int dive_num) {
+    return(sentinel_ctx_run(sentinel_op_download(ctx, dive_num, NULL, NULL)));
+}
+
+/**
+ * sentinel_ctx_download_resumable: Downloads the given dive into ctx->header_list, retrying after
+ *                                  transfer errors, see download_sentinel_dive_resumable
+ **/
+
+bool sentinel_ctx_download_resumable(sentinel_ctx_t* ctx, const int dive_num, const int attempts,
+                                     sentinel_download_report_t* report) {
+    *report = DEFAULT_DOWNLOAD_REPORT;
+
+    if (!sentinel_ctx_check_dive(ctx, dive_num))
+        return(false);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    ctx->busy = true;
+
+    bool res = download_sentinel_dive_resumable(ctx->fd, dive_num, &ctx->header_list[dive_num], attempts, report);
+
+    ctx->busy = false;
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_ctx_check_dive: Checks that the context is free for a download of the given dive
+ **/
+
+bool sentinel_ctx_check_dive(const sentinel_ctx_t* ctx, const int dive_num) {
+    if (ctx->fd < 0 || ctx->busy || ctx->header_list == NULL) {
+        sentinel_error("%s", "The context is not connected, busy or the dives are not listed");
+        return(false);
+    }
+
+    if (sentinel_header_table_get(&ctx->table, dive_num) == NULL) {
+        sentinel_error("Non-existing dive: %d", dive_num);
+        return(false);
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_ctx_stats: Returns the counters of the context, the effective baud rate is updated
+ **/
+
+sentinel_stats_t* sentinel_ctx_stats(sentinel_ctx_t* ctx) {
+    if (ctx->stats.receive_ns > 0)
+        ctx->stats.effective_baud = ctx->stats.bytes_received * 10.0 / (ctx->stats.receive_ns / 1e9);
+
+    return(&ctx->stats);
+}
+
+/**
+ * sentinel_ctx_enter: Makes the context current on this thread, returns the previous one which
+ *                     has to be given to sentinel_ctx_leave
+ **/
+
+sentinel_ctx_t* sentinel_ctx_enter(sentinel_ctx_t* ctx) {
+    sentinel_ctx_t* prev = current_ctx;
+    current_ctx = ctx;
+    return(prev);
+}
+
+/**
+ * sentinel_ctx_leave: Restores the context which was current before sentinel_ctx_enter
+ **/
+
+void sentinel_ctx_leave(sentinel_ctx_t* prev) {
+    current_ctx = prev;
+}
+
+/**
+ * sentinel_ctx_current: Returns the context current on this thread, NULL outside sentinel_ctx_*
+ **/
+
+sentinel_ctx_t* sentinel_ctx_current(void) {
+    return(current_ctx);
+}
@@ -0,0 +1,607 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+/* Bühlmann ZHL-16C coefficients, stored as one array per coefficient so that
+ * the per-record loops run over contiguous memory and can be vectorized */
+static const double ZHL16C_N2_HALFTIME[SENTINEL_DECO_TISSUES] = {
+    4.0, 8.0, 12.5, 18.5, 27.0, 38.3, 54.3, 77.0,
+    109.0, 146.0, 187.0, 239.0, 305.0, 390.0, 498.0, 635.0
+};
+
+static const double ZHL16C_N2_A[SENTINEL_DECO_TISSUES] = {
+    1.2599, 1.0000, 0.8618, 0.7562, 0.6200, 0.5043, 0.4410, 0.4000,
+    0.3750, 0.3500, 0.3295, 0.3065, 0.2835, 0.2610, 0.2480, 0.2327
+};
+
+static const double ZHL16C_N2_B[SENTINEL_DECO_TISSUES] = {
+    0.5050, 0.6514, 0.7222, 0.7825, 0.8126, 0.8434, 0.8693, 0.8910,
+    0.9092, 0.9222, 0.9319, 0.9403, 0.9477, 0.9544, 0.9602, 0.9653
+};
+
+static const double ZHL16C_HE_HALFTIME[SENTINEL_DECO_TISSUES] = {
+    1.51, 3.02, 4.72, 6.99, 10.21, 14.48, 20.53, 29.11,
+    41.20, 55.19, 70.69, 90.34, 115.29, 147.42, 188.24, 240.03
+};
+
+static const double ZHL16C_HE_A[SENTINEL_DECO_TISSUES] = {
+    1.7424, 1.3830, 1.1919, 1.0458, 0.9220, 0.8205, 0.7305, 0.6502,
+    0.5950, 0.5545, 0.5333, 0.5189, 0.5181, 0.5176, 0.5172, 0.5119
+};
+
+static const double ZHL16C_HE_B[SENTINEL_DECO_TISSUES] = {
+    0.4245, 0.5747, 0.6527, 0.7223, 0.7582, 0.7957, 0.8279, 0.8553,
+    0.8757, 0.8903, 0.8997, 0.9073, 0.9122, 0.9171, 0.9217, 0.9267
+};
+
+static const double SENTINEL_WATER_VAPOUR_BAR = 0.0627; /* Alveolar water vapour pressure */
+static const double SENTINEL_AIR_N2_FRACTION  = 0.7902;
+static const double SENTINEL_BAR_PER_METER    = 0.1;
+
+const sentinel_deco_params_t DEFAULT_DECO_PARAMS = {
+    0.30, /* gf_low */
+    0.85, /* gf_high */
+    0.0,  /* surface_pressure, taken from the header */
+    3.0   /* ceiling_tolerance */
+};
+
+const sentinel_deco_result_t DEFAULT_DECO_RESULT = {
+    0,
+    0.0,
+    0.0,
+    0,
+    {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0},
+    NULL
+};
+
+/**
+ * sentinel_deco_surface_pressure: Returns the surface pressure in bar to use for the given
+ *                                 dive. The DAtmos header value is used if it looks sane
+ **/
+
+static double sentinel_deco_surface_pressure(const sentinel_header_t* header, const sentinel_deco_params_t* params) {
+    if (params->surface_pressure > 0.0)
+        return(params->surface_pressure);
+
+    if (header->atm > 500 && header->atm < 1200)
+        return(header->atm / 1000.0);
+
+    return(1.01325);
+}
+
+/**
+ * sentinel_deco_diluent: Picks the diluent from the configured gasses of the header, this is
+ *                        the first enabled gas. Falls back to air if no gas is enabled
+ **/
+
+void sentinel_deco_diluent(const sentinel_header_t* header, double* f_n2, double* f_he) {
+    int i = 0;
+
+    *f_n2 = SENTINEL_AIR_N2_FRACTION;
+    *f_he = 0.0;
+
+    for (i = 0; i < 10; i++) {
+        if (header->gas[i].enabled && (header->gas[i].n2 + header->gas[i].he) > 0) {
+            *f_n2 = header->gas[i].n2 / 100.0;
+            *f_he = header->gas[i].he / 100.0;
+            return;
+        }
+    }
+}
+
+/**
+ * sentinel_deco_set_interval: Precomputes the per-record saturation factors for the given record
+ *                             interval. This is the only place where exp() is called, so replaying
+ *                             a dive costs no transcendental functions per record
+ **/
+
+void sentinel_deco_set_interval(sentinel_deco_state_t* state, const int interval) {
+    int i = 0;
+
+    if (state->interval == interval)
+        return;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        state->k_n2[i] = 1.0 - exp(-interval * M_LN2 / (ZHL16C_N2_HALFTIME[i] * 60.0));
+        state->k_he[i] = 1.0 - exp(-interval * M_LN2 / (ZHL16C_HE_HALFTIME[i] * 60.0));
+    }
+
+    state->interval = interval;
+}
+
+/**
+ * sentinel_deco_init: Sets the tissues to be saturated with air at the surface pressure of the
+ *                     dive and prepares the state for replaying the given dive
+ **/
+
+bool sentinel_deco_init(sentinel_deco_state_t* state, const sentinel_header_t* header, const sentinel_deco_params_t* params) {
+    if (state == NULL || header == NULL || params == NULL) {
+        sentinel_error("%s", "Received NULL state, header or parameters");
+        return(false);
+    }
+
+    if (header->record_interval <= 0) {
+        sentinel_error("Invalid record interval: %d", header->record_interval);
+        return(false);
+    }
+
+    state->surface_pressure = sentinel_deco_surface_pressure(header, params);
+    state->gf_low           = params->gf_low;
+    state->gf_high          = params->gf_high;
+    state->first_stop       = 0.0;
+
+    double p_n2 = (state->surface_pressure - SENTINEL_WATER_VAPOUR_BAR) * SENTINEL_AIR_N2_FRACTION;
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        state->p_n2[i] = p_n2;
+        state->p_he[i] = 0.0;
+    }
+
+    sentinel_deco_diluent(header, &state->f_n2, &state->f_he);
+    sentinel_deco_set_interval(state, header->record_interval);
+
+    return(true);
+}
+
+/**
+ * sentinel_deco_inspired: Returns the inspired N2 and He pressures (bar) at the given depth (m) and
+ *                         loop pO2 (bar). The inert gas fraction of the loop is the diluent's N2/He
+ *                         ratio applied to what is left after the pO2 and water vapour
+ **/
+
+static void sentinel_deco_inspired(const double surface_pressure, const double f_n2, const double f_he,
+                                   const double depth, const double po2, double* pi_n2, double* pi_he) {
+    const double ambient = surface_pressure + depth * SENTINEL_BAR_PER_METER;
+    double inert = ambient - po2 - SENTINEL_WATER_VAPOUR_BAR;
+    const double f_inert = f_n2 + f_he;
+
+    if (inert < 0.0 || f_inert <= 0.0)
+        inert = 0.0;
+
+    *pi_n2 = (f_inert > 0.0) ? inert * f_n2 / f_inert : 0.0;
+    *pi_he = (f_inert > 0.0) ? inert * f_he / f_inert : 0.0;
+}
+
+/**
+ * sentinel_deco_step: Advances the tissues by one record interval at the given depth (m) and
+ *                     loop pO2 (bar)
+ **/
+
+void sentinel_deco_step(sentinel_deco_state_t* state, const double depth, const double po2) {
+    double pi_n2 = 0.0;
+    double pi_he = 0.0;
+    int i = 0;
+
+    sentinel_deco_inspired(state->surface_pressure, state->f_n2, state->f_he, depth, po2, &pi_n2, &pi_he);
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        state->p_n2[i] += (pi_n2 - state->p_n2[i]) * state->k_n2[i];
+        state->p_he[i] += (pi_he - state->p_he[i]) * state->k_he[i];
+    }
+}
+
+/**
+ * sentinel_deco_tissue_limit: Returns the lowest ambient pressure (bar) compartment i tolerates
+ *                             with the given gradient factor
+ **/
+
+static inline double sentinel_deco_tissue_limit(const double p_n2, const double p_he, const int i, const double gf) {
+    const double p = p_n2 + p_he;
+    const double a = (ZHL16C_N2_A[i] * p_n2 + ZHL16C_HE_A[i] * p_he) / p;
+    const double b = (ZHL16C_N2_B[i] * p_n2 + ZHL16C_HE_B[i] * p_he) / p;
+
+    return((p - a * gf) / (gf / b + 1.0 - gf));
+}
+
+/**
+ * sentinel_deco_tissue_tolerated: Returns the lowest ambient pressure (bar) compartment i tolerates
+ *                                 when the gradient factor goes linearly from gf_low at the first
+ *                                 stop to gf_high at the surface. The gradient factor is taken at
+ *                                 that ambient pressure itself, so the M-value line becomes a
+ *                                 quadratic in the ambient pressure, of which we want the root
+ *                                 between the surface and the first stop
+ **/
+
+static inline double sentinel_deco_tissue_tolerated(const double p_n2, const double p_he, const int i,
+                                                    const double surface_pressure, const double first_stop,
+                                                    const double gf_low, const double gf_high) {
+    if (first_stop <= surface_pressure)
+        return(sentinel_deco_tissue_limit(p_n2, p_he, i, gf_high));
+
+    const double p = p_n2 + p_he;
+    const double a = (ZHL16C_N2_A[i] * p_n2 + ZHL16C_HE_A[i] * p_he) / p;
+    const double b = (ZHL16C_N2_B[i] * p_n2 + ZHL16C_HE_B[i] * p_he) / p;
+    /* gf(P) = gf_0 + slope * P and the tolerated P solves p = P + gf(P) * (a + P * (1 / b - 1)) */
+    const double slope = (gf_low - gf_high) / (first_stop - surface_pressure);
+    const double gf_0 = gf_high - slope * surface_pressure;
+    const double c = 1.0 / b - 1.0;
+    const double qa = slope * c;
+    const double qb = 1.0 + gf_0 * c + slope * a;
+    const double qc = gf_0 * a - p;
+    const double discriminant = qb * qb - 4.0 * qa * qc;
+
+    if (discriminant < 0.0 || qb <= 0.0)
+        return(sentinel_deco_tissue_limit(p_n2, p_he, i, gf_low));
+
+    /* The smaller root, written so that it does not cancel out when slope is close to zero */
+    const double tolerated = -2.0 * qc / (qb + sqrt(discriminant));
+
+    if (tolerated > first_stop)
+        return(sentinel_deco_tissue_limit(p_n2, p_he, i, gf_low));
+
+    if (tolerated < surface_pressure)
+        return(sentinel_deco_tissue_limit(p_n2, p_he, i, gf_high));
+
+    return(tolerated);
+}
+
+/**
+ * sentinel_deco_ceiling: Returns the current ceiling in meters. The first stop is anchored to the
+ *                        deepest ceiling seen with gf_low, and the gradient factor is interpolated
+ *                        linearly from gf_low at the first stop to gf_high at the surface, at the
+ *                        depth of the ceiling itself
+ **/
+
+double sentinel_deco_ceiling(sentinel_deco_state_t* state) {
+    double low = 0.0;
+    double max_tolerated = 0.0;
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        const double tolerated = sentinel_deco_tissue_limit(state->p_n2[i], state->p_he[i], i, state->gf_low);
+
+        if (tolerated > low)
+            low = tolerated;
+    }
+
+    if (low > state->first_stop)
+        state->first_stop = low;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        const double tolerated = sentinel_deco_tissue_tolerated(state->p_n2[i], state->p_he[i], i, state->surface_pressure,
+                                                                state->first_stop, state->gf_low, state->gf_high);
+
+        if (tolerated > max_tolerated)
+            max_tolerated = tolerated;
+    }
+
+    const double ceiling = (max_tolerated - state->surface_pressure) / SENTINEL_BAR_PER_METER;
+
+    return(ceiling > 0.0 ? ceiling : 0.0);
+}
+
+/**
+ * sentinel_deco_tissue_percentage: Fills the given array with the loading of each compartment as
+ *                                  a percentage of its surface M-value, which is what we compare
+ *                                  against the Tissue lines of the header
+ **/
+
+void sentinel_deco_tissue_percentage(const sentinel_deco_state_t* state, double* percentage) {
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        const double p = state->p_n2[i] + state->p_he[i];
+        const double a = (ZHL16C_N2_A[i] * state->p_n2[i] + ZHL16C_HE_A[i] * state->p_he[i]) / p;
+        const double b = (ZHL16C_N2_B[i] * state->p_n2[i] + ZHL16C_HE_B[i] * state->p_he[i]) / p;
+        percentage[i] = 100.0 * p / (state->surface_pressure / b + a);
+    }
+}
+
+/**
+ * sentinel_deco_replay_with_state: Replays the log of the dive through the given state which
+ *                                  must already have the record interval set. The per-record
+ *                                  ceiling is stored in result->ceiling if it is not NULL
+ **/
+
+static bool sentinel_deco_replay_with_state(sentinel_deco_state_t* state, const sentinel_header_t* header,
+                                            const sentinel_deco_params_t* params, sentinel_deco_result_t* result) {
+    double* ceiling_list = result->ceiling;
+    int i = 0;
+
+    *result = DEFAULT_DECO_RESULT;
+    result->ceiling = ceiling_list;
+
+    if (header->log == NULL) {
+        sentinel_error("%s", "The dive has no log, download it first");
+        return(false);
+    }
+
+    while (header->log[i] != NULL) {
+        sentinel_deco_step(state, header->log[i]->depth, header->log[i]->po2);
+        const double ceiling = sentinel_deco_ceiling(state);
+
+        if (ceiling > result->max_ceiling)
+            result->max_ceiling = ceiling;
+
+        if (fabs(ceiling - header->log[i]->ceiling) > params->ceiling_tolerance)
+            result->ceiling_mismatches++;
+
+        if (ceiling_list != NULL)
+            ceiling_list[i] = ceiling;
+
+        i++;
+    }
+
+    result->records       = i;
+    result->final_ceiling = (i > 0) ? sentinel_deco_ceiling(state) : 0.0;
+    sentinel_deco_tissue_percentage(state, result->tissue_percentage);
+
+    return(true);
+}
+
+/**
+ * sentinel_deco_replay: Replays a single downloaded dive through the 16 compartments with the
+ *                       given gradient factors and fills in the result
+ **/
+
+bool sentinel_deco_replay(const sentinel_header_t* header, const sentinel_deco_params_t* params, sentinel_deco_result_t* result) {
+    sentinel_deco_state_t state;
+
+    if (result == NULL) {
+        sentinel_error("%s", "Received NULL result");
+        return(false);
+    }
+
+    state.interval = 0;
+
+    if (!sentinel_deco_init(&state, header, params))
+        return(false);
+
+    return(sentinel_deco_replay_with_state(&state, header, params, result));
+}
+
+/* Number of dives a batch replay steps together */
+#define SENTINEL_DECO_LANES 8
+
+/* The dives of a batch replay, one per lane. The compartments are stored with the lanes innermost
+ * so that each compartment is updated for all the dives in one contiguous loop */
+typedef struct sentinel_deco_lanes {
+    double p_n2[SENTINEL_DECO_TISSUES][SENTINEL_DECO_LANES];
+    double p_he[SENTINEL_DECO_TISSUES][SENTINEL_DECO_LANES];
+    double k_n2[SENTINEL_DECO_TISSUES][SENTINEL_DECO_LANES];
+    double k_he[SENTINEL_DECO_TISSUES][SENTINEL_DECO_LANES];
+    double pi_n2[SENTINEL_DECO_LANES];
+    double pi_he[SENTINEL_DECO_LANES];
+    double surface_pressure[SENTINEL_DECO_LANES];
+    double first_stop[SENTINEL_DECO_LANES];
+    double gf_low[SENTINEL_DECO_LANES];
+    double gf_high[SENTINEL_DECO_LANES];
+    double ceiling[SENTINEL_DECO_LANES];
+    sentinel_deco_state_t state[SENTINEL_DECO_LANES];       /* Keeps the interval factors between dives */
+    const sentinel_header_t* header[SENTINEL_DECO_LANES];   /* NULL if the lane is free */
+    sentinel_deco_result_t* result[SENTINEL_DECO_LANES];
+    int record[SENTINEL_DECO_LANES];
+} sentinel_deco_lanes_t;
+
+/**
+ * sentinel_deco_lanes_start: Prepares the given dive for replay in lane l. Returns false if the
+ *                            dive can not be replayed, in which case the lane stays free
+ **/
+
+static bool sentinel_deco_lanes_start(sentinel_deco_lanes_t* lanes, const int l, const sentinel_header_t* header,
+                                      const sentinel_deco_params_t* params, sentinel_deco_result_t* result) {
+    sentinel_deco_state_t* state = &lanes->state[l];
+    int i = 0;
+
+    *result = DEFAULT_DECO_RESULT;
+
+    if (!sentinel_deco_init(state, header, params))
+        return(false);
+
+    if (header->log == NULL) {
+        sentinel_error("%s", "The dive has no log, download it first");
+        return(false);
+    }
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        lanes->p_n2[i][l] = state->p_n2[i];
+        lanes->p_he[i][l] = state->p_he[i];
+        lanes->k_n2[i][l] = state->k_n2[i];
+        lanes->k_he[i][l] = state->k_he[i];
+    }
+
+    lanes->surface_pressure[l] = state->surface_pressure;
+    lanes->first_stop[l]       = state->first_stop;
+    lanes->gf_low[l]           = state->gf_low;
+    lanes->gf_high[l]          = state->gf_high;
+    lanes->header[l]           = header;
+    lanes->result[l]           = result;
+    lanes->record[l]           = 0;
+
+    return(true);
+}
+
+/**
+ * sentinel_deco_lanes_finish: Fills in the rest of the result of the dive in lane l and frees the
+ *                             lane. The factors of a free lane are zeroed so that its compartments
+ *                             stay as they are while the other lanes are stepped
+ **/
+
+static void sentinel_deco_lanes_finish(sentinel_deco_lanes_t* lanes, const int l) {
+    sentinel_deco_state_t* state = &lanes->state[l];
+    sentinel_deco_result_t* result = lanes->result[l];
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        state->p_n2[i]    = lanes->p_n2[i][l];
+        state->p_he[i]    = lanes->p_he[i][l];
+        lanes->k_n2[i][l] = 0.0;
+        lanes->k_he[i][l] = 0.0;
+    }
+
+    state->first_stop = lanes->first_stop[l];
+
+    result->records       = lanes->record[l];
+    result->final_ceiling = (lanes->record[l] > 0) ? sentinel_deco_ceiling(state) : 0.0;
+    sentinel_deco_tissue_percentage(state, result->tissue_percentage);
+
+    lanes->header[l] = NULL;
+}
+
+/**
+ * sentinel_deco_lanes_step: Advances the compartments of all the lanes by one record interval with
+ *                           the inspired pressures in pi_n2 and pi_he, then computes the ceiling of
+ *                           every lane the same way as sentinel_deco_ceiling does
+ **/
+
+static void sentinel_deco_lanes_step(sentinel_deco_lanes_t* lanes) {
+    double low[SENTINEL_DECO_LANES];
+    double max_tolerated[SENTINEL_DECO_LANES];
+    int i = 0;
+    int l = 0;
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+            lanes->p_n2[i][l] += (lanes->pi_n2[l] - lanes->p_n2[i][l]) * lanes->k_n2[i][l];
+            lanes->p_he[i][l] += (lanes->pi_he[l] - lanes->p_he[i][l]) * lanes->k_he[i][l];
+        }
+    }
+
+    for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+        low[l]           = 0.0;
+        max_tolerated[l] = 0.0;
+    }
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+            const double tolerated = sentinel_deco_tissue_limit(lanes->p_n2[i][l], lanes->p_he[i][l], i, lanes->gf_low[l]);
+
+            if (tolerated > low[l])
+                low[l] = tolerated;
+        }
+    }
+
+    for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+        if (low[l] > lanes->first_stop[l])
+            lanes->first_stop[l] = low[l];
+    }
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+            const double tolerated = sentinel_deco_tissue_tolerated(lanes->p_n2[i][l], lanes->p_he[i][l], i, lanes->surface_pressure[l],
+                                                                    lanes->first_stop[l], lanes->gf_low[l], lanes->gf_high[l]);
+
+            if (tolerated > max_tolerated[l])
+                max_tolerated[l] = tolerated;
+        }
+    }
+
+    for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+        const double ceiling = (max_tolerated[l] - lanes->surface_pressure[l]) / SENTINEL_BAR_PER_METER;
+        lanes->ceiling[l] = (ceiling > 0.0) ? ceiling : 0.0;
+    }
+}
+
+/**
+ * sentinel_deco_replay_batch: Replays all the dives of the given NULL-terminated header list and
+ *                             stores the results into the results array, which has to have room
+ *                             for as many items as there are headers. Per-record ceilings are
+ *                             not stored in batch mode. Up to SENTINEL_DECO_LANES dives are stepped
+ *                             together record by record, and a lane whose dive ends takes the next
+ *                             dive of the list. The results are the same as from sentinel_deco_replay.
+ *                             Returns the number of dives successfully replayed
+ **/
+
+int sentinel_deco_replay_batch(sentinel_header_t** header_list, const sentinel_deco_params_t* params, sentinel_deco_result_t* results) {
+    sentinel_deco_lanes_t lanes;
+    int replayed = 0;
+    int next = 0;
+    int i = 0;
+    int l = 0;
+
+    if (header_list == NULL || results == NULL)
+        return(0);
+
+    for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+        for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+            lanes.p_n2[i][l] = 1.0;
+            lanes.p_he[i][l] = 0.0;
+            lanes.k_n2[i][l] = 0.0;
+            lanes.k_he[i][l] = 0.0;
+        }
+
+        lanes.surface_pressure[l] = 1.0;
+        lanes.first_stop[l]       = 0.0;
+        lanes.gf_low[l]           = 1.0;
+        lanes.gf_high[l]          = 1.0;
+        lanes.state[l].interval   = 0;
+        lanes.header[l]           = NULL;
+    }
+
+    while (true) {
+        int active = 0;
+
+        for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+            /* Finish the dive of the lane if it has run out of records and take the next one */
+            while (lanes.header[l] != NULL || header_list[next] != NULL) {
+                if (lanes.header[l] == NULL) {
+                    results[next].ceiling = NULL;
+
+                    if (sentinel_deco_lanes_start(&lanes, l, header_list[next], params, &results[next]))
+                        replayed++;
+                    else
+                        sentinel_error("Unable to replay dive #%d", next);
+
+                    next++;
+                } else if (lanes.header[l]->log[lanes.record[l]] == NULL) {
+                    sentinel_deco_lanes_finish(&lanes, l);
+                } else {
+                    break;
+                }
+            }
+
+            lanes.pi_n2[l] = 0.0;
+            lanes.pi_he[l] = 0.0;
+
+            if (lanes.header[l] != NULL) {
+                const sentinel_deco_state_t* state = &lanes.state[l];
+                const sentinel_dive_log_line_t* line = lanes.header[l]->log[lanes.record[l]];
+
+                sentinel_deco_inspired(state->surface_pressure, state->f_n2, state->f_he, line->depth, line->po2, &lanes.pi_n2[l], &lanes.pi_he[l]);
+                active++;
+            }
+        }
+
+        if (active == 0)
+            break;
+
+        sentinel_deco_lanes_step(&lanes);
+
+        for (l = 0; l < SENTINEL_DECO_LANES; l++) {
+            if (lanes.header[l] == NULL)
+                continue;
+
+            sentinel_deco_result_t* result = lanes.result[l];
+
+            if (lanes.ceiling[l] > result->max_ceiling)
+                result->max_ceiling = lanes.ceiling[l];
+
+            if (fabs(lanes.ceiling[l] - lanes.header[l]->log[lanes.record[l]]->ceiling) > params->ceiling_tolerance)
+                result->ceiling_mismatches++;
+
+            lanes.record[l]++;
+        }
+    }
+
+    return(replayed);
+}
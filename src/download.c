@@ -19,24 +19,175 @@
  * MA 02110-1301 USA
  */
 
+#include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "libsentinel.h"
 
+/* Room for a few hundred dives of an hour, the pages are only used as they are written */
+#define SHM_DATA_SIZE (16 * 1024 * 1024)
+#define SHM_SLOTS     64
+
+/* Receive window of the dives streamed to files, holds the header and a few log lines */
+#define STREAM_WINDOW 4096
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+/**
+ * print_anomaly: Prints an anomaly found by the detector, the data is the dive number
+ **/
+
+static void print_anomaly(const sentinel_anomaly_t* anomaly, void* data) {
+    const char* state = anomaly->cleared ? "cleared" : "raised";
+
+    if (anomaly->cell < 0)
+        printf("Dive %d record %d: %s %s, loop at %.2f bar\n", *(int*) data, anomaly->time_idx,
+               SENTINEL_NOTES[anomaly->code - 1].note, state, anomaly->value);
+    else
+        printf("Dive %d record %d: %s %s, cell %d at %.2f bar\n", *(int*) data, anomaly->time_idx,
+               SENTINEL_NOTES[anomaly->code - 1].note, state, anomaly->cell + 1, anomaly->value);
+}
+
+/* What is done with each record of a streamed dive, see stream_record */
+typedef struct stream_state {
+    const sentinel_fixed_header_t* header;
+    sentinel_detector_t* detector; /* NULL without -A */
+    sentinel_oxtox_t oxtox;
+} stream_state_t;
+
+/**
+ * stream_record: Adds a record of a streamed dive to the oxygen exposure and feeds it to the
+ *                detector, if any. The header has been parsed by the time the first record arrives
+ **/
+
+static void stream_record(const sentinel_record_t* record, void* data) {
+    stream_state_t* state = data;
+
+    if (state->oxtox.records == 0)
+        sentinel_oxtox_init(&state->oxtox, state->header->record_interval);
+
+    sentinel_oxtox_update_raw(&state->oxtox, record->po2);
+
+    if (state->detector != NULL)
+        sentinel_detector_feed(state->detector, record);
+}
+
+/**
+ * stream_dive: Streams a dive to <num>.txt in the directory in constant memory. With a store the
+ *              dive is streamed into the store instead and <num>.txt links to the stored file.
+ *              The oxygen exposure is computed and with detect the anomalies are printed while
+ *              the records arrive
+ **/
+
+static bool stream_dive(sentinel_ctx_t* ctx, sentinel_store_t* store, const char* out_dir, int dive_num, const bool detect) {
+    static char window[STREAM_WINDOW];
+    sentinel_fixed_header_t header;
+    sentinel_fixed_dive_t dive;
+    sentinel_detector_t detector;
+    stream_state_t state;
+    char path[4096];
+    bool res = false;
+
+    snprintf(path, sizeof(path), "%s/%d.txt", out_dir, dive_num);
+    sentinel_fixed_init(&dive, window, sizeof(window), &header, NULL, 0);
+
+    state.header   = &header;
+    state.detector = NULL;
+    sentinel_oxtox_init(&state.oxtox, 0);
+
+    if (detect) {
+        sentinel_detector_init(&detector, print_anomaly, &dive_num);
+        state.detector = &detector;
+    }
+
+    dive.record_callback = stream_record;
+    dive.record_data     = &state;
+
+    if (store != NULL) {
+        const sentinel_store_result_t stored = sentinel_store_stream(store, ctx->fd, dive_num, &dive);
+
+        if (detect)
+            sentinel_detector_finish(&detector);
+
+        char* dive_path = (stored != SENTINEL_STORE_ERROR) ? sentinel_store_dive_path(store, header.content_hash) : NULL;
+        char* target = (dive_path != NULL) ? realpath(dive_path, NULL) : NULL;
+
+        unlink(path);
+
+        if (stored == SENTINEL_STORE_ERROR) {
+            eprint("Dive %d is incomplete: %d of %d records, not storing it", dive_num, dive.count, header.log_lines);
+        } else if (target == NULL || symlink(target, path) != 0) {
+            eprint("Could not link %s to the stored dive %016" PRIx64, path, header.content_hash);
+        } else {
+            printf("Dive %d: %d records %s as %016" PRIx64 " in %s, CNS %.1f%% OTU %.0f (header %.1f%% %d)\n",
+                   dive_num, dive.count, (stored == SENTINEL_STORE_DUPLICATE) ? "already stored" : "stored",
+                   header.content_hash, path, state.oxtox.cns, state.oxtox.otu, header.cns, header.otu);
+            res = true;
+        }
+
+        free(target);
+        sentinel_free(dive_path);
+
+        return(res);
+    }
+
+    FILE* out = fopen(path, "w");
+
+    if (out == NULL) {
+        eprint("Could not write %s", path);
+        return(false);
+    }
+
+    const sentinel_fixed_status_t streamed = sentinel_fixed_stream(ctx->fd, dive_num, &dive, fileno(out));
+
+    if (detect)
+        sentinel_detector_finish(&detector);
+
+    if (streamed != SENTINEL_FIXED_OK || !dive.ended) {
+        eprint("Dive %d is incomplete: %d of %d records in %s", dive_num, dive.count, header.log_lines, path);
+    } else {
+        printf("Dive %d: %d records in %s, CNS %.1f%% OTU %.0f (header %.1f%% %d)\n", dive_num, dive.count, path,
+               state.oxtox.cns, state.oxtox.otu, header.cns, header.otu);
+        res = true;
+    }
+
+    fclose(out);
+
+    return(res);
+}
+
 void print_help()
 {
     printf("Usage:\n");
-    printf("download -d <device> [ [-f <num>]  [-t <num>] | [-n <num>] ] [-v] | -h | -l\n");
+    printf("download -d <device> [ [-f <num>]  [-t <num>] | [-n <num>] ] [-A] [-o <dir>] [-P <name>] [-r <num>] [-S <dir>] [-s] [-v] | -h | -l | -U <path> [-p <num>] | -S <dir> -x <format> [-j <num>] | -S <dir> -e <notes>\n");
     printf("Default behavior is to download all dives\n");
+    printf("-A Print the anomalies of the oxygen cells and the loop in the downloaded dives\n");
     printf("-d <device> Which device to use, usually /dev/ttyUSB0\n");
+    printf("-e <notes> List the events of the store with any of the notes separated by , or all of them separated by +\n");
     printf("-f <num> Optional: Start downloading from this dive, list the dives first to see the number\n");
     printf("-h This help\n");
-    printf("-l List the dives\n");
+    printf("-j <num> With -x, format the dives in this many threads, default one per core\n");
+    printf("-l List the dives, with -S only those newer than the newest dive in the store\n");
     printf("-n <num> Download this specific dive, list the dives first to see the number\n");
+    printf("-o <dir> Write each dive to <num>.txt in this directory as it arrives, in constant memory. With -S the\n");
+    printf("         dives are streamed into the store and <num>.txt links to the stored dive. Not with -P\n");
+    printf("-p <num> With -U, fetch this many of the newest dives in the background after listing them\n");
+    printf("-P <name> Publish the downloaded dives to the shared memory segment of this name\n");
+    printf("-r <num> Request a dive this many times when the transfer breaks, default 3\n");
+    printf("-S <dir> Add the downloaded dives to the store in this directory, dives already there are not printed\n");
+    printf("-s Print the session statistics as JSON at the end\n");
     printf("-t <num> Download the dives including this one, list the dives first to see the number\n");
+    printf("-U <path> Serve the lists and dives to the clients of a Unix socket at this path until interrupted\n");
     printf("-v Be more verbose\n");
+    printf("-x <format> Export the dives of the store to stdout as csv, json or xml (Subsurface), no device is needed\n");
     printf("\n");
 }
 
@@ -44,33 +195,79 @@ int main(int argc, char **argv) {
     int c = 0;
     int from_dive = 0;
     int to_dive   = 0;
+    int attempts  = 3;
+    int prefetch  = 0;
+    int threads   = 0;
     char *device_name = malloc(sizeof(char));
+    char *store_path  = NULL;
+    char *shm_name    = NULL;
+    char *socket_path = NULL;
+    char *out_dir     = NULL;
+    char *export_name = NULL;
+    char *event_names = NULL;
     bool verbose    = false;
     bool list_dives = false;
+    bool print_stats = false;
+    bool detect = false;
+    int status = 0;
     opterr = 0;
 
-    while ((c = getopt (argc, argv, "d:f:hln:t:v")) != -1)
+    while ((c = getopt (argc, argv, "Ad:e:f:hj:ln:o:p:P:r:sS:t:U:vx:")) != -1)
         switch (c) {
+        case 'A': /* Detect anomalies */
+            detect = true;
+            break;
         case 'd': /* Set serial device to <device> */
             device_name = realloc(device_name, (strlen(optarg) + 1));
             strcpy(device_name, optarg);
             break;
+        case 'e': /* Events of the store */
+            event_names = optarg;
+            break;
         case 'f': /* Download dives (from dive header) */
             from_dive = atoi(optarg);
             break;
+        case 'j': /* Export threads */
+            threads = atoi(optarg);
+            break;
         case 'l': /* List dives (from dive header) */
             list_dives = true;
             break;
         case 'n': /* Download dive #n */
             from_dive = to_dive = atoi(optarg);
             break;
+        case 'o': /* Stream the dives to files */
+            out_dir = optarg;
+            break;
+        case 'p': /* Prefetch with the server */
+            prefetch = atoi(optarg);
+            break;
+        case 'P': /* Shared memory segment */
+            shm_name = optarg;
+            break;
+        case 'r': /* Attempts per dive */
+            attempts = atoi(optarg);
+            break;
+        case 's': /* Print statistics at the end */
+            print_stats = true;
+            break;
+        case 'S': /* Dive store */
+            store_path = optarg;
+            break;
         case 't': /* Download all dives up to #n */
             to_dive = atoi(optarg);
             break;
+        case 'U': /* Server socket */
+            socket_path = optarg;
+            break;
         case 'v':
             verbose = true;
+            sentinel_set_log_level(SENTINEL_LOG_DEBUG);
             dprint(verbose, "%s", "Verbose set");
             break;
+        case 'x': /* Export the store */
+            export_name = optarg;
+            break;
         case 'h': /* Print help and exit */
         default:
             print_help();
@@ -100,6 +297,91 @@ int main(int argc, char **argv) {
         dprint(verbose, "Printing dives from %d to %d", from_dive, to_dive);
     }
 
+    /* The streamed dives are never parsed into a header, which the shared memory needs */
+    if (out_dir != NULL && shm_name != NULL) {
+        eprint("%s", "Streaming the dives with -o can not be combined with -P");
+        print_help();
+        exit(1);
+    }
+
+    /* Exporting only reads the store */
+    if (export_name != NULL) {
+        static const char* FORMATS[] = {"csv", "json", "xml"};
+        int format = -1;
+        int i = 0;
+
+        for (i = 0; i < 3; i++) {
+            if (strcmp(export_name, FORMATS[i]) == 0)
+                format = i;
+        }
+
+        if (format < 0 || store_path == NULL) {
+            eprint("%s", "Exporting needs the store with -S and the format csv, json or xml");
+            print_help();
+            exit(1);
+        }
+
+        sentinel_store_t* store = sentinel_store_open(store_path);
+
+        if (store == NULL) {
+            eprint("Could not open the store in %s", store_path);
+            exit(1);
+        }
+
+        const long long start_ns = sentinel_time_ns();
+        const bool res = sentinel_export_store(store, STDOUT_FILENO, format, threads);
+
+        dprint(verbose, "Exported %d dives in %.3f s", store->count, (sentinel_time_ns() - start_ns) / 1e9);
+        sentinel_store_close(store);
+        free(device_name);
+        exit(res ? 0 : 1);
+    }
+
+    /* So does looking for events */
+    if (event_names != NULL) {
+        const sentinel_event_match_t match = (strchr(event_names, '+') != NULL) ? SENTINEL_EVENTS_ALL : SENTINEL_EVENTS_ANY;
+        uint8_t codes[32];
+        int code_count = 0;
+        char* saveptr = NULL;
+        char* name = NULL;
+        int i = 0;
+
+        for (name = strtok_r(event_names, ",+", &saveptr); name != NULL && code_count < 32;
+             name = strtok_r(NULL, ",+", &saveptr)) {
+            codes[code_count] = sentinel_note_code(name, strlen(name));
+
+            if (codes[code_count++] == SENTINEL_NOTE_UNKNOWN) {
+                eprint("Unknown note: %s", name);
+                exit(1);
+            }
+        }
+
+        sentinel_store_t* store = (store_path != NULL) ? sentinel_store_open(store_path) : NULL;
+        sentinel_event_t* events = NULL;
+
+        if (store == NULL) {
+            eprint("%s", "Looking for events needs the store with -S");
+            exit(1);
+        }
+
+        const int count = sentinel_store_events(store, codes, code_count, match, 0, 0, &events);
+
+        for (i = 0; i < count; i++) {
+            const sentinel_store_entry_t* entry = &store->entries[events[i].dive];
+            const time_t start_s = entry->start_s;
+            char date[32];
+
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", gmtime(&start_s));
+            printf("%016" PRIx64 " %s record %d: %s\n", entry->hash, date, events[i].time_idx,
+                   SENTINEL_NOTES[events[i].code - 1].note);
+        }
+
+        sentinel_free(events);
+        sentinel_store_close(store);
+        free(device_name);
+        exit((count >= 0) ? 0 : 1);
+    }
+
     /* Is the device string empty */
     if (!strlen(device_name)) {
         eprint("%s", "No device defined");
@@ -124,69 +406,165 @@ int main(int argc, char **argv) {
     }
 
     dprint(verbose, "Opening the serial device: %s", device_name);
-    int fd = connect_sentinel(device_name);
+    sentinel_ctx_t* ctx = sentinel_ctx_new(NULL);
+    int tries = 20;
 
-    if (fd <= 0) {
-        eprint("Unable to connect to the device: %s", device_name);
+    if (ctx == NULL) {
+        eprint("%s", "Unable to allocate the context");
         exit(1);
     }
 
-    int tries = 20;
-    if (!is_sentinel_idle(fd, tries)) {
-        eprint("Could not connect to Sentinel after %d tries, is Sentinel connected?", tries);
-        disconnect_sentinel(fd);
+    if (!sentinel_ctx_connect(ctx, device_name, tries)) {
+        eprint("Could not connect to Sentinel at %s after %d tries, is Sentinel connected?", device_name, tries);
+        sentinel_ctx_free(ctx);
         exit(1);
     }
 
     dprint(verbose, "Connected to: %s", device_name);
     free(device_name);
 
-    if (list_dives) {
+    if (socket_path != NULL) {
+        sentinel_server_t* server = sentinel_server_new(ctx, socket_path);
+
+        if (server == NULL) {
+            eprint("Could not serve on %s", socket_path);
+        } else {
+            server->prefetch = prefetch;
+            signal(SIGINT, handle_signal);
+            signal(SIGTERM, handle_signal);
+            dprint(verbose, "Serving on %s", socket_path);
+
+            while (!stop && sentinel_server_process(server, 1000))
+                ;
+
+            dprint(verbose, "%lld transfers from the rebreather, %lld of them prefetched, %lld replies",
+                   server->transfers, server->prefetched, server->served);
+            sentinel_server_free(server);
+        }
+
+        sentinel_ctx_disconnect(ctx);
+    } else if (list_dives) {
         dprint(verbose, "%s", "Printing the list of dives");
-        sentinel_header_t **header_list = NULL;
-        bool res = get_sentinel_dive_list(fd, &header_list);
-        disconnect_sentinel(fd);
+        sentinel_store_t* store = (store_path != NULL) ? sentinel_store_open(store_path) : NULL;
+        bool res = false;
+
+        if (store_path != NULL && store == NULL) {
+            eprint("Could not open the store %s", store_path);
+        } else if (store != NULL) {
+            dprint(verbose, "Listing the dives after the newest of the rebreather in %s", store_path);
+            res = sentinel_store_list_new(ctx, store);
+
+            if (res && ctx->header_list == NULL)
+                printf("No new dives\n");
+        } else {
+            res = sentinel_ctx_list(ctx);
+        }
 
-        if (res && (header_list != NULL)) {
+        sentinel_store_close(store);
+        sentinel_ctx_disconnect(ctx);
+
+        if (res && (ctx->header_list != NULL)) {
             int i = 0;
 
             dprint(verbose, "%s", "######################################################################");
-            while (header_list[i] != NULL) {
-                short_print_sentinel_header(i, header_list[i]);
-                i++;
+            for (i = 0; i < ctx->table.count; i++) {
+                short_print_sentinel_header(i, sentinel_header_table_get(&ctx->table, i));
             }
 
             dprint(verbose, "%s", "######################################################################");
         }
-
-        if (header_list != NULL) free_sentinel_header_list(header_list);
     } else {
+        sentinel_store_t* store = NULL;
+        sentinel_shm_t* shm = NULL;
+
+        if (store_path != NULL && (store = sentinel_store_open(store_path)) == NULL) {
+            eprint("Could not open the store %s", store_path);
+            sentinel_ctx_free(ctx);
+            exit(1);
+        }
+
+        if (shm_name != NULL && (shm = sentinel_shm_create(shm_name, SHM_DATA_SIZE, SHM_SLOTS)) == NULL) {
+            eprint("Could not create the shared memory segment %s", shm_name);
+            sentinel_store_close(store);
+            sentinel_ctx_free(ctx);
+            exit(1);
+        }
+
         // Download all dives
         // First, get the list of dive headers
         dprint(verbose, "%s", "Get the list of dives");
-        sentinel_header_t **header_list = NULL;
-        bool res = get_sentinel_dive_list(fd, &header_list);
+        bool res = sentinel_ctx_list(ctx);
         // Next download each dive data
-        if (res && (header_list != NULL)) {
+        if (res && (ctx->header_list != NULL)) {
             int i = from_dive;
             dprint(verbose, "Fetching dives from %d to %d", from_dive, to_dive);
             dprint(verbose, "%s", "######################################################################");
-            while (header_list[i] != NULL && i <= to_dive) {
+            while (out_dir != NULL && i < ctx->table.count && i <= to_dive) {
+                if (!stream_dive(ctx, store, out_dir, i, detect))
+                    status = 1;
+
+                i++;
+            }
+
+            while (out_dir == NULL && i < ctx->table.count && i <= to_dive) {
                 dprint(verbose, "Downloading dive number: %d", i);
-                download_sentinel_dive(fd, i, &header_list[i]);
-                full_print_sentinel_dive(header_list[i]);
+                sentinel_download_report_t report;
+                sentinel_store_result_t stored = SENTINEL_STORE_ERROR;
+
+                if (store != NULL)
+                    stored = sentinel_store_download(ctx, store, i, attempts, &report);
+                else
+                    sentinel_ctx_download_resumable(ctx, i, attempts, &report);
+
+                if (!report.complete)
+                    eprint("Dive %d is incomplete: %d of %d records, first missing %d",
+                           i, report.received, report.expected, report.first_missing);
+
+                dprint(verbose, "Dive %d: %d of %d records in %d attempts, %d duplicates, %d rejected",
+                       i, report.received, report.expected, report.attempts, report.duplicates, report.rejected);
+
+                if (stored == SENTINEL_STORE_DUPLICATE)
+                    printf("Dive %d is already in the store as %016" PRIx64 "\n", i,
+                           sentinel_header_table_get(&ctx->table, i)->content_hash);
+                else
+                    full_print_sentinel_dive(sentinel_header_table_get(&ctx->table, i));
+
+                if (detect && report.complete && stored != SENTINEL_STORE_DUPLICATE) {
+                    sentinel_header_t* header = sentinel_header_table_get(&ctx->table, i);
+                    sentinel_detector_t detector;
+                    sentinel_record_t record;
+                    int j = 0;
+
+                    sentinel_detector_init(&detector, print_anomaly, &i);
+
+                    for (j = 0; header->log != NULL && header->log[j] != NULL; j++) {
+                        sentinel_record_from_log_line(&record, header->log[j]);
+                        sentinel_detector_feed(&detector, &record);
+                    }
+
+                    sentinel_detector_finish(&detector);
+                }
+
+                if (shm != NULL && report.complete && stored != SENTINEL_STORE_DUPLICATE &&
+                    !sentinel_shm_publish(shm, sentinel_header_table_get(&ctx->table, i)))
+                    eprint("Could not publish dive %d", i);
+
                 i++;
             }
 
             dprint(verbose, "%s", "######################################################################");
         }
 
-        disconnect_sentinel(fd);
-
-        if (header_list != NULL) free_sentinel_header_list(header_list);
+        sentinel_ctx_disconnect(ctx);
+        sentinel_store_close(store);
+        sentinel_shm_close(shm);
     }
 
+    if (print_stats) print_sentinel_stats_json(stdout, sentinel_ctx_stats(ctx));
+
+    sentinel_ctx_free(ctx);
+
     dprint(verbose, "Printing dives from %d to %d", from_dive, to_dive);
     dprint(verbose, "%s", "Task completed");
-    exit(0);
+    exit(status);
 }
@@ -0,0 +1,152 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <signal.h>
+
+#include "libsentinel.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+void print_help(void) {
+    printf("Usage:\n");
+    printf("emulate [-c <num>] [-n <num>] [-V <version>] [-b <rate>] [-p <ms>] [-e <rate>] [-F <faults>] [-v] [dump files] | -h\n");
+    printf("-c <num> Number of emulated rebreathers, default 1\n");
+    printf("-n <num> Number of generated dives when no dump files are given, default %d\n", DEFAULT_EMULATOR_CONFIG.generated_dives);
+    printf("-V <version> Firmware version of the generated dives: V3.0C, V009A or V009B, default V009A\n");
+    printf("-b <rate> Line rate in bytes per second, 0 for unlimited, default %d\n", DEFAULT_EMULATOR_CONFIG.line_rate);
+    printf("-p <ms> Interval of the P while idle, default %d\n", DEFAULT_EMULATOR_CONFIG.idle_interval_ms);
+    printf("-e <rate> Probability of a response getting a fault, 0.0 - 1.0, default 0.0\n");
+    printf("-F <faults> Faults to inject, any of t (truncate), m (out of memory), d (drop) and c (corrupt), default all\n");
+    printf("-v Verbose mode\n");
+    printf("-h This help\n");
+    printf("\n");
+    printf("The dump files are served in the given order, the first one is dive 0.\n");
+    printf("The pty of each rebreather is printed, and they run until interrupted.\n");
+}
+
+int main(int argc, char **argv) {
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+    sentinel_emulator_t** emu = NULL;
+    char* faults = "tmdc";
+    int count = 1;
+    int c = 0;
+    int i = 0;
+
+    opterr = 0;
+
+    while ((c = getopt (argc, argv, "b:c:e:F:hn:p:vV:")) != -1)
+        switch (c) {
+        case 'b': /* Line rate */
+            config.line_rate = atoi(optarg);
+            break;
+        case 'c': /* Number of rebreathers */
+            count = atoi(optarg);
+            break;
+        case 'e': /* Fault rate */
+            config.fault_rate = atof(optarg);
+            break;
+        case 'F': /* Fault types */
+            faults = optarg;
+            break;
+        case 'n': /* Generated dives */
+            config.generated_dives = atoi(optarg);
+            break;
+        case 'p': /* Idle interval */
+            config.idle_interval_ms = atoi(optarg);
+            break;
+        case 'v': /* Verbose */
+            sentinel_set_log_level(SENTINEL_LOG_DEBUG);
+            break;
+        case 'V': /* Firmware version */
+            config.generator.firmware = SENTINEL_FW_UNKNOWN;
+
+            for (i = SENTINEL_FW_UNKNOWN + 1; i < SENTINEL_FW_COUNT; i++) {
+                if (strcmp(optarg, SENTINEL_FIRMWARE_NAME[i]) == 0)
+                    config.generator.firmware = i;
+            }
+
+            break;
+        case 'h': /* Print help and exit */
+        default:
+            print_help();
+            exit(0);
+        }
+
+    if (optind < argc)
+        config.dump_files = &argv[optind];
+
+    if (count < 1) {
+        eprint("Invalid number of rebreathers: %d", count);
+        exit(1);
+    }
+
+    if (config.fault_rate > 0.0) {
+        if (strchr(faults, 't') != NULL) config.faults |= SENTINEL_FAULT_TRUNCATE;
+        if (strchr(faults, 'm') != NULL) config.faults |= SENTINEL_FAULT_OUT_OF_MEMORY;
+        if (strchr(faults, 'd') != NULL) config.faults |= SENTINEL_FAULT_DROP;
+        if (strchr(faults, 'c') != NULL) config.faults |= SENTINEL_FAULT_CORRUPT;
+    }
+
+    emu = calloc(count, sizeof(sentinel_emulator_t*));
+
+    if (emu == NULL) {
+        eprint("%s", "Failed to allocate the emulators");
+        exit(1);
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    for (i = 0; i < count; i++) {
+        /* Every rebreather gets its own set of generated dives */
+        config.generator.seed = DEFAULT_EMULATOR_CONFIG.generator.seed + i * 1000;
+        emu[i] = sentinel_emulator_start_pty(&config);
+
+        if (emu[i] == NULL) {
+            eprint("Failed to start emulator %d", i);
+            break;
+        }
+
+        printf("%s\n", emu[i]->client_path);
+    }
+
+    fflush(stdout);
+
+    while (!stop && i == count) {
+        pause();
+    }
+
+    for (i = 0; i < count; i++) {
+        if (emu[i] != NULL)
+            fprintf(stderr, "Emulator %d: %ld commands, %ld bytes, %ld faults\n", i, emu[i]->commands, emu[i]->bytes_sent, emu[i]->faults_injected);
+
+        sentinel_emulator_free(emu[i]);
+    }
+
+    free(emu);
+
+    return(0);
+}
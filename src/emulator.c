@@ -0,0 +1,455 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <poll.h>
+#include <signal.h>
+#include <pty.h>
+#include <sys/socket.h>
+
+#include "libsentinel.h"
+
+const sentinel_emulator_config_t DEFAULT_EMULATOR_CONFIG = {
+    NULL, /* dump_files */
+    3,    /* generated_dives */
+    {SENTINEL_FW_V009A, 360, 10, 0.05, 30.0, 1, 551970272}, /* generator */
+    960,  /* line_rate, 9600 baud with 8N1 */
+    1500, /* idle_interval_ms */
+    0.0,  /* fault_rate */
+    SENTINEL_FAULT_NONE /* faults */
+};
+
+/**
+ * sentinel_emulator_read_file: Reads the whole dump file into a newly allocated string
+ **/
+
+static char* sentinel_emulator_read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        sentinel_error("Unable to open dump file: %s", path);
+        return(NULL);
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* data = calloc(size + 1, sizeof(char));
+
+    if (data != NULL && fread(data, 1, size, file) != (size_t) size) {
+        sentinel_error("Unable to read dump file: %s", path);
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    return(data);
+}
+
+/**
+ * sentinel_emulator_build_list: Builds the response to the M command, which is the header of each
+ *                               dive up until the gas lines, each preceded by d\r\n
+ **/
+
+static char* sentinel_emulator_build_list(sentinel_emulator_t* emu) {
+    size_t size = 6;
+    int i = 0;
+
+    for (i = 0; i < emu->dive_count; i++) {
+        size += strlen(emu->dives[i]) + 3;
+    }
+
+    char* list = calloc(size, sizeof(char));
+
+    if (list == NULL)
+        return(NULL);
+
+    size_t len = 0;
+
+    for (i = 0; i < emu->dive_count; i++) {
+        const char* start = strstr(emu->dives[i], "ver=");
+        const char* end   = strstr(emu->dives[i], "\r\nGas ");
+
+        if (start == NULL || end == NULL) {
+            sentinel_warn("Dive %d has no header, skipping it in the list", i);
+            continue;
+        }
+
+        memcpy(list + len, "d\r\n", 3);
+        len += 3;
+        memcpy(list + len, start, end + 2 - start);
+        len += end + 2 - start;
+    }
+
+    memcpy(list + len, "End\r\n", 5);
+
+    return(list);
+}
+
+/**
+ * sentinel_emulator_random: xorshift32 for the fault injection
+ **/
+
+static unsigned int sentinel_emulator_random(sentinel_emulator_t* emu) {
+    emu->rnd ^= emu->rnd << 13;
+    emu->rnd ^= emu->rnd >> 17;
+    emu->rnd ^= emu->rnd << 5;
+    return(emu->rnd);
+}
+
+/**
+ * sentinel_emulator_write: Writes the data to the device end at the configured line rate. Returns
+ *                          false if the emulator is being stopped or the other end is gone
+ **/
+
+static bool sentinel_emulator_write(sentinel_emulator_t* emu, const char* data, size_t len) {
+    const size_t chunk = (emu->config.line_rate > 0) ? (size_t) (emu->config.line_rate / 100 + 1) : len;
+    size_t sent = 0;
+
+    while (sent < len && __atomic_load_n(&emu->running, __ATOMIC_ACQUIRE)) {
+        const size_t n = (len - sent < chunk) ? len - sent : chunk;
+        ssize_t w = write(emu->fd, data + sent, n);
+
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                struct pollfd pfd = {emu->fd, POLLOUT, 0};
+                poll(&pfd, 1, 10);
+                continue;
+            }
+
+            return(false);
+        }
+
+        sent += w;
+        emu->bytes_sent += w;
+
+        if (emu->config.line_rate > 0) {
+            struct timespec ts;
+            const long long ns = (long long) w * 1000000000LL / emu->config.line_rate;
+            ts.tv_sec  = ns / 1000000000LL;
+            ts.tv_nsec = ns % 1000000000LL;
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return(sent == len);
+}
+
+/**
+ * sentinel_emulator_respond: Sends the response, injecting a fault into it if the dice say so
+ **/
+
+static void sentinel_emulator_respond(sentinel_emulator_t* emu, const char* data) {
+    const size_t len = strlen(data);
+    int faults[4];
+    int fault_count = 0;
+
+    if (emu->config.faults & SENTINEL_FAULT_TRUNCATE) faults[fault_count++] = SENTINEL_FAULT_TRUNCATE;
+    if (emu->config.faults & SENTINEL_FAULT_OUT_OF_MEMORY) faults[fault_count++] = SENTINEL_FAULT_OUT_OF_MEMORY;
+    if (emu->config.faults & SENTINEL_FAULT_DROP) faults[fault_count++] = SENTINEL_FAULT_DROP;
+    if (emu->config.faults & SENTINEL_FAULT_CORRUPT) faults[fault_count++] = SENTINEL_FAULT_CORRUPT;
+
+    if (fault_count == 0 || len < 2 ||
+        (sentinel_emulator_random(emu) & 0xffffff) / (double) 0x1000000 >= emu->config.fault_rate) {
+        sentinel_emulator_write(emu, data, len);
+        return;
+    }
+
+    const size_t pos = sentinel_emulator_random(emu) % len;
+    const int fault  = faults[sentinel_emulator_random(emu) % fault_count];
+    char corrupt = 0;
+
+    emu->faults_injected++;
+    sentinel_debug("Injecting fault %d at byte %zu of %zu", fault, pos, len);
+
+    switch (fault) {
+    case SENTINEL_FAULT_TRUNCATE:
+        /* The transfer stops and the rebreather goes back to sending wait bytes */
+        if (sentinel_emulator_write(emu, data, pos))
+            sentinel_emulator_write(emu, "PPPPPP", 6);
+        break;
+    case SENTINEL_FAULT_OUT_OF_MEMORY:
+        if (sentinel_emulator_write(emu, data, pos))
+            sentinel_emulator_write(emu, ",,,,,,", 6);
+        break;
+    case SENTINEL_FAULT_DROP:
+        if (sentinel_emulator_write(emu, data, pos))
+            sentinel_emulator_write(emu, data + pos + 1, len - pos - 1);
+        break;
+    case SENTINEL_FAULT_CORRUPT:
+        corrupt = 0x21 + sentinel_emulator_random(emu) % 94;
+
+        if (sentinel_emulator_write(emu, data, pos) && sentinel_emulator_write(emu, &corrupt, 1))
+            sentinel_emulator_write(emu, data + pos + 1, len - pos - 1);
+        break;
+    }
+}
+
+/**
+ * sentinel_emulator_command: Handles one command received from the library
+ **/
+
+static void sentinel_emulator_command(sentinel_emulator_t* emu, const char* cmd, const int len) {
+    emu->commands++;
+
+    if (cmd[0] == 'M') {
+        sentinel_emulator_respond(emu, emu->list);
+    } else if (cmd[0] == 'D' && len > 1) {
+        const int dive_num = atoi(cmd + 1);
+
+        if (dive_num < 0 || dive_num >= emu->dive_count) {
+            sentinel_warn("Request for non-existing dive: %d", dive_num);
+            return;
+        }
+
+        sentinel_emulator_respond(emu, emu->dives[dive_num]);
+    } else {
+        sentinel_debug("Unknown command: '%c'", cmd[0]);
+    }
+}
+
+/**
+ * sentinel_emulator_thread: Main loop of the emulator, sends the wait byte at the idle cadence
+ *                           and serves the commands
+ **/
+
+static void* sentinel_emulator_thread(void* arg) {
+    sentinel_emulator_t* emu = arg;
+    char cmd[32];
+
+    while (__atomic_load_n(&emu->running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd[2] = {{emu->fd, POLLIN, 0}, {emu->stop_pipe[0], POLLIN, 0}};
+        int n = poll(pfd, 2, emu->config.idle_interval_ms);
+
+        if (!__atomic_load_n(&emu->running, __ATOMIC_ACQUIRE))
+            break;
+
+        if (n == 0) {
+            /* If nobody is reading, the buffer fills up and the wait byte is dropped */
+            if (write(emu->fd, SENTINEL_WAIT_BYTE, sizeof(SENTINEL_WAIT_BYTE)) > 0)
+                emu->bytes_sent++;
+
+            continue;
+        }
+
+        if (n < 0 || !(pfd[0].revents & POLLIN)) {
+            if (n < 0 && errno != EINTR) break;
+            if (pfd[0].revents & (POLLHUP | POLLERR)) sentinel_sleep(10);
+            continue;
+        }
+
+        /* Give the rest of a multi byte command a moment to arrive */
+        sentinel_sleep(SENTINEL_LOOP_SLEEP_MS);
+        ssize_t len = read(emu->fd, cmd, sizeof(cmd) - 1);
+
+        if (len > 0) {
+            cmd[len] = 0;
+            sentinel_emulator_command(emu, cmd, len);
+            /* The rebreather goes back to waiting for commands */
+            sentinel_emulator_write(emu, "PPP", 3);
+        }
+    }
+
+    return(NULL);
+}
+
+/**
+ * sentinel_emulator_alloc: Loads or generates the dives and prepares the emulator, but does not
+ *                          start it
+ **/
+
+static sentinel_emulator_t* sentinel_emulator_alloc(const sentinel_emulator_config_t* config) {
+    sentinel_emulator_t* emu = calloc(1, sizeof(sentinel_emulator_t));
+    int i = 0;
+
+    if (emu == NULL)
+        return(NULL);
+
+    emu->config    = *config;
+    emu->fd        = -1;
+    emu->client_fd = -1;
+    emu->rnd       = (config->generator.seed != 0) ? config->generator.seed : 1;
+    emu->stop_pipe[0] = emu->stop_pipe[1] = -1;
+
+    if (config->dump_files != NULL) {
+        while (config->dump_files[emu->dive_count] != NULL) {
+            emu->dive_count++;
+        }
+    } else {
+        emu->dive_count = config->generated_dives;
+    }
+
+    emu->dives = calloc(emu->dive_count + 1, sizeof(char*));
+
+    if (emu->dives == NULL) {
+        free(emu);
+        return(NULL);
+    }
+
+    for (i = 0; i < emu->dive_count; i++) {
+        if (config->dump_files != NULL) {
+            emu->dives[i] = sentinel_emulator_read_file(config->dump_files[i]);
+        } else {
+            /* Dive 0 is the newest one */
+            sentinel_generator_t gen = config->generator;
+            gen.seed  += i;
+            gen.start -= i * 86400;
+            emu->dives[i] = sentinel_generate_dive(&gen);
+        }
+
+        if (emu->dives[i] == NULL) {
+            sentinel_emulator_free(emu);
+            return(NULL);
+        }
+    }
+
+    emu->list = sentinel_emulator_build_list(emu);
+
+    if (emu->list == NULL || pipe(emu->stop_pipe) != 0) {
+        sentinel_emulator_free(emu);
+        return(NULL);
+    }
+
+    return(emu);
+}
+
+/**
+ * sentinel_emulator_run: Starts the emulator thread on the device end
+ **/
+
+static bool sentinel_emulator_run(sentinel_emulator_t* emu) {
+    fcntl(emu->fd, F_SETFL, fcntl(emu->fd, F_GETFL) | O_NONBLOCK);
+    __atomic_store_n(&emu->running, true, __ATOMIC_RELEASE);
+
+    /* Signals belong to the application, the thread inherits a mask blocking all of them */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    const int res = pthread_create(&emu->thread, NULL, sentinel_emulator_thread, emu);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (res != 0) {
+        sentinel_error("%s", "Unable to start the emulator thread");
+        __atomic_store_n(&emu->running, false, __ATOMIC_RELEASE);
+        return(false);
+    }
+
+    emu->started = true;
+    return(true);
+}
+
+/**
+ * sentinel_emulator_start_pty: Starts an emulator on a new pseudo terminal. The library connects to
+ *                              it with connect_sentinel(emu->client_path) like to a real device
+ **/
+
+sentinel_emulator_t* sentinel_emulator_start_pty(const sentinel_emulator_config_t* config) {
+    sentinel_emulator_t* emu = sentinel_emulator_alloc(config);
+    struct termios options;
+
+    if (emu == NULL)
+        return(NULL);
+
+    if (openpty(&emu->fd, &emu->client_fd, emu->client_path, NULL, NULL) != 0) {
+        sentinel_error("%s", "Unable to open pseudo terminal");
+        sentinel_emulator_free(emu);
+        return(NULL);
+    }
+
+    /* The slave end is kept open so that the master does not see a hangup between connections */
+    if (tcgetattr(emu->client_fd, &options) == 0) {
+        cfmakeraw(&options);
+        tcsetattr(emu->client_fd, TCSANOW, &options);
+    }
+
+    if (!sentinel_emulator_run(emu)) {
+        sentinel_emulator_free(emu);
+        return(NULL);
+    }
+
+    return(emu);
+}
+
+/**
+ * sentinel_emulator_start_socketpair: Starts an emulator on an in-memory socket pair. The library
+ *                                     uses emu->client_fd directly instead of connect_sentinel
+ **/
+
+sentinel_emulator_t* sentinel_emulator_start_socketpair(const sentinel_emulator_config_t* config) {
+    sentinel_emulator_t* emu = sentinel_emulator_alloc(config);
+    int sv[2];
+
+    if (emu == NULL)
+        return(NULL);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        sentinel_error("%s", "Unable to create socket pair");
+        sentinel_emulator_free(emu);
+        return(NULL);
+    }
+
+    emu->fd        = sv[0];
+    emu->client_fd = sv[1];
+    fcntl(emu->client_fd, F_SETFL, fcntl(emu->client_fd, F_GETFL) | O_NONBLOCK);
+
+    if (!sentinel_emulator_run(emu)) {
+        sentinel_emulator_free(emu);
+        return(NULL);
+    }
+
+    return(emu);
+}
+
+/**
+ * sentinel_emulator_free: Stops the emulator thread if it is running and frees everything
+ **/
+
+void sentinel_emulator_free(sentinel_emulator_t* emu) {
+    int i = 0;
+
+    if (emu == NULL)
+        return;
+
+    if (emu->started) {
+        __atomic_store_n(&emu->running, false, __ATOMIC_RELEASE);
+
+        if (write(emu->stop_pipe[1], "x", 1) < 0)
+            sentinel_warn("%s", "Unable to wake up the emulator thread");
+
+        pthread_join(emu->thread, NULL);
+    }
+
+    if (emu->fd >= 0) close(emu->fd);
+    if (emu->client_fd >= 0) close(emu->client_fd);
+    if (emu->stop_pipe[0] >= 0) close(emu->stop_pipe[0]);
+    if (emu->stop_pipe[1] >= 0) close(emu->stop_pipe[1]);
+
+    if (emu->dives != NULL) {
+        for (i = 0; i < emu->dive_count; i++) {
+            free(emu->dives[i]);
+        }
+
+        free(emu->dives);
+    }
+
+    free(emu->list);
+    free(emu);
+}
@@ -0,0 +1,415 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <inttypes.h>
+
+#include "libsentinel.h"
+
+static const char SENTINEL_STORE_EVENTS[] = "events";
+
+/* The most notes asked for at a time in sentinel_store_events */
+#define SENTINEL_EVENTS_MAX_CODES 32
+
+typedef struct sentinel_event_list {
+    sentinel_event_t* events;
+    int count;
+    int size;
+} sentinel_event_list_t;
+
+/**
+ * sentinel_events_list: Returns the index of the posting list of the note code, -1 for none
+ **/
+
+static int sentinel_events_list(const int code) {
+    if (code == SENTINEL_NOTE_UNKNOWN)
+        return(SENTINEL_NOTE_COUNT);
+
+    return((code >= 1 && code <= SENTINEL_NOTE_COUNT) ? code - 1 : -1);
+}
+
+static bool sentinel_posting_before(const sentinel_posting_t* a, const sentinel_posting_t* b) {
+    return(a->dive < b->dive || (a->dive == b->dive && a->time_idx < b->time_idx));
+}
+
+/**
+ * sentinel_events_add: Adds a posting to the list in order. The dives are indexed as they are added
+ *                      to the store, so the posting nearly always goes to the end
+ **/
+
+static bool sentinel_events_add(sentinel_posting_list_t* list, const sentinel_posting_t* posting) {
+    if (list->count == list->size) {
+        const int new_size = (list->size > 0) ? list->size * 2 : 64;
+        sentinel_posting_t* tmp = sentinel_realloc(list->postings, new_size * sizeof(sentinel_posting_t));
+
+        if (tmp == NULL) {
+            sentinel_error("%s", "Failed to reallocate the event postings");
+            return(false);
+        }
+
+        list->postings = tmp;
+        list->size     = new_size;
+    }
+
+    int i = list->count;
+
+    while (i > 0 && sentinel_posting_before(posting, &list->postings[i - 1])) {
+        i--;
+    }
+
+    memmove(&list->postings[i + 1], &list->postings[i], (list->count - i) * sizeof(sentinel_posting_t));
+    list->postings[i] = *posting;
+    list->count++;
+
+    return(true);
+}
+
+/**
+ * sentinel_events_index: Adds the notes of the records of a dive to the postings of the store and to
+ *                        the events file, a line of the hash and code/time_idx of each note
+ **/
+
+bool sentinel_events_index(sentinel_store_t* store, const int dive, const sentinel_record_t* records, const int count) {
+    bool res = true;
+    FILE* out = fopen(store->events_path, "a");
+    int i = 0;
+    int n = 0;
+
+    if (out == NULL) {
+        sentinel_error("Could not open %s: %s", store->events_path, strerror(errno));
+        return(false);
+    }
+
+    fprintf(out, "%016" PRIx64, store->entries[dive].hash);
+
+    for (i = 0; i < count; i++) {
+        const sentinel_record_t* record = &records[i];
+        const sentinel_posting_t posting = {dive, record->time_idx};
+
+        for (n = 0; n < 3; n++) {
+            const int idx = sentinel_events_list(record->note[n]);
+
+            /* A note repeated on the same line is the same event */
+            if (idx < 0 || (n > 0 && record->note[n] == record->note[0]) || (n > 1 && record->note[n] == record->note[1]))
+                continue;
+
+            res &= sentinel_events_add(&store->events[idx], &posting);
+            fprintf(out, " %d/%d", record->note[n], record->time_idx);
+        }
+    }
+
+    fputc('\n', out);
+    res &= (fflush(out) == 0 && fsync(fileno(out)) == 0);
+    res &= (fclose(out) == 0);
+
+    return(res);
+}
+
+/**
+ * sentinel_events_open: Reads the events file of the store. The dives missing from it, eg. added
+ *                       before there was one or when the program stopped in between, are set in
+ *                       missing, to be indexed from their files
+ **/
+
+bool sentinel_events_open(sentinel_store_t* store, bool* missing) {
+    char* line = NULL;
+    size_t line_size = 0;
+    bool res = true;
+    int i = 0;
+
+    if ((store->events_path = sentinel_store_file(store, SENTINEL_STORE_EVENTS)) == NULL)
+        return(false);
+
+    if ((store->events = sentinel_calloc(SENTINEL_NOTE_COUNT + 1, sizeof(sentinel_posting_list_t))) == NULL)
+        return(false);
+
+    for (i = 0; i < store->count; i++) {
+        missing[i] = true;
+    }
+
+    FILE* in = fopen(store->events_path, "r");
+
+    while (in != NULL && res && sentinel_store_getline(&line, &line_size, in) > 0) {
+        char* p = line;
+        char* q = NULL;
+        const uint64_t hash = strtoull(p, &q, 16);
+        const sentinel_store_entry_t* entry = (q != p) ? sentinel_store_find(store, hash) : NULL;
+
+        /* Lines of dives which did not make it to the index are left out */
+        if (entry == NULL || !missing[entry - store->entries])
+            continue;
+
+        const int dive = entry - store->entries;
+        missing[dive] = false;
+
+        for (p = q; res; p = q) {
+            const int idx = sentinel_events_list(strtol(p, &q, 10));
+
+            if (q == p || *q != '/')
+                break;
+
+            p = q + 1;
+            const sentinel_posting_t posting = {dive, (int) strtol(p, &q, 10)};
+
+            if (q == p)
+                break;
+
+            if (idx >= 0)
+                res = sentinel_events_add(&store->events[idx], &posting);
+        }
+    }
+
+    if (in != NULL)
+        fclose(in);
+
+    sentinel_free(line);
+
+    return(res);
+}
+
+/**
+ * sentinel_events_free: Frees the postings of the store
+ **/
+
+void sentinel_events_free(sentinel_store_t* store) {
+    int i = 0;
+
+    if (store->events != NULL) {
+        for (i = 0; i <= SENTINEL_NOTE_COUNT; i++) {
+            sentinel_free(store->events[i].postings);
+        }
+    }
+
+    sentinel_free(store->events);
+    sentinel_free(store->events_path);
+}
+
+/**
+ * sentinel_events_seek: Returns the first posting at or after pos of the given dive or a later one,
+ *                       galloping ahead and then searching the last step in halves
+ **/
+
+static int sentinel_events_seek(const sentinel_posting_list_t* list, int pos, const int dive) {
+    int step = 1;
+    int hi = pos;
+
+    while (hi < list->count && list->postings[hi].dive < dive) {
+        pos   = hi + 1;
+        hi   += step;
+        step *= 2;
+    }
+
+    if (hi > list->count)
+        hi = list->count;
+
+    while (pos < hi) {
+        const int mid = pos + (hi - pos) / 2;
+
+        if (list->postings[mid].dive < dive)
+            pos = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return(pos);
+}
+
+/**
+ * sentinel_events_first_dive: Returns the first dive which started at or after start_s, or at or
+ *                             before it when the entries are in descending order, searching the
+ *                             entries in halves. With past the dives which started at start_s are
+ *                             skipped too, so that no bound has to be moved by a second, which
+ *                             would overflow INT_MAX or INT_MIN. Only for a store whose entries
+ *                             are in order
+ **/
+
+static int sentinel_events_first_dive(const sentinel_store_t* store, const int start_s, const bool past) {
+    int lo = 0;
+    int hi = store->count;
+
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        const int mid_s = store->entries[mid].start_s;
+
+        if (store->ascending ? (mid_s < start_s || (past && mid_s == start_s)) :
+                               (mid_s > start_s || (past && mid_s == start_s)))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return(lo);
+}
+
+/**
+ * sentinel_events_merge: Merges the postings from pos up to end of the lists into the events in
+ *                        order, leaving out the dives which started outside from_s and to_s
+ **/
+
+static bool sentinel_events_merge(const sentinel_store_t* store, const sentinel_posting_list_t** lists,
+                                  const uint8_t* codes, int* pos, const int* end, const int count,
+                                  const int from_s, const int to_s, sentinel_event_list_t* out) {
+    int i = 0;
+
+    while (true) {
+        int best = -1;
+
+        for (i = 0; i < count; i++) {
+            if (pos[i] < end[i] && (best < 0 || sentinel_posting_before(&lists[i]->postings[pos[i]], &lists[best]->postings[pos[best]])))
+                best = i;
+        }
+
+        if (best < 0)
+            return(true);
+
+        const sentinel_posting_t* posting = &lists[best]->postings[pos[best]++];
+        const int start_s = store->entries[posting->dive].start_s;
+
+        if ((from_s != 0 && start_s < from_s) || (to_s != 0 && start_s > to_s))
+            continue;
+
+        if (out->count == out->size) {
+            const int new_size = (out->size > 0) ? out->size * 2 : 256;
+            sentinel_event_t* tmp = sentinel_realloc(out->events, new_size * sizeof(sentinel_event_t));
+
+            if (tmp == NULL) {
+                sentinel_error("%s", "Failed to reallocate the events");
+                return(false);
+            }
+
+            out->events = tmp;
+            out->size   = new_size;
+        }
+
+        out->events[out->count++] = (sentinel_event_t) {posting->dive, posting->time_idx, codes[best]};
+    }
+}
+
+/**
+ * sentinel_store_events: Finds the notes with the given codes in the stored dives which started
+ *                        between from_s and to_s, 0 for no limit. With SENTINEL_EVENTS_ANY every
+ *                        event of any of the notes is returned, with SENTINEL_EVENTS_ALL the events
+ *                        of the dives which have all of the notes. The events are sorted by dive
+ *                        and time_idx and freed with sentinel_free. Returns their count, -1 on error.
+ *                        When the dives were added in the order they started, or in the reverse
+ *                        order, the postings of the dives between from_s and to_s are found in
+ *                        halves instead of filtered
+ **/
+
+int sentinel_store_events(const sentinel_store_t* store, const uint8_t* codes, const int code_count,
+                          const sentinel_event_match_t match, const int from_s, const int to_s,
+                          sentinel_event_t** events) {
+    const sentinel_posting_list_t* lists[SENTINEL_EVENTS_MAX_CODES];
+    uint8_t list_codes[SENTINEL_EVENTS_MAX_CODES];
+    int pos[SENTINEL_EVENTS_MAX_CODES];
+    int end[SENTINEL_EVENTS_MAX_CODES];
+    int stop[SENTINEL_EVENTS_MAX_CODES]; /* End of the postings of the dives between from_s and to_s */
+    sentinel_event_list_t out = {NULL, 0, 0};
+    int first_dive = 0;
+    int last_dive = store->count; /* Exclusive */
+    bool res = true;
+    int count = 0;
+    int i = 0;
+    int j = 0;
+
+    *events = NULL;
+
+    for (i = 0; i < code_count; i++) {
+        const int idx = sentinel_events_list(codes[i]);
+        bool seen = false;
+
+        if (idx < 0 || count == SENTINEL_EVENTS_MAX_CODES) {
+            sentinel_error("Can not look for the note code %d", codes[i]);
+            return(-1);
+        }
+
+        for (j = 0; j < count; j++) {
+            seen |= (list_codes[j] == codes[i]);
+        }
+
+        if (seen)
+            continue;
+
+        lists[count]      = &store->events[idx];
+        list_codes[count] = codes[i];
+        count++;
+    }
+
+    if (count == 0)
+        return(0);
+
+    if (store->ascending) {
+        first_dive = (from_s != 0) ? sentinel_events_first_dive(store, from_s, false) : 0;
+        last_dive  = (to_s != 0) ? sentinel_events_first_dive(store, to_s, true) : store->count;
+    } else if (store->descending) {
+        first_dive = (to_s != 0) ? sentinel_events_first_dive(store, to_s, false) : 0;
+        last_dive  = (from_s != 0) ? sentinel_events_first_dive(store, from_s, true) : store->count;
+    }
+
+    for (i = 0; i < count; i++) {
+        pos[i]  = sentinel_events_seek(lists[i], 0, first_dive);
+        stop[i] = sentinel_events_seek(lists[i], pos[i], last_dive);
+        end[i]  = stop[i];
+    }
+
+    if (match == SENTINEL_EVENTS_ANY) {
+        res = sentinel_events_merge(store, lists, list_codes, pos, end, count, from_s, to_s, &out);
+    } else {
+        /* Every list is skipped ahead to the latest dive among their heads until they all agree */
+        while (res) {
+            int dive = -1;
+            bool agree = true;
+            bool done = false;
+
+            for (i = 0; i < count; i++) {
+                if (pos[i] >= stop[i])
+                    done = true;
+                else if (lists[i]->postings[pos[i]].dive > dive)
+                    dive = lists[i]->postings[pos[i]].dive;
+            }
+
+            if (done)
+                break;
+
+            for (i = 0; i < count; i++) {
+                pos[i] = sentinel_events_seek(lists[i], pos[i], dive);
+                agree &= (pos[i] < stop[i] && lists[i]->postings[pos[i]].dive == dive);
+            }
+
+            if (!agree)
+                continue;
+
+            for (i = 0; i < count; i++) {
+                end[i] = sentinel_events_seek(lists[i], pos[i], dive + 1);
+            }
+
+            res = sentinel_events_merge(store, lists, list_codes, pos, end, count, from_s, to_s, &out);
+        }
+    }
+
+    if (!res) {
+        sentinel_free(out.events);
+        return(-1);
+    }
+
+    *events = out.events;
+
+    return(out.count);
+}
@@ -0,0 +1,1001 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "libsentinel.h"
+
+/* Dives formatted between two writes, the output of two batches is held at a time */
+#define SENTINEL_EXPORT_BATCH 128
+
+/* Room reserved before formatting the header of a dive and each record, none of them is longer */
+#define SENTINEL_EXPORT_HEADER_ROOM 1024
+#define SENTINEL_EXPORT_RECORD_ROOM 512
+
+#define SENTINEL_EXPORT_MAX_THREADS 64
+
+/* Records of a worker to begin with, they are grown for longer dives */
+#define SENTINEL_EXPORT_RECORDS 4096
+
+/* Written vectors at a time, consecutive dives formatted by the same worker are one vector */
+#define SENTINEL_EXPORT_IOV 256
+
+#define JSON_SEPARATOR ",\n"
+
+typedef struct sentinel_export_buffer {
+    char* data;
+    size_t len;
+    size_t size;
+} sentinel_export_buffer_t;
+
+/* Where the output of a dive of the batch is, in the buffer of the worker which formatted it */
+typedef struct sentinel_export_slot {
+    int worker;
+    size_t offset;
+    size_t len;
+} sentinel_export_slot_t;
+
+struct sentinel_export;
+
+/* The dives of the batch left to a worker are next up to end. The worker takes them from the
+ * front and the idle workers steal half of them from the back */
+typedef struct sentinel_export_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int next;
+    int end;
+    int index;
+    sentinel_export_buffer_t out[2]; /* By the parity of the batch */
+    char* text; /* The file of the dive */
+    size_t text_size;
+    sentinel_fixed_header_t header;
+    sentinel_record_t* records;
+    int max_records;
+    int count; /* Records of the dive being formatted */
+    struct sentinel_export* export;
+} sentinel_export_worker_t;
+
+typedef struct sentinel_export {
+    const sentinel_store_t* store;
+    sentinel_ctx_t* ctx; /* Of the caller, the workers allocate in it one at a time */
+    pthread_mutex_t alloc_lock;
+    sentinel_export_format_t format;
+    sentinel_export_worker_t* workers;
+    int threads;
+    pthread_mutex_t start_lock; /* Held until all of the workers are started */
+    pthread_barrier_t barrier;
+    int batch;
+    int batch_start;
+    bool finished;
+    bool failed;
+    sentinel_export_slot_t slots[2][SENTINEL_EXPORT_BATCH];
+} sentinel_export_t;
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static const int POWERS_OF_TEN[] = {1, 10, 100, 1000};
+
+/**
+ * sentinel_export_uint: Writes the number two digits at a time, returns the end of it
+ **/
+
+static char* sentinel_export_uint(char* p, unsigned long long value) {
+    char tmp[20];
+    int n = sizeof(tmp);
+
+    while (value >= 100) {
+        const int pair = (value % 100) * 2;
+        value /= 100;
+        tmp[--n] = DIGIT_PAIRS[pair + 1];
+        tmp[--n] = DIGIT_PAIRS[pair];
+    }
+
+    if (value >= 10) {
+        tmp[--n] = DIGIT_PAIRS[value * 2 + 1];
+        tmp[--n] = DIGIT_PAIRS[value * 2];
+    } else {
+        tmp[--n] = '0' + value;
+    }
+
+    memcpy(p, tmp + n, sizeof(tmp) - n);
+
+    return(p + sizeof(tmp) - n);
+}
+
+static char* sentinel_export_int(char* p, const long long value) {
+    if (value < 0) {
+        *p++ = '-';
+        return(sentinel_export_uint(p, -(unsigned long long) value));
+    }
+
+    return(sentinel_export_uint(p, value));
+}
+
+/**
+ * sentinel_export_fixed: Writes a fixed point number, value is in units of 10^-decimals, 1 - 3
+ **/
+
+static char* sentinel_export_fixed(char* p, const long long value, const int decimals) {
+    unsigned long long abs_value = value;
+    int i = 0;
+
+    if (value < 0) {
+        *p++ = '-';
+        abs_value = -(unsigned long long) value;
+    }
+
+    p = sentinel_export_uint(p, abs_value / POWERS_OF_TEN[decimals]);
+    *p++ = '.';
+
+    unsigned long long fraction = abs_value % POWERS_OF_TEN[decimals];
+
+    for (i = decimals - 1; i >= 0; i--) {
+        p[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+
+    return(p + decimals);
+}
+
+/**
+ * sentinel_export_two: Writes a number of 0 - 99 with two digits, for dates and times
+ **/
+
+static char* sentinel_export_two(char* p, const int value) {
+    *p++ = DIGIT_PAIRS[value * 2];
+    *p++ = DIGIT_PAIRS[value * 2 + 1];
+    return(p);
+}
+
+static char* sentinel_export_hex64(char* p, uint64_t value) {
+    int i = 0;
+
+    for (i = 15; i >= 0; i--) {
+        p[i] = HEX_DIGITS[value & 0xf];
+        value >>= 4;
+    }
+
+    return(p + 16);
+}
+
+static char* sentinel_export_literal(char* p, const char* str, const size_t len) {
+    memcpy(p, str, len);
+    return(p + len);
+}
+
+#define EXPORT_LITERAL(p, str) sentinel_export_literal((p), (str), sizeof(str) - 1)
+
+/**
+ * sentinel_export_text: Writes a string of the dive escaped for the format, the control characters
+ *                       are left out
+ **/
+
+static char* sentinel_export_text(char* p, const char* str, const sentinel_export_format_t format) {
+    for (; *str != '\0'; str++) {
+        const char c = *str;
+
+        if ((unsigned char) c < 0x20)
+            continue;
+
+        if (format == SENTINEL_EXPORT_JSON && (c == '"' || c == '\\')) {
+            *p++ = '\\';
+        } else if (format == SENTINEL_EXPORT_XML) {
+            switch (c) {
+            case '&':
+                p = EXPORT_LITERAL(p, "&amp;");
+                continue;
+            case '<':
+                p = EXPORT_LITERAL(p, "&lt;");
+                continue;
+            case '>':
+                p = EXPORT_LITERAL(p, "&gt;");
+                continue;
+            case '\'':
+                p = EXPORT_LITERAL(p, "&apos;");
+                continue;
+            case '"':
+                p = EXPORT_LITERAL(p, "&quot;");
+                continue;
+            }
+        } else if (format == SENTINEL_EXPORT_CSV && (c == ',' || c == ';')) {
+            continue;
+        }
+
+        *p++ = c;
+    }
+
+    return(p);
+}
+
+/**
+ * sentinel_export_minutes: Writes seconds as m:ss min, the way Subsurface writes times
+ **/
+
+static char* sentinel_export_minutes(char* p, const int seconds) {
+    p = sentinel_export_uint(p, seconds / 60);
+    *p++ = ':';
+    p = sentinel_export_two(p, seconds % 60);
+    return(EXPORT_LITERAL(p, " min"));
+}
+
+/**
+ * sentinel_export_depth: Depth in centimeters, see sentinel_record_depth
+ **/
+
+static long long sentinel_export_depth(const sentinel_record_t* record) {
+    return((record->depth * 75 + 4) / 8);
+}
+
+static const char* sentinel_export_note(const uint8_t code) {
+    if (code == 0)
+        return(NULL);
+
+    if (code == SENTINEL_NOTE_UNKNOWN || code > SENTINEL_NOTE_COUNT)
+        return("UNKNOWN");
+
+    return(SENTINEL_NOTES[code - 1].note);
+}
+
+/**
+ * sentinel_export_realloc: Reallocates memory of a worker in the context of the caller. A context
+ *                          is for one thread at a time, so the workers take turns
+ **/
+
+static void* sentinel_export_realloc(sentinel_export_t* export, void* ptr, const size_t size) {
+    pthread_mutex_lock(&export->alloc_lock);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(export->ctx);
+    void* tmp = sentinel_realloc(ptr, size);
+
+    sentinel_ctx_leave(prev);
+    pthread_mutex_unlock(&export->alloc_lock);
+
+    return(tmp);
+}
+
+/**
+ * sentinel_export_reserve: Makes room for len more bytes in the buffer, which is doubled when full
+ **/
+
+static char* sentinel_export_reserve(sentinel_export_worker_t* w, sentinel_export_buffer_t* buf, const size_t len) {
+    if (buf->len + len > buf->size) {
+        size_t size = (buf->size > 0) ? buf->size : 65536;
+
+        while (buf->len + len > size)
+            size *= 2;
+
+        char* tmp = sentinel_export_realloc(w->export, buf->data, size);
+
+        if (tmp == NULL) {
+            sentinel_error("%s", "Failed to reallocate export buffer");
+            return(NULL);
+        }
+
+        buf->data = tmp;
+        buf->size = size;
+    }
+
+    return(buf->data + buf->len);
+}
+
+/**
+ * sentinel_export_csv: One row per record, the dives are told apart by their hash
+ **/
+
+static bool sentinel_export_csv(sentinel_export_worker_t* w, sentinel_export_buffer_t* buf, const uint64_t hash) {
+    const int interval = w->header.record_interval;
+    int i = 0;
+    int c = 0;
+    int n = 0;
+
+    for (i = 0; i < w->count; i++) {
+        const sentinel_record_t* r = &w->records[i];
+        char* p = sentinel_export_reserve(w, buf, SENTINEL_EXPORT_RECORD_ROOM);
+
+        if (p == NULL)
+            return(false);
+
+        char* start = p;
+
+        p = sentinel_export_hex64(p, hash);
+        *p++ = ',';
+        p = sentinel_export_int(p, r->time_idx * interval);
+        *p++ = ',';
+        p = sentinel_export_fixed(p, sentinel_export_depth(r), 2);
+        *p++ = ',';
+        p = sentinel_export_fixed(p, r->po2, 2);
+
+        for (c = 0; c < 3; c++) {
+            *p++ = ',';
+            p = sentinel_export_fixed(p, r->cell_o2[c], 2);
+        }
+
+        *p++ = ',';
+        p = sentinel_export_fixed(p, r->setpoint, 2);
+        *p++ = ',';
+        p = sentinel_export_int(p, r->temperature);
+        *p++ = ',';
+        p = sentinel_export_int(p, r->ceiling);
+        *p++ = ',';
+        p = sentinel_export_fixed(p, r->scrubber, 1);
+        *p++ = ',';
+        p = sentinel_export_int(p, r->co2);
+        *p++ = ',';
+
+        bool first = true;
+
+        for (n = 0; n < 3; n++) {
+            const char* note = sentinel_export_note(r->note[n]);
+
+            if (note == NULL)
+                continue;
+
+            if (!first)
+                *p++ = ';';
+
+            p = sentinel_export_text(p, note, SENTINEL_EXPORT_CSV);
+            first = false;
+        }
+
+        *p++ = '\n';
+        buf->len += p - start;
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_export_json: An object per dive with the header values and an array of the records. Every
+ *                       dive starts with the separator, it is left out of the first one written
+ **/
+
+static bool sentinel_export_json(sentinel_export_worker_t* w, sentinel_export_buffer_t* buf, const uint64_t hash) {
+    const sentinel_fixed_header_t* h = &w->header;
+    char* p = sentinel_export_reserve(w, buf, SENTINEL_EXPORT_HEADER_ROOM);
+    int i = 0;
+    int c = 0;
+    int n = 0;
+
+    if (p == NULL)
+        return(false);
+
+    char* start = p;
+
+    p = EXPORT_LITERAL(p, JSON_SEPARATOR "{\"hash\":\"");
+    p = sentinel_export_hex64(p, hash);
+    p = EXPORT_LITERAL(p, "\",\"serial_number\":\"");
+    p = sentinel_export_text(p, h->serial_number, SENTINEL_EXPORT_JSON);
+    p = EXPORT_LITERAL(p, "\",\"version\":\"");
+    p = sentinel_export_text(p, h->version, SENTINEL_EXPORT_JSON);
+    p = EXPORT_LITERAL(p, "\",\"start_s\":");
+    p = sentinel_export_int(p, h->start_s);
+    p = EXPORT_LITERAL(p, ",\"end_s\":");
+    p = sentinel_export_int(p, h->end_s);
+    p = EXPORT_LITERAL(p, ",\"length_s\":");
+    p = sentinel_export_int(p, h->length_s);
+    p = EXPORT_LITERAL(p, ",\"record_interval\":");
+    p = sentinel_export_int(p, h->record_interval);
+    p = EXPORT_LITERAL(p, ",\"max_depth_m\":");
+    p = sentinel_export_fixed(p, llround(h->max_depth * 100), 2);
+    p = EXPORT_LITERAL(p, ",\"records\":[");
+    buf->len += p - start;
+
+    for (i = 0; i < w->count; i++) {
+        const sentinel_record_t* r = &w->records[i];
+
+        if ((p = sentinel_export_reserve(w, buf, SENTINEL_EXPORT_RECORD_ROOM)) == NULL)
+            return(false);
+
+        start = p;
+
+        if (i > 0)
+            *p++ = ',';
+
+        p = EXPORT_LITERAL(p, "\n{\"time_s\":");
+        p = sentinel_export_int(p, r->time_idx * h->record_interval);
+        p = EXPORT_LITERAL(p, ",\"depth_m\":");
+        p = sentinel_export_fixed(p, sentinel_export_depth(r), 2);
+        p = EXPORT_LITERAL(p, ",\"po2_bar\":");
+        p = sentinel_export_fixed(p, r->po2, 2);
+        p = EXPORT_LITERAL(p, ",\"cells_bar\":[");
+
+        for (c = 0; c < 3; c++) {
+            if (c > 0)
+                *p++ = ',';
+
+            p = sentinel_export_fixed(p, r->cell_o2[c], 2);
+        }
+
+        p = EXPORT_LITERAL(p, "],\"setpoint_bar\":");
+        p = sentinel_export_fixed(p, r->setpoint, 2);
+        p = EXPORT_LITERAL(p, ",\"temperature_c\":");
+        p = sentinel_export_int(p, r->temperature);
+        p = EXPORT_LITERAL(p, ",\"ceiling_m\":");
+        p = sentinel_export_int(p, r->ceiling);
+        p = EXPORT_LITERAL(p, ",\"scrubber_pct\":");
+        p = sentinel_export_fixed(p, r->scrubber, 1);
+        p = EXPORT_LITERAL(p, ",\"co2\":");
+        p = sentinel_export_int(p, r->co2);
+        p = EXPORT_LITERAL(p, ",\"notes\":[");
+
+        bool first = true;
+
+        for (n = 0; n < 3; n++) {
+            const char* note = sentinel_export_note(r->note[n]);
+
+            if (note == NULL)
+                continue;
+
+            if (!first)
+                *p++ = ',';
+
+            *p++ = '"';
+            p = sentinel_export_text(p, note, SENTINEL_EXPORT_JSON);
+            *p++ = '"';
+            first = false;
+        }
+
+        p = EXPORT_LITERAL(p, "]}");
+        buf->len += p - start;
+    }
+
+    if ((p = sentinel_export_reserve(w, buf, 4)) == NULL)
+        return(false);
+
+    p = EXPORT_LITERAL(p, "]}");
+    buf->len += 2;
+
+    return(true);
+}
+
+/**
+ * sentinel_export_xml: A dive of a Subsurface divelog, the cells are the O2 sensors, the setpoint
+ *                      is po2 and the notes are events of the Subsurface type of the note
+ **/
+
+static bool sentinel_export_xml(sentinel_export_worker_t* w, sentinel_export_buffer_t* buf, const int number) {
+    const sentinel_fixed_header_t* h = &w->header;
+    const time_t start_s = h->start_s;
+    struct tm tm;
+    char* p = sentinel_export_reserve(w, buf, SENTINEL_EXPORT_HEADER_ROOM);
+    int i = 0;
+    int c = 0;
+    int n = 0;
+
+    if (p == NULL)
+        return(false);
+
+    char* start = p;
+
+    gmtime_r(&start_s, &tm);
+
+    p = EXPORT_LITERAL(p, "<dive number='");
+    p = sentinel_export_int(p, number);
+    p = EXPORT_LITERAL(p, "' date='");
+    p = sentinel_export_uint(p, tm.tm_year + 1900);
+    *p++ = '-';
+    p = sentinel_export_two(p, tm.tm_mon + 1);
+    *p++ = '-';
+    p = sentinel_export_two(p, tm.tm_mday);
+    p = EXPORT_LITERAL(p, "' time='");
+    p = sentinel_export_two(p, tm.tm_hour);
+    *p++ = ':';
+    p = sentinel_export_two(p, tm.tm_min);
+    *p++ = ':';
+    p = sentinel_export_two(p, tm.tm_sec);
+    p = EXPORT_LITERAL(p, "' duration='");
+    p = sentinel_export_minutes(p, h->length_s);
+    p = EXPORT_LITERAL(p, "'>\n<divecomputer model='VR Technology Sentinel' dctype='CCR' no_o2sensors='3'>\n"
+                          "<extradata key='Serial' value='");
+    p = sentinel_export_text(p, h->serial_number, SENTINEL_EXPORT_XML);
+    p = EXPORT_LITERAL(p, "' />\n<extradata key='Firmware' value='");
+    p = sentinel_export_text(p, h->version, SENTINEL_EXPORT_XML);
+    p = EXPORT_LITERAL(p, "' />\n<depth max='");
+    p = sentinel_export_fixed(p, llround(h->max_depth * 100), 2);
+    p = EXPORT_LITERAL(p, " m' />\n");
+    buf->len += p - start;
+
+    for (i = 0; i < w->count; i++) {
+        const sentinel_record_t* r = &w->records[i];
+        const int time_s = r->time_idx * h->record_interval;
+
+        if ((p = sentinel_export_reserve(w, buf, SENTINEL_EXPORT_RECORD_ROOM)) == NULL)
+            return(false);
+
+        start = p;
+
+        p = EXPORT_LITERAL(p, "<sample time='");
+        p = sentinel_export_minutes(p, time_s);
+        p = EXPORT_LITERAL(p, "' depth='");
+        p = sentinel_export_fixed(p, sentinel_export_depth(r), 2);
+        p = EXPORT_LITERAL(p, " m' temp='");
+        p = sentinel_export_fixed(p, r->temperature * 10, 1);
+        p = EXPORT_LITERAL(p, " C'");
+
+        for (c = 0; c < 3; c++) {
+            p = EXPORT_LITERAL(p, " sensor");
+            *p++ = '1' + c;
+            p = EXPORT_LITERAL(p, "='");
+            p = sentinel_export_fixed(p, r->cell_o2[c], 2);
+            p = EXPORT_LITERAL(p, " bar'");
+        }
+
+        p = EXPORT_LITERAL(p, " po2='");
+        p = sentinel_export_fixed(p, r->setpoint, 2);
+        p = EXPORT_LITERAL(p, " bar' />\n");
+
+        for (n = 0; n < 3; n++) {
+            const char* note = sentinel_export_note(r->note[n]);
+
+            if (note == NULL)
+                continue;
+
+            p = EXPORT_LITERAL(p, "<event time='");
+            p = sentinel_export_minutes(p, time_s);
+            p = EXPORT_LITERAL(p, "' type='");
+            p = sentinel_export_int(p, (r->note[n] != SENTINEL_NOTE_UNKNOWN && r->note[n] <= SENTINEL_NOTE_COUNT)
+                                       ? SENTINEL_NOTES[r->note[n] - 1].type : 0);
+            p = EXPORT_LITERAL(p, "' name='");
+            p = sentinel_export_text(p, note, SENTINEL_EXPORT_XML);
+            p = EXPORT_LITERAL(p, "' />\n");
+        }
+
+        buf->len += p - start;
+    }
+
+    if ((p = sentinel_export_reserve(w, buf, 32)) == NULL)
+        return(false);
+
+    start = p;
+    p = EXPORT_LITERAL(p, "</divecomputer>\n</dive>\n");
+    buf->len += p - start;
+
+    return(true);
+}
+
+/**
+ * sentinel_export_read: Reads the file of the dive into the text buffer of the worker
+ **/
+
+static bool sentinel_export_read(sentinel_export_worker_t* w, const sentinel_store_entry_t* entry, size_t* len) {
+    char path[4096];
+    struct stat sb;
+    bool res = false;
+
+    /* The path is formatted in place, like sentinel_store_dive_path, to leave out an allocation per dive */
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 ".txt", w->export->store->path, entry->hash);
+
+    const int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        sentinel_error("Could not read %s: %s", path, strerror(errno));
+    } else {
+        if ((size_t) sb.st_size > w->text_size) {
+            char* tmp = sentinel_export_realloc(w->export, w->text, sb.st_size);
+
+            if (tmp != NULL) {
+                w->text      = tmp;
+                w->text_size = sb.st_size;
+            }
+        }
+
+        *len = 0;
+
+        while (sb.st_size <= (off_t) w->text_size && *len < (size_t) sb.st_size) {
+            const ssize_t n = read(fd, w->text + *len, sb.st_size - *len);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0)
+                break;
+
+            *len += n;
+        }
+
+        res = (*len == (size_t) sb.st_size);
+
+        if (!res)
+            sentinel_error("Could not read %s", path);
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    return(res);
+}
+
+/**
+ * sentinel_export_parse: Parses the dive into the header and the records of the worker. The records
+ *                        are grown to the log lines of the index first, and should the dive still
+ *                        not fit, to all of its records and the dive parsed again
+ **/
+
+static bool sentinel_export_parse(sentinel_export_worker_t* w, const size_t len, const int log_lines) {
+    sentinel_fixed_dive_t dive;
+    sentinel_fixed_status_t status = SENTINEL_FIXED_TRUNCATED;
+    int max_records = (log_lines > SENTINEL_EXPORT_RECORDS) ? log_lines : SENTINEL_EXPORT_RECORDS;
+
+    while (status == SENTINEL_FIXED_TRUNCATED) {
+        if (max_records > w->max_records) {
+            sentinel_record_t* tmp = sentinel_export_realloc(w->export, w->records, max_records * sizeof(sentinel_record_t));
+
+            if (tmp == NULL) {
+                sentinel_error("%s", "Failed to reallocate export records");
+                return(false);
+            }
+
+            w->records     = tmp;
+            w->max_records = max_records;
+        }
+
+        sentinel_fixed_init(&dive, NULL, 0, &w->header, w->records, w->max_records);
+        status = sentinel_fixed_parse(&dive, w->text, len);
+        max_records = dive.count + dive.dropped;
+    }
+
+    w->count = dive.count;
+
+    return(status == SENTINEL_FIXED_OK);
+}
+
+/**
+ * sentinel_export_dive: Formats a dive of the store into the buffer of the batch
+ **/
+
+static void sentinel_export_dive(sentinel_export_worker_t* w, const int idx) {
+    sentinel_export_t* export = w->export;
+    const int parity = export->batch & 1;
+    const sentinel_store_entry_t* entry = &export->store->entries[idx];
+    sentinel_export_buffer_t* buf = &w->out[parity];
+    sentinel_export_slot_t* slot = &export->slots[parity][idx - export->batch_start];
+    size_t len = 0;
+    bool res = false;
+
+    slot->worker = w->index;
+    slot->offset = buf->len;
+
+    if (sentinel_export_read(w, entry, &len)) {
+        if (!sentinel_export_parse(w, len, entry->log_lines))
+            sentinel_error("Could not parse the dive %016" PRIx64, entry->hash);
+        else if (export->format == SENTINEL_EXPORT_CSV)
+            res = sentinel_export_csv(w, buf, entry->hash);
+        else if (export->format == SENTINEL_EXPORT_JSON)
+            res = sentinel_export_json(w, buf, entry->hash);
+        else
+            res = sentinel_export_xml(w, buf, idx + 1);
+    }
+
+    if (!res) {
+        buf->len = slot->offset;
+        __atomic_store_n(&export->failed, true, __ATOMIC_RELAXED);
+    }
+
+    slot->len = buf->len - slot->offset;
+}
+
+/**
+ * sentinel_export_take: Returns the next dive of the worker, or one stolen from the back of another
+ *                       worker together with half of the dives left to it. -1 when all are taken
+ **/
+
+static int sentinel_export_take(sentinel_export_worker_t* w) {
+    sentinel_export_t* export = w->export;
+    int idx = -1;
+    int i = 0;
+
+    pthread_mutex_lock(&w->lock);
+
+    if (w->next < w->end)
+        idx = w->next++;
+
+    pthread_mutex_unlock(&w->lock);
+
+    for (i = 1; idx < 0 && i < export->threads; i++) {
+        sentinel_export_worker_t* victim = &export->workers[(w->index + i) % export->threads];
+        int stolen = 0;
+
+        pthread_mutex_lock(&victim->lock);
+
+        if (victim->next < victim->end) {
+            stolen = (victim->end - victim->next + 1) / 2;
+            victim->end -= stolen;
+            idx = victim->end;
+        }
+
+        pthread_mutex_unlock(&victim->lock);
+
+        if (stolen > 0) {
+            pthread_mutex_lock(&w->lock);
+            w->next = idx + 1;
+            w->end  = idx + stolen;
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+
+    return(idx);
+}
+
+/**
+ * sentinel_export_worker: Formats the dives of each batch until the export is finished
+ **/
+
+static void* sentinel_export_worker(void* data) {
+    sentinel_export_worker_t* w = data;
+    sentinel_export_t* export = w->export;
+    int idx;
+
+    pthread_mutex_lock(&export->start_lock);
+    pthread_mutex_unlock(&export->start_lock);
+
+    while (true) {
+        pthread_barrier_wait(&export->barrier);
+
+        if (export->finished)
+            break;
+
+        w->out[export->batch & 1].len = 0;
+
+        while ((idx = sentinel_export_take(w)) >= 0)
+            sentinel_export_dive(w, idx);
+
+        pthread_barrier_wait(&export->barrier);
+    }
+
+    return(NULL);
+}
+
+/**
+ * sentinel_export_deal: Starts the given batch by dealing its dives evenly to the workers
+ **/
+
+static int sentinel_export_deal(sentinel_export_t* export, const int batch) {
+    const int start = batch * SENTINEL_EXPORT_BATCH;
+    const int count = (export->store->count - start < SENTINEL_EXPORT_BATCH)
+                      ? export->store->count - start : SENTINEL_EXPORT_BATCH;
+    int i = 0;
+
+    export->batch       = batch;
+    export->batch_start = start;
+
+    for (i = 0; i < export->threads; i++) {
+        export->workers[i].next = start + (long) count * i / export->threads;
+        export->workers[i].end  = start + (long) count * (i + 1) / export->threads;
+    }
+
+    return(count);
+}
+
+/**
+ * sentinel_export_writev: Writes all of the vectors, retrying short writes
+ **/
+
+static bool sentinel_export_writev(int fd, struct iovec* iov, int count) {
+    while (count > 0 && iov[count - 1].iov_len == 0)
+        count--;
+
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            sentinel_error("Could not write the export: %s", strerror(errno));
+            return(false);
+        }
+
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_export_write: Writes the dives of a batch in order, first tells whether none has been
+ *                        written yet
+ **/
+
+static bool sentinel_export_write(sentinel_export_t* export, int fd, const int batch, const int count, bool* first) {
+    const int parity = batch & 1;
+    struct iovec iov[SENTINEL_EXPORT_IOV];
+    int n = 0;
+    int i = 0;
+
+    for (i = 0; i < count; i++) {
+        const sentinel_export_slot_t* slot = &export->slots[parity][i];
+        char* data = export->workers[slot->worker].out[parity].data + slot->offset;
+        size_t len = slot->len;
+
+        if (len == 0)
+            continue;
+
+        if (*first && export->format == SENTINEL_EXPORT_JSON) {
+            data += strlen(JSON_SEPARATOR);
+            len  -= strlen(JSON_SEPARATOR);
+        }
+
+        *first = false;
+
+        if (n > 0 && (char*) iov[n - 1].iov_base + iov[n - 1].iov_len == data) {
+            iov[n - 1].iov_len += len;
+            continue;
+        }
+
+        if (n == SENTINEL_EXPORT_IOV) {
+            if (!sentinel_export_writev(fd, iov, n))
+                return(false);
+
+            n = 0;
+        }
+
+        iov[n].iov_base = data;
+        iov[n].iov_len  = len;
+        n++;
+    }
+
+    return(sentinel_export_writev(fd, iov, n));
+}
+
+/**
+ * sentinel_export_store: Exports all of the dives of the store to the descriptor in the order they were
+ *                        added. The dives are formatted by the given number of threads, 0 for one per
+ *                        core, while the previous batch is written. Returns false if a dive could not
+ *                        be read or the output written, the other dives are still exported
+ **/
+
+bool sentinel_export_store(const sentinel_store_t* store, int out_fd, const sentinel_export_format_t format,
+                           int threads) {
+    static const char* PROLOGUE[] = {
+        "hash,time_s,depth_m,po2_bar,cell1_bar,cell2_bar,cell3_bar,setpoint_bar,temperature_c,ceiling_m,scrubber_pct,co2,notes\n",
+        "[\n",
+        "<divelog program='libsentinel' version='3'>\n<dives>\n"
+    };
+    static const char* EPILOGUE[] = {
+        "",
+        "\n]\n",
+        "</dives>\n</divelog>\n"
+    };
+    struct iovec iov;
+    bool first = true;
+    bool res = true;
+    int batch = 0;
+    int i = 0;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > store->count)
+        threads = store->count;
+
+    if (threads > SENTINEL_EXPORT_MAX_THREADS)
+        threads = SENTINEL_EXPORT_MAX_THREADS;
+
+    iov.iov_base = (char*) PROLOGUE[format];
+    iov.iov_len  = strlen(PROLOGUE[format]);
+
+    if (!sentinel_export_writev(out_fd, &iov, 1))
+        return(false);
+
+    if (threads > 0) {
+        sentinel_export_t* export = sentinel_calloc(1, sizeof(sentinel_export_t));
+
+        if (export == NULL || (export->workers = sentinel_calloc(threads, sizeof(sentinel_export_worker_t))) == NULL) {
+            sentinel_error("%s", "Failed to allocate the export");
+            sentinel_free(export);
+            return(false);
+        }
+
+        export->store  = store;
+        export->ctx    = sentinel_ctx_current();
+        export->format = format;
+        pthread_mutex_init(&export->alloc_lock, NULL);
+        pthread_mutex_init(&export->start_lock, NULL);
+        pthread_mutex_lock(&export->start_lock);
+
+        /* The workers wait for the start lock, so that fewer of them can be used if some could
+         * not be started */
+        for (i = 0; i < threads; i++) {
+            sentinel_export_worker_t* w = &export->workers[i];
+
+            w->index  = i;
+            w->export = export;
+            pthread_mutex_init(&w->lock, NULL);
+
+            if (pthread_create(&w->thread, NULL, sentinel_export_worker, w) != 0) {
+                pthread_mutex_destroy(&w->lock);
+                break;
+            }
+
+            export->threads++;
+        }
+
+        pthread_barrier_init(&export->barrier, NULL, export->threads + 1);
+        pthread_mutex_unlock(&export->start_lock);
+
+        if (export->threads == 0) {
+            sentinel_error("%s", "Could not start the export threads");
+            res = false;
+        } else {
+            int count = sentinel_export_deal(export, 0);
+
+            pthread_barrier_wait(&export->barrier);
+            pthread_barrier_wait(&export->barrier);
+
+            for (batch = 0; ; batch++) {
+                const bool more = res && (batch + 1) * SENTINEL_EXPORT_BATCH < store->count;
+                int next_count = 0;
+
+                if (more)
+                    next_count = sentinel_export_deal(export, batch + 1);
+                else
+                    export->finished = true;
+
+                /* The workers format the next batch while this one is written */
+                pthread_barrier_wait(&export->barrier);
+                res = res && sentinel_export_write(export, out_fd, batch, count, &first);
+
+                if (!more)
+                    break;
+
+                pthread_barrier_wait(&export->barrier);
+                count = next_count;
+            }
+        }
+
+        for (i = 0; i < export->threads; i++) {
+            pthread_join(export->workers[i].thread, NULL);
+            pthread_mutex_destroy(&export->workers[i].lock);
+            sentinel_free(export->workers[i].out[0].data);
+            sentinel_free(export->workers[i].out[1].data);
+            sentinel_free(export->workers[i].text);
+            sentinel_free(export->workers[i].records);
+        }
+
+        pthread_barrier_destroy(&export->barrier);
+        pthread_mutex_destroy(&export->start_lock);
+        pthread_mutex_destroy(&export->alloc_lock);
+        res = res && !export->failed;
+        sentinel_free(export->workers);
+        sentinel_free(export);
+    }
+
+    iov.iov_base = (char*) EPILOGUE[format];
+    iov.iov_len  = strlen(EPILOGUE[format]);
+
+    return(sentinel_export_writev(out_fd, &iov, 1) && res);
+}
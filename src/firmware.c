@@ -0,0 +1,230 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <ctype.h>
+
+#include "libsentinel.h"
+
+/* Version strings as they appear on the ver= line, indexed by sentinel_firmware_t */
+const char* SENTINEL_FIRMWARE_NAME[SENTINEL_FW_COUNT] = {
+    "unknown",
+    "V3.0C",
+    "V009A",
+    "V009B"
+};
+
+/* Position of the co2 field z after the first tempstick field of the V009 log line, ie. after the
+ * eight tempstick fields, x and y */
+#define SENTINEL_V009_CO2 10
+
+/* The parser of each firmware, V009A only adds fields after the co2 which are not parsed */
+static const sentinel_log_parser_t SENTINEL_LOG_PARSER[SENTINEL_FW_COUNT] = {
+    NULL,
+    parse_sentinel_log_line_v30c,
+    parse_sentinel_log_line_v009,
+    parse_sentinel_log_line_v009
+};
+
+/* The record layout of each firmware, V3.0C has only notes after the fixed fields */
+static const sentinel_record_layout_t SENTINEL_RECORD_LAYOUT[SENTINEL_FW_COUNT] = {
+    {false, 0},
+    {false, 0},
+    {true, SENTINEL_V009_CO2},
+    {true, SENTINEL_V009_CO2}
+};
+
+/**
+ * sentinel_firmware_from_version: Returns the firmware of the given ver= value, trailing white space
+ *                                 is ignored
+ **/
+
+sentinel_firmware_t sentinel_firmware_from_version(const char* version) {
+    int i = 0;
+
+    if (version == NULL)
+        return(SENTINEL_FW_UNKNOWN);
+
+    size_t len = strlen(version);
+
+    while (len > 0 && isspace((unsigned char) version[len - 1])) {
+        len--;
+    }
+
+    for (i = SENTINEL_FW_UNKNOWN + 1; i < SENTINEL_FW_COUNT; i++) {
+        if (strlen(SENTINEL_FIRMWARE_NAME[i]) == len && strncmp(SENTINEL_FIRMWARE_NAME[i], version, len) == 0)
+            return(i);
+    }
+
+    return(SENTINEL_FW_UNKNOWN);
+}
+
+/**
+ * sentinel_log_parser: Returns the log line parser of the firmware, NULL if it is not supported
+ **/
+
+sentinel_log_parser_t sentinel_log_parser(const sentinel_firmware_t firmware) {
+    if (firmware <= SENTINEL_FW_UNKNOWN || firmware >= SENTINEL_FW_COUNT)
+        return(NULL);
+
+    return(SENTINEL_LOG_PARSER[firmware]);
+}
+
+/**
+ * sentinel_record_layout: Returns the record layout of the firmware, NULL if it is not supported
+ **/
+
+const sentinel_record_layout_t* sentinel_record_layout(const sentinel_firmware_t firmware) {
+    if (firmware <= SENTINEL_FW_UNKNOWN || firmware >= SENTINEL_FW_COUNT)
+        return(NULL);
+
+    return(&SENTINEL_RECORD_LAYOUT[firmware]);
+}
+
+/**
+ * sentinel_split_fields: Finds the start of each comma separated field of the line, at most
+ *                        SENTINEL_MAX_FIELDS. The fields are not terminated, atoi stops at the comma
+ **/
+
+static int sentinel_split_fields(char* linestr, char** field) {
+    int count = 0;
+
+    while (count < SENTINEL_MAX_FIELDS) {
+        field[count++] = linestr;
+        linestr = strchr(linestr, ',');
+
+        if (linestr == NULL)
+            break;
+
+        linestr++;
+    }
+
+    return(count);
+}
+
+/**
+ * sentinel_parse_fixed_fields: Parses the 16 fields which every firmware starts the log line with
+ **/
+
+static void sentinel_parse_fixed_fields(int interval, sentinel_dive_log_line_t* line, char** field) {
+    line->time_idx            = atoi(field[0] + 1);
+    line->time_s              = line->time_idx * interval;
+    line->time_string         = seconds_to_hms(line->time_s);
+    line->depth               = (atoi(field[1]) * 6) / 64.0;
+    line->po2                 = atoi(field[3]) / 100.0;
+    line->temperature         = atoi(field[5] + 1);
+    line->scrubber_left       = atoi(field[6] + 1) / 10.0;
+    line->primary_battery_V   = atoi(field[7] + 1) / 100.0;
+    line->secondary_battery_V = atoi(field[8] + 1) / 100.0;
+    line->diluent_pressure    = atoi(field[9] + 1);
+    line->o2_pressure         = atoi(field[10] + 1);
+    line->cell_o2[0]          = atoi(field[11] + 1) / 100.0;
+    line->cell_o2[1]          = atoi(field[12] + 1) / 100.0;
+    line->cell_o2[2]          = atoi(field[13] + 1) / 100.0;
+    line->setpoint            = atoi(field[14] + 1) / 100.0;
+    line->ceiling             = atoi(field[15] + 1);
+}
+
+/**
+ * sentinel_parse_note: Adds the note of the field, which ends at the next comma or the end of the line
+ **/
+
+static bool sentinel_parse_note(sentinel_dive_log_line_t* line, const int note_idx, const char* field) {
+    char note_str[32];
+    size_t len = strcspn(field, ",");
+
+    if (len >= sizeof(note_str))
+        len = sizeof(note_str) - 1;
+
+    memcpy(note_str, field, len);
+    note_str[len] = '\0';
+
+    line->note = resize_sentinel_note_list(line->note, note_idx + 1);
+
+    if (line->note == NULL)
+        return(false);
+
+    line->note[note_idx] = alloc_sentinel_note();
+
+    if (line->note[note_idx] == NULL)
+        return(false);
+
+    if (!get_sentinel_note(line->note[note_idx], note_str))
+        sentinel_error("Unable to add note: %s", note_str);
+
+    return(true);
+}
+
+/**
+ * parse_sentinel_log_line_v30c: Parses a log line of V3.0C, the fixed fields followed only by notes
+ **/
+
+bool parse_sentinel_log_line_v30c(int interval, sentinel_dive_log_line_t* line, char* linestr) {
+    char* field[SENTINEL_MAX_FIELDS];
+    const int count = sentinel_split_fields(linestr, field);
+    int i = 0;
+
+    *line = DEFAULT_LOG_LINE;
+
+    if (count < 16 || linestr[0] != 'R')
+        return(false);
+
+    sentinel_parse_fixed_fields(interval, line, field);
+
+    for (i = 16; i < count; i++) {
+        if (!sentinel_parse_note(line, i - 16, field[i]))
+            return(false);
+    }
+
+    return(true);
+}
+
+/**
+ * parse_sentinel_log_line_v009: Parses a log line of V009A or V009B, the fixed fields, notes until
+ *                               the first tempstick field S, the tempstick and the co2
+ **/
+
+bool parse_sentinel_log_line_v009(int interval, sentinel_dive_log_line_t* line, char* linestr) {
+    char* field[SENTINEL_MAX_FIELDS];
+    const int count = sentinel_split_fields(linestr, field);
+    int i = 16;
+    int j = 0;
+
+    *line = DEFAULT_LOG_LINE;
+
+    if (count < 16 || linestr[0] != 'R')
+        return(false);
+
+    sentinel_parse_fixed_fields(interval, line, field);
+
+    for (; i < count && field[i][0] != 'S'; i++) {
+        if (!sentinel_parse_note(line, i - 16, field[i]))
+            return(false);
+    }
+
+    for (j = 0; j < 8 && i + j < count; j++) {
+        line->tempstick_value[j] = atoi(field[i + j] + 1) / 10.0;
+    }
+
+    if (i + SENTINEL_V009_CO2 < count)
+        line->co2 = atoi(field[i + SENTINEL_V009_CO2] + 1);
+
+    return(true);
+}
@@ -0,0 +1,449 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include <stddef.h>
+
+#include "libsentinel.h"
+
+/* Longest header line which is parsed, the rest of a longer line is ignored */
+#define SENTINEL_FIXED_LINE 128
+
+typedef enum sentinel_fixed_kind {
+    SENTINEL_FIXED_INT = 0,
+    SENTINEL_FIXED_DOUBLE,
+    SENTINEL_FIXED_TIME /* Sentinel time converted to unixtime */
+} sentinel_fixed_kind_t;
+
+typedef struct sentinel_fixed_field {
+    const char* format; /* For sscanf, with a single conversion */
+    sentinel_fixed_kind_t kind;
+    size_t offset;
+} sentinel_fixed_field_t;
+
+/* The single value header lines, as parse_sentinel_header reads them */
+static const sentinel_fixed_field_t SENTINEL_FIXED_FIELDS[] = {
+    {"Recint=%d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, record_interval)},
+    {"Mem %*d, %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, log_lines)},
+    {"Start %*d, %d", SENTINEL_FIXED_TIME, offsetof(sentinel_fixed_header_t, start_s)},
+    {"Finish %*d, %d", SENTINEL_FIXED_TIME, offsetof(sentinel_fixed_header_t, end_s)},
+    {"MaxD %*d, %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, max_depth)},
+    {"Status %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, status)},
+    {"OTU %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, otu)},
+    {"DAtmos %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, atm)},
+    {"DStack %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, stack)},
+    {"DUsage %*d, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, usage)},
+    {"DCNS %*d, %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, cns)},
+    {"DSafety %*d, %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, safety)},
+    {"Dexpert, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, expert)},
+    {"Dtpm, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, tpm)},
+    {"DVGMMaxDSafety %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, vgm_max_safety)},
+    {"DVGMStopSafety %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, vgm_stop_safety)},
+    {"DVGMMidSafety %lf", SENTINEL_FIXED_DOUBLE, offsetof(sentinel_fixed_header_t, vgm_mid_safety)},
+    {"Dfiltertype, %d", SENTINEL_FIXED_INT, offsetof(sentinel_fixed_header_t, filter_type)}
+};
+
+/**
+ * sentinel_fixed_copy: Copies the rest of the line into the string of the header, truncating it to
+ *                      fit and dropping trailing spaces
+ **/
+
+static void sentinel_fixed_copy(char* dest, size_t size, const char* src) {
+    size_t len = strlen(src);
+
+    while (len > 0 && src[len - 1] == ' ') {
+        len--;
+    }
+
+    if (len >= size)
+        len = size - 1;
+
+    memcpy(dest, src, len);
+    dest[len] = 0;
+}
+
+/**
+ * sentinel_fixed_header_line: Parses a line of the dive header, without the line separator, into
+ *                             the header. Unknown lines are skipped
+ **/
+
+static void sentinel_fixed_header_line(sentinel_fixed_header_t* header, const char* linestr, size_t len) {
+    char line[SENTINEL_FIXED_LINE];
+    size_t i = 0;
+    int idx = 0;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+    double d = 0.0;
+
+    if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+
+    memcpy(line, linestr, len);
+    line[len] = 0;
+
+    if (strncmp(line, "ver=", 4) == 0) {
+        sentinel_fixed_copy(header->version, sizeof(header->version), line + 4);
+    } else if (strncmp(line, "SN=", 3) == 0) {
+        sentinel_fixed_copy(header->serial_number, sizeof(header->serial_number), line + 3);
+    } else if (strncmp(line, "DDecoAlg ", 9) == 0) {
+        sentinel_fixed_copy(header->decoalg, sizeof(header->decoalg), line + 9);
+    } else if (sscanf(line, "Dcellhealth %d, %d", &idx, &a) == 2) {
+        if (idx >= 1 && idx <= 3)
+            header->cell_health[idx - 1] = a;
+    } else if (sscanf(line, "Gas %d, %d, %d, %lf, %d", &idx, &a, &b, &d, &c) == 5) {
+        idx -= 4010;
+
+        if (idx >= 0 && idx < 10) {
+            header->gas[idx].n2        = a;
+            header->gas[idx].he        = b;
+            header->gas[idx].o2        = 100 - a - b;
+            header->gas[idx].max_depth = d;
+            header->gas[idx].enabled   = c;
+        }
+    } else if (sscanf(line, "Tissue %d, %d, %d", &idx, &a, &b) == 3) {
+        idx -= 4020;
+
+        if (idx >= 0 && idx < 16) {
+            header->tissue[idx].t1 = a;
+            header->tissue[idx].t2 = b;
+        }
+    } else {
+        for (i = 0; i < sizeof(SENTINEL_FIXED_FIELDS) / sizeof(SENTINEL_FIXED_FIELDS[0]); i++) {
+            const sentinel_fixed_field_t* field = &SENTINEL_FIXED_FIELDS[i];
+            char* value = (char*) header + field->offset;
+
+            if (field->kind == SENTINEL_FIXED_DOUBLE) {
+                if (sscanf(line, field->format, &d) == 1) {
+                    memcpy(value, &d, sizeof(double));
+                    break;
+                }
+            } else if (sscanf(line, field->format, &a) == 1) {
+                if (field->kind == SENTINEL_FIXED_TIME)
+                    a = sentinel_to_unix_timestamp(a);
+
+                memcpy(value, &a, sizeof(int));
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * sentinel_fixed_header: Parses the dive header, which ends where the profile starts
+ **/
+
+static void sentinel_fixed_header(sentinel_fixed_header_t* header, const char* text, size_t len) {
+    const char* line = text;
+    const char* end  = text + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    memset(header, 0, sizeof(sentinel_fixed_header_t));
+
+    while ((next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        sentinel_fixed_header_line(header, line, line_len);
+        line = next;
+    }
+
+    if (header->start_s < header->end_s && header->start_s > 0)
+        header->length_s = header->end_s - header->start_s;
+
+    header->content_hash = sentinel_hash_header(text, len);
+}
+
+/**
+ * sentinel_fixed_record: Parses a log line of the profile into the next free record, a line which
+ *                        does not fit is parsed all the same and counted in dropped. Without
+ *                        records the lines are only parsed and counted. Each parsed record is
+ *                        passed to the record callback while the rest of the dive is still arriving
+ **/
+
+static void sentinel_fixed_record(sentinel_fixed_dive_t* dive, const char* line, size_t len) {
+    sentinel_record_t spare;
+    sentinel_record_t* record = (dive->records != NULL && dive->count < dive->max_records) ?
+                                &dive->records[dive->count] : &spare;
+
+    dive->header->content_hash = sentinel_hash_line(dive->header->content_hash, line, len);
+
+    if (!parse_sentinel_record(dive->layout, record, line, len)) {
+        sentinel_error("Unable to parse log line: %.*s", (int) len, line);
+        dive->rejected++;
+        return;
+    }
+
+    sentinel_summary_add(&dive->header->summary, record);
+
+    if (dive->record_callback != NULL)
+        dive->record_callback(record, dive->record_data);
+
+    if (record == &spare && dive->records != NULL)
+        dive->dropped++;
+    else
+        dive->count++;
+}
+
+/**
+ * sentinel_fixed_lines: Parses the complete lines of the text, the header only once all of it is
+ *                       there. With last the text is the whole rest of the dive, and a final line
+ *                       without the separator is parsed too. Returns the bytes consumed
+ **/
+
+static size_t sentinel_fixed_lines(sentinel_fixed_dive_t* dive, const char* text, size_t len, const bool last) {
+    const char* line = text;
+    const char* end  = text + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    if (dive->overflow)
+        return(len);
+
+    if (!dive->in_profile) {
+        const char* profile = memmem(text, len, "Profile\r\n", 9);
+
+        if (profile == NULL)
+            return(0);
+
+        sentinel_fixed_header(dive->header, text, profile - text);
+        dive->in_profile = true;
+        dive->layout     = sentinel_record_layout(sentinel_firmware_from_version(dive->header->version));
+        line = profile + 9;
+
+        if (dive->layout == NULL)
+            sentinel_error("Unsupported firmware version: %s", (dive->header->version[0] != 0) ? dive->header->version : "none");
+    }
+
+    while (!dive->ended && (next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        /* A line without the separator may still be arriving */
+        if (line + line_len == end && !last)
+            break;
+
+        /* The records of an unsupported firmware are read but not parsed */
+        if (dive->layout != NULL)
+            sentinel_fixed_record(dive, line, line_len);
+
+        line = next;
+    }
+
+    if (next == NULL && line < end)
+        dive->ended = true;
+
+    /* Whatever follows the end is not part of the dive */
+    return(dive->ended ? len : (size_t) (line - text));
+}
+
+/**
+ * sentinel_fixed_status: The outcome of a dive which was fed completely
+ **/
+
+static sentinel_fixed_status_t sentinel_fixed_status(const sentinel_fixed_dive_t* dive) {
+    if (dive->out_failed)
+        return(SENTINEL_FIXED_FAILED);
+
+    if (dive->overflow) {
+        sentinel_error("The window of %zu bytes is too small for the %s", dive->window_size,
+                       dive->in_profile ? "log lines" : "header");
+        return(SENTINEL_FIXED_OVERFLOW);
+    }
+
+    if (!dive->in_profile) {
+        sentinel_error("%s", "Received dive without a profile");
+        return(SENTINEL_FIXED_FAILED);
+    }
+
+    if (dive->layout == NULL)
+        return(SENTINEL_FIXED_FAILED);
+
+    if (dive->dropped > 0) {
+        sentinel_warn("Dive truncated to %d records, %d did not fit", dive->count, dive->dropped);
+        return(SENTINEL_FIXED_TRUNCATED);
+    }
+
+    return(SENTINEL_FIXED_OK);
+}
+
+/**
+ * sentinel_fixed_reset: Clears the dive for the next download or parse, the buffers are kept
+ **/
+
+static void sentinel_fixed_reset(sentinel_fixed_dive_t* dive) {
+    memset(dive->header, 0, sizeof(sentinel_fixed_header_t));
+
+    dive->count      = 0;
+    dive->dropped    = 0;
+    dive->rejected   = 0;
+    dive->in_profile = false;
+    dive->ended      = false;
+    dive->overflow   = false;
+    dive->out_failed = false;
+    dive->layout     = NULL;
+}
+
+/**
+ * sentinel_fixed_init: Sets the caller supplied buffers of the dive. The window has to hold the
+ *                      header of the dive, about 1.5 kB, and the longest log line. The records
+ *                      bound the profile, records after the last one are dropped. The record
+ *                      callback is cleared, set it after this to see the records as they arrive
+ **/
+
+void sentinel_fixed_init(sentinel_fixed_dive_t* dive, char* window, size_t window_size,
+                         sentinel_fixed_header_t* header, sentinel_record_t* records, const int max_records) {
+    dive->window          = window;
+    dive->window_size     = window_size;
+    dive->header          = header;
+    dive->records         = records;
+    dive->max_records     = max_records;
+    dive->out_fd          = -1;
+    dive->record_callback = NULL;
+    dive->record_data     = NULL;
+
+    sentinel_fixed_reset(dive);
+}
+
+/**
+ * sentinel_fixed_feed: Parses the complete lines of a dive as it arrives, starting from the ver=
+ *                      line or anything before it. Returns the bytes consumed, the rest has to be
+ *                      fed again with the data that follows it
+ **/
+
+size_t sentinel_fixed_feed(sentinel_fixed_dive_t* dive, const char* text, size_t len) {
+    return(sentinel_fixed_lines(dive, text, len, false));
+}
+
+/**
+ * sentinel_fixed_parse: Parses a whole dive, as received or read from a dump file, into the buffers
+ *                       of the dive. The window is not used
+ **/
+
+sentinel_fixed_status_t sentinel_fixed_parse(sentinel_fixed_dive_t* dive, const char* text, size_t len) {
+    const long long parse_start = sentinel_time_ns();
+
+    sentinel_fixed_reset(dive);
+    sentinel_fixed_lines(dive, text, len, true);
+    sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+
+    return(sentinel_fixed_status(dive));
+}
+
+/**
+ * sentinel_fixed_write: Writes all of the data, retrying short writes
+ **/
+
+static bool sentinel_fixed_write(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t n = write(fd, data, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return(false);
+
+        data += n;
+        len  -= n;
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_fixed_hook: Parses the lines completed by the last read and makes room in the window
+ **/
+
+static void sentinel_fixed_hook(sentinel_receiver_t* rx, void* data) {
+    sentinel_fixed_dive_t* dive = data;
+    const long long parse_start = sentinel_time_ns();
+    size_t parsed = sentinel_fixed_lines(dive, rx->buffer, rx->len, rx->state == SENTINEL_RX_DONE);
+
+    /* A full window which can not be parsed is given up, but the rest of the dive is still read so
+     * that it is not taken for the next response. Only what the receiver needs to find the end is kept */
+    if (rx->len + 1 >= rx->size && parsed == 0 && rx->state == SENTINEL_RX_BODY) {
+        dive->overflow = true;
+        parsed = rx->len - rx->end_len;
+    }
+
+    /* The parsed part ends at a line, so the output is a valid dive up to its last line at any time */
+    if (parsed > 0 && dive->out_fd >= 0 && !dive->overflow && !dive->out_failed &&
+        !sentinel_fixed_write(dive->out_fd, rx->buffer, parsed)) {
+        sentinel_error("Could not write the dive: %s", strerror(errno));
+        dive->out_failed = true;
+    }
+
+    if (parsed > 0) {
+        memmove(rx->buffer, rx->buffer + parsed, rx->len - parsed + 1);
+        rx->len -= parsed;
+    }
+
+    sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+}
+
+/**
+ * sentinel_fixed_download: Fetches the given dive from the rebreather into the buffers of the dive,
+ *                          parsing it as it arrives in the window. Nothing is allocated
+ **/
+
+sentinel_fixed_status_t sentinel_fixed_download(int fd, int dive_num, sentinel_fixed_dive_t* dive) {
+    char command[16];
+    sentinel_receiver_t rx;
+
+    sentinel_fixed_reset(dive);
+
+    if (dive->window == NULL || dive->window_size <= sizeof(SENTINEL_PROFILE_END)) {
+        sentinel_error("%s", "The dive has no receive window");
+        return(SENTINEL_FIXED_OVERFLOW);
+    }
+
+    sentinel_receiver_init_fixed(&rx, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
+                                 SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END), dive->window, dive->window_size);
+
+    if (!send_sentinel_command(fd, command, sentinel_dive_command(command, sizeof(command), dive_num)))
+        return(SENTINEL_FIXED_FAILED);
+
+    if (receive_sentinel_response_hook(fd, &rx, sentinel_fixed_hook, dive) != SENTINEL_RX_DONE) {
+        sentinel_error("%s", "Failed to read dive data from Sentinel");
+        return(SENTINEL_FIXED_FAILED);
+    }
+
+    return(sentinel_fixed_status(dive));
+}
+
+/**
+ * sentinel_fixed_stream: Like sentinel_fixed_download, but the dive is also written to out_fd as it
+ *                        arrives, in the format it is received in. The memory used stays the same
+ *                        whatever the length of the dive, and if the download breaks off, the
+ *                        output has every complete line received until then. With NULL records
+ *                        the dive is only written
+ **/
+
+sentinel_fixed_status_t sentinel_fixed_stream(int fd, int dive_num, sentinel_fixed_dive_t* dive, int out_fd) {
+    dive->out_fd = out_fd;
+
+    sentinel_fixed_status_t res = sentinel_fixed_download(fd, dive_num, dive);
+
+    dive->out_fd = -1;
+
+    if (res != SENTINEL_FIXED_FAILED && fdatasync(out_fd) != 0 && errno != EINVAL) {
+        sentinel_error("Could not write the dive: %s", strerror(errno));
+        res = SENTINEL_FIXED_FAILED;
+    }
+
+    return(res);
+}
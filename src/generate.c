@@ -0,0 +1,262 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+const sentinel_generator_t DEFAULT_GENERATOR = {
+    SENTINEL_FW_V009A,
+    360,   /* records, one hour */
+    10,    /* record_interval */
+    0.05,  /* note_density */
+    30.0,  /* max_depth */
+    1,     /* seed */
+    551970272 /* start */
+};
+
+/* Notes seen in the sample dumps */
+static const char* GENERATOR_NOTES[] = {
+    "PPO2 HIGH",
+    "PPO2 mHIGH",
+    "PPO2 LOW",
+    "PPO2 mLOW",
+    "PPO2 SPINC",
+    "ASCENT FAST",
+    "HPRATE HI",
+    "CELLmV ERROR",
+    "FILTERREDDIFF",
+    "PPO2 OFF"
+};
+
+typedef struct sentinel_gen_buffer {
+    char* str;
+    size_t len;
+    size_t size;
+} sentinel_gen_buffer_t;
+
+/**
+ * sentinel_gen_append: printf-style append to the growing output buffer, the buffer is doubled
+ *                      whenever it runs out so that the number of reallocations stays small
+ **/
+
+static bool sentinel_gen_append(sentinel_gen_buffer_t* buf, const char* format, ...) {
+    va_list args;
+
+    while (true) {
+        va_start(args, format);
+        int n = vsnprintf(buf->str + buf->len, buf->size - buf->len, format, args);
+        va_end(args);
+
+        if (n < 0)
+            return(false);
+
+        if ((size_t) n < buf->size - buf->len) {
+            buf->len += n;
+            return(true);
+        }
+
+        char* tmp = realloc(buf->str, buf->size * 2);
+
+        if (tmp == NULL) {
+            sentinel_error("%s", "Failed to reallocate generator buffer");
+            return(false);
+        }
+
+        buf->str   = tmp;
+        buf->size *= 2;
+    }
+}
+
+/**
+ * sentinel_gen_random: xorshift32, we want the same dive for the same seed on every platform
+ **/
+
+static unsigned int sentinel_gen_random(unsigned int* state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return(x);
+}
+
+/**
+ * sentinel_gen_uniform: Returns a random number between 0.0 and 1.0
+ **/
+
+static double sentinel_gen_uniform(unsigned int* state) {
+    return((sentinel_gen_random(state) & 0xffffff) / (double) 0x1000000);
+}
+
+/**
+ * sentinel_gen_depth: Returns the depth in meters at the given point of the dive. The profile is a
+ *                     descent, a flat bottom, an ascent to a 5 m stop and a final ascent
+ **/
+
+static double sentinel_gen_depth(const sentinel_generator_t* gen, const int idx) {
+    const double t = (gen->records > 1) ? (double) idx / (gen->records - 1) : 0.0;
+
+    if (t < 0.15) return(gen->max_depth * t / 0.15);
+    if (t < 0.60) return(gen->max_depth);
+    if (t < 0.80) return(5.0 + (gen->max_depth - 5.0) * (0.80 - t) / 0.20);
+    if (t < 0.95) return(5.0);
+
+    return(5.0 * (1.0 - t) / 0.05);
+}
+
+/**
+ * sentinel_gen_header_lines: Appends the header lines that are common to both the dive list (M)
+ *                            and the dive data (D<n>), ie. everything up to the gas lines
+ **/
+
+static bool sentinel_gen_header_lines(sentinel_gen_buffer_t* buf, const sentinel_generator_t* gen) {
+    const char* version = SENTINEL_FIRMWARE_NAME[gen->firmware];
+    const int length    = gen->records * gen->record_interval;
+    bool res = true;
+
+    res &= sentinel_gen_append(buf, "ver=%s\r\nRecint=%d\r\nSN=4854FCE3%08X\r\n%s\r\n",
+                               version, gen->record_interval, gen->seed, version);
+    res &= sentinel_gen_append(buf, "Mem 0, 4000, %d\r\nMemi 1720, 4049, %d\r\n",
+                               gen->records, 1720 + gen->records - 1);
+    res &= sentinel_gen_append(buf, "Start 4001, %d\r\nFinish 4002, %d\r\nMaxD 4003, %.2lf\r\n",
+                               gen->start, gen->start + length, gen->max_depth);
+    res &= sentinel_gen_append(buf, "Status 4004, 0\r\nOTU 4005, %d\r\nDescend prob 4006, 0\r\n",
+                               length / 60);
+    res &= sentinel_gen_append(buf, "DAtmos 4008, 1013\r\nDStack 4009, 2420\r\nDUsage 4010,    8\r\n");
+
+    if (gen->firmware != SENTINEL_FW_V30C) {
+        res &= sentinel_gen_append(buf, "DCNS 4011, %lf\r\nDSafety 4012, 0.004000\r\n", length / 120.0);
+        res &= sentinel_gen_append(buf, "Dexpert, 2\r\nDtpm, 1\r\nDDecoAlg VGM\r\n");
+        res &= sentinel_gen_append(buf, "DVGMMaxDSafety 0.000000\r\nDVGMStopSafety 0.000000\r\nDVGMMidSafety 0.000000\r\n");
+        res &= sentinel_gen_append(buf, "Dfiltertype, 0\r\nDcellhealth 1, 101\r\nDcellhealth 2, 103\r\nDcellhealth 3, 114\r\n");
+    }
+
+    return(res);
+}
+
+/**
+ * sentinel_gen_log_line: Appends a single profile record in the layout of the firmware
+ **/
+
+static bool sentinel_gen_log_line(sentinel_gen_buffer_t* buf, const sentinel_generator_t* gen,
+                                  const int idx, unsigned int* rnd) {
+    const double depth = sentinel_gen_depth(gen, idx);
+    const int setpoint = (depth > 3.0) ? 120 : 70;
+    const int po2      = setpoint + (int) (sentinel_gen_random(rnd) % 11) - 5;
+    const int minutes  = idx * gen->record_interval / 60;
+    bool res = true;
+
+    res &= sentinel_gen_append(buf, "R%04d,%04d,0001,%04d,M%d,T%d,A%d,B%d,C%d,D%d,E%d,F%d,G%d,H%d,I%d,J%d",
+                               idx, (int) lround(depth * 64.0 / 6.0), po2, idx % 2, 20 - (int) (depth / 5.0),
+                               990 - minutes, 394, 388, 220 - minutes / 2, 195 - minutes / 2,
+                               po2 + 1, po2 - 1, po2, setpoint, (depth > 20.0) ? 3 : 0);
+
+    if (sentinel_gen_uniform(rnd) < gen->note_density) {
+        res &= sentinel_gen_append(buf, ",%s", GENERATOR_NOTES[sentinel_gen_random(rnd) % 10]);
+
+        if (sentinel_gen_uniform(rnd) < gen->note_density)
+            res &= sentinel_gen_append(buf, ",%s", GENERATOR_NOTES[sentinel_gen_random(rnd) % 10]);
+    }
+
+    if (gen->firmware == SENTINEL_FW_V009A) {
+        res &= sentinel_gen_append(buf, ",S152,T151,U146,V142,W140,X139,Y138,Z137,x0,y0,z%d,v18936,t28704,o32507,f37522",
+                                   50 + idx % 20);
+    } else if (gen->firmware == SENTINEL_FW_V009B) {
+        res &= sentinel_gen_append(buf, ",S116,T158,U178,V198,W196,X195,Y188,Z182,x0,y0,z%d", idx % 20);
+    }
+
+    res &= sentinel_gen_append(buf, "\r\n");
+
+    return(res);
+}
+
+/**
+ * sentinel_generate_dive: Returns a newly allocated string with a synthetic dive in the same format
+ *                         as the rebreather sends it as a response to the D<n> command
+ **/
+
+char* sentinel_generate_dive(const sentinel_generator_t* gen) {
+    sentinel_gen_buffer_t buf = {NULL, 0, 4096};
+    unsigned int rnd = (gen->seed != 0) ? gen->seed : 1;
+    bool res = true;
+    int i = 0;
+
+    if (gen->firmware <= SENTINEL_FW_UNKNOWN || gen->firmware >= SENTINEL_FW_COUNT || gen->records < 1) {
+        sentinel_error("Invalid generator firmware (%d) or number of records (%d)", gen->firmware, gen->records);
+        return(NULL);
+    }
+
+    buf.str = calloc(buf.size, sizeof(char));
+
+    if (buf.str == NULL)
+        return(NULL);
+
+    res &= sentinel_gen_append(&buf, "              d\r\n");
+    res &= sentinel_gen_header_lines(&buf, gen);
+
+    for (i = 0; i < 10; i++) {
+        res &= sentinel_gen_append(&buf, "Gas %d, 79, 0, 400, %d\r\n", 4010 + i, (i == 1) ? 1 : 0);
+    }
+
+    for (i = 0; i < 16; i++) {
+        res &= sentinel_gen_append(&buf, "Tissue %d, %d, 0\r\n", 4020 + i, 35 + i * 5);
+    }
+
+    res &= sentinel_gen_append(&buf, "Profile\r\n");
+
+    for (i = 0; i < gen->records; i++) {
+        res &= sentinel_gen_log_line(&buf, gen, i, &rnd);
+    }
+
+    res &= sentinel_gen_append(&buf, "End\r\n");
+
+    if (!res) {
+        free(buf.str);
+        return(NULL);
+    }
+
+    return(buf.str);
+}
+
+/**
+ * sentinel_generate_header: Returns a newly allocated string with the header of a synthetic dive
+ *                           as it appears in the response to the list (M) command
+ **/
+
+char* sentinel_generate_header(const sentinel_generator_t* gen) {
+    sentinel_gen_buffer_t buf = {NULL, 0, 1024};
+
+    if (gen->firmware <= SENTINEL_FW_UNKNOWN || gen->firmware >= SENTINEL_FW_COUNT || gen->records < 1) {
+        sentinel_error("Invalid generator firmware (%d) or number of records (%d)", gen->firmware, gen->records);
+        return(NULL);
+    }
+
+    buf.str = calloc(buf.size, sizeof(char));
+
+    if (buf.str == NULL)
+        return(NULL);
+
+    if (!sentinel_gen_append(&buf, "d\r\n") || !sentinel_gen_header_lines(&buf, gen)) {
+        free(buf.str);
+        return(NULL);
+    }
+
+    return(buf.str);
+}
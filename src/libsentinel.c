@@ -19,35 +19,93 @@
  * MA 02110-1301 USA
  */
 
+#include <poll.h>
+
 #include "libsentinel.h"
 
+/* Default values for the structs */
+const sentinel_dive_log_line_t DEFAULT_LOG_LINE = {
+    0,
+    0,
+    NULL,
+    0.0,
+    0.0,
+    0,
+    0.0,
+    0.0,
+    0.0,
+    0,
+    0,
+    {0.0,0.0,0.0},
+    0.0,
+    0,
+    NULL,
+    {0.0,0.0,0.0,0.0,0.0,0.0,0.0,0.0},
+    0.0
+};
+
+const sentinel_header_t DEFAULT_HEADER = {
+    NULL,
+    0,
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    NULL,
+    NULL,
+    0.0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0.0,
+    0.0,
+    0,
+    0,
+    NULL,
+    0.0,
+    0.0,
+    0.0,
+    0,
+    {0,0,0},
+    {{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0},{0,0,0,0.0,0}},
+    {{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0},{0,0}},
+    NULL,
+    0,
+    {0}
+};
+
 /**
  * connect_sentinel: Connects to the given serial port and returns the file descriptor for it
  **/
 
 int connect_sentinel(char* device) {
+    const long long connect_start = sentinel_time_ns();
     int fd = open_sentinel_device(device);
 
     if (fd == 0) {
-        eprint("Could not open device: %s", device);
+        sentinel_error("Could not open device: %s", device);
         return(0);
     }
 
     struct termios options;
     memset (&options, 0, sizeof (options));
     if (tcgetattr(fd, &options) != 0) {
-        eprint("Unable to get attributes from fd: %d", fd);
+        sentinel_error("Unable to get attributes from fd: %d", fd);
         return(0);
     }
 
     /* Set baud rate */
     if (cfsetispeed(&options, B9600) != 0) {
-        eprint("%s", "Could not set serial speed to 9600 for input");
+        sentinel_error("%s", "Could not set serial speed to 9600 for input");
         return(0);
     }
 
     if (cfsetospeed(&options, B9600) != 0) {
-        eprint("%s", "Could not set serial speed to 9600 for output");
+        sentinel_error("%s", "Could not set serial speed to 9600 for output");
         return(0);
     }
 
@@ -67,16 +125,17 @@ int connect_sentinel(char* device) {
     options.c_cflag |= CS8;
 
     if (tcsetattr( fd, TCSANOW, &options ) == -1)
-        eprint("%s", "Unable to set tcsetattr");
+        sentinel_error("%s", "Unable to set tcsetattr");
 
     fcntl(fd, F_SETFL, FNDELAY);
 
     int value = TIOCM_RTS;
     if (ioctl (fd, TIOCMBIS, &value) != 0) {
-        eprint("%s", "Unable to set RTS line, are you running against the emulator?");
+        sentinel_warn("%s", "Unable to set RTS line, are you running against the emulator?");
     }
 
     sentinel_sleep(500);
+    sentinel_get_stats()->connect_ns += sentinel_time_ns() - connect_start;
     return(fd);
 }
 
@@ -90,7 +149,7 @@ int open_sentinel_device(char* device) {
     fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
     if (fd == -1) {
-        eprint("Could not open device: %s", device);
+        sentinel_error("Could not open device: %s", device);
         return(0);
     } else
         fcntl(fd, F_SETFL, FNDELAY);
@@ -121,7 +180,7 @@ bool is_sentinel_idle(int fd, const int tries) {
             return(false);
         }
 
-        int n = read(fd, read_byte, sizeof(read_byte));
+        int n = sentinel_read(fd, read_byte, sizeof(read_byte));
 
         if (n > 0) {
             for (int i = 0; i < n; i++) {
@@ -133,14 +192,16 @@ bool is_sentinel_idle(int fd, const int tries) {
             /* We reset the tries as this is really flushing the buffer */
             i = tries;
         } else {
-            dprint(true, "Failed (%d) to read the serial device with return value: %d", i, m);
+            sentinel_trace("Failed (%d) to read the serial device with return value: %d", i, m);
+            sentinel_get_stats()->idle_retries++;
         }
 
-        flushed_bytes += n;
+        if (n > 0) flushed_bytes += n;
         m = memcmp(store_byte, expected, sizeof(expected));
 
         if (m == 0) {
-            if (flushed_bytes > 0) dprint(true, "Flushed %d bytes from device buffer", flushed_bytes);
+            if (flushed_bytes > 0) sentinel_debug("Flushed %d bytes from device buffer", flushed_bytes);
+            sentinel_get_stats()->flushed_bytes += flushed_bytes;
             return(true);
         }
 
@@ -153,128 +214,120 @@ bool is_sentinel_idle(int fd, const int tries) {
 }
 
 /**
- * send_sentinel_command: Handles sending of commands to the rebreather
+ * send_sentinel_command: Handles sending of commands to the rebreather. Whatever the rebreather
+ *                        sent before the command, usually wait bytes, is discarded first so that
+ *                        it is not mistaken for the response
  **/
 
 bool send_sentinel_command(int fd, const void* command, size_t size) {
     size_t nbytes = 0;
-    char* buf = calloc(size + 1, sizeof(char));
-    strncpy(buf, command, size);
+    char stale[SENTINEL_READ_CHUNK];
+    ssize_t n = 0;
+
+    while ((n = sentinel_read(fd, stale, sizeof(stale))) > 0) {
+        sentinel_get_stats()->flushed_bytes += n;
+    }
 
     while (nbytes < size) {
-        size_t n = write(fd, (const char*) command + nbytes, size - nbytes);
+        n = sentinel_write(fd, (const char*) command + nbytes, size - nbytes);
 
         if (n < 1) {
-            eprint("write() of %lu bytes failed!\n", (size - nbytes));
+            sentinel_error("write() of %lu bytes failed!", (size - nbytes));
             return(false);
         }
 
         nbytes += n;
     }
 
-    free(buf);
     return(true);
 }
 
 /**
  * read_sentinel_response: Waits for the given start and then stores everything into the
- *                         buffer until the wait byte is encountered. Expects that a command
+ *                         buffer until the given end is encountered. Expects that a command
  *                         has already been sent
  **/
 
 bool read_sentinel_response(int fd, char** buffer, const char start[], int start_len, const char end[], int end_len) {
-    char slide_start[start_len];
-    memset(slide_start, 0, start_len);
+    sentinel_receiver_t rx;
 
-    char slide_end[end_len];
-    memset(slide_end, 0, end_len);
+    *buffer = NULL;
 
-    char buf[1] ={0};
-
-    char* end_str = restring(end, end_len);
+    if (!sentinel_receiver_init(&rx, start, start_len, end, end_len))
+        return(false);
 
-    int i = 0;
-    int n = 0;
-    // Wait to receive the start packet for 20 cycles or as long as we get the wait byte
-    while (( n == 0) &&
-           (i < 20)) {
-        // TODO: Should we really read start_len worth of data here? What if the read data
-        //       is a partial beginning of start-matcher?
-        n = read(fd, slide_start, start_len);
-        sentinel_sleep(SENTINEL_LOOP_SLEEP_MS);
-
-        if (strncmp("PPP", slide_start, 3) == 0) {
-            i++;
-        }
+    if (receive_sentinel_response(fd, &rx) != SENTINEL_RX_DONE) {
+        sentinel_free(rx.buffer);
+        return(false);
     }
 
-    while ((n > 0) &&
-           (memcmp(slide_start, start, start_len) != 0)) {
-        n = read(fd, buf, sizeof(buf));
-        int j = 0;
-
-        while (j < (start_len - 1)) {
-            slide_start[j] = slide_start[j + 1];
-            j++;
-        }
-
-        slide_start[j] = buf[0];
+    *buffer = rx.buffer;
+    return(true);
+}
 
-        sentinel_sleep(SENTINEL_LOOP_SLEEP_MS);
-    }
+/**
+ * receive_sentinel_response: Feeds the receiver until the response is complete, broken or the
+ *                            device goes silent. The buffer of the receiver is left for the caller
+ *                            also when the response is incomplete
+ **/
 
-    // TODO: Make sure the buffer is not already initialized
-    // Initialize the buffer so that it fits at least the end string
-    *buffer = calloc(2, sizeof(char*));
-    // Copy whatever we last read from the device to the buffer, otherwise we lose the first char
-    strncpy(*buffer, buf, 1);
-    *buffer = resize_string(*buffer, end_len + 1);
-    // Then we read in end_len bytes from the device
-    n = read(fd, *buffer, end_len);
+sentinel_rx_state_t receive_sentinel_response(int fd, sentinel_receiver_t* rx) {
+    return(receive_sentinel_response_hook(fd, rx, NULL, NULL));
+}
 
-    int m = memcmp(*buffer + strlen(*buffer) - end_len, end, end_len);
+/**
+ * receive_sentinel_response_hook: Like receive_sentinel_response, but calls the hook after every
+ *                                 read, so that the response can be handled while it arrives.
+ *                                 The hook may consume the start of the buffer
+ **/
 
-    // We need to advance the index, otherwise we will overwrite the beginning of the buffer
-    i = strlen(*buffer);
+sentinel_rx_state_t receive_sentinel_response_hook(int fd, sentinel_receiver_t* rx, sentinel_rx_hook_t hook, void* data) {
+    const long long receive_start = sentinel_time_ns();
+    char chunk[SENTINEL_READ_CHUNK];
 
-    while (m != 0) {
-        n = read(fd, buf, sizeof(buf));
+    while (rx->state == SENTINEL_RX_WAIT_START || rx->state == SENTINEL_RX_BODY) {
+        struct pollfd pfd = {fd, POLLIN, 0};
 
-        if (n < 0) {
-            sentinel_sleep(50);
-            continue;
+        if (poll(&pfd, 1, SENTINEL_RESPONSE_TIMEOUT_MS) == 0) {
+            sentinel_error("No data from the device in %d ms", SENTINEL_RESPONSE_TIMEOUT_MS);
+            break;
         }
 
-        *buffer = resize_string(*buffer, strlen(*buffer) + 1);
-        if (*buffer == NULL) return(false);
+        size_t room = sizeof(chunk);
 
-        strncpy(*buffer + i, buf, 1);
-        if (*buffer == NULL) return(false);
+        /* A fixed buffer is only read into as far as it has room, the hook makes more */
+        if (rx->fixed && rx->size - rx->len - 1 < room)
+            room = rx->size - rx->len - 1;
 
-        m = memcmp(*buffer + strlen(*buffer) - end_len, end, end_len);
-        // Let's do a sanity check, in case the transmission is not correct
-        // if it starts to print out ,,, then we seem to be out of memory on the rebreather
-        if (m != 0 && i > 3 &&
-            ((memcmp(*buffer + strlen(*buffer) - 3, "PPP", 3) == 0) ||
-             (memcmp(*buffer + strlen(*buffer) - 3, ",,,", 3) == 0))) {
-            eprint("Somehow we missed the end string (%s) and see a lot of wait bytes or end-of-memory", end_str);
+        if (room == 0) {
+            sentinel_error("The response does not fit in the buffer of %zu bytes", rx->size);
+            rx->state = SENTINEL_RX_FAILED;
             break;
         }
 
-        sentinel_sleep(SENTINEL_LOOP_SLEEP_MS);
-        i++;
-    }
+        ssize_t n = sentinel_read(fd, chunk, room);
 
-    dprint(true, "Read bytes: %d", i);
+        if (n > 0)
+            sentinel_get_stats()->bytes_received += n;
 
-    free(end_str);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            sentinel_error("%s", "The device was closed");
+            break;
+        }
 
-    if (buffer == NULL) {
-        eprint("%s", "Buffer is empty");
-        return(false);
+        if (n > 0 && sentinel_receiver_feed(rx, chunk, n) != SENTINEL_RX_WAIT_START && hook != NULL)
+            hook(rx, data);
+
+        if (rx->state == SENTINEL_RX_WAIT_START && rx->wait_bytes > SENTINEL_RESPONSE_WAIT_BYTES) {
+            sentinel_error("No response after %d wait bytes", rx->wait_bytes);
+            break;
+        }
     }
 
-    return(true);
+    sentinel_debug("Read bytes: %zu", rx->len);
+    sentinel_get_stats()->receive_ns += sentinel_time_ns() - receive_start;
+
+    return(rx->state);
 }
 
 /**
@@ -297,12 +350,12 @@ bool download_sentinel_header(int fd, char** buffer) {
     send_sentinel_command(fd, SENTINEL_LIST_CMD, sizeof(SENTINEL_LIST_CMD));
     if (!read_sentinel_response(fd, buffer, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
                                 SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END))) {
-        eprint("%s", "Failed to read header from Sentinel");
+        sentinel_error("%s", "Failed to read header from Sentinel");
         return(false);
     }
 
     if (*buffer == NULL) {
-        eprint("%s", "Received NULL value as answer from device");
+        sentinel_error("%s", "Received NULL value as answer from device");
         return(false);
     }
 
@@ -318,7 +371,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
     char** h_lines = str_cut(buffer, "\r\n"); /* Cut it by lines */
 
     if (h_lines == NULL) {
-        eprint("%s", "Received empty header string");
+        sentinel_error("%s", "Received empty header string");
         return(false);
     }
 
@@ -339,8 +392,19 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             continue;
         }
         if (strncmp(h_lines[line_idx], "SN=", 3) == 0) {
-            (*header_struct)->serial_number = resize_string((*header_struct)->serial_number, strlen(h_lines[line_idx]) - 3);
-            strncpy((*header_struct)->serial_number, (h_lines[line_idx] + 3), (strlen(h_lines[line_idx]) - 4));
+            /* The whole serial number without the trailing spaces, the same as in
+             * sentinel_fixed_header_t, so that the dives of a rebreather are stored under one */
+            size_t len = strlen(h_lines[line_idx] + 3);
+
+            while (len > 0 && h_lines[line_idx][3 + len - 1] == ' ') {
+                len--;
+            }
+
+            (*header_struct)->serial_number = resize_string((*header_struct)->serial_number, len);
+
+            if ((*header_struct)->serial_number != NULL)
+                memcpy((*header_struct)->serial_number, h_lines[line_idx] + 3, len);
+
             line_idx++;
             continue;
         }
@@ -348,7 +412,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -362,7 +426,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -376,7 +440,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -390,7 +454,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -403,7 +467,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -416,7 +480,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -429,7 +493,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -442,7 +506,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -455,7 +519,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -469,7 +533,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -483,7 +547,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -496,7 +560,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -509,7 +573,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -522,7 +586,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&h_lines[line_idx], " ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -557,7 +621,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&tmp_ptr, ", ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -572,7 +636,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&tmp_ptr, ", ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -592,7 +656,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             char** fields = str_cut(&tmp_ptr, ", ");
 
             if (fields == NULL) {
-                eprint("Received empty split list from: '%s'", h_lines[line_idx]);
+                sentinel_error("Received empty split list from: '%s'", h_lines[line_idx]);
                 return(false);
             }
 
@@ -605,7 +669,7 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
             continue;
         }
 
-        dprint(true, "Unknown field: '%s'", h_lines[line_idx]);
+        sentinel_trace("Unknown field: '%s'", h_lines[line_idx]);
         line_idx++;
     }
 
@@ -625,34 +689,35 @@ bool parse_sentinel_header(sentinel_header_t** header_struct, char** buffer) {
 }
 
 /**
- * parse_sentinel_log_line: Parse the single log line of a dive
+ * parse_sentinel_log_line: Parse the single log line of a dive, guessing the layout of the fields
+ *                          after the notes. The downloads use the parser of the firmware instead,
+ *                          see sentinel_log_parser
  **/
 
 bool parse_sentinel_log_line(int interval, sentinel_dive_log_line_t* line, char* linestr) {
     char** log_field = str_cut(&linestr, ","); /* Cut it by comma */
 
     if (log_field == NULL) {
-        eprint("Received empty split list from: '%s'", linestr);
+        sentinel_error("Received empty split list from: '%s'", linestr);
         return(false);
     }
 
-    // Print all the fields we splitted
-    int i = 0;
-    while (log_field[i] != NULL) {
-        i++;
-    }
-
-    // Then again, with the shifted value
-    i = 0;
-    while (log_field[i] != NULL) {
-        i++;
+    int count = 0;
+    while (log_field[count] != NULL) {
+        count++;
     }
 
-    i = 0;
+    int i = 0;
 
     // Default values for the line
     *line = DEFAULT_LOG_LINE;
 
+    /* The fixed fields are skipped over in pairs below, a shorter line would be read past its end */
+    if (count < 16) {
+        free_string_array(log_field);
+        return(false);
+    }
+
     /* We presume that the first 15 fields are always in the same order
      * and represent the same thing */
     if (log_field[i] != NULL) line->time_idx             = atoi(log_field[i] + 1);
@@ -686,7 +751,7 @@ bool parse_sentinel_log_line(int interval, sentinel_dive_log_line_t* line, char*
         line->note[note_idx] = alloc_sentinel_note();
 
         if (!get_sentinel_note(line->note[note_idx], log_field[i])) {
-            eprint("Unable to add note: %s", log_field[i]);
+            sentinel_error("Unable to add note: %s", log_field[i]);
         }
 
         note_idx++;
@@ -701,7 +766,7 @@ bool parse_sentinel_log_line(int interval, sentinel_dive_log_line_t* line, char*
         j++;
     }
 
-    if (log_field[i] != NULL) line->co2                 = atoi(log_field[i + 2] + 1);
+    if (i + 2 < count) line->co2                        = atoi(log_field[i + 2] + 1);
 
     free_string_array(log_field);
 
@@ -714,7 +779,7 @@ bool parse_sentinel_log_line(int interval, sentinel_dive_log_line_t* line, char*
  **/
 
 sentinel_note_t* alloc_sentinel_note(void) {
-    sentinel_note_t *tmp = malloc(sizeof(sentinel_note_t));
+    sentinel_note_t *tmp = sentinel_malloc(sizeof(sentinel_note_t));
 
     if (tmp == NULL)
         return(NULL);
@@ -738,18 +803,18 @@ sentinel_note_t** resize_sentinel_note_list(sentinel_note_t** old_list, int list
 
     int new_size = list_size + 1;
 
-    sentinel_note_t** new_list = realloc(old_list, new_size * sizeof(sentinel_note_t*));
+    sentinel_note_t** new_list = sentinel_realloc(old_list, new_size * sizeof(sentinel_note_t*));
 
     if (new_list == NULL) {
-        eprint("%s", "Failed to reallocate note list");
+        sentinel_error("%s", "Failed to reallocate note list");
         int j = 0;
 
         while (old_list[j] != NULL) {
-            free(old_list[j]);
+            sentinel_free(old_list[j]);
             j++;
         }
 
-        free(old_list);
+        sentinel_free(old_list);
         return(NULL);
     }
 
@@ -763,56 +828,233 @@ sentinel_note_t** resize_sentinel_note_list(sentinel_note_t** old_list, int list
  **/
 
 bool get_sentinel_dive_list(int fd, sentinel_header_t*** header_list) {
-    /* Create and minimal allocation of the buffer */
-    char* buffer;
+    char* buffer = NULL;
+
     if (!download_sentinel_header(fd, &buffer)) {
-        eprint("%s", "Failed to get the Sentinel header");
-        free(buffer);
+        sentinel_error("%s", "Failed to get the Sentinel header");
+        sentinel_free(buffer);
+        return(false);
+    }
+
+    sentinel_trace("Received dive list:\n%s", buffer);
+    bool res = parse_sentinel_dive_list(&buffer, header_list);
+    sentinel_free(buffer);
+
+    return(res);
+}
+
+/* State of get_sentinel_dive_list_since while the list arrives */
+typedef struct sentinel_list_since {
+    const char* serial_number;
+    int start_s;
+    sentinel_list_anchor_t anchor; /* Sets serial_number and start_s from the first header, then NULL */
+    void* anchor_data;
+    char anchor_serial[32];
+    sentinel_header_t*** header_list;
+    int count;
+    bool found; /* The known header has been seen, the rest is skipped */
+    bool failed;
+} sentinel_list_since_t;
+
+/**
+ * sentinel_list_since_known: Tells whether the header is the known one. Every dive on the
+ *                            rebreather has its serial number, so with an anchor the first
+ *                            header tells which known dive to look for
+ **/
+
+static bool sentinel_list_since_known(sentinel_list_since_t* since, const sentinel_header_t* header) {
+    if (since->anchor != NULL) {
+        snprintf(since->anchor_serial, sizeof(since->anchor_serial), "%s",
+                 (header->serial_number != NULL) ? header->serial_number : "");
+        since->serial_number = since->anchor_serial;
+        since->start_s       = since->anchor(since->serial_number, since->anchor_data);
+        since->anchor        = NULL;
+    }
+
+    return(header->start_s == since->start_s &&
+           (since->serial_number == NULL ||
+            (header->serial_number != NULL && strcmp(header->serial_number, since->serial_number) == 0)));
+}
+
+/**
+ * sentinel_list_since_hook: Parses the headers completed by the last read, until the known one
+ **/
+
+static void sentinel_list_since_hook(sentinel_receiver_t* rx, void* data) {
+    sentinel_list_since_t* since = data;
+    size_t parsed = 0;
+
+    while (!since->found && !since->failed) {
+        const char* block = rx->buffer + parsed;
+        const char* next  = strstr(block, "\r\nd\r\n");
+        size_t block_len  = 0;
+        size_t advance    = 0;
+
+        if (next != NULL) {
+            block_len = next + 2 - block;
+            advance   = next + 5 - block;
+        } else if (rx->state == SENTINEL_RX_DONE && (next = strstr(block, "End\r\n")) != NULL && next > block) {
+            block_len = next - block;
+            advance   = block_len;
+        } else {
+            break;
+        }
+
+        const long long parse_start = sentinel_time_ns();
+        char* header_str = sentinel_calloc(block_len + 1, sizeof(char));
+        sentinel_header_t* header = alloc_sentinel_header();
+
+        if (header_str == NULL || header == NULL) {
+            sentinel_free(header_str);
+            sentinel_free(header);
+            since->failed = true;
+            break;
+        }
+
+        memcpy(header_str, block, block_len);
+        *header = DEFAULT_HEADER;
+
+        if (!parse_sentinel_header(&header, &header_str)) {
+            sentinel_error("%s", "Failed parse the Sentinel header");
+            free_sentinel_header(header);
+            since->failed = true;
+        } else if (sentinel_list_since_known(since, header)) {
+            free_sentinel_header(header);
+            since->found = true;
+        } else {
+            *since->header_list = resize_sentinel_header_list(*since->header_list, since->count + 1);
+
+            if (*since->header_list == NULL) {
+                free_sentinel_header(header);
+                since->failed = true;
+            } else {
+                (*since->header_list)[since->count++] = header;
+            }
+        }
+
+        sentinel_free(header_str);
+        sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+        parsed += advance;
+    }
+
+    /* Only the part which can still hold the start of a header or the end is kept, after the known
+     * header only what the receiver needs to find the end */
+    if (since->found && rx->len > (size_t) rx->end_len)
+        parsed = rx->len - rx->end_len;
+
+    if (parsed > 0) {
+        memmove(rx->buffer, rx->buffer + parsed, rx->len - parsed + 1);
+        rx->len -= parsed;
+    }
+}
+
+/**
+ * sentinel_list_since: Fetches the list, keeping the headers until the known one of since
+ **/
+
+static bool sentinel_list_since(int fd, sentinel_list_since_t* since) {
+    sentinel_receiver_t rx;
+
+    if (!sentinel_receiver_init(&rx, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
+                                SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END)))
+        return(false);
+
+    if (!send_sentinel_command(fd, SENTINEL_LIST_CMD, sizeof(SENTINEL_LIST_CMD))) {
+        sentinel_free(rx.buffer);
         return(false);
     }
 
-    printf("========= List ==========\n");
-    printf("%s", buffer);
-    printf("========= List ==========\n");
+    const sentinel_rx_state_t state = receive_sentinel_response_hook(fd, &rx, sentinel_list_since_hook, since);
+    sentinel_free(rx.buffer);
+
+    if (state != SENTINEL_RX_DONE) {
+        sentinel_error("%s", "Failed to read header from Sentinel");
+        return(false);
+    }
+
+    sentinel_debug("%d new dives, known dive %s", since->count, since->found ? "found" : "not found");
+
+    return(!since->failed);
+}
+
+/**
+ * get_sentinel_dive_list_since: Fetches the headers of the dives newer than the given known one,
+ *                               newest first like get_sentinel_dive_list. The headers are parsed
+ *                               as they arrive and parsing stops at the known header. NULL
+ *                               serial_number matches any. The rebreather can not be told to stop
+ *                               sending the list, so the rest of it is still read, but not kept or
+ *                               parsed, as it would otherwise be taken for the next response.
+ *                               If the known header is not on the rebreather, all the headers are
+ *                               returned
+ **/
+
+bool get_sentinel_dive_list_since(int fd, const char* serial_number, const int start_s,
+                                  sentinel_header_t*** header_list) {
+    sentinel_list_since_t since = {serial_number, start_s, NULL, NULL, {0}, header_list, 0, false, false};
+
+    return(sentinel_list_since(fd, &since));
+}
+
+/**
+ * get_sentinel_dive_list_anchored: Like get_sentinel_dive_list_since, but the known dive is asked
+ *                                  from the anchor with the serial number of the first header, the
+ *                                  rebreather which is connected. An anchor returning -1 knows no
+ *                                  dive of it and all the headers are returned
+ **/
+
+bool get_sentinel_dive_list_anchored(int fd, sentinel_list_anchor_t anchor, void* data,
+                                     sentinel_header_t*** header_list) {
+    sentinel_list_since_t since = {NULL, -1, anchor, data, {0}, header_list, 0, false, false};
+
+    return(sentinel_list_since(fd, &since));
+}
+
+/**
+ * parse_sentinel_dive_list: Parses the response to the list command and populates the given
+ *                           header-struct list
+ **/
+
+bool parse_sentinel_dive_list(char** buffer, sentinel_header_t*** header_list) {
     // TODO: This is not working, for some reason SENTINEL_HEADER_START is longer (5) and has 2 newlines
     // char** head_array = str_cut(buffer, SENTINEL_HEADER_START);
-    char** head_array = str_cut(&buffer, "d\r\n");
+    char** head_array = str_cut(buffer, "d\r\n");
 
     if (head_array == NULL) {
-        eprint("Received empty head array from: '%s'", buffer);
+        sentinel_error("Received empty head array from: '%s'", *buffer);
         return(false);
     }
 
-    /* We can now free the original buffer */
-    free(buffer);
-
     int header_idx = 0;
 
     while (head_array[header_idx] != NULL) {
         *header_list = resize_sentinel_header_list(*header_list, header_idx + 1);
 
         if (*header_list == NULL) {
-            eprint("%s", "Failed to reallocate header_list");
+            sentinel_error("%s", "Failed to reallocate header_list");
             return(false);
         }
 
         (*header_list)[header_idx] = alloc_sentinel_header();
 
         if ((*header_list)[header_idx] == NULL) {
-            eprint("Could not allocate memory for header struct (%d)", header_idx);
+            sentinel_error("Could not allocate memory for header struct (%d)", header_idx);
             return(false);
         }
 
+        const long long parse_start = sentinel_time_ns();
+
         if (!parse_sentinel_header(&(*header_list)[header_idx], &head_array[header_idx])) {
-            eprint("%s", "Failed parse the Sentinel header");
+            sentinel_error("%s", "Failed parse the Sentinel header");
             return(false);
         }
 
+        sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+
         header_idx++;
     }
 
     free_string_array(head_array);
-    /* TODO: Invert the list as it is now from the newest to the oldest */
+    /* The list is from the newest to the oldest, sentinel_header_table_t has them in the order of time */
     return(true);
 }
 
@@ -822,7 +1064,7 @@ bool get_sentinel_dive_list(int fd, sentinel_header_t*** header_list) {
  **/
 
 sentinel_header_t* alloc_sentinel_header(void) {
-    sentinel_header_t *tmp = malloc(sizeof(sentinel_header_t));
+    sentinel_header_t *tmp = sentinel_malloc(sizeof(sentinel_header_t));
 
     if (tmp == NULL)
         return(NULL);
@@ -837,14 +1079,14 @@ sentinel_header_t* alloc_sentinel_header(void) {
 
 void free_sentinel_header(sentinel_header_t* header) {
     if (header != NULL) {
-        if (header->version       != NULL) free(header->version);
-        if (header->decoalg       != NULL) free(header->decoalg);
-        if (header->serial_number != NULL) free(header->serial_number);
-        if (header->start_time    != NULL) free(header->start_time);
-        if (header->end_time      != NULL) free(header->end_time);
-        if (header->length_time   != NULL) free(header->length_time);
+        if (header->version       != NULL) sentinel_free(header->version);
+        if (header->decoalg       != NULL) sentinel_free(header->decoalg);
+        if (header->serial_number != NULL) sentinel_free(header->serial_number);
+        if (header->start_time    != NULL) sentinel_free(header->start_time);
+        if (header->end_time      != NULL) sentinel_free(header->end_time);
+        if (header->length_time   != NULL) sentinel_free(header->length_time);
         if (header->log           != NULL) free_sentinel_log_list(header->log);
-        free(header);
+        sentinel_free(header);
     }
 }
 
@@ -857,13 +1099,13 @@ void free_sentinel_note_list(sentinel_note_t** note) {
         int i = 0;
 
         while (note[i] != NULL) {
-            if (note[i]->note != NULL) free(note[i]->note);
-            if (note[i]->description != NULL) free(note[i]->description);
-            free(note[i]);
+            if (note[i]->note != NULL) sentinel_free(note[i]->note);
+            if (note[i]->description != NULL) sentinel_free(note[i]->description);
+            sentinel_free(note[i]);
             i++;
         }
 
-        free(note);
+        sentinel_free(note);
     }
 }
 
@@ -874,9 +1116,9 @@ void free_sentinel_note_list(sentinel_note_t** note) {
 
 void free_sentinel_log(sentinel_dive_log_line_t* log) {
     if (log != NULL) {
-        if (log->time_string != NULL) free(log->time_string);
+        if (log->time_string != NULL) sentinel_free(log->time_string);
         free_sentinel_note_list(log->note);
-        free(log);
+        sentinel_free(log);
     }
 }
 
@@ -893,7 +1135,7 @@ void free_sentinel_log_list(sentinel_dive_log_line_t** log) {
             i++;
         }
 
-        free(log);
+        sentinel_free(log);
     }
 }
 
@@ -940,6 +1182,21 @@ void print_sentinel_header(sentinel_header_t* header) {
         for (i = 0; i < 16; i++) {
             printf("tissue[%d]: %3d %3d\n", i, header->tissue[i].t1, header->tissue[i].t2 );
         }
+
+        if (header->summary.records > 0) {
+            const sentinel_summary_t* summary = &header->summary;
+
+            printf("depth: min %.2lf max %.2lf mean %.2lf\n", sentinel_summary_min_depth(summary),
+                   sentinel_summary_max_depth(summary), sentinel_summary_mean_depth(summary));
+            printf("po2: min %.2lf max %.2lf\n", summary->min_po2 / 100.0, summary->max_po2 / 100.0);
+            printf("cell_o2 min: %.2lf %.2lf %.2lf\n", summary->min_cell_o2[0] / 100.0,
+                   summary->min_cell_o2[1] / 100.0, summary->min_cell_o2[2] / 100.0);
+            printf("battery_V min: %.2lf %.2lf\n", summary->min_battery[0] / 100.0, summary->min_battery[1] / 100.0);
+            printf("pressure drop: diluent %d o2 %d\n", sentinel_summary_diluent_drop(summary),
+                   sentinel_summary_o2_drop(summary));
+            printf("co2 max: %d\n", summary->max_co2);
+            printf("events: %d\n", sentinel_summary_events(summary));
+        }
     }
 }
 
@@ -1018,18 +1275,18 @@ sentinel_dive_log_line_t** resize_sentinel_log_list(sentinel_dive_log_line_t** o
 
     int new_size = list_size + 1;
 
-    sentinel_dive_log_line_t** new_list = realloc(old_list, new_size * sizeof(sentinel_dive_log_line_t*));
+    sentinel_dive_log_line_t** new_list = sentinel_realloc(old_list, new_size * sizeof(sentinel_dive_log_line_t*));
 
     if (new_list == NULL) {
-        eprint("%s", "Failed to reallocate log list");
+        sentinel_error("%s", "Failed to reallocate log list");
         int j = 0;
 
         while (old_list[j] != NULL) {
-            free(old_list[j]);
+            sentinel_free(old_list[j]);
             j++;
         }
 
-        free(old_list);
+        sentinel_free(old_list);
         return(NULL);
     }
 
@@ -1044,7 +1301,7 @@ sentinel_dive_log_line_t** resize_sentinel_log_list(sentinel_dive_log_line_t** o
  **/
 
 sentinel_dive_log_line_t* alloc_sentinel_dive_log_line(void) {
-    sentinel_dive_log_line_t* tmp = malloc(sizeof(sentinel_dive_log_line_t));
+    sentinel_dive_log_line_t* tmp = sentinel_malloc(sizeof(sentinel_dive_log_line_t));
 
     if (tmp == NULL)
         return(NULL);
@@ -1067,33 +1324,34 @@ void free_sentinel_dive_log_list(sentinel_dive_log_line_t** old_list) {
         i++;
     }
 
-    free(old_list);
+    sentinel_free(old_list);
 }
 
 
 /**
- * resize_sentinel_header_list: Manages the resizing of an sentinel_header_t array
+ * resize_sentinel_header_list: Manages the resizing of an sentinel_header_t array, which is grown
+ *                              one header at a time and only ever allocated by this function
  **/
 
 sentinel_header_t** resize_sentinel_header_list(sentinel_header_t** old_list, int list_size) {
-    // Let's first get a count of the old list
-    int i = 0;
-
-    if (old_list != NULL) {
-        while (old_list[i] != NULL) {
-            i++;
+    /* The capacity is the size rounded up to a power of two, at least 8, so the list is only
+     * reallocated when the size reaches the capacity */
+    sentinel_header_t** new_list = old_list;
+    int new_size = 8;
+
+    if (old_list == NULL || (list_size + 1 > new_size && (list_size & (list_size - 1)) == 0)) {
+        while (new_size < list_size + 1) {
+            new_size *= 2;
         }
-    }
-
-    int new_size = list_size + 1;
 
-    sentinel_header_t** new_list = realloc(old_list, new_size * sizeof(sentinel_header_t*));
+        new_list = sentinel_realloc(old_list, new_size * sizeof(sentinel_header_t*));
 
-    if (new_list == NULL) {
-        eprint("%s", "Failed to reallocate header_list");
+        if (new_list == NULL) {
+            sentinel_error("%s", "Failed to reallocate header_list");
 
-        free_sentinel_header_list(old_list);
-        return(NULL);
+            free_sentinel_header_list(old_list);
+            return(NULL);
+        }
     }
 
     new_list[list_size] = NULL;
@@ -1114,72 +1372,56 @@ void free_sentinel_header_list(sentinel_header_t** old_list) {
         i++;
     }
 
-    free(old_list);
+    sentinel_free(old_list);
 }
 
+#define SENTINEL_NOTE_INFO(note, type, description) {note, type, description},
+
+const sentinel_note_info_t SENTINEL_NOTES[SENTINEL_NOTE_KINDS] = {
+    SENTINEL_NOTE_TABLE(SENTINEL_NOTE_INFO)
+};
+
+const int SENTINEL_NOTE_COUNT = SENTINEL_NOTE_KINDS;
+
 /**
- * get_sentinel_note: Creates and returns a note struct on the given note-string. The type is
- *                    taken from Subsurface
+ * sentinel_note_code: Returns the index + 1 of the note in SENTINEL_NOTES, or SENTINEL_NOTE_UNKNOWN.
+ *                     Trailing spaces, which some firmware sends, are ignored
  **/
 
-bool get_sentinel_note(sentinel_note_t* note, char* note_str) {
-    note->note = calloc(1, sizeof(char));
-    note->note = resize_string(note->note, (strlen(note_str) + 1));
-    strncpy(note->note, note_str, strlen(note_str));
-
-    if (strcmp(note_str, "ASCENT")) {
-        note->type  = 3;
-        note->description = strdup("Ascent");
-    } else if (strcmp(note_str, "ASCENT FAST")) {
-        note->type  = 3;
-        note->description = strdup("High ascent rate");
-    } else if (strcmp(note_str, "CELLmV ERROR")) {
-        note->type  = 20;
-        note->description = strdup("Cell voltage error");
-    } else if (strcmp(note_str, "DECO ALARM")) {
-        note->type  = 1;
-        note->description = strdup("Deco alarm");
-    } else if (strcmp(note_str, "FILTERREDDIFF")) {
-        note->type  = 20;
-        note->description = strdup("Filter reading difference");
-    } else if (strcmp(note_str, "HPRATE HI")) {
-        note->type  = 20;
-        note->description = strdup("High pressure rate");
-    } else if (strcmp(note_str, "PPO2 <HIGH")) {
-        note->type  = 20;
-        note->description = strdup("PO2 very high");
-    } else if (strcmp(note_str, "PPO2 HIGH")) {
-        note->type  = 20;
-        note->description = strdup("PO2 high");
-    } else if (strcmp(note_str, "PPO2 LOW")) {
-        note->type  = 20;
-        note->description = strdup("PO2 low");
-    } else if (strcmp(note_str, "PPO2 mHIGH")) {
-        note->type  = 20;
-        note->description = strdup("PO2 medium high");
-    } else if (strcmp(note_str, "PPO2 mLOW")) {
-        note->type  = 20;
-        note->description = strdup("PO2 medium low");
-    } else if (strcmp(note_str, "PPO2 OFF")) {
-        note->type  = 20;
-        note->description = strdup("No pO2-reading");
-    } else if (strcmp(note_str, "PPO2 SPINC")) {
-        note->type  = 20;
-        note->description = strdup("SP change");
-    } else if (strcmp(note_str, "PPO2 VHIGH")) {
-        note->type  = 20;
-        note->description = strdup("PO2 very high");
-    } else if (strcmp(note_str, "PREDIVE ABORT")) {
-        note->type  = 20;
-        note->description = strdup("No predive check done");
-    } else if (strcmp(note_str, "VALVE")) {
-        note->type  = 20;
-        note->description = strdup("Valve issue detected");
-    } else {
-        eprint("Unknown note: '%s'", note_str);
+int sentinel_note_code(const char* note_str, size_t len) {
+    int i = 0;
+
+    while (len > 0 && note_str[len - 1] == ' ') {
+        len--;
     }
 
-    return(note);
+    for (i = 0; i < SENTINEL_NOTE_COUNT; i++) {
+        if (strlen(SENTINEL_NOTES[i].note) == len && strncmp(SENTINEL_NOTES[i].note, note_str, len) == 0)
+            return(i + 1);
+    }
+
+    return(SENTINEL_NOTE_UNKNOWN);
+}
+
+/**
+ * get_sentinel_note: Populates the note struct from the given note-string, returns false if the
+ *                    note is not known
+ **/
+
+bool get_sentinel_note(sentinel_note_t* note, char* note_str) {
+    const int code = sentinel_note_code(note_str, strlen(note_str));
+
+    note->note        = sentinel_strdup(note_str);
+    note->type        = 0;
+    note->description = NULL;
+
+    if (code == SENTINEL_NOTE_UNKNOWN)
+        return(false);
+
+    note->type        = SENTINEL_NOTES[code - 1].type;
+    note->description = sentinel_strdup(SENTINEL_NOTES[code - 1].description);
+
+    return(true);
 }
 
 /**
@@ -1188,68 +1430,88 @@ bool get_sentinel_note(sentinel_note_t* note, char* note_str) {
  **/
 
 bool download_sentinel_dive(int fd, int dive_num, sentinel_header_t** header_item) {
-    int cmd_size = (int) log10(dive_num) + 2;
+    char command[16];
+    char* buffer = NULL;
     bool res = true;
 
-    if (dive_num == 0)
-        cmd_size = 2;
-
-    char command[cmd_size];
-    char* buffer;
-    /* TODO: This is not how the dive number is formed. It is actually just the ascii character,
-     *       so eg. first dive is 0x30 (0) and the commad is D0, 12th dive is 0x3C (<) and the
-     *       command is D< */
-    sprintf(command, "D%d", dive_num);
-    res = send_sentinel_command(fd, &command, sizeof(command));
+    res = send_sentinel_command(fd, command, sentinel_dive_command(command, sizeof(command), dive_num));
     if (!res) return(false);
 
     if (!read_sentinel_response(fd, &buffer, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
                                 SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END))) {
-        eprint("%s", "Failed to read dive data from Sentinel");
+        sentinel_error("%s", "Failed to read dive data from Sentinel");
         res = false;
     } else {
-        printf("========= Dive ==========\n");
-        printf("%s", buffer);
-        printf("========= Dive ==========\n");
-        // Let's first separate the header from the profile
-        char** header_and_profile = str_cut(&buffer, "Profile\r\n");
-
-        // Let's repopulate the header, then we will also get the gas and tissues too
-        free_sentinel_header(*header_item);
-        *header_item = alloc_sentinel_header();
-        **header_item = DEFAULT_HEADER;
-
-        if (!parse_sentinel_header(header_item, &header_and_profile[0])) {
-            eprint("%s", "Failed to re-parse header");
-            res = false;
-        } else {
-            // Next we split the loglines
-            char** log_lines = str_cut(&header_and_profile[1], "\r\n");
-            int i = 0;
+        sentinel_trace("Received dive:\n%s", buffer);
+        res = parse_sentinel_dive(&buffer, header_item);
+    }
 
-            // TODO: We know how many log lines there should be, from the Mem header line,
-            //       this should be verified
-            while (log_lines[i] != NULL && strncmp(log_lines[i], "End", 3) != 0) {
-                (*header_item)->log = resize_sentinel_log_list((*header_item)->log, i + 1);
-                (*header_item)->log[i] = alloc_sentinel_dive_log_line();
+    sentinel_free(buffer);
+    return(res);
+}
 
-                if (!parse_sentinel_log_line((*header_item)->record_interval, (*header_item)->log[i], log_lines[i])) {
-                    eprint("Unable to parse log line: %s", log_lines[i]);
-                }
+/**
+ * parse_sentinel_dive: Parses the response to the download command and populates the missing data
+ *                      in the given dive construct
+ **/
 
-                i++;
-            }
+bool parse_sentinel_dive(char** buffer, sentinel_header_t** header_item) {
+    const long long parse_start = sentinel_time_ns();
+    sentinel_log_parser_t parser = NULL;
+    bool res = true;
+    // Let's first separate the header from the profile
+    char** header_and_profile = str_cut(buffer, "Profile\r\n");
+
+    if (header_and_profile == NULL || header_and_profile[0] == NULL || header_and_profile[1] == NULL) {
+        sentinel_error("%s", "Received dive without a profile");
+        free_string_array(header_and_profile);
+        return(false);
+    }
+
+    uint64_t hash = sentinel_hash_header(header_and_profile[0], strlen(header_and_profile[0]));
+
+    // Let's repopulate the header, then we will also get the gas and tissues too
+    free_sentinel_header(*header_item);
+    *header_item = alloc_sentinel_header();
+    **header_item = DEFAULT_HEADER;
 
-            free_string_array(log_lines);
+    if (!parse_sentinel_header(header_item, &header_and_profile[0])) {
+        sentinel_error("%s", "Failed to re-parse header");
+        res = false;
+    } else if ((parser = sentinel_log_parser(sentinel_firmware_from_version((*header_item)->version))) == NULL) {
+        sentinel_error("Unsupported firmware version: %s", ((*header_item)->version != NULL) ? (*header_item)->version : "none");
+        res = false;
+    } else {
+        // Next we split the loglines
+        char** log_lines = str_cut(&header_and_profile[1], "\r\n");
+        int i = 0;
 
+        // TODO: We know how many log lines there should be, from the Mem header line,
+        //       this should be verified
+        while (log_lines != NULL && log_lines[i] != NULL && strncmp(log_lines[i], "End", 3) != 0) {
+            (*header_item)->log = resize_sentinel_log_list((*header_item)->log, i + 1);
+            (*header_item)->log[i] = alloc_sentinel_dive_log_line();
+            hash = sentinel_hash_line(hash, log_lines[i], strlen(log_lines[i]));
+
+            if (!parser((*header_item)->record_interval, (*header_item)->log[i], log_lines[i])) {
+                sentinel_error("Unable to parse log line: %s", log_lines[i]);
+            } else {
+                sentinel_summary_add_line(&(*header_item)->summary, (*header_item)->log[i]);
+            }
+
+            i++;
         }
 
-        free_string_array(header_and_profile);
+        free_string_array(log_lines);
+        (*header_item)->content_hash = hash;
     }
 
-    free(buffer);
+    free_string_array(header_and_profile);
+    sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+
     return(res);
 }
+
 /*************************************************************************/
 /* Minor helper functions used internally                                */
 /*************************************************************************/
@@ -1261,12 +1523,12 @@ bool download_sentinel_dive(int fd, int dive_num, sentinel_header_t** header_ite
 
 char** str_cut(char** orig_string, const char* delim) {
     if (orig_string == NULL) {
-        dprint(true, "%s", "Original string is null, return null");
+        sentinel_debug("%s", "Original string is null, return null");
         return(NULL);
     }
 
     if (delim == NULL || delim == 0) {
-        dprint(true, "%s", "Delimiter is null, return null");
+        sentinel_debug("%s", "Delimiter is null, return null");
         /* TODO: Should this actually return an array with each char is separated? */
         return(NULL);
     }
@@ -1331,10 +1593,10 @@ char** str_cut(char** orig_string, const char* delim) {
  **/
 
 char* resize_string(char* old_str, int string_length) {
-    char* new_str = calloc(string_length + 1, sizeof(char));
+    char* new_str = sentinel_calloc(string_length + 1, sizeof(char));
 
     if (new_str == NULL) {
-        eprint("%s", "Unable to calloc string, return null");
+        sentinel_error("%s", "Unable to calloc string, return null");
         return(NULL);
     }
 
@@ -1344,11 +1606,11 @@ char* resize_string(char* old_str, int string_length) {
 
     char* tmp = strncpy(new_str, old_str, strlen(old_str));
 
-    free(old_str);
+    sentinel_free(old_str);
 
     if (tmp == NULL) {
-        eprint("%s", "Unable to strncpy the old string to the new");
-        free(new_str);
+        sentinel_error("%s", "Unable to strncpy the old string to the new");
+        sentinel_free(new_str);
         return(NULL);
     }
 
@@ -1362,13 +1624,13 @@ char* resize_string(char* old_str, int string_length) {
  **/
 
 char** resize_string_array(char** old_arr, int arr_size) {
-    char** new_arr = calloc(arr_size + 1, sizeof(char**));
+    char** new_arr = sentinel_calloc(arr_size + 1, sizeof(char**));
 
     if (old_arr == NULL && arr_size > 0) {
         int i = 0;
 
         for (i = 0; i < arr_size; i++) {
-            new_arr[i] = calloc(1, sizeof(char));
+            new_arr[i] = sentinel_calloc(1, sizeof(char));
         }
 
         return(new_arr);
@@ -1376,7 +1638,7 @@ char** resize_string_array(char** old_arr, int arr_size) {
 
     if (arr_size == 0) {
         new_arr[0] = NULL;
-        if (old_arr != NULL) free(old_arr);
+        if (old_arr != NULL) sentinel_free(old_arr);
         return(new_arr);
     }
 
@@ -1386,7 +1648,7 @@ char** resize_string_array(char** old_arr, int arr_size) {
      *       Maybe next consider storing these values in a linked list instead? */
 
     while (old_arr[i] != NULL) {
-        new_arr[i] = calloc(strlen(old_arr[i]) + 1, sizeof(char));
+        new_arr[i] = sentinel_calloc(strlen(old_arr[i]) + 1, sizeof(char));
         strncpy(new_arr[i], old_arr[i], strlen(old_arr[i]));
         i++;
     }
@@ -1407,11 +1669,11 @@ void free_string_array(char** str_arr) {
     if (str_arr == NULL) return;
 
     while (str_arr[i] != NULL) {
-        free(str_arr[i]);
+        sentinel_free(str_arr[i]);
         i++;
     }
 
-    free(str_arr);
+    sentinel_free(str_arr);
 }
 
 /**
@@ -1430,14 +1692,14 @@ int sentinel_to_unix_timestamp(const int sentinel_time) {
 char* sentinel_to_utc_datestring(const int sentinel_time) {
     time_t t = sentinel_to_unix_timestamp(sentinel_time);
     const char* format = default_format;
-    static int str_length = 60;
+    const int str_length = 60;
 
-    char* outstr = calloc(str_length + 1, sizeof(char));
+    char* outstr = sentinel_calloc(str_length + 1, sizeof(char));
     struct tm lt;
     localtime_r(&t, &lt);
 
     if (strftime(outstr, str_length, format, &lt) == 0) {
-        eprint("strftime returned 0 for %d", sentinel_time);
+        sentinel_error("strftime returned 0 for %d", sentinel_time);
         return(0);
     }
 
@@ -1449,8 +1711,8 @@ char* sentinel_to_utc_datestring(const int sentinel_time) {
  **/
 
 char* seconds_to_hms(const int seconds) {
-    static int str_length = 60;
-    char* outstr = calloc(str_length, sizeof(char));
+    const int str_length = 60;
+    char* outstr = sentinel_calloc(str_length, sizeof(char));
     int hours    = seconds / 3600;
     int mins     = (seconds - hours * 3600) / 60;
     int secs     = seconds % 60;
@@ -1467,10 +1729,14 @@ void sentinel_sleep(const int msecs) {
     ts.tv_sec  = (msecs / 1000);
     ts.tv_nsec = (msecs % 1000) * 1000000;
 
+    sentinel_stats_t* stats = sentinel_get_stats();
+    stats->wakeups++;
+    stats->slept_ns += (long long) msecs * 1000000;
+
     while (nanosleep (&ts, &ts) != 0) {
         int errcode = errno;
         if (errcode != EINTR ) {
-            eprint("%s", "Something went wrong while nanosleeping");
+            sentinel_error("%s", "Something went wrong while nanosleeping");
         }
     }
 }
@@ -1481,7 +1747,7 @@ void sentinel_sleep(const int msecs) {
 
 char* restring(const char* old_str, const int old_len) {
     // Just initialize the new string
-    char* new_str = calloc(1, sizeof(char));
+    char* new_str = sentinel_calloc(1, sizeof(char));
 
     int i = 0;
     int j = 0;
@@ -1510,3 +1776,88 @@ char* restring(const char* old_str, const int old_len) {
 
     return(new_str);
 }
+
+/**
+ * sentinel_read: read() which keeps count of the calls and the bytes read, inside a context
+ *                the transport of the context is used
+ **/
+
+ssize_t sentinel_read(int fd, void* buf, size_t count) {
+    sentinel_stats_t* stats = sentinel_get_stats();
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+    ssize_t n = (ctx != NULL) ? ctx->transport.read(fd, buf, count, ctx->transport.data) : read(fd, buf, count);
+
+    stats->read_calls++;
+
+    if (n > 0)
+        stats->bytes_read += n;
+    else
+        stats->empty_reads++;
+
+    return(n);
+}
+
+/**
+ * sentinel_write: write() which keeps count of the bytes written, inside a context the
+ *                 transport of the context is used
+ **/
+
+ssize_t sentinel_write(int fd, const void* buf, size_t count) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+    ssize_t n = (ctx != NULL) ? ctx->transport.write(fd, buf, count, ctx->transport.data) : write(fd, buf, count);
+
+    if (n > 0)
+        sentinel_get_stats()->bytes_written += n;
+
+    return(n);
+}
+
+/**
+ * sentinel_malloc, sentinel_calloc, sentinel_realloc, sentinel_strdup, sentinel_free: All the
+ *                  allocations of the library go through these so that they can be counted,
+ *                  inside a context the allocator of the context is used
+ **/
+
+void* sentinel_malloc(size_t size) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+    sentinel_get_stats()->allocations++;
+    return((ctx != NULL) ? ctx->allocator.malloc(size, ctx->allocator.data) : malloc(size));
+}
+
+void* sentinel_calloc(size_t nmemb, size_t size) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+    sentinel_get_stats()->allocations++;
+    return((ctx != NULL) ? ctx->allocator.calloc(nmemb, size, ctx->allocator.data) : calloc(nmemb, size));
+}
+
+void* sentinel_realloc(void* ptr, size_t size) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+    sentinel_get_stats()->allocations++;
+    return((ctx != NULL) ? ctx->allocator.realloc(ptr, size, ctx->allocator.data) : realloc(ptr, size));
+}
+
+char* sentinel_strdup(const char* str) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+
+    if (ctx == NULL) {
+        sentinel_get_stats()->allocations++;
+        return(strdup(str));
+    }
+
+    const size_t len = strlen(str) + 1;
+    char* dup = sentinel_malloc(len);
+
+    if (dup != NULL)
+        memcpy(dup, str, len);
+
+    return(dup);
+}
+
+void sentinel_free(void* ptr) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+
+    if (ctx != NULL)
+        ctx->allocator.free(ptr, ctx->allocator.data);
+    else
+        free(ptr);
+}
@@ -0,0 +1,279 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <sys/resource.h>
+
+#include "libsentinel.h"
+
+/* One docked rebreather and the gateway thread syncing it */
+typedef struct load_device {
+    sentinel_emulator_t* emu;
+    pthread_t thread;
+    pthread_barrier_t* barrier;
+    bool ok;
+    int dives;
+    long bytes;
+    long long latency_ns; /* From connect to the last dive parsed */
+    long long cpu_ns; /* CPU time of the syncing thread */
+} load_device_t;
+
+void print_help(void) {
+    printf("Usage:\n");
+    printf("loadtest [-s <num>] [-m <num>] [-n <num>] [-r <num>] [-b <rate>] [-V <version>] | -h\n");
+    printf("-s <num> Number of rebreathers in the first round, default 1\n");
+    printf("-m <num> Maximum number of rebreathers, doubled every round from -s, default 256\n");
+    printf("-n <num> Number of dives on each rebreather, default 2\n");
+    printf("-r <num> Number of log lines in each dive, default 60\n");
+    printf("-b <rate> Line rate in bytes per second, 0 for unlimited, default 0\n");
+    printf("-V <version> Firmware version of the generated dives: V3.0C, V009A or V009B, default V009A\n");
+    printf("-h This help\n");
+    printf("\n");
+}
+
+/**
+ * load_thread_cpu_ns: CPU time used by the calling thread
+ **/
+
+static long long load_thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return((long long) ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/**
+ * load_sync_thread: Does a full sync of one rebreather in its own context the same way as
+ *                   download does, ie. connect, list and download every dive
+ **/
+
+static void* load_sync_thread(void* arg) {
+    load_device_t* dev = arg;
+    sentinel_ctx_t* ctx = sentinel_ctx_new(NULL);
+    int i = 0;
+
+    pthread_barrier_wait(dev->barrier);
+
+    if (ctx == NULL)
+        return(NULL);
+
+    const long long cpu_start = load_thread_cpu_ns();
+    const long long start     = sentinel_time_ns();
+
+    if (sentinel_ctx_connect(ctx, dev->emu->client_path, 20) && sentinel_ctx_list(ctx) && ctx->header_list != NULL) {
+        dev->ok = true;
+
+        for (i = 0; i < ctx->table.count; i++) {
+            if (sentinel_ctx_download(ctx, i))
+                dev->dives++;
+            else
+                dev->ok = false;
+        }
+    }
+
+    sentinel_ctx_disconnect(ctx);
+
+    dev->latency_ns = sentinel_time_ns() - start;
+    dev->cpu_ns     = load_thread_cpu_ns() - cpu_start;
+    dev->bytes      = sentinel_ctx_stats(ctx)->bytes_read;
+
+    sentinel_ctx_free(ctx);
+
+    return(NULL);
+}
+
+/**
+ * load_compare_latency: qsort comparator for the latencies
+ **/
+
+static int load_compare_latency(const void* a, const void* b) {
+    const long long x = *(const long long*) a;
+    const long long y = *(const long long*) b;
+    return((x > y) - (x < y));
+}
+
+/**
+ * load_round: Syncs count rebreathers at once and prints one row of results
+ **/
+
+static bool load_round(const sentinel_emulator_config_t* config, const int count) {
+    load_device_t* dev = calloc(count, sizeof(load_device_t));
+    long long* latency = calloc(count, sizeof(long long));
+    pthread_barrier_t barrier;
+    sentinel_emulator_config_t emu_config = *config;
+    bool res = true;
+    int i = 0;
+
+    if (dev == NULL || latency == NULL) {
+        eprint("%s", "Failed to allocate the devices");
+        free(dev);
+        free(latency);
+        return(false);
+    }
+
+    for (i = 0; i < count; i++) {
+        emu_config.generator.seed = config->generator.seed + i * 1000;
+        dev[i].emu = sentinel_emulator_start_pty(&emu_config);
+
+        if (dev[i].emu == NULL) {
+            eprint("Failed to start emulator %d, out of ptys or file descriptors?", i);
+            res = false;
+            break;
+        }
+    }
+
+    if (res) {
+        struct rusage usage_start, usage_end;
+        long bytes = 0;
+        long long cpu = 0;
+        int ok = 0;
+
+        /* The main thread joins the barrier too, so that the clock starts when all are ready */
+        pthread_barrier_init(&barrier, NULL, count + 1);
+
+        for (i = 0; i < count; i++) {
+            dev[i].barrier = &barrier;
+
+            /* The threads already started would wait on the barrier forever */
+            if (pthread_create(&dev[i].thread, NULL, load_sync_thread, &dev[i]) != 0) {
+                eprint("Failed to start sync thread %d", i);
+                exit(1);
+            }
+        }
+
+        getrusage(RUSAGE_SELF, &usage_start);
+        pthread_barrier_wait(&barrier);
+        const long long start = sentinel_time_ns();
+
+        for (i = 0; i < count; i++) {
+            pthread_join(dev[i].thread, NULL);
+            latency[i] = dev[i].latency_ns;
+            bytes     += dev[i].bytes;
+            cpu       += dev[i].cpu_ns;
+            ok        += dev[i].ok ? 1 : 0;
+        }
+
+        const double wall = (sentinel_time_ns() - start) / 1e9;
+        getrusage(RUSAGE_SELF, &usage_end);
+
+        /* The process CPU includes the emulators, the sync threads alone are the library */
+        const double process_cpu = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) +
+                                   (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) +
+                                   (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1e6 +
+                                   (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1e6;
+
+        qsort(latency, count, sizeof(long long), load_compare_latency);
+
+        printf("%7d %5d %10ld %9.2lf %10.1lf %9.0lf %9.0lf %9.0lf %9.0lf %10.2lf %10.2lf\n",
+               count, ok, bytes, wall, bytes / 1024.0 / wall,
+               latency[count / 2] / 1e6, latency[(count * 95) / 100] / 1e6,
+               latency[(count * 99) / 100] / 1e6, latency[count - 1] / 1e6,
+               (bytes > 0) ? cpu / 1e3 / (bytes / 1024.0) : 0.0,
+               (bytes > 0) ? process_cpu * 1e6 / (bytes / 1024.0) : 0.0);
+        fflush(stdout);
+        pthread_barrier_destroy(&barrier);
+    }
+
+    for (i = 0; i < count; i++) {
+        sentinel_emulator_free(dev[i].emu);
+    }
+
+    free(dev);
+    free(latency);
+
+    return(res);
+}
+
+int main(int argc, char **argv) {
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+    struct rlimit limit;
+    int first = 1;
+    int max = 256;
+    int count = 0;
+    int c = 0;
+    int i = 0;
+
+    config.generated_dives   = 2;
+    config.generator.records = 60;
+    config.line_rate         = 0;
+    config.idle_interval_ms  = 100;
+    opterr = 0;
+
+    /* Every connect warns about the RTS line of the pty */
+    sentinel_set_log_level(SENTINEL_LOG_ERROR);
+
+    while ((c = getopt (argc, argv, "b:hm:n:r:s:V:")) != -1)
+        switch (c) {
+        case 'b': /* Line rate */
+            config.line_rate = atoi(optarg);
+            break;
+        case 'm': /* Maximum number of rebreathers */
+            max = atoi(optarg);
+            break;
+        case 'n': /* Dives per rebreather */
+            config.generated_dives = atoi(optarg);
+            break;
+        case 'r': /* Log lines per dive */
+            config.generator.records = atoi(optarg);
+            break;
+        case 's': /* Number of rebreathers in the first round */
+            first = atoi(optarg);
+            break;
+        case 'V': /* Firmware version */
+            config.generator.firmware = SENTINEL_FW_UNKNOWN;
+
+            for (i = SENTINEL_FW_UNKNOWN + 1; i < SENTINEL_FW_COUNT; i++) {
+                if (strcmp(optarg, SENTINEL_FIRMWARE_NAME[i]) == 0)
+                    config.generator.firmware = i;
+            }
+
+            break;
+        case 'h': /* Print help and exit */
+        default:
+            print_help();
+            exit(0);
+        }
+
+    if (first < 1 || max < first) {
+        eprint("Invalid range of rebreathers: %d - %d", first, max);
+        exit(1);
+    }
+
+    /* Every rebreather takes five descriptors, the emulator side and the library side */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    printf("Firmware: %s dives per rebreather: %d log lines: %d line rate: %d B/s\n",
+           SENTINEL_FIRMWARE_NAME[config.generator.firmware], config.generated_dives,
+           config.generator.records, config.line_rate);
+    printf("%7s %5s %10s %9s %10s %9s %9s %9s %9s %10s %10s\n", "devices", "ok", "bytes", "wall s", "KiB/s",
+           "p50 ms", "p95 ms", "p99 ms", "max ms", "lib us/KiB", "all us/KiB");
+
+    for (count = first; ; count = (count * 2 < max) ? count * 2 : max) {
+        if (!load_round(&config, count))
+            exit(1);
+
+        if (count == max)
+            break;
+    }
+
+    return(0);
+}
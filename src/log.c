@@ -0,0 +1,94 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+/* Checked by the logging macros before anything is formatted */
+int sentinel_log_level = SENTINEL_LOG_WARN;
+
+static sentinel_log_sink_t log_sink = NULL;
+static void* log_sink_data = NULL;
+
+static const char* LOG_LEVEL_NAME[] = {
+    "NONE",
+    BOLD KRED "ERROR",
+    BOLD KMAG "WARNING",
+    BOLD KGRN "INFO",
+    BOLD KYEL "DEBUG",
+    BOLD KCYN "TRACE"
+};
+
+/**
+ * sentinel_default_log_sink: Writes the message to stderr in the same format as eprint and dprint
+ **/
+
+static void sentinel_default_log_sink(int level, const char* file, const char* func, int line, const char* message, void* data) {
+    (void) data;
+    fprintf(stderr, "%s: %s: %s: %d:" RESET " %s\n", LOG_LEVEL_NAME[level], file, func, line, message);
+}
+
+/**
+ * sentinel_set_log_level: Sets the most verbose level which is still logged. Levels above
+ *                         SENTINEL_LOG_MAX_LEVEL have been compiled out and can not be enabled
+ **/
+
+void sentinel_set_log_level(const int level) {
+    if (level < SENTINEL_LOG_NONE)
+        sentinel_log_level = SENTINEL_LOG_NONE;
+    else if (level > SENTINEL_LOG_TRACE)
+        sentinel_log_level = SENTINEL_LOG_TRACE;
+    else
+        sentinel_log_level = level;
+}
+
+/**
+ * sentinel_set_log_sink: Installs a function which receives all the log messages of the library,
+ *                        NULL restores the default which writes to stderr
+ **/
+
+void sentinel_set_log_sink(sentinel_log_sink_t sink, void* data) {
+    log_sink      = sink;
+    log_sink_data = data;
+}
+
+/**
+ * sentinel_log_write: Formats the message and hands it to the sink of the current context or the
+ *                     library. This is only called by the logging macros once they have checked
+ *                     that the level is enabled
+ **/
+
+void sentinel_log_write(int level, const char* file, const char* func, int line, const char* format, ...) {
+    char message[1024];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+
+    if (ctx != NULL && ctx->log_sink != NULL)
+        ctx->log_sink(level, file, func, line, message, ctx->log_sink_data);
+    else if (log_sink != NULL)
+        log_sink(level, file, func, line, message, log_sink_data);
+    else
+        sentinel_default_log_sink(level, file, func, line, message, NULL);
+}
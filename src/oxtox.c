@@ -0,0 +1,170 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <pthread.h>
+
+#include "libsentinel.h"
+
+/* NOAA single exposure limits in minutes, from 0.6 to 1.6 bar in 0.1 bar steps */
+static const double NOAA_CNS_LIMIT_MIN[11] = {
+    720.0, 570.0, 450.0, 360.0, 300.0, 240.0, 210.0, 180.0, 150.0, 120.0, 45.0
+};
+
+static const double SENTINEL_CNS_HALFTIME_MIN = 90.0; /* Surface elimination of CNS */
+
+/* The po2 is recorded in hundredths of a bar, so a table with one entry per
+ * hundredth gives the exact value for every possible record */
+static double cns_per_second[SENTINEL_OXTOX_TABLE_SIZE];
+static double otu_per_second[SENTINEL_OXTOX_TABLE_SIZE];
+static pthread_once_t oxtox_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * sentinel_oxtox_build_tables: Fills the CNS and OTU rate tables, this is where all the pow()
+ *                              and exp() calls happen, once per process
+ **/
+
+static void sentinel_oxtox_build_tables(void) {
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_OXTOX_TABLE_SIZE; i++) {
+        const double po2 = i / 100.0;
+        double limit = 0.0;
+
+        if (po2 <= 0.5) {
+            cns_per_second[i] = 0.0;
+            otu_per_second[i] = 0.0;
+            continue;
+        }
+
+        if (po2 <= 0.6) {
+            limit = NOAA_CNS_LIMIT_MIN[0];
+        } else if (po2 <= 1.6) {
+            /* Linear interpolation between the NOAA table points */
+            const int idx = (i - 60) / 10;
+            const double frac = ((i - 60) % 10) / 10.0;
+            limit = NOAA_CNS_LIMIT_MIN[idx];
+
+            if (idx < 10)
+                limit += (NOAA_CNS_LIMIT_MIN[idx + 1] - NOAA_CNS_LIMIT_MIN[idx]) * frac;
+        } else {
+            /* Beyond the table, continue the 1.5 to 1.6 bar decay exponentially */
+            const double k = log(NOAA_CNS_LIMIT_MIN[9] / NOAA_CNS_LIMIT_MIN[10]) / 0.1;
+            limit = NOAA_CNS_LIMIT_MIN[10] * exp(-k * (po2 - 1.6));
+        }
+
+        cns_per_second[i] = 100.0 / (limit * 60.0);
+        otu_per_second[i] = pow((po2 - 0.5) / 0.5, 0.83) / 60.0;
+    }
+}
+
+/**
+ * sentinel_oxtox_init: Initializes the running oxygen exposure for a dive with the given record
+ *                      interval in seconds
+ **/
+
+void sentinel_oxtox_init(sentinel_oxtox_t* oxtox, const int interval) {
+    pthread_once(&oxtox_table_once, sentinel_oxtox_build_tables);
+
+    oxtox->interval  = interval;
+    oxtox->cns       = 0.0;
+    oxtox->otu       = 0.0;
+    oxtox->records   = 0;
+    oxtox->cns_decay = exp(-interval * M_LN2 / (SENTINEL_CNS_HALFTIME_MIN * 60.0));
+}
+
+/**
+ * sentinel_oxtox_update_raw: Adds one record interval at the given pO2 in hundredths of a bar,
+ *                            which is how the value is sent by the rebreather
+ **/
+
+void sentinel_oxtox_update_raw(sentinel_oxtox_t* oxtox, int po2_cbar) {
+    if (po2_cbar < 0)
+        po2_cbar = 0;
+
+    if (po2_cbar >= SENTINEL_OXTOX_TABLE_SIZE)
+        po2_cbar = SENTINEL_OXTOX_TABLE_SIZE - 1;
+
+    if (po2_cbar <= 50) {
+        oxtox->cns *= oxtox->cns_decay;
+    } else {
+        oxtox->cns += cns_per_second[po2_cbar] * oxtox->interval;
+        oxtox->otu += otu_per_second[po2_cbar] * oxtox->interval;
+    }
+
+    oxtox->records++;
+}
+
+/**
+ * sentinel_oxtox_update: Adds one record interval at the given pO2 in bar
+ **/
+
+void sentinel_oxtox_update(sentinel_oxtox_t* oxtox, const double po2) {
+    sentinel_oxtox_update_raw(oxtox, (int) lround(po2 * 100.0));
+}
+
+/**
+ * sentinel_oxtox_dive: Computes the CNS and OTU of the whole downloaded dive. If cns or otu
+ *                      are not NULL, then the running values after each log line are stored
+ *                      in them, they need to have room for all the log lines
+ **/
+
+bool sentinel_oxtox_dive(const sentinel_header_t* header, sentinel_oxtox_t* oxtox, double* cns, double* otu) {
+    int i = 0;
+
+    if (header == NULL || oxtox == NULL) {
+        sentinel_error("%s", "Received NULL header or oxtox");
+        return(false);
+    }
+
+    if (header->log == NULL) {
+        sentinel_error("%s", "The dive has no log, download it first");
+        return(false);
+    }
+
+    sentinel_oxtox_init(oxtox, header->record_interval);
+
+    while (header->log[i] != NULL) {
+        sentinel_oxtox_update(oxtox, header->log[i]->po2);
+
+        if (cns != NULL) cns[i] = oxtox->cns;
+        if (otu != NULL) otu[i] = oxtox->otu;
+
+        i++;
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_oxtox_matches_header: Compares the computed values to those reported by the rebreather
+ *                                in the header, returns false if either differs more than allowed
+ **/
+
+bool sentinel_oxtox_matches_header(const sentinel_header_t* header, const sentinel_oxtox_t* oxtox,
+                                   const double cns_tolerance, const double otu_tolerance) {
+    if (fabs(header->cns - oxtox->cns) > cns_tolerance)
+        return(false);
+
+    if (fabs(header->otu - oxtox->otu) > otu_tolerance)
+        return(false);
+
+    return(true);
+}
@@ -0,0 +1,218 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+/**
+ * sentinel_pyramid_value: The value of the column in the record, in the units of sentinel_dive_log_line_t
+ **/
+
+static double sentinel_pyramid_value(const sentinel_record_t* record, const sentinel_pyramid_column_t column) {
+    switch (column) {
+    case SENTINEL_PYRAMID_DEPTH:
+        return(sentinel_record_depth(record));
+    case SENTINEL_PYRAMID_PO2:
+        return(sentinel_record_po2(record));
+    case SENTINEL_PYRAMID_CELL1:
+        return(sentinel_record_cell_o2(record, 0));
+    case SENTINEL_PYRAMID_CELL2:
+        return(sentinel_record_cell_o2(record, 1));
+    case SENTINEL_PYRAMID_CELL3:
+        return(sentinel_record_cell_o2(record, 2));
+    case SENTINEL_PYRAMID_SETPOINT:
+        return(sentinel_record_setpoint(record));
+    case SENTINEL_PYRAMID_TEMPERATURE:
+        return(record->temperature);
+    default:
+        return(0.0);
+    }
+}
+
+/**
+ * sentinel_pyramid_records_in: Number of records in the given bucket, only the last one can be short
+ **/
+
+static int sentinel_pyramid_records_in(const int records, const int bucket_size, const int idx) {
+    const int left = records - idx * bucket_size;
+
+    return((left < bucket_size) ? left : bucket_size);
+}
+
+/**
+ * sentinel_pyramid_build: Builds the pyramid of the records, each level from the one below it, so
+ *                         the whole pyramid takes about as many buckets as there are records
+ **/
+
+sentinel_pyramid_t* sentinel_pyramid_build(const sentinel_record_t* records, const int count, const int interval) {
+    int levels = 0;
+    int total = 0;
+    int size = 2;
+    int c = 0;
+    int i = 0;
+    int l = 0;
+
+    if (records == NULL || count < 2) {
+        sentinel_error("%s", "A pyramid needs at least two records");
+        return(NULL);
+    }
+
+    for (size = 2; ; size *= 2) {
+        levels++;
+        total += (count + size - 1) / size;
+
+        if (size >= count)
+            break;
+    }
+
+    sentinel_pyramid_t* pyramid = sentinel_calloc(1, sizeof(sentinel_pyramid_t));
+
+    if (pyramid == NULL)
+        return(NULL);
+
+    pyramid->records         = count;
+    pyramid->record_interval = interval;
+    pyramid->levels          = levels;
+    pyramid->level           = sentinel_calloc(levels, sizeof(sentinel_pyramid_level_t));
+
+    /* The buckets of every level and column are in one allocation, freed with the first one */
+    sentinel_bucket_t* buckets = sentinel_malloc(total * SENTINEL_PYRAMID_COLUMNS * sizeof(sentinel_bucket_t));
+
+    if (pyramid->level == NULL || buckets == NULL) {
+        sentinel_free(buckets);
+        sentinel_pyramid_free(pyramid);
+        return(NULL);
+    }
+
+    for (l = 0, size = 2; l < levels; l++, size *= 2) {
+        sentinel_pyramid_level_t* level = &pyramid->level[l];
+
+        level->bucket_size = size;
+        level->count       = (count + size - 1) / size;
+
+        for (c = 0; c < SENTINEL_PYRAMID_COLUMNS; c++) {
+            level->bucket[c] = buckets;
+            buckets += level->count;
+        }
+    }
+
+    /* The first level straight from the records */
+    for (c = 0; c < SENTINEL_PYRAMID_COLUMNS; c++) {
+        sentinel_bucket_t* bucket = pyramid->level[0].bucket[c];
+
+        for (i = 0; i < count; i += 2) {
+            const double a = sentinel_pyramid_value(&records[i], c);
+            const double b = (i + 1 < count) ? sentinel_pyramid_value(&records[i + 1], c) : a;
+
+            bucket[i / 2].min  = (a < b) ? a : b;
+            bucket[i / 2].max  = (a > b) ? a : b;
+            bucket[i / 2].mean = (a + b) / 2.0;
+        }
+    }
+
+    /* The rest by merging pairs of the buckets below, the mean weighted by the records in each */
+    for (l = 1; l < levels; l++) {
+        const sentinel_pyramid_level_t* below = &pyramid->level[l - 1];
+        sentinel_pyramid_level_t* level = &pyramid->level[l];
+
+        for (c = 0; c < SENTINEL_PYRAMID_COLUMNS; c++) {
+            for (i = 0; i < level->count; i++) {
+                const sentinel_bucket_t* a = &below->bucket[c][2 * i];
+                sentinel_bucket_t* bucket  = &level->bucket[c][i];
+
+                if (2 * i + 1 >= below->count) {
+                    *bucket = *a;
+                    continue;
+                }
+
+                const sentinel_bucket_t* b = &below->bucket[c][2 * i + 1];
+                const int na = sentinel_pyramid_records_in(count, below->bucket_size, 2 * i);
+                const int nb = sentinel_pyramid_records_in(count, below->bucket_size, 2 * i + 1);
+
+                bucket->min  = (a->min < b->min) ? a->min : b->min;
+                bucket->max  = (a->max > b->max) ? a->max : b->max;
+                bucket->mean = ((double) a->mean * na + (double) b->mean * nb) / (na + nb);
+            }
+        }
+    }
+
+    return(pyramid);
+}
+
+/**
+ * sentinel_pyramid_dive: Builds the pyramid of a downloaded dive, build it once and keep it with
+ *                        the dive
+ **/
+
+sentinel_pyramid_t* sentinel_pyramid_dive(const sentinel_header_t* header) {
+    sentinel_record_t* records = NULL;
+
+    if (header == NULL || header->log == NULL) {
+        sentinel_error("%s", "The dive has no log, download it first");
+        return(NULL);
+    }
+
+    const int count = sentinel_records_from_log(header->log, &records);
+
+    if (count < 0)
+        return(NULL);
+
+    sentinel_pyramid_t* pyramid = sentinel_pyramid_build(records, count, header->record_interval);
+
+    sentinel_free(records);
+
+    return(pyramid);
+}
+
+/**
+ * sentinel_pyramid_level: Returns the most detailed level with at most max_buckets buckets, eg. the
+ *                         width of the plot in pixels. NULL when all the records fit, in which
+ *                         case plot the records themselves
+ **/
+
+const sentinel_pyramid_level_t* sentinel_pyramid_level(const sentinel_pyramid_t* pyramid, const int max_buckets) {
+    int l = 0;
+
+    if (pyramid->records <= max_buckets)
+        return(NULL);
+
+    for (l = 0; l < pyramid->levels - 1; l++) {
+        if (pyramid->level[l].count <= max_buckets)
+            break;
+    }
+
+    return(&pyramid->level[l]);
+}
+
+/**
+ * sentinel_pyramid_free: Frees the pyramid and its buckets
+ **/
+
+void sentinel_pyramid_free(sentinel_pyramid_t* pyramid) {
+    if (pyramid == NULL)
+        return;
+
+    if (pyramid->level != NULL) {
+        sentinel_free(pyramid->level[0].bucket[0]);
+        sentinel_free(pyramid->level);
+    }
+
+    sentinel_free(pyramid);
+}
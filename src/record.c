@@ -0,0 +1,476 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include "libsentinel.h"
+
+/**
+ * sentinel_field_value: Parses the integer of a field which is not null-terminated
+ **/
+
+static long sentinel_field_value(const char* field, size_t len) {
+    bool negative = false;
+    long value = 0;
+    size_t i = 0;
+
+    if (len > 0 && field[0] == '-') {
+        negative = true;
+        i++;
+    }
+
+    for (; i < len && field[i] >= '0' && field[i] <= '9'; i++) {
+        value = value * 10 + (field[i] - '0');
+
+        if (value > 0xffff)
+            break;
+    }
+
+    return(negative ? -value : value);
+}
+
+/**
+ * sentinel_prefixed_value: Parses the integer of a field which starts with a letter, like A749
+ **/
+
+static long sentinel_prefixed_value(const char* field, size_t len) {
+    return((len > 0) ? sentinel_field_value(field + 1, len - 1) : 0);
+}
+
+/**
+ * sentinel_clamp_u16: Clamps a value to the range of an unsigned field of a record
+ **/
+
+uint16_t sentinel_clamp_u16(const long value) {
+    return((value < 0) ? 0 : (value > UINT16_MAX) ? UINT16_MAX : (uint16_t) value);
+}
+
+/**
+ * sentinel_clamp_s16: Clamps a value to the range of a signed field of a record
+ **/
+
+int16_t sentinel_clamp_s16(const long value) {
+    return((value < INT16_MIN) ? INT16_MIN : (value > INT16_MAX) ? INT16_MAX : (int16_t) value);
+}
+
+/**
+ * sentinel_dive_layout: Returns the record layout of the firmware on the ver= line of the dive
+ *                       header, which ends where the profile starts. Returns NULL if the firmware
+ *                       is not supported
+ **/
+
+const sentinel_record_layout_t* sentinel_dive_layout(const char* header, size_t len) {
+    const char* ver = memmem(header, len, "ver=", 4);
+    char version[16];
+    size_t version_len = 0;
+
+    if (ver != NULL) {
+        const char* end = header + len;
+        const char* eol = NULL;
+
+        ver += 4;
+        eol  = memmem(ver, end - ver, SENTINEL_LINE_SEPARATOR, sizeof(SENTINEL_LINE_SEPARATOR));
+        version_len = ((eol != NULL) ? eol : end) - ver;
+
+        if (version_len >= sizeof(version))
+            version_len = sizeof(version) - 1;
+
+        memcpy(version, ver, version_len);
+    }
+
+    version[version_len] = 0;
+
+    const sentinel_record_layout_t* layout = sentinel_record_layout(sentinel_firmware_from_version(version));
+
+    if (layout == NULL)
+        sentinel_error("Unsupported firmware version: %s", (version_len > 0) ? version : "none");
+
+    return(layout);
+}
+
+/**
+ * parse_sentinel_record: Parses a log line, without the line separator, straight into a compact
+ *                        record in the layout of the firmware of the dive. The fields are read in
+ *                        the same order as parse_sentinel_log_line reads them, but nothing is
+ *                        allocated
+ **/
+
+bool parse_sentinel_record(const sentinel_record_layout_t* layout, sentinel_record_t* record, const char* linestr, size_t len) {
+    const char* field[SENTINEL_MAX_FIELDS];
+    size_t field_len[SENTINEL_MAX_FIELDS];
+    const char* end = linestr + len;
+    const char* p = linestr;
+    int count = 0;
+    int i = 0;
+    int j = 0;
+
+    while (p <= end && count < SENTINEL_MAX_FIELDS) {
+        const char* comma = memchr(p, ',', end - p);
+
+        if (comma == NULL)
+            comma = end;
+
+        field[count]     = p;
+        field_len[count] = comma - p;
+        count++;
+        p = comma + 1;
+    }
+
+    if (count < 16 || field_len[0] < 2 || linestr[0] != 'R')
+        return(false);
+
+    memset(record, 0, sizeof(sentinel_record_t));
+
+    record->time_idx         = sentinel_clamp_u16(sentinel_prefixed_value(field[0], field_len[0]));
+    record->depth            = sentinel_clamp_u16(sentinel_field_value(field[1], field_len[1]));
+    record->po2              = sentinel_clamp_u16(sentinel_field_value(field[3], field_len[3]));
+    record->temperature      = sentinel_clamp_s16(sentinel_prefixed_value(field[5], field_len[5]));
+    record->scrubber         = sentinel_clamp_s16(sentinel_prefixed_value(field[6], field_len[6]));
+    record->battery[0]       = sentinel_clamp_u16(sentinel_prefixed_value(field[7], field_len[7]));
+    record->battery[1]       = sentinel_clamp_u16(sentinel_prefixed_value(field[8], field_len[8]));
+    record->diluent_pressure = sentinel_clamp_s16(sentinel_prefixed_value(field[9], field_len[9]));
+    record->o2_pressure      = sentinel_clamp_s16(sentinel_prefixed_value(field[10], field_len[10]));
+    record->cell_o2[0]       = sentinel_clamp_u16(sentinel_prefixed_value(field[11], field_len[11]));
+    record->cell_o2[1]       = sentinel_clamp_u16(sentinel_prefixed_value(field[12], field_len[12]));
+    record->cell_o2[2]       = sentinel_clamp_u16(sentinel_prefixed_value(field[13], field_len[13]));
+    record->setpoint         = sentinel_clamp_u16(sentinel_prefixed_value(field[14], field_len[14]));
+    record->ceiling          = sentinel_clamp_s16(sentinel_prefixed_value(field[15], field_len[15]));
+
+    /* Notes until the first tempstick field, or until the end of the line without a tempstick */
+    for (i = 16; i < count && (!layout->tempstick || field_len[i] == 0 || field[i][0] != 'S'); i++) {
+        if (j < 3)
+            record->note[j++] = sentinel_note_code(field[i], field_len[i]);
+    }
+
+    if (!layout->tempstick)
+        return(true);
+
+    for (j = 0; j < 8 && i + j < count; j++) {
+        record->tempstick[j] = sentinel_clamp_s16(sentinel_prefixed_value(field[i + j], field_len[i + j]));
+    }
+
+    if (i + layout->co2 < count)
+        record->co2 = sentinel_clamp_u16(sentinel_prefixed_value(field[i + layout->co2], field_len[i + layout->co2]));
+
+    return(true);
+}
+
+/**
+ * sentinel_profile_next_line: Finds the next non-empty line at *line, which ends at the line
+ *                             separator or at end. Sets *line to the start of the line and len to
+ *                             its length without the separator, and returns where the line after it
+ *                             starts, never past end. A last line without the separator ends at end.
+ *                             Returns NULL at the End line, with *line at it, or at end
+ **/
+
+const char* sentinel_profile_next_line(const char** line, const char* end, size_t* len) {
+    const char* p = *line;
+
+    while (p < end) {
+        const char* eol = memmem(p, end - p, SENTINEL_LINE_SEPARATOR, sizeof(SENTINEL_LINE_SEPARATOR));
+
+        if (eol == NULL)
+            eol = end;
+
+        if (eol > p) {
+            *line = p;
+            *len  = eol - p;
+
+            if (*len >= 3 && strncmp(p, "End", 3) == 0)
+                return(NULL);
+
+            return((eol < end) ? eol + sizeof(SENTINEL_LINE_SEPARATOR) : end);
+        }
+
+        p = (eol < end) ? eol + sizeof(SENTINEL_LINE_SEPARATOR) : end;
+    }
+
+    *line = end;
+    *len  = 0;
+
+    return(NULL);
+}
+
+/**
+ * parse_sentinel_dive_records: Parses the profile of a dive, as received or read from a dump file,
+ *                              into an allocated array of records. Returns the number of records,
+ *                              -1 if there is no profile, the firmware is not supported or the
+ *                              allocation fails
+ **/
+
+int parse_sentinel_dive_records(const char* text, size_t len, sentinel_record_t** records) {
+    const long long parse_start = sentinel_time_ns();
+    const char* profile = memmem(text, len, "Profile\r\n", 9);
+    int count = 0;
+    int size = 0;
+
+    *records = NULL;
+
+    if (profile == NULL) {
+        sentinel_error("%s", "Received dive without a profile");
+        return(-1);
+    }
+
+    const sentinel_record_layout_t* layout = sentinel_dive_layout(text, profile - text);
+
+    if (layout == NULL)
+        return(-1);
+
+    const char* line = profile + 9;
+    const char* end  = text + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    while ((next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        if (count == size) {
+            size = (size > 0) ? size * 2 : 256;
+            sentinel_record_t* tmp = sentinel_realloc(*records, size * sizeof(sentinel_record_t));
+
+            if (tmp == NULL) {
+                sentinel_free(*records);
+                *records = NULL;
+                return(-1);
+            }
+
+            *records = tmp;
+        }
+
+        if (parse_sentinel_record(layout, &(*records)[count], line, line_len))
+            count++;
+        else
+            sentinel_error("Unable to parse log line: %.*s", (int) line_len, line);
+
+        line = next;
+    }
+
+    sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+
+    return(count);
+}
+
+/**
+ * sentinel_record_from_log_line: Converts a log line back to the units of the rebreather
+ **/
+
+void sentinel_record_from_log_line(sentinel_record_t* record, const sentinel_dive_log_line_t* line) {
+    int i = 0;
+
+    memset(record, 0, sizeof(sentinel_record_t));
+
+    record->time_idx         = sentinel_clamp_u16(line->time_idx);
+    record->depth            = sentinel_clamp_u16(lround(line->depth * 64.0 / 6.0));
+    record->po2              = sentinel_clamp_u16(lround(line->po2 * 100.0));
+    record->temperature      = sentinel_clamp_s16(line->temperature);
+    record->scrubber         = sentinel_clamp_s16(lround(line->scrubber_left * 10.0));
+    record->battery[0]       = sentinel_clamp_u16(lround(line->primary_battery_V * 100.0));
+    record->battery[1]       = sentinel_clamp_u16(lround(line->secondary_battery_V * 100.0));
+    record->diluent_pressure = sentinel_clamp_s16(line->diluent_pressure);
+    record->o2_pressure      = sentinel_clamp_s16(line->o2_pressure);
+    record->setpoint         = sentinel_clamp_u16(lround(line->setpoint * 100.0));
+    record->ceiling          = sentinel_clamp_s16(line->ceiling);
+    record->co2              = sentinel_clamp_u16(lround(line->co2));
+
+    for (i = 0; i < 3; i++) {
+        record->cell_o2[i] = sentinel_clamp_u16(lround(line->cell_o2[i] * 100.0));
+    }
+
+    for (i = 0; i < 8; i++) {
+        record->tempstick[i] = sentinel_clamp_s16(lround(line->tempstick_value[i] * 10.0));
+    }
+
+    for (i = 0; i < 3 && line->note != NULL && line->note[i] != NULL; i++) {
+        record->note[i] = (line->note[i]->note != NULL) ?
+                          sentinel_note_code(line->note[i]->note, strlen(line->note[i]->note)) : SENTINEL_NOTE_UNKNOWN;
+    }
+}
+
+/**
+ * sentinel_record_to_log_line: Converts a record to a log line, which allocates the time string
+ *                              and the notes like parse_sentinel_log_line does. An unknown note
+ *                              comes back as UNKNOWN, as the original text is not kept
+ **/
+
+bool sentinel_record_to_log_line(const sentinel_record_t* record, const int interval, sentinel_dive_log_line_t* line) {
+    int i = 0;
+
+    *line = DEFAULT_LOG_LINE;
+
+    line->time_idx            = record->time_idx;
+    line->time_s              = sentinel_record_time_s(record, interval);
+    line->time_string         = seconds_to_hms(line->time_s);
+    line->depth               = sentinel_record_depth(record);
+    line->po2                 = sentinel_record_po2(record);
+    line->temperature         = record->temperature;
+    line->scrubber_left       = sentinel_record_scrubber_left(record);
+    line->primary_battery_V   = sentinel_record_battery_V(record, 0);
+    line->secondary_battery_V = sentinel_record_battery_V(record, 1);
+    line->diluent_pressure    = record->diluent_pressure;
+    line->o2_pressure         = record->o2_pressure;
+    line->setpoint            = sentinel_record_setpoint(record);
+    line->ceiling             = record->ceiling;
+    line->co2                 = record->co2;
+
+    for (i = 0; i < 3; i++) {
+        line->cell_o2[i] = sentinel_record_cell_o2(record, i);
+    }
+
+    for (i = 0; i < 8; i++) {
+        line->tempstick_value[i] = sentinel_record_tempstick(record, i);
+    }
+
+    for (i = 0; i < 3 && record->note[i] != 0; i++) {
+        line->note = resize_sentinel_note_list(line->note, i + 1);
+
+        if (line->note == NULL)
+            return(false);
+
+        line->note[i] = alloc_sentinel_note();
+
+        if (line->note[i] == NULL)
+            return(false);
+
+        get_sentinel_note(line->note[i], (record->note[i] <= SENTINEL_NOTE_COUNT) ?
+                          (char*) SENTINEL_NOTES[record->note[i] - 1].note : "UNKNOWN");
+    }
+
+    return(line->time_string != NULL);
+}
+
+/**
+ * sentinel_records_from_log: Converts a NULL-terminated log into an allocated array of records,
+ *                            returns the number of records or -1 if the allocation fails
+ **/
+
+int sentinel_records_from_log(sentinel_dive_log_line_t** log, sentinel_record_t** records) {
+    int count = 0;
+    int i = 0;
+
+    *records = NULL;
+
+    while (log != NULL && log[count] != NULL) {
+        count++;
+    }
+
+    if (count == 0)
+        return(0);
+
+    *records = sentinel_malloc(count * sizeof(sentinel_record_t));
+
+    if (*records == NULL)
+        return(-1);
+
+    for (i = 0; i < count; i++) {
+        sentinel_record_from_log_line(&(*records)[i], log[i]);
+    }
+
+    return(count);
+}
+
+/**
+ * sentinel_records_to_log: Converts records into a NULL-terminated log for the callers of the
+ *                          header->log, free it with free_sentinel_log_list
+ **/
+
+sentinel_dive_log_line_t** sentinel_records_to_log(const sentinel_record_t* records, const int count, const int interval) {
+    sentinel_dive_log_line_t** log = sentinel_calloc(count + 1, sizeof(sentinel_dive_log_line_t*));
+    int i = 0;
+
+    if (log == NULL)
+        return(NULL);
+
+    for (i = 0; i < count; i++) {
+        log[i] = alloc_sentinel_dive_log_line();
+
+        if (log[i] == NULL || !sentinel_record_to_log_line(&records[i], interval, log[i])) {
+            if (log[i] != NULL)
+                free_sentinel_log(log[i]);
+
+            log[i] = NULL;
+            free_sentinel_log_list(log);
+            return(NULL);
+        }
+    }
+
+    return(log);
+}
+
+/**
+ * sentinel_record_time_s: Seconds since the start of the dive
+ **/
+
+int sentinel_record_time_s(const sentinel_record_t* record, const int interval) {
+    return(record->time_idx * interval);
+}
+
+/**
+ * sentinel_record_depth: Depth in meters, see parse_sentinel_log_line
+ **/
+
+double sentinel_record_depth(const sentinel_record_t* record) {
+    return((record->depth * 6) / 64.0);
+}
+
+/**
+ * sentinel_record_po2: pO2 in bar
+ **/
+
+double sentinel_record_po2(const sentinel_record_t* record) {
+    return(record->po2 / 100.0);
+}
+
+/**
+ * sentinel_record_scrubber_left: Scrubber left in percent
+ **/
+
+double sentinel_record_scrubber_left(const sentinel_record_t* record) {
+    return(record->scrubber / 10.0);
+}
+
+/**
+ * sentinel_record_battery_V: Battery voltage of the primary (0) or the secondary (1) handset
+ **/
+
+double sentinel_record_battery_V(const sentinel_record_t* record, const int handset) {
+    return(record->battery[handset] / 100.0);
+}
+
+/**
+ * sentinel_record_cell_o2: pO2 of the given cell, 0 - 2, in bar
+ **/
+
+double sentinel_record_cell_o2(const sentinel_record_t* record, const int cell) {
+    return(record->cell_o2[cell] / 100.0);
+}
+
+/**
+ * sentinel_record_setpoint: Setpoint in bar
+ **/
+
+double sentinel_record_setpoint(const sentinel_record_t* record) {
+    return(record->setpoint / 100.0);
+}
+
+/**
+ * sentinel_record_tempstick: Temperature of the given tempstick sensor, 0 - 7, in Celsius
+ **/
+
+double sentinel_record_tempstick(const sentinel_record_t* record, const int sensor) {
+    return(record->tempstick[sensor] / 10.0);
+}
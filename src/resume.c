@@ -0,0 +1,374 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <ctype.h>
+
+#include "libsentinel.h"
+
+const sentinel_download_report_t DEFAULT_DOWNLOAD_REPORT = {
+    0,     /* expected */
+    0,     /* received */
+    0,     /* attempts */
+    0,     /* duplicates */
+    0,     /* rejected */
+    -1,    /* first_missing */
+    false  /* complete */
+};
+
+/* First letter of the fields M to J, which every firmware sends after R####, depth, 0001 and po2 */
+static const char SENTINEL_FIELD_PREFIX[] = "MTABCDEFGHIJ";
+
+/**
+ * sentinel_valid_log_line: Checks that the line has all the fixed fields of a record in the right
+ *                          format. The rebreather sends no checksum, so a digit replaced by another
+ *                          digit still passes
+ **/
+
+bool sentinel_valid_log_line(const char* line, const size_t len) {
+    size_t field_start = 0;
+    size_t i = 0;
+    int field = 0;
+
+    if (len < 6 || line[0] != 'R' || line[5] != ',')
+        return(false);
+
+    for (i = 1; i < 5; i++) {
+        if (!isdigit((unsigned char) line[i]))
+            return(false);
+    }
+
+    for (i = 0; i <= len; i++) {
+        if (i < len && line[i] != ',') {
+            if (!isprint((unsigned char) line[i]))
+                return(false);
+
+            continue;
+        }
+
+        const char* f = line + field_start;
+        const size_t flen = i - field_start;
+        size_t j = 0;
+
+        if (field >= 1 && field <= 3) {
+            if (flen == 0)
+                return(false);
+
+            for (j = 0; j < flen; j++) {
+                if (!isdigit((unsigned char) f[j]))
+                    return(false);
+            }
+        } else if (field >= 4 && field <= 15) {
+            if (flen < 2 || f[0] != SENTINEL_FIELD_PREFIX[field - 4])
+                return(false);
+
+            for (j = 1; j < flen; j++) {
+                if (!isdigit((unsigned char) f[j]) && !(j == 1 && f[j] == '-'))
+                    return(false);
+            }
+        }
+
+        field++;
+        field_start = i + 1;
+    }
+
+    return(field >= 16);
+}
+
+/**
+ * sentinel_resume_header: Keeps the header of the dive, the part before the profile, and parses it
+ **/
+
+static bool sentinel_resume_header(const char* buffer, const char* profile, sentinel_header_t** header_item,
+                                   sentinel_resume_t* resume) {
+    char* header_str = sentinel_calloc(profile - buffer + 1, sizeof(char));
+    resume->header_text = sentinel_calloc(profile - buffer + 1, sizeof(char));
+
+    if (header_str == NULL || resume->header_text == NULL) {
+        sentinel_free(header_str);
+        return(false);
+    }
+
+    memcpy(header_str, buffer, profile - buffer);
+    memcpy(resume->header_text, buffer, profile - buffer);
+
+    free_sentinel_header(*header_item);
+    *header_item = alloc_sentinel_header();
+    **header_item = DEFAULT_HEADER;
+
+    bool res = parse_sentinel_header(header_item, &header_str);
+    sentinel_free(header_str);
+
+    if (!res) {
+        sentinel_free(resume->header_text);
+        resume->header_text = NULL;
+    }
+
+    return(res);
+}
+
+/**
+ * sentinel_resume_records: Keeps every complete and valid record of the profile which has not
+ *                          been received on an earlier attempt. Returns false if out of memory
+ **/
+
+static bool sentinel_resume_records(const char* profile, const size_t len, sentinel_resume_t* resume,
+                                    sentinel_download_report_t* report) {
+    const char* line = profile;
+    const char* end  = profile + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    while ((next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        /* The rest was cut off by the break */
+        if (line + line_len == end)
+            break;
+
+        if (line_len > (size_t) SENTINEL_MAX_LINE || !sentinel_valid_log_line(line, line_len)) {
+            report->rejected++;
+            line = next;
+            continue;
+        }
+
+        const int idx = atoi(line + 1);
+
+        /* A corrupted index would otherwise fill a hole with the wrong record */
+        if (report->expected > 0 && idx >= report->expected) {
+            report->rejected++;
+            line = next;
+            continue;
+        }
+
+        if (idx >= resume->size) {
+            int new_size = (resume->size > 0) ? resume->size : 64;
+
+            while (idx >= new_size) {
+                new_size *= 2;
+            }
+
+            char** tmp = sentinel_realloc(resume->lines, new_size * sizeof(char*));
+
+            if (tmp == NULL)
+                return(false);
+
+            memset(tmp + resume->size, 0, (new_size - resume->size) * sizeof(char*));
+            resume->lines = tmp;
+            resume->size  = new_size;
+        }
+
+        if (resume->lines[idx] != NULL) {
+            report->duplicates++;
+        } else {
+            resume->lines[idx] = sentinel_calloc(line_len + 1, sizeof(char));
+
+            if (resume->lines[idx] == NULL)
+                return(false);
+
+            memcpy(resume->lines[idx], line, line_len);
+
+            report->received++;
+        }
+
+        line = next;
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_resume_receive: Requests the dive until every record announced by the header has been
+ *                          received or the attempts run out. The header is parsed into header_item,
+ *                          the records are kept unparsed in resume
+ **/
+
+bool sentinel_resume_receive(int fd, int dive_num, sentinel_header_t** header_item, const int attempts,
+                             sentinel_resume_t* resume, sentinel_download_report_t* report) {
+    bool res = true;
+    char command[16];
+    int i = 0;
+
+    *resume = (sentinel_resume_t) {NULL, NULL, 0, false};
+    *report = DEFAULT_DOWNLOAD_REPORT;
+    report->expected = (*header_item != NULL) ? (*header_item)->log_lines : 0;
+
+    while (res && report->attempts < attempts) {
+        sentinel_receiver_t rx;
+
+        if (report->attempts > 0 && !is_sentinel_idle(fd, 20)) {
+            sentinel_error("%s", "The rebreather did not become idle for the retry");
+            break;
+        }
+
+        report->attempts++;
+
+        if (!sentinel_receiver_init(&rx, SENTINEL_HEADER_START, sizeof(SENTINEL_HEADER_START),
+                                    SENTINEL_PROFILE_END, sizeof(SENTINEL_PROFILE_END)))
+            break;
+
+        if (!send_sentinel_command(fd, command, sentinel_dive_command(command, sizeof(command), dive_num))) {
+            sentinel_free(rx.buffer);
+            break;
+        }
+
+        const sentinel_rx_state_t state = receive_sentinel_response(fd, &rx);
+        const char* profile = (rx.buffer != NULL) ? strstr(rx.buffer, "Profile\r\n") : NULL;
+
+        if (profile != NULL) {
+            const long long parse_start = sentinel_time_ns();
+
+            if (resume->header_text == NULL && sentinel_resume_header(rx.buffer, profile, header_item, resume) &&
+                (*header_item)->log_lines > 0)
+                report->expected = (*header_item)->log_lines;
+
+            profile += strlen("Profile\r\n");
+            res = sentinel_resume_records(profile, rx.len - (profile - rx.buffer), resume, report);
+            sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+        }
+
+        sentinel_free(rx.buffer);
+        resume->done |= (state == SENTINEL_RX_DONE);
+
+        if (report->expected > 0 && report->received >= report->expected)
+            break;
+
+        /* The whole dive came through, retrying would send the same records */
+        if (resume->done && report->expected == 0)
+            break;
+
+        sentinel_warn("Dive %d attempt %d: %d of %d records", dive_num, report->attempts,
+                      report->received, report->expected);
+    }
+
+    for (i = 0; i < resume->size; i++) {
+        if (resume->lines[i] == NULL && i < report->expected) {
+            report->first_missing = i;
+            break;
+        }
+    }
+
+    if (report->first_missing < 0 && resume->size < report->expected)
+        report->first_missing = resume->size;
+
+    report->complete = resume->header_text != NULL && report->first_missing < 0 &&
+                       ((report->expected > 0) ? report->received >= report->expected : resume->done);
+
+    return(resume->header_text != NULL);
+}
+
+/**
+ * sentinel_resume_parse: Parses the received records, in the order of their time index, into the
+ *                        log of the header and sets its content hash
+ **/
+
+bool sentinel_resume_parse(const sentinel_resume_t* resume, sentinel_header_t* header) {
+    const long long parse_start = sentinel_time_ns();
+    const sentinel_log_parser_t parser = sentinel_log_parser(sentinel_firmware_from_version(header->version));
+    uint64_t hash = sentinel_hash_header(resume->header_text, strlen(resume->header_text));
+    int count = 0;
+    int i = 0;
+
+    if (parser == NULL) {
+        sentinel_error("Unsupported firmware version: %s", (header->version != NULL) ? header->version : "none");
+        return(false);
+    }
+
+    memset(&header->summary, 0, sizeof(sentinel_summary_t));
+
+    for (i = 0; i < resume->size; i++) {
+        if (resume->lines[i] == NULL)
+            continue;
+
+        header->log = resize_sentinel_log_list(header->log, count + 1);
+
+        if (header->log == NULL)
+            return(false);
+
+        header->log[count] = alloc_sentinel_dive_log_line();
+
+        if (header->log[count] == NULL)
+            return(false);
+
+        hash = sentinel_hash_line(hash, resume->lines[i], strlen(resume->lines[i]));
+        if (!parser(header->record_interval, header->log[count], resume->lines[i]))
+            sentinel_error("Unable to parse log line: %s", resume->lines[i]);
+        else
+            sentinel_summary_add_line(&header->summary, header->log[count]);
+
+        count++;
+    }
+
+    header->content_hash = hash;
+    sentinel_get_stats()->parse_ns += sentinel_time_ns() - parse_start;
+
+    return(true);
+}
+
+/**
+ * sentinel_resume_hash: Content hash of the received dive, the same as sentinel_resume_parse sets
+ **/
+
+uint64_t sentinel_resume_hash(const sentinel_resume_t* resume) {
+    uint64_t hash = sentinel_hash_header(resume->header_text, strlen(resume->header_text));
+    int i = 0;
+
+    for (i = 0; i < resume->size; i++) {
+        if (resume->lines[i] != NULL)
+            hash = sentinel_hash_line(hash, resume->lines[i], strlen(resume->lines[i]));
+    }
+
+    return(hash);
+}
+
+/**
+ * sentinel_resume_free: Frees the received header and records, not the struct itself
+ **/
+
+void sentinel_resume_free(sentinel_resume_t* resume) {
+    int i = 0;
+
+    for (i = 0; i < resume->size; i++) {
+        sentinel_free(resume->lines[i]);
+    }
+
+    sentinel_free(resume->lines);
+    sentinel_free(resume->header_text);
+    *resume = (sentinel_resume_t) {NULL, NULL, 0, false};
+}
+
+/**
+ * download_sentinel_dive_resumable: Like download_sentinel_dive, but keeps every complete record
+ *                                   of a broken transfer and asks for the dive again, up to the
+ *                                   given number of attempts. The records are merged by their
+ *                                   time index. The report tells how complete the dive is
+ *                                   compared to the log_lines of the header
+ **/
+
+bool download_sentinel_dive_resumable(int fd, int dive_num, sentinel_header_t** header_item, const int attempts,
+                                      sentinel_download_report_t* report) {
+    sentinel_resume_t resume;
+
+    if (sentinel_resume_receive(fd, dive_num, header_item, attempts, &resume, report) &&
+        !sentinel_resume_parse(&resume, *header_item))
+        report->complete = false;
+
+    sentinel_resume_free(&resume);
+
+    return(report->complete);
+}
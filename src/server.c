@@ -0,0 +1,626 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* accept4 */
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "libsentinel.h"
+
+#define SENTINEL_SERVER_NONE -2 /* Client not waiting for anything */
+
+static const int SENTINEL_SERVER_BACKLOG = 16;
+
+/**
+ * sentinel_server_new: Starts serving the connected context on a Unix socket at the given path,
+ *                      an old socket at the path is removed. The dives are listed right away
+ **/
+
+sentinel_server_t* sentinel_server_new(sentinel_ctx_t* ctx, const char* path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        sentinel_error("Too long socket path: %s", path);
+        return(NULL);
+    }
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    sentinel_server_t* server = sentinel_calloc(1, sizeof(sentinel_server_t));
+
+    if (server == NULL) {
+        sentinel_ctx_leave(prev);
+        return(NULL);
+    }
+
+    server->ctx       = ctx;
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    server->path      = sentinel_strdup(path);
+    server->op_dive   = SENTINEL_SERVER_NONE;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (server->listen_fd < 0 || server->path == NULL ||
+        bind(server->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, SENTINEL_SERVER_BACKLOG) != 0) {
+        sentinel_error("Could not listen on %s: %s", path, strerror(errno));
+        sentinel_server_free(server);
+        sentinel_ctx_leave(prev);
+        return(NULL);
+    }
+
+    server->queue = sentinel_malloc(sizeof(int));
+
+    if (server->queue == NULL) {
+        sentinel_server_free(server);
+        sentinel_ctx_leave(prev);
+        return(NULL);
+    }
+
+    server->queue[server->queue_len++] = SENTINEL_SERVER_LIST;
+    sentinel_ctx_leave(prev);
+
+    return(server);
+}
+
+/**
+ * sentinel_server_reply: Queues the reply to the client, the cached text is copied after the line
+ *                        with its length. NULL text is an error with the reason
+ **/
+
+static void sentinel_server_reply(sentinel_server_client_t* client, const char* text, const size_t len,
+                                  const char* reason) {
+    char line[64];
+    const int line_len = (text != NULL) ? snprintf(line, sizeof(line), "OK %zu\n", len) :
+                                          snprintf(line, sizeof(line), "ERR %s\n", reason);
+    const size_t reply_len = line_len + ((text != NULL) ? len : 0);
+
+    client->waiting    = SENTINEL_SERVER_NONE;
+    client->reply      = sentinel_malloc(reply_len);
+    client->reply_len  = reply_len;
+    client->reply_sent = 0;
+
+    if (client->reply == NULL) {
+        client->reply_len = 0;
+        return;
+    }
+
+    memcpy(client->reply, line, line_len);
+
+    if (text != NULL)
+        memcpy(client->reply + line_len, text, len);
+}
+
+/**
+ * sentinel_server_answer: Replies to the clients waiting for the list or the dive from the cache,
+ *                         or with the error when there is nothing cached
+ **/
+
+static void sentinel_server_answer(sentinel_server_t* server, const int what, const char* reason) {
+    int i = 0;
+
+    for (i = 0; i < server->client_count; i++) {
+        sentinel_server_client_t* client = server->clients[i];
+
+        if (client->waiting != what)
+            continue;
+
+        if (what == SENTINEL_SERVER_LIST && server->list_text != NULL)
+            sentinel_server_reply(client, server->list_text, server->list_len, NULL);
+        else if (what >= 0 && what < server->dive_count && server->dive_text[what] != NULL)
+            sentinel_server_reply(client, server->dive_text[what], server->dive_len[what], NULL);
+        else
+            sentinel_server_reply(client, NULL, 0, reason);
+    }
+}
+
+/**
+ * sentinel_server_enqueue: Queues a transfer, unless the same one is already queued or in flight.
+ *                          This is where the requests of many clients for one dive are coalesced
+ **/
+
+static bool sentinel_server_enqueue(sentinel_server_t* server, const int what) {
+    int i = 0;
+
+    if (server->op != NULL && server->op_dive == what)
+        return(true);
+
+    for (i = 0; i < server->queue_len; i++) {
+        if (server->queue[i] == what)
+            return(true);
+    }
+
+    int* queue = sentinel_realloc(server->queue, (server->queue_len + 1) * sizeof(int));
+
+    if (queue == NULL)
+        return(false);
+
+    server->queue = queue;
+    server->queue[server->queue_len++] = what;
+
+    return(true);
+}
+
+/**
+ * sentinel_server_cache_clear: Forgets the list and the dives, eg. when the dives are listed again
+ **/
+
+static void sentinel_server_cache_clear(sentinel_server_t* server) {
+    int i = 0;
+
+    for (i = 0; i < server->dive_count; i++) {
+        sentinel_free(server->dive_text[i]);
+    }
+
+    sentinel_free(server->dive_text);
+    sentinel_free(server->dive_len);
+    sentinel_free(server->list_text);
+
+    server->dive_text  = NULL;
+    server->dive_len   = NULL;
+    server->dive_count = 0;
+    server->list_text  = NULL;
+    server->list_len   = 0;
+}
+
+/**
+ * sentinel_server_fail_queue: Replies with an error to every client waiting for the list or a queued
+ *                             dive, as none of the dives can be fetched without the list
+ **/
+
+static void sentinel_server_fail_queue(sentinel_server_t* server) {
+    int i = 0;
+
+    for (i = 0; i < server->queue_len; i++) {
+        sentinel_server_answer(server, server->queue[i], "Listing the dives failed");
+    }
+
+    server->queue_len = 0;
+    sentinel_server_answer(server, SENTINEL_SERVER_LIST, "Listing the dives failed");
+}
+
+/**
+ * sentinel_server_finish: Caches the response of the finished transfer and replies to the clients
+ *                         waiting for it
+ **/
+
+static void sentinel_server_finish(sentinel_server_t* server) {
+    sentinel_op_t* op = server->op;
+    const int what = server->op_dive;
+    char* text = NULL;
+
+    if (op->status == SENTINEL_OP_DONE && (text = sentinel_malloc(op->rx.len)) != NULL)
+        memcpy(text, op->rx.buffer, op->rx.len);
+
+    if (text != NULL && what == SENTINEL_SERVER_LIST) {
+        sentinel_server_cache_clear(server);
+
+        server->dive_count    = server->ctx->table.count;
+        server->dive_text     = sentinel_calloc(server->dive_count + 1, sizeof(char*));
+        server->dive_len      = sentinel_calloc(server->dive_count + 1, sizeof(size_t));
+        server->list_text     = text;
+        server->list_len      = op->rx.len;
+        server->prefetch_next = 0;
+
+        if (server->dive_text == NULL || server->dive_len == NULL)
+            sentinel_server_cache_clear(server);
+    } else if (text != NULL && what >= 0 && what < server->dive_count) {
+        sentinel_free(server->dive_text[what]);
+        server->dive_text[what] = text;
+        server->dive_len[what]  = op->rx.len;
+    } else {
+        sentinel_free(text);
+    }
+
+    sentinel_op_free(op);
+    server->op      = NULL;
+    server->op_dive = SENTINEL_SERVER_NONE;
+    server->transfers++;
+
+    if (what == SENTINEL_SERVER_LIST && server->list_text == NULL)
+        sentinel_server_fail_queue(server);
+    else
+        sentinel_server_answer(server, what, "Transfer from the rebreather failed");
+}
+
+/**
+ * sentinel_server_start_prefetch: Starts fetching the next of the newest dives which is not cached,
+ *                                 when the device is free and no client waits for a transfer. A
+ *                                 request which comes in meanwhile goes next, at the end of the dive
+ **/
+
+static void sentinel_server_start_prefetch(sentinel_server_t* server) {
+    const int last = (server->prefetch < server->dive_count) ? server->prefetch : server->dive_count;
+
+    while (server->op == NULL && server->queue_len == 0 && server->prefetch_next < last) {
+        const int what = server->prefetch_next++;
+
+        if (server->dive_text[what] != NULL)
+            continue;
+
+        server->op = sentinel_op_download(server->ctx, what, NULL, NULL);
+
+        if (server->op != NULL) {
+            server->op_dive = what;
+            server->prefetched++;
+            sentinel_debug("Prefetching dive %d", what);
+        }
+    }
+}
+
+/**
+ * sentinel_server_start: Starts the next queued transfer when the device is free. A dive needs the
+ *                        list, which is then fetched first. With nothing queued, the prefetch goes on
+ **/
+
+static void sentinel_server_start(sentinel_server_t* server) {
+    while (server->op == NULL && server->queue_len > 0) {
+        int what = server->queue[0];
+
+        if (what != SENTINEL_SERVER_LIST && server->list_text == NULL) {
+            what = SENTINEL_SERVER_LIST;
+        } else {
+            server->queue_len--;
+            memmove(server->queue, server->queue + 1, server->queue_len * sizeof(int));
+        }
+
+        if (what == SENTINEL_SERVER_LIST) {
+            server->op = sentinel_op_list(server->ctx, NULL, NULL);
+        } else if (what < server->dive_count && server->dive_text[what] != NULL) {
+            sentinel_server_answer(server, what, NULL);
+            continue;
+        } else {
+            server->op = sentinel_op_download(server->ctx, what, NULL, NULL);
+        }
+
+        if (server->op != NULL) {
+            server->op_dive = what;
+        } else if (what == SENTINEL_SERVER_LIST) {
+            sentinel_server_fail_queue(server);
+        } else {
+            sentinel_server_answer(server, what, "No such dive");
+        }
+    }
+
+    sentinel_server_start_prefetch(server);
+}
+
+/**
+ * sentinel_server_request: Handles one request line of the client
+ **/
+
+static void sentinel_server_request(sentinel_server_t* server, sentinel_server_client_t* client, const char* line) {
+    int dive_num = 0;
+    char extra = 0;
+
+    if (strcmp(line, "list") == 0) {
+        if (server->list_text != NULL) {
+            sentinel_server_reply(client, server->list_text, server->list_len, NULL);
+        } else {
+            client->waiting = SENTINEL_SERVER_LIST;
+
+            if (!sentinel_server_enqueue(server, SENTINEL_SERVER_LIST))
+                sentinel_server_reply(client, NULL, 0, "Out of memory");
+        }
+    } else if (sscanf(line, "dive %d%c", &dive_num, &extra) == 1 && dive_num >= 0) {
+        if (dive_num < server->dive_count && server->dive_text[dive_num] != NULL) {
+            sentinel_server_reply(client, server->dive_text[dive_num], server->dive_len[dive_num], NULL);
+        } else if (server->list_text != NULL && dive_num >= server->dive_count) {
+            sentinel_server_reply(client, NULL, 0, "No such dive");
+        } else {
+            client->waiting = dive_num;
+
+            if (!sentinel_server_enqueue(server, dive_num))
+                sentinel_server_reply(client, NULL, 0, "Out of memory");
+        }
+    } else {
+        sentinel_server_reply(client, NULL, 0, "Unknown request, use list or dive <n>");
+    }
+}
+
+/**
+ * sentinel_server_accept: Takes in the new clients
+ **/
+
+static void sentinel_server_accept(sentinel_server_t* server) {
+    int fd = -1;
+
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        sentinel_server_client_t* client = sentinel_calloc(1, sizeof(sentinel_server_client_t));
+        sentinel_server_client_t** clients = sentinel_realloc(server->clients,
+                                                              (server->client_count + 1) * sizeof(sentinel_server_client_t*));
+
+        if (client == NULL || clients == NULL) {
+            sentinel_free(client);
+            server->clients = (clients != NULL) ? clients : server->clients;
+            close(fd);
+            continue;
+        }
+
+        client->fd      = fd;
+        client->waiting = SENTINEL_SERVER_NONE;
+        server->clients = clients;
+        server->clients[server->client_count++] = client;
+    }
+}
+
+/**
+ * sentinel_server_client_io: Reads the requests of the client and sends the pending reply, returns
+ *                            false when the client is gone
+ **/
+
+static bool sentinel_server_client_io(sentinel_server_t* server, sentinel_server_client_t* client) {
+    if (client->reply != NULL) {
+        const ssize_t n = send(client->fd, client->reply + client->reply_sent,
+                               client->reply_len - client->reply_sent, MSG_NOSIGNAL);
+
+        if (n < 0)
+            return(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+        client->reply_sent += n;
+
+        if (client->reply_sent < client->reply_len)
+            return(true);
+
+        sentinel_free(client->reply);
+        client->reply = NULL;
+        server->served++;
+    }
+
+    while (client->reply == NULL && client->waiting == SENTINEL_SERVER_NONE) {
+        char* eol = memchr(client->request, '\n', client->request_len);
+
+        if (eol != NULL) {
+            const size_t line_len = eol - client->request;
+
+            *eol = '\0';
+
+            if (line_len > 0 && client->request[line_len - 1] == '\r')
+                client->request[line_len - 1] = '\0';
+
+            sentinel_server_request(server, client, client->request);
+
+            client->request_len -= line_len + 1;
+            memmove(client->request, eol + 1, client->request_len);
+            continue;
+        }
+
+        if (client->request_len == sizeof(client->request))
+            return(false);
+
+        const ssize_t n = recv(client->fd, client->request + client->request_len,
+                               sizeof(client->request) - client->request_len, 0);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return(false);
+
+        if (n < 0)
+            break;
+
+        client->request_len += n;
+    }
+
+    return(true);
+}
+
+/**
+ * sentinel_server_client_free: Disconnects the client, a transfer it waited for still goes on
+ **/
+
+static void sentinel_server_client_free(sentinel_server_client_t* client) {
+    close(client->fd);
+    sentinel_free(client->reply);
+    sentinel_free(client);
+}
+
+/**
+ * sentinel_server_poll: Polls the listening socket, the device and the clients, the descriptors
+ *                       are kept in the server and grown with the clients
+ **/
+
+static bool sentinel_server_poll(sentinel_server_t* server, const int timeout_ms) {
+    int timeout = timeout_ms;
+    int count = 0;
+    int i = 0;
+
+    sentinel_server_start(server);
+
+    if (server->pfd_size < server->client_count + 2) {
+        struct pollfd* pfd = sentinel_realloc(server->pfd, (server->client_count + 2) * sizeof(struct pollfd));
+
+        if (pfd == NULL) {
+            sentinel_error("%s", "Failed to allocate the descriptors to poll");
+            return(false);
+        }
+
+        server->pfd      = pfd;
+        server->pfd_size = server->client_count + 2;
+    }
+
+    struct pollfd* pfd = server->pfd;
+
+    pfd[count].fd       = server->listen_fd;
+    pfd[count++].events = POLLIN;
+
+    if (server->op != NULL) {
+        const int op_timeout = sentinel_op_timeout(server->op);
+
+        pfd[count].fd       = sentinel_op_fd(server->op);
+        pfd[count++].events = POLLIN;
+        timeout = (timeout < 0 || op_timeout < timeout) ? op_timeout : timeout;
+    }
+
+    for (i = 0; i < server->client_count; i++) {
+        sentinel_server_client_t* client = server->clients[i];
+
+        pfd[count].fd       = client->fd;
+        pfd[count++].events = (client->reply != NULL) ? POLLOUT :
+                              (client->waiting == SENTINEL_SERVER_NONE) ? POLLIN : 0;
+    }
+
+    if (poll(pfd, count, timeout) < 0 && errno != EINTR) {
+        sentinel_error("poll() failed: %s", strerror(errno));
+        return(false);
+    }
+
+    if (server->op != NULL && sentinel_op_process(server->op) != SENTINEL_OP_RUNNING)
+        sentinel_server_finish(server);
+
+    if (pfd[0].revents & POLLIN)
+        sentinel_server_accept(server);
+
+    /* The replies of the finished transfer are sent right away, without waiting for POLLOUT */
+    for (i = 0; i < server->client_count; i++) {
+        if (sentinel_server_client_io(server, server->clients[i]))
+            continue;
+
+        sentinel_server_client_free(server->clients[i]);
+        server->clients[i--] = server->clients[--server->client_count];
+    }
+
+    sentinel_server_start(server);
+
+    return(true);
+}
+
+/**
+ * sentinel_server_process: Waits up to the given time for the device and the clients and handles
+ *                          whatever is ready, call it in a loop. Returns false if poll fails
+ **/
+
+bool sentinel_server_process(sentinel_server_t* server, const int timeout_ms) {
+    sentinel_ctx_t* prev = sentinel_ctx_enter(server->ctx);
+    const bool res = sentinel_server_poll(server, timeout_ms);
+
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_server_free: Closes the socket and the clients, the context is left connected
+ **/
+
+void sentinel_server_free(sentinel_server_t* server) {
+    int i = 0;
+
+    if (server == NULL)
+        return;
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(server->ctx);
+
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+
+        if (server->path != NULL)
+            unlink(server->path);
+    }
+
+    for (i = 0; i < server->client_count; i++) {
+        sentinel_server_client_free(server->clients[i]);
+    }
+
+    sentinel_op_free(server->op);
+    sentinel_server_cache_clear(server);
+    sentinel_free(server->pfd);
+    sentinel_free(server->clients);
+    sentinel_free(server->queue);
+    sentinel_free(server->path);
+    sentinel_free(server);
+    sentinel_ctx_leave(prev);
+}
+
+/**
+ * sentinel_server_query: Sends the request to the server at the path and waits for the reply.
+ *                        The response of the rebreather is returned in a terminated string allocated
+ *                        with sentinel_malloc, which can be given to parse_sentinel_dive_list or
+ *                        parse_sentinel_dive
+ **/
+
+bool sentinel_server_query(const char* path, const char* request, char** reply, size_t* len) {
+    struct sockaddr_un addr;
+    char line[128];
+    size_t line_len = 0;
+    size_t size = 0;
+    size_t got = 0;
+    bool res = false;
+
+    *reply = NULL;
+    *len   = 0;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return(false);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        sentinel_error("Could not connect to %s: %s", path, strerror(errno));
+
+        if (fd >= 0)
+            close(fd);
+
+        return(false);
+    }
+
+    snprintf(line, sizeof(line), "%s\n", request);
+
+    if (send(fd, line, strlen(line), MSG_NOSIGNAL) != (ssize_t) strlen(line)) {
+        close(fd);
+        return(false);
+    }
+
+    /* The reply line is read a byte at a time, so that nothing of the response is read with it */
+    while (line_len < sizeof(line) - 1 && recv(fd, line + line_len, 1, 0) == 1 && line[line_len] != '\n') {
+        line_len++;
+    }
+
+    line[line_len] = '\0';
+
+    if (sscanf(line, "OK %zu", &size) != 1) {
+        sentinel_error("The server replied: %s", line);
+    } else if ((*reply = sentinel_malloc(size + 1)) != NULL) {
+        ssize_t n = 0;
+
+        while (got < size && (n = recv(fd, *reply + got, size - got, 0)) > 0) {
+            got += n;
+        }
+
+        (*reply)[got] = '\0';
+        *len = got;
+        res  = (got == size);
+
+        if (!res) {
+            sentinel_free(*reply);
+            *reply = NULL;
+        }
+    }
+
+    close(fd);
+
+    return(res);
+}
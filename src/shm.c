@@ -0,0 +1,514 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memfd_create */
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libsentinel.h"
+
+/* The dive is published as one column for each value of sentinel_record_t */
+typedef struct sentinel_shm_column_info {
+    const char* name;
+    sentinel_column_type_t type;
+    size_t offset; /* In sentinel_record_t */
+} sentinel_shm_column_info_t;
+
+#define SENTINEL_SHM_COLUMN(name, type, field) {name, type, offsetof(sentinel_record_t, field)}
+
+static const sentinel_shm_column_info_t SENTINEL_SHM_COLUMNS[] = {
+    SENTINEL_SHM_COLUMN("time_idx", SENTINEL_COLUMN_U16, time_idx),
+    SENTINEL_SHM_COLUMN("depth", SENTINEL_COLUMN_U16, depth),
+    SENTINEL_SHM_COLUMN("po2", SENTINEL_COLUMN_U16, po2),
+    SENTINEL_SHM_COLUMN("temperature", SENTINEL_COLUMN_S16, temperature),
+    SENTINEL_SHM_COLUMN("scrubber", SENTINEL_COLUMN_S16, scrubber),
+    SENTINEL_SHM_COLUMN("battery_0", SENTINEL_COLUMN_U16, battery[0]),
+    SENTINEL_SHM_COLUMN("battery_1", SENTINEL_COLUMN_U16, battery[1]),
+    SENTINEL_SHM_COLUMN("diluent_pressure", SENTINEL_COLUMN_S16, diluent_pressure),
+    SENTINEL_SHM_COLUMN("o2_pressure", SENTINEL_COLUMN_S16, o2_pressure),
+    SENTINEL_SHM_COLUMN("cell_o2_0", SENTINEL_COLUMN_U16, cell_o2[0]),
+    SENTINEL_SHM_COLUMN("cell_o2_1", SENTINEL_COLUMN_U16, cell_o2[1]),
+    SENTINEL_SHM_COLUMN("cell_o2_2", SENTINEL_COLUMN_U16, cell_o2[2]),
+    SENTINEL_SHM_COLUMN("setpoint", SENTINEL_COLUMN_U16, setpoint),
+    SENTINEL_SHM_COLUMN("ceiling", SENTINEL_COLUMN_S16, ceiling),
+    SENTINEL_SHM_COLUMN("tempstick_0", SENTINEL_COLUMN_S16, tempstick[0]),
+    SENTINEL_SHM_COLUMN("tempstick_1", SENTINEL_COLUMN_S16, tempstick[1]),
+    SENTINEL_SHM_COLUMN("tempstick_2", SENTINEL_COLUMN_S16, tempstick[2]),
+    SENTINEL_SHM_COLUMN("tempstick_3", SENTINEL_COLUMN_S16, tempstick[3]),
+    SENTINEL_SHM_COLUMN("tempstick_4", SENTINEL_COLUMN_S16, tempstick[4]),
+    SENTINEL_SHM_COLUMN("tempstick_5", SENTINEL_COLUMN_S16, tempstick[5]),
+    SENTINEL_SHM_COLUMN("tempstick_6", SENTINEL_COLUMN_S16, tempstick[6]),
+    SENTINEL_SHM_COLUMN("tempstick_7", SENTINEL_COLUMN_S16, tempstick[7]),
+    SENTINEL_SHM_COLUMN("co2", SENTINEL_COLUMN_U16, co2),
+    SENTINEL_SHM_COLUMN("note_0", SENTINEL_COLUMN_U8, note[0]),
+    SENTINEL_SHM_COLUMN("note_1", SENTINEL_COLUMN_U8, note[1]),
+    SENTINEL_SHM_COLUMN("note_2", SENTINEL_COLUMN_U8, note[2])
+};
+
+#define SENTINEL_SHM_COLUMN_COUNT ((int) (sizeof(SENTINEL_SHM_COLUMNS) / sizeof(SENTINEL_SHM_COLUMNS[0])))
+
+/**
+ * sentinel_column_size: Bytes of a single value of the column type
+ **/
+
+static size_t sentinel_column_size(const sentinel_column_type_t type) {
+    return((type == SENTINEL_COLUMN_U8) ? 1 : 2);
+}
+
+/**
+ * sentinel_shm_name: Returns the name of the segment for shm_open, which has to start with a slash
+ **/
+
+static char* sentinel_shm_name(const char* name) {
+    char* shm_name = sentinel_malloc(strlen(name) + 2);
+
+    if (shm_name != NULL)
+        sprintf(shm_name, "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    return(shm_name);
+}
+
+/**
+ * sentinel_shm_map: Maps the segment of the descriptor and checks that it is laid out as expected
+ **/
+
+static sentinel_shm_t* sentinel_shm_map(int fd, const bool writer) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(sentinel_shm_segment_t)) {
+        sentinel_error("%s", "The shared memory segment is too small");
+        return(NULL);
+    }
+
+    const int prot = writer ? PROT_READ | PROT_WRITE : PROT_READ;
+    sentinel_shm_segment_t* segment = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+
+    if (segment == MAP_FAILED) {
+        sentinel_error("Could not map the shared memory segment: %s", strerror(errno));
+        return(NULL);
+    }
+
+    const bool magic = (memcmp(segment->magic, SENTINEL_SHM_MAGIC, sizeof(segment->magic)) == 0);
+
+    /* The magic is written last, the layout is read only after it */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (!magic || segment->slots == 0 || segment->data_offset < sizeof(sentinel_shm_segment_t) ||
+        segment->data_offset + segment->data_size > (uint64_t) st.st_size) {
+        sentinel_error("%s", "Not a shared memory segment of dives");
+        munmap(segment, st.st_size);
+        return(NULL);
+    }
+
+    sentinel_shm_t* shm = sentinel_calloc(1, sizeof(sentinel_shm_t));
+
+    if (shm == NULL) {
+        munmap(segment, st.st_size);
+        return(NULL);
+    }
+
+    shm->fd      = fd;
+    shm->segment = segment;
+    shm->size    = st.st_size;
+    shm->writer  = writer;
+
+    return(shm);
+}
+
+/**
+ * sentinel_shm_create: Creates the segment for publishing dives, with room for data_size bytes of
+ *                      dives and the given number of announcements. A named segment which already
+ *                      exists with the same sizes is published to further, NULL name creates an
+ *                      anonymous segment, see sentinel_shm_fd. There can be only one publisher
+ **/
+
+sentinel_shm_t* sentinel_shm_create(const char* name, const size_t data_size, const int slots) {
+    char* shm_name = NULL;
+    struct stat st;
+    int fd = -1;
+
+    if (data_size < sizeof(sentinel_shm_dive_t) || slots < 1) {
+        sentinel_error("Invalid size of the shared memory segment: %zu bytes, %d slots", data_size, slots);
+        return(NULL);
+    }
+
+    const uint64_t data_offset = (sizeof(sentinel_shm_segment_t) + slots * sizeof(sentinel_shm_slot_t) + 63) & ~63ULL;
+    const size_t size = data_offset + data_size;
+
+    if (name == NULL) {
+        fd = memfd_create("sentinel", MFD_CLOEXEC);
+    } else if ((shm_name = sentinel_shm_name(name)) != NULL) {
+        fd = shm_open(shm_name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        sentinel_free(shm_name);
+    }
+
+    if (fd < 0) {
+        sentinel_error("Could not create the shared memory segment: %s", strerror(errno));
+        return(NULL);
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return(NULL);
+    }
+
+    if (st.st_size == 0) {
+        if (ftruncate(fd, size) != 0) {
+            sentinel_error("Could not size the shared memory segment: %s", strerror(errno));
+            close(fd);
+            return(NULL);
+        }
+
+        sentinel_shm_segment_t* segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (segment == MAP_FAILED) {
+            sentinel_error("Could not map the shared memory segment: %s", strerror(errno));
+            close(fd);
+            return(NULL);
+        }
+
+        segment->slots       = slots;
+        segment->data_offset = data_offset;
+        segment->data_size   = data_size;
+
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(segment->magic, SENTINEL_SHM_MAGIC, sizeof(segment->magic));
+        munmap(segment, size);
+    } else if ((size_t) st.st_size != size) {
+        sentinel_error("The shared memory segment %s exists with another size", name);
+        close(fd);
+        return(NULL);
+    }
+
+    sentinel_shm_t* shm = sentinel_shm_map(fd, true);
+
+    if (shm == NULL) {
+        close(fd);
+        return(NULL);
+    }
+
+    if (shm->segment->slots != (uint32_t) slots || shm->segment->data_size != data_size) {
+        sentinel_error("The shared memory segment %s exists with another layout", name);
+        sentinel_shm_close(shm);
+        return(NULL);
+    }
+
+    shm->next = shm->segment->published;
+
+    return(shm);
+}
+
+/**
+ * sentinel_shm_open: Maps the named segment for reading, starting from the oldest dive still
+ *                    announced in it
+ **/
+
+sentinel_shm_t* sentinel_shm_open(const char* name) {
+    char* shm_name = sentinel_shm_name(name);
+
+    if (shm_name == NULL)
+        return(NULL);
+
+    const int fd = shm_open(shm_name, O_RDONLY | O_CLOEXEC, 0);
+
+    sentinel_free(shm_name);
+
+    if (fd < 0) {
+        sentinel_error("Could not open the shared memory segment %s: %s", name, strerror(errno));
+        return(NULL);
+    }
+
+    sentinel_shm_t* shm = sentinel_shm_attach(fd);
+
+    if (shm == NULL)
+        close(fd);
+
+    return(shm);
+}
+
+/**
+ * sentinel_shm_attach: Maps the segment of the descriptor for reading, eg. one received from the
+ *                      publisher of an anonymous segment. The descriptor is closed with the segment
+ **/
+
+sentinel_shm_t* sentinel_shm_attach(int fd) {
+    sentinel_shm_t* shm = sentinel_shm_map(fd, false);
+
+    if (shm == NULL)
+        return(NULL);
+
+    const uint64_t published = __atomic_load_n(&shm->segment->published, __ATOMIC_ACQUIRE);
+
+    shm->next = (published > shm->segment->slots) ? published - shm->segment->slots : 0;
+
+    return(shm);
+}
+
+/**
+ * sentinel_shm_fd: Returns the descriptor of the segment, to be passed to other processes
+ **/
+
+int sentinel_shm_fd(const sentinel_shm_t* shm) {
+    return(shm->fd);
+}
+
+/**
+ * sentinel_shm_dive_length: Bytes the dive takes in the data area, the values of each column are
+ *                           aligned to 8 bytes
+ **/
+
+static size_t sentinel_shm_dive_length(const int records) {
+    size_t length = sizeof(sentinel_shm_dive_t) + SENTINEL_SHM_COLUMN_COUNT * sizeof(sentinel_shm_column_t);
+    int i = 0;
+
+    for (i = 0; i < SENTINEL_SHM_COLUMN_COUNT; i++) {
+        length += (records * sentinel_column_size(SENTINEL_SHM_COLUMNS[i].type) + 7) & ~(size_t) 7;
+    }
+
+    return(length);
+}
+
+/**
+ * sentinel_shm_fill: Lays out the dive and its records by column at the given address
+ **/
+
+static void sentinel_shm_fill(sentinel_shm_dive_t* dive, const size_t length, const sentinel_header_t* header,
+                              const sentinel_record_t* records, const int count) {
+    size_t offset = sizeof(sentinel_shm_dive_t) + SENTINEL_SHM_COLUMN_COUNT * sizeof(sentinel_shm_column_t);
+    int i = 0;
+    int j = 0;
+
+    memset(dive, 0, sizeof(sentinel_shm_dive_t));
+    memcpy(dive->magic, SENTINEL_SHM_DIVE_MAGIC, sizeof(dive->magic));
+
+    dive->length          = length;
+    dive->content_hash    = header->content_hash;
+    dive->start_s         = header->start_s;
+    dive->end_s           = header->end_s;
+    dive->record_interval = header->record_interval;
+    dive->records         = count;
+    dive->max_depth       = header->max_depth;
+    dive->columns         = SENTINEL_SHM_COLUMN_COUNT;
+
+    if (header->serial_number != NULL)
+        strncpy(dive->serial_number, header->serial_number, sizeof(dive->serial_number) - 1);
+
+    if (header->version != NULL)
+        strncpy(dive->version, header->version, sizeof(dive->version) - 1);
+
+    for (i = 0; i < SENTINEL_SHM_COLUMN_COUNT; i++) {
+        const sentinel_shm_column_info_t* info = &SENTINEL_SHM_COLUMNS[i];
+        const size_t size = sentinel_column_size(info->type);
+        char* values = (char*) dive + offset;
+
+        memset(dive->column[i].name, 0, sizeof(dive->column[i].name));
+        strncpy(dive->column[i].name, info->name, sizeof(dive->column[i].name) - 1);
+        dive->column[i].type   = info->type;
+        dive->column[i].offset = offset;
+
+        for (j = 0; j < count; j++) {
+            memcpy(values + j * size, (const char*) &records[j] + info->offset, size);
+        }
+
+        offset += (count * size + 7) & ~(size_t) 7;
+    }
+}
+
+/**
+ * sentinel_shm_publish: Lays out the downloaded dive in the data area and announces it. The space
+ *                       of the oldest dives is reused, readers still on them see it with
+ *                       sentinel_shm_valid
+ **/
+
+bool sentinel_shm_publish(sentinel_shm_t* shm, const sentinel_header_t* header) {
+    sentinel_shm_segment_t* segment = shm->segment;
+    sentinel_record_t* records = NULL;
+
+    if (!shm->writer || header == NULL || header->log == NULL) {
+        sentinel_error("%s", "Only downloaded dives can be published, by the creator of the segment");
+        return(false);
+    }
+
+    const int count = sentinel_records_from_log(header->log, &records);
+
+    if (count < 0)
+        return(false);
+
+    const size_t length = sentinel_shm_dive_length(count);
+
+    if (length > segment->data_size) {
+        sentinel_error("The dive of %zu bytes does not fit the shared memory segment", length);
+        sentinel_free(records);
+        return(false);
+    }
+
+    /* The dive is never split at the end of the data area, the rest of it is skipped instead */
+    uint64_t position = segment->reserved_end;
+
+    if (position % segment->data_size + length > segment->data_size)
+        position += segment->data_size - position % segment->data_size;
+
+    /* The readers check the reserved end after reading a dive, so it has to move before the
+     * space of the old dives is overwritten */
+    __atomic_store_n(&segment->reserved_end, position + length, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    sentinel_shm_fill((sentinel_shm_dive_t*) ((char*) segment + segment->data_offset + position % segment->data_size),
+                      length, header, records, count);
+    sentinel_free(records);
+
+    const uint64_t seq = segment->published;
+    sentinel_shm_slot_t* slot = &segment->slot[seq % segment->slots];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->position     = position;
+    slot->length       = length;
+    slot->content_hash = header->content_hash;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&segment->published, seq + 1, __ATOMIC_RELEASE);
+
+    return(true);
+}
+
+/**
+ * sentinel_shm_next: Returns the next published dive, NULL if there is none yet. The dive is read
+ *                    in place, check with sentinel_shm_valid that it was not overwritten while
+ *                    reading it. The dives overwritten before they were read are added to lost
+ **/
+
+const sentinel_shm_dive_t* sentinel_shm_next(sentinel_shm_t* shm, uint64_t* lost) {
+    const sentinel_shm_segment_t* segment = shm->segment;
+
+    while (true) {
+        const uint64_t published = __atomic_load_n(&segment->published, __ATOMIC_ACQUIRE);
+
+        if (shm->next >= published)
+            return(NULL);
+
+        if (published - shm->next > segment->slots) {
+            if (lost != NULL)
+                *lost += published - segment->slots - shm->next;
+
+            shm->next = published - segment->slots;
+        }
+
+        const sentinel_shm_slot_t* slot = &segment->slot[shm->next % segment->slots];
+        const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        const uint64_t position = slot->position;
+        const uint64_t length   = slot->length;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        /* Still being written, try again later */
+        if (seq == 0)
+            return(NULL);
+
+        /* Reused for a newer announcement before or while we were reading it */
+        if (seq != shm->next + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            if (lost != NULL)
+                (*lost)++;
+
+            shm->next++;
+            continue;
+        }
+
+        shm->next++;
+        shm->position = position;
+
+        if (!sentinel_shm_valid(shm) || length > segment->data_size) {
+            if (lost != NULL)
+                (*lost)++;
+
+            continue;
+        }
+
+        return((const sentinel_shm_dive_t*) ((const char*) segment + segment->data_offset +
+                                             position % segment->data_size));
+    }
+}
+
+/**
+ * sentinel_shm_valid: Tells if the dive returned last by sentinel_shm_next is still intact, ie.
+ *                     its space has not been reused for a newer dive
+ **/
+
+bool sentinel_shm_valid(const sentinel_shm_t* shm) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    const uint64_t reserved_end = __atomic_load_n(&shm->segment->reserved_end, __ATOMIC_RELAXED);
+
+    return(reserved_end - shm->position <= shm->segment->data_size);
+}
+
+/**
+ * sentinel_shm_column: Returns the values of the named column, one per record, and sets its type.
+ *                      NULL if the dive has no such column
+ **/
+
+const void* sentinel_shm_column(const sentinel_shm_dive_t* dive, const char* name, sentinel_column_type_t* type) {
+    uint32_t i = 0;
+
+    for (i = 0; i < dive->columns; i++) {
+        if (strncmp(dive->column[i].name, name, sizeof(dive->column[i].name)) == 0) {
+            if (type != NULL)
+                *type = dive->column[i].type;
+
+            return((const char*) dive + dive->column[i].offset);
+        }
+    }
+
+    return(NULL);
+}
+
+/**
+ * sentinel_shm_close: Unmaps the segment and closes its descriptor, a named segment stays for the
+ *                     other processes until sentinel_shm_unlink
+ **/
+
+void sentinel_shm_close(sentinel_shm_t* shm) {
+    if (shm == NULL)
+        return;
+
+    munmap(shm->segment, shm->size);
+    close(shm->fd);
+    sentinel_free(shm);
+}
+
+/**
+ * sentinel_shm_unlink: Removes the named segment, the processes which have it mapped keep it
+ **/
+
+bool sentinel_shm_unlink(const char* name) {
+    char* shm_name = sentinel_shm_name(name);
+
+    if (shm_name == NULL)
+        return(false);
+
+    const int res = shm_unlink(shm_name);
+
+    sentinel_free(shm_name);
+
+    return(res == 0);
+}
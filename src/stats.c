@@ -0,0 +1,83 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include "libsentinel.h"
+
+/* One set of counters per thread, so that sessions run in different threads
+ * do not mix up their numbers */
+static __thread sentinel_stats_t stats;
+
+/**
+ * sentinel_get_stats: Returns the counters of the calling thread, or of the context when called
+ *                     inside one. The effective baud rate is updated from the bytes received and
+ *                     the time spent receiving them
+ **/
+
+sentinel_stats_t* sentinel_get_stats(void) {
+    sentinel_ctx_t* ctx = sentinel_ctx_current();
+
+    if (ctx != NULL)
+        return(sentinel_ctx_stats(ctx));
+
+    if (stats.receive_ns > 0)
+        stats.effective_baud = stats.bytes_received * 10.0 / (stats.receive_ns / 1e9);
+
+    return(&stats);
+}
+
+/**
+ * sentinel_reset_stats: Zeroes the counters of the calling thread
+ **/
+
+void sentinel_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * print_sentinel_stats_json: Prints the given counters as a single JSON object
+ **/
+
+void print_sentinel_stats_json(FILE* out, const sentinel_stats_t* s) {
+    fprintf(out, "{\"bytes_read\": %ld, ", s->bytes_read);
+    fprintf(out, "\"bytes_written\": %ld, ", s->bytes_written);
+    fprintf(out, "\"read_calls\": %ld, ", s->read_calls);
+    fprintf(out, "\"empty_reads\": %ld, ", s->empty_reads);
+    fprintf(out, "\"wakeups\": %ld, ", s->wakeups);
+    fprintf(out, "\"slept_ms\": %.3lf, ", s->slept_ns / 1e6);
+    fprintf(out, "\"flushed_bytes\": %ld, ", s->flushed_bytes);
+    fprintf(out, "\"idle_retries\": %ld, ", s->idle_retries);
+    fprintf(out, "\"connect_ms\": %.3lf, ", s->connect_ns / 1e6);
+    fprintf(out, "\"receive_ms\": %.3lf, ", s->receive_ns / 1e6);
+    fprintf(out, "\"bytes_received\": %ld, ", s->bytes_received);
+    fprintf(out, "\"parse_ms\": %.3lf, ", s->parse_ns / 1e6);
+    fprintf(out, "\"allocations\": %ld, ", s->allocations);
+    fprintf(out, "\"effective_baud\": %.1lf}\n", s->effective_baud);
+}
+
+/**
+ * sentinel_time_ns: Monotonic clock in nanoseconds, used for the phase timers
+ **/
+
+long long sentinel_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((long long) ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
@@ -0,0 +1,747 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* memmem */
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "libsentinel.h"
+
+/* 64-bit FNV-1a */
+static const uint64_t SENTINEL_HASH_OFFSET = 14695981039346656037ULL;
+static const uint64_t SENTINEL_HASH_PRIME  = 1099511628211ULL;
+
+/* The dives are stored in the same format as the dump files of the emulator */
+static const char SENTINEL_STORE_DIVE_START[] = "              d\r\n";
+static const char SENTINEL_STORE_DIVE_END[] = "End\r\n@@P\r\n";
+static const char SENTINEL_STORE_INDEX[] = "index";
+
+/**
+ * sentinel_hash_header: Hashes the header of a dive from its ver= line on. The line separators
+ *                       are left out, so that only the content counts
+ **/
+
+uint64_t sentinel_hash_header(const char* header, size_t len) {
+    const char* ver = memmem(header, len, "ver=", 4);
+    uint64_t hash = SENTINEL_HASH_OFFSET;
+    size_t i = 0;
+
+    if (ver != NULL) {
+        len   -= ver - header;
+        header = ver;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (header[i] == '\r' || header[i] == '\n')
+            continue;
+
+        hash = (hash ^ (unsigned char) header[i]) * SENTINEL_HASH_PRIME;
+    }
+
+    return(hash);
+}
+
+/**
+ * sentinel_hash_line: Adds a record of the profile, without the line separator, to the hash
+ **/
+
+uint64_t sentinel_hash_line(uint64_t hash, const char* line, size_t len) {
+    uint64_t line_hash = SENTINEL_HASH_OFFSET;
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        line_hash = (line_hash ^ (unsigned char) line[i]) * SENTINEL_HASH_PRIME;
+    }
+
+    /* Folding the lines in one at a time keeps the order of the records in the hash */
+    for (i = 0; i < sizeof(line_hash); i++) {
+        hash = (hash ^ ((line_hash >> (8 * i)) & 0xff)) * SENTINEL_HASH_PRIME;
+    }
+
+    return(hash);
+}
+
+/**
+ * sentinel_dive_hash: Content hash of a dive as received with the D command or read from a dump
+ *                     file. This is the same hash as parse_sentinel_dive sets to the header.
+ *                     Returns 0 if there is no profile in the text
+ **/
+
+uint64_t sentinel_dive_hash(const char* text, size_t len) {
+    const char* profile = memmem(text, len, "Profile\r\n", 9);
+
+    if (profile == NULL)
+        return(0);
+
+    uint64_t hash = sentinel_hash_header(text, profile - text);
+    const char* line = profile + 9;
+    const char* end  = text + len;
+    const char* next = NULL;
+    size_t line_len = 0;
+
+    while ((next = sentinel_profile_next_line(&line, end, &line_len)) != NULL) {
+        hash = sentinel_hash_line(hash, line, line_len);
+        line = next;
+    }
+
+    return(hash);
+}
+
+/**
+ * sentinel_store_slot: Returns the slot of the hash table where the hash is, or the empty slot
+ *                      where it would go
+ **/
+
+static int sentinel_store_slot(const sentinel_store_t* store, const uint64_t hash) {
+    int slot = (int) (hash & (store->slot_count - 1));
+
+    while (store->slots[slot] != 0 && store->entries[store->slots[slot] - 1].hash != hash) {
+        slot = (slot + 1) & (store->slot_count - 1);
+    }
+
+    return(slot);
+}
+
+/**
+ * sentinel_store_append: Adds an entry to the in-memory index, in the context of the store
+ **/
+
+static bool sentinel_store_append(sentinel_store_t* store, const sentinel_store_entry_t* entry) {
+    int i = 0;
+
+    if (store->count == store->size) {
+        const int new_size = (store->size > 0) ? store->size * 2 : 64;
+        sentinel_store_entry_t* tmp = sentinel_realloc(store->entries, new_size * sizeof(sentinel_store_entry_t));
+
+        if (tmp == NULL)
+            return(false);
+
+        store->entries = tmp;
+        store->size    = new_size;
+    }
+
+    /* The table is kept at most half full */
+    if ((store->count + 1) * 2 > store->slot_count) {
+        const int new_count = (store->slot_count > 0) ? store->slot_count * 2 : 128;
+        int* tmp = sentinel_calloc(new_count, sizeof(int));
+
+        if (tmp == NULL)
+            return(false);
+
+        sentinel_free(store->slots);
+        store->slots      = tmp;
+        store->slot_count = new_count;
+
+        for (i = 0; i < store->count; i++) {
+            store->slots[sentinel_store_slot(store, store->entries[i].hash)] = i + 1;
+        }
+    }
+
+    /* Until a dive is added out of order, the events of a time range are found in halves */
+    const int last_s = (store->count > 0) ? store->entries[store->count - 1].start_s : entry->start_s;
+
+    store->ascending  = (store->count == 0 || store->ascending) && entry->start_s >= last_s;
+    store->descending = (store->count == 0 || store->descending) && entry->start_s <= last_s;
+    store->entries[store->count] = *entry;
+    store->slots[sentinel_store_slot(store, entry->hash)] = ++store->count;
+
+    return(true);
+}
+
+/**
+ * sentinel_store_index_dive: Parses the profile of a stored dive once for its events and its summary
+ **/
+
+static bool sentinel_store_index_dive(sentinel_store_t* store, const int dive, const bool events, const bool summary) {
+    sentinel_record_t* records = NULL;
+    size_t len = 0;
+    bool res = false;
+    char* text = sentinel_store_read(store, &store->entries[dive], &len);
+    const int count = (text != NULL) ? parse_sentinel_dive_records(text, len, &records) : -1;
+
+    if (count >= 0) {
+        res = true;
+
+        if (events)
+            res &= sentinel_events_index(store, dive, records, count);
+
+        if (summary)
+            res &= sentinel_summary_index(store, dive, records, count);
+    }
+
+    sentinel_free(records);
+    sentinel_free(text);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_open: Opens the store in the given directory, which is created if needed, and
+ *                      reads its index. The store is kept in the memory of the current context,
+ *                      which has to outlive it
+ **/
+
+sentinel_store_t* sentinel_store_open(const char* path) {
+    sentinel_store_t* store = sentinel_calloc(1, sizeof(sentinel_store_t));
+    char line[256];
+    int i = 0;
+
+    if (store == NULL)
+        return(NULL);
+
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        sentinel_error("Could not create the store %s: %s", path, strerror(errno));
+        sentinel_free(store);
+        return(NULL);
+    }
+
+    store->ctx  = sentinel_ctx_current();
+    store->path = sentinel_strdup(path);
+
+    if (store->path != NULL)
+        store->index_path = sentinel_store_file(store, SENTINEL_STORE_INDEX);
+
+    if (store->path == NULL || store->index_path == NULL) {
+        sentinel_store_close(store);
+        return(NULL);
+    }
+
+    FILE* index = fopen(store->index_path, "r");
+
+    if (index != NULL) {
+        while (fgets(line, sizeof(line), index) != NULL) {
+            sentinel_store_entry_t entry = {0, {0}, 0, 0, {0}};
+
+            if (sscanf(line, "%" SCNx64 " %d %d %31s", &entry.hash, &entry.start_s, &entry.log_lines,
+                       entry.serial_number) < 3) {
+                sentinel_warn("Skipping a broken line in the index of %s", path);
+                continue;
+            }
+
+            if (strcmp(entry.serial_number, "-") == 0)
+                entry.serial_number[0] = 0;
+
+            if (sentinel_store_find(store, entry.hash) == NULL && !sentinel_store_append(store, &entry)) {
+                fclose(index);
+                sentinel_store_close(store);
+                return(NULL);
+            }
+        }
+
+        fclose(index);
+    }
+
+    bool* missing_events = sentinel_calloc(store->count + 1, sizeof(bool));
+    bool* missing_summary = sentinel_calloc(store->count + 1, sizeof(bool));
+
+    if (missing_events == NULL || missing_summary == NULL || !sentinel_events_open(store, missing_events) ||
+        !sentinel_summary_open(store, missing_summary)) {
+        sentinel_free(missing_events);
+        sentinel_free(missing_summary);
+        sentinel_store_close(store);
+        return(NULL);
+    }
+
+    /* The dives added before the events and the summaries were kept, or when the program stopped
+     * before writing them, are indexed from their files */
+    for (i = 0; i < store->count; i++) {
+        if ((missing_events[i] || missing_summary[i]) &&
+            !sentinel_store_index_dive(store, i, missing_events[i], missing_summary[i]))
+            sentinel_warn("Dive %016" PRIx64 " is left out of the events or the summaries", store->entries[i].hash);
+    }
+
+    sentinel_free(missing_events);
+    sentinel_free(missing_summary);
+
+    sentinel_debug("Opened store %s with %d dives", path, store->count);
+
+    return(store);
+}
+
+/**
+ * sentinel_store_close: Frees the store in the context it was opened in, the files stay
+ **/
+
+void sentinel_store_close(sentinel_store_t* store) {
+    if (store == NULL)
+        return;
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(store->ctx);
+
+    sentinel_events_free(store);
+    sentinel_summary_free(store);
+    sentinel_free(store->entries);
+    sentinel_free(store->slots);
+    sentinel_free(store->index_path);
+    sentinel_free(store->path);
+    sentinel_free(store);
+    sentinel_ctx_leave(prev);
+}
+
+/**
+ * sentinel_store_find: Returns the entry of the dive with the given content hash, NULL if the
+ *                      dive is not in the store
+ **/
+
+const sentinel_store_entry_t* sentinel_store_find(const sentinel_store_t* store, const uint64_t hash) {
+    if (store->count == 0)
+        return(NULL);
+
+    const int slot = sentinel_store_slot(store, hash);
+
+    return((store->slots[slot] != 0) ? &store->entries[store->slots[slot] - 1] : NULL);
+}
+
+/**
+ * sentinel_store_newest: Returns the entry of the newest dive of the given rebreather in the store,
+ *                        NULL serial_number matches any. NULL if there is none
+ **/
+
+const sentinel_store_entry_t* sentinel_store_newest(const sentinel_store_t* store, const char* serial_number) {
+    const sentinel_store_entry_t* newest = NULL;
+    int i = 0;
+
+    for (i = 0; i < store->count; i++) {
+        if (serial_number != NULL && strcmp(store->entries[i].serial_number, serial_number) != 0)
+            continue;
+
+        if (newest == NULL || store->entries[i].start_s > newest->start_s)
+            newest = &store->entries[i];
+    }
+
+    return(newest);
+}
+
+/**
+ * sentinel_store_anchor: Anchor of sentinel_store_list_new, the newest dive of the rebreather
+ **/
+
+static int sentinel_store_anchor(const char* serial_number, void* data) {
+    const sentinel_store_entry_t* newest = sentinel_store_newest(data, serial_number);
+
+    return((newest != NULL) ? newest->start_s : -1);
+}
+
+/**
+ * sentinel_store_list_new: Fetches the headers of the dives of the connected rebreather newer than
+ *                          its newest dive in the store into ctx->header_list. The rebreather is
+ *                          told by the serial number of the first header, so the dives of other
+ *                          rebreathers in the store do not matter
+ **/
+
+bool sentinel_store_list_new(sentinel_ctx_t* ctx, const sentinel_store_t* store) {
+    return(sentinel_ctx_list_anchored(ctx, sentinel_store_anchor, (void*) store));
+}
+
+/**
+ * sentinel_store_file: Returns the path of the named file in the store, allocated with sentinel_malloc
+ **/
+
+char* sentinel_store_file(const sentinel_store_t* store, const char* name) {
+    const size_t len = strlen(store->path) + strlen(name) + 2;
+    char* path = sentinel_malloc(len);
+
+    if (path != NULL)
+        snprintf(path, len, "%s/%s", store->path, name);
+
+    return(path);
+}
+
+/**
+ * sentinel_store_getline: Reads a line of any length like getline, into a buffer grown with
+ *                         sentinel_realloc. Returns the length of the line, -1 at the end or on error
+ **/
+
+ssize_t sentinel_store_getline(char** line, size_t* size, FILE* in) {
+    size_t len = 0;
+
+    while (true) {
+        if (*size - len < 2) {
+            const size_t new_size = (*size > 0) ? *size * 2 : 256;
+            char* tmp = sentinel_realloc(*line, new_size);
+
+            if (tmp == NULL)
+                return(-1);
+
+            *line = tmp;
+            *size = new_size;
+        }
+
+        if (fgets(*line + len, *size - len, in) == NULL)
+            return((len > 0) ? (ssize_t) len : -1);
+
+        len += strlen(*line + len);
+
+        if (len > 0 && (*line)[len - 1] == '\n')
+            return(len);
+    }
+}
+
+/**
+ * sentinel_store_dive_path: Returns the path of the file of the dive, allocated with sentinel_malloc
+ **/
+
+char* sentinel_store_dive_path(const sentinel_store_t* store, const uint64_t hash) {
+    char name[32];
+
+    snprintf(name, sizeof(name), "%016" PRIx64 ".txt", hash);
+
+    return(sentinel_store_file(store, name));
+}
+
+/**
+ * sentinel_store_index: Adds the entry of a dive, whose file is already written, to the index, its
+ *                       notes to the events and its summary. If those are not written, the dive is
+ *                       indexed again from its file when the store is opened. The memory of the
+ *                       store grows in the context of the store, not the one downloading the dive
+ **/
+
+static bool sentinel_store_index(sentinel_store_t* store, const sentinel_store_entry_t* entry) {
+    bool res = false;
+    FILE* index = fopen(store->index_path, "a");
+
+    if (index == NULL) {
+        sentinel_error("Could not open %s: %s", store->index_path, strerror(errno));
+        return(false);
+    }
+
+    fprintf(index, "%016" PRIx64 " %d %d %s\n", entry->hash, entry->start_s, entry->log_lines,
+            (entry->serial_number[0] != 0) ? entry->serial_number : "-");
+    res = (fflush(index) == 0 && fsync(fileno(index)) == 0);
+    res &= (fclose(index) == 0);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(store->ctx);
+
+    res = res && sentinel_store_append(store, entry);
+
+    if (res && !sentinel_store_index_dive(store, store->count - 1, true, true))
+        sentinel_warn("Dive %016" PRIx64 " is indexed again when the store is opened", entry->hash);
+
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_write: Writes the dive file through a temporary file, so that a crash never
+ *                       leaves a partial dive, and then adds the dive to the index
+ **/
+
+static bool sentinel_store_write(sentinel_store_t* store, const sentinel_store_entry_t* entry,
+                                 const char* header_text, char** lines, const int line_count) {
+    char* path = sentinel_store_dive_path(store, entry->hash);
+    char* tmp_path = NULL;
+    bool res = false;
+    int i = 0;
+
+    if (path == NULL || (tmp_path = sentinel_malloc(strlen(path) + 5)) == NULL) {
+        sentinel_free(path);
+        return(false);
+    }
+
+    sprintf(tmp_path, "%s.tmp", path);
+
+    FILE* out = fopen(tmp_path, "w");
+
+    if (out == NULL) {
+        sentinel_error("Could not write %s: %s", tmp_path, strerror(errno));
+    } else {
+        const char* ver = strstr(header_text, "ver=");
+
+        fputs(SENTINEL_STORE_DIVE_START, out);
+        fputs((ver != NULL) ? ver : header_text, out);
+        fputs("Profile\r\n", out);
+
+        for (i = 0; i < line_count; i++) {
+            if (lines[i] != NULL)
+                fprintf(out, "%s\r\n", lines[i]);
+        }
+
+        fputs(SENTINEL_STORE_DIVE_END, out);
+        res = (fflush(out) == 0 && fsync(fileno(out)) == 0);
+        res &= (fclose(out) == 0);
+        res = res && (rename(tmp_path, path) == 0);
+
+        if (!res) {
+            sentinel_error("Could not write %s: %s", path, strerror(errno));
+            unlink(tmp_path);
+        }
+    }
+
+    sentinel_free(tmp_path);
+    sentinel_free(path);
+
+    return(res && sentinel_store_index(store, entry));
+}
+
+/**
+ * sentinel_store_entry: Fills the index entry of a dive from its header
+ **/
+
+static void sentinel_store_entry(sentinel_store_entry_t* entry, const sentinel_header_t* header, const uint64_t hash) {
+    *entry = (sentinel_store_entry_t) {hash, {0}, header->start_s, header->log_lines, {0}};
+
+    if (header->serial_number != NULL)
+        snprintf(entry->serial_number, sizeof(entry->serial_number), "%s", header->serial_number);
+}
+
+/**
+ * sentinel_store_ingest: Adds a dive, as received with the D command or read from a dump file, to
+ *                        the store. A dive already in the store costs only the hash and the
+ *                        lookup, otherwise only the header is parsed. Dives of an unsupported
+ *                        firmware are not added. The hash is returned in hash if it is not NULL
+ **/
+
+sentinel_store_result_t sentinel_store_ingest(sentinel_store_t* store, const char* text, size_t len, uint64_t* hash) {
+    const uint64_t dive_hash = sentinel_dive_hash(text, len);
+    const char* profile = memmem(text, len, "Profile\r\n", 9);
+    sentinel_store_result_t res = SENTINEL_STORE_ERROR;
+    sentinel_store_entry_t entry;
+    char** lines = NULL;
+
+    if (hash != NULL)
+        *hash = dive_hash;
+
+    if (profile == NULL) {
+        sentinel_error("%s", "No profile in the dive");
+        return(SENTINEL_STORE_ERROR);
+    }
+
+    if (sentinel_store_find(store, dive_hash) != NULL)
+        return(SENTINEL_STORE_DUPLICATE);
+
+    char* header_text = sentinel_calloc(profile - text + 1, sizeof(char));
+    char* header_str = sentinel_calloc(profile - text + 1, sizeof(char));
+    sentinel_header_t* header = alloc_sentinel_header();
+
+    if (header_text != NULL && header_str != NULL && header != NULL) {
+        memcpy(header_text, text, profile - text);
+        memcpy(header_str, text, profile - text);
+        *header = DEFAULT_HEADER;
+
+        if (parse_sentinel_header(&header, &header_str) && sentinel_dive_layout(text, profile - text) != NULL) {
+            /* The records are written as they are, up to End */
+            char* body = sentinel_calloc(len - (profile + 9 - text) + 1, sizeof(char));
+
+            if (body != NULL) {
+                memcpy(body, profile + 9, len - (profile + 9 - text));
+
+                char* end = strstr(body, "End\r\n");
+
+                if (end != NULL)
+                    *end = 0;
+
+                lines = str_cut(&body, "\r\n");
+                sentinel_free(body);
+            }
+
+            int line_count = 0;
+
+            while (lines != NULL && lines[line_count] != NULL) {
+                line_count++;
+            }
+
+            sentinel_store_entry(&entry, header, dive_hash);
+
+            if (sentinel_store_write(store, &entry, header_text, lines, line_count))
+                res = SENTINEL_STORE_ADDED;
+        }
+    }
+
+    free_string_array(lines);
+    free_sentinel_header(header);
+    sentinel_free(header_str);
+    sentinel_free(header_text);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_download: Downloads the given dive of the context like
+ *                          sentinel_ctx_download_resumable and adds it to the store. A dive
+ *                          already in the store is recognized from the hash of the received text
+ *                          and not parsed or written, its header in ctx->header_list has no log.
+ *                          Incomplete dives are not stored
+ **/
+
+sentinel_store_result_t sentinel_store_download(sentinel_ctx_t* ctx, sentinel_store_t* store, const int dive_num,
+                                                const int attempts, sentinel_download_report_t* report) {
+    sentinel_store_result_t res = SENTINEL_STORE_ERROR;
+    sentinel_resume_t resume;
+
+    *report = DEFAULT_DOWNLOAD_REPORT;
+
+    if (!sentinel_ctx_check_dive(ctx, dive_num))
+        return(SENTINEL_STORE_ERROR);
+
+    sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+    sentinel_header_t** header_item = &ctx->header_list[dive_num];
+    ctx->busy = true;
+
+    if (sentinel_resume_receive(ctx->fd, dive_num, header_item, attempts, &resume, report) && report->complete) {
+        const uint64_t hash = sentinel_resume_hash(&resume);
+
+        if (sentinel_store_find(store, hash) != NULL) {
+            (*header_item)->content_hash = hash;
+            res = SENTINEL_STORE_DUPLICATE;
+        } else if (sentinel_resume_parse(&resume, *header_item)) {
+            sentinel_store_entry_t entry;
+            sentinel_store_entry(&entry, *header_item, hash);
+
+            if (sentinel_store_write(store, &entry, resume.header_text, resume.lines, resume.size))
+                res = SENTINEL_STORE_ADDED;
+        }
+    } else {
+        sentinel_error("Dive %d is incomplete, not storing it", dive_num);
+    }
+
+    sentinel_resume_free(&resume);
+    ctx->busy = false;
+    sentinel_ctx_leave(prev);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_stream: Downloads the given dive straight into the store with sentinel_fixed_stream,
+ *                        in the memory of the buffers of the dive. The dive is written to a
+ *                        temporary file as it arrives and only added once complete. A dive already
+ *                        in the store is recognized from its hash once downloaded
+ **/
+
+sentinel_store_result_t sentinel_store_stream(sentinel_store_t* store, int fd, const int dive_num,
+                                              sentinel_fixed_dive_t* dive) {
+    sentinel_store_result_t res = SENTINEL_STORE_ERROR;
+    char* tmp_path = NULL;
+    char* path = NULL;
+    FILE* out = NULL;
+
+    /* Unique, so that several downloads can stream into the same store */
+    if ((tmp_path = sentinel_store_file(store, "incoming-XXXXXX")) == NULL)
+        return(SENTINEL_STORE_ERROR);
+
+    const int tmp_fd = mkstemp(tmp_path);
+
+    /* mkstemp leaves the file readable only by the owner, the other dives are not */
+    if (tmp_fd >= 0 && (fchmod(tmp_fd, 0644) != 0 || (out = fdopen(tmp_fd, "w")) == NULL))
+        close(tmp_fd);
+
+    if (out == NULL || fputs(SENTINEL_STORE_DIVE_START, out) < 0 || fflush(out) != 0) {
+        sentinel_error("Could not write %s: %s", tmp_path, strerror(errno));
+    } else {
+        const sentinel_fixed_status_t status = sentinel_fixed_stream(fd, dive_num, dive, fileno(out));
+        const sentinel_fixed_header_t* header = dive->header;
+
+        if ((status != SENTINEL_FIXED_OK && status != SENTINEL_FIXED_TRUNCATED) || !dive->ended) {
+            sentinel_error("Dive %d is incomplete, not storing it", dive_num);
+        } else if (sentinel_store_find(store, header->content_hash) != NULL) {
+            res = SENTINEL_STORE_DUPLICATE;
+        } else if ((path = sentinel_store_dive_path(store, header->content_hash)) != NULL) {
+            /* The End line is already there */
+            bool written = (fputs(SENTINEL_STORE_DIVE_END + strlen("End\r\n"), out) >= 0 && fflush(out) == 0 && fsync(fileno(out)) == 0);
+            sentinel_store_entry_t entry = {header->content_hash, {0}, header->start_s, header->log_lines, {0}};
+
+            snprintf(entry.serial_number, sizeof(entry.serial_number), "%s", header->serial_number);
+
+            if (!written || rename(tmp_path, path) != 0)
+                sentinel_error("Could not write %s: %s", path, strerror(errno));
+            else if (sentinel_store_index(store, &entry))
+                res = SENTINEL_STORE_ADDED;
+        }
+    }
+
+    if (out != NULL)
+        fclose(out);
+
+    if (res != SENTINEL_STORE_ADDED && tmp_fd >= 0)
+        unlink(tmp_path);
+
+    sentinel_free(tmp_path);
+    sentinel_free(path);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_read: Returns the text of a dive of the store, NUL terminated, with its length in
+ *                      len. NULL if the file can not be read
+ **/
+
+char* sentinel_store_read(const sentinel_store_t* store, const sentinel_store_entry_t* entry, size_t* len) {
+    char* path = sentinel_store_dive_path(store, entry->hash);
+    char* buffer = NULL;
+    struct stat sb;
+
+    if (path == NULL)
+        return(NULL);
+
+    FILE* in = fopen(path, "r");
+
+    if (in == NULL || fstat(fileno(in), &sb) != 0) {
+        sentinel_error("Could not read %s: %s", path, strerror(errno));
+    } else if ((buffer = sentinel_calloc(sb.st_size + 1, sizeof(char))) != NULL) {
+        if (fread(buffer, 1, sb.st_size, in) == (size_t) sb.st_size) {
+            *len = sb.st_size;
+        } else {
+            sentinel_error("Could not read %s", path);
+            sentinel_free(buffer);
+            buffer = NULL;
+        }
+    }
+
+    if (in != NULL)
+        fclose(in);
+
+    sentinel_free(path);
+
+    return(buffer);
+}
+
+/**
+ * sentinel_store_load: Reads and parses a dive of the store into header_item, which is freed first
+ **/
+
+bool sentinel_store_load(const sentinel_store_t* store, const sentinel_store_entry_t* entry,
+                         sentinel_header_t** header_item) {
+    size_t len = 0;
+    char* buffer = sentinel_store_read(store, entry, &len);
+    bool res = (buffer != NULL && parse_sentinel_dive(&buffer, header_item));
+
+    sentinel_free(buffer);
+
+    return(res);
+}
+
+/**
+ * sentinel_store_scan: Feeds a dive of the store to the detector without parsing it into a header,
+ *                      see sentinel_detector_scan
+ **/
+
+bool sentinel_store_scan(const sentinel_store_t* store, const sentinel_store_entry_t* entry,
+                         sentinel_detector_t* detector) {
+    size_t len = 0;
+    char* buffer = sentinel_store_read(store, entry, &len);
+    bool res = (buffer != NULL && sentinel_detector_scan(detector, buffer, len) >= 0);
+
+    sentinel_free(buffer);
+
+    return(res);
+}
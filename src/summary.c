@@ -0,0 +1,311 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <inttypes.h>
+
+#include "libsentinel.h"
+
+static const char SENTINEL_STORE_SUMMARIES[] = "summaries";
+
+/**
+ * sentinel_summary_add: Adds a record to the summary, the first record sets the minimums and maximums
+ **/
+
+void sentinel_summary_add(sentinel_summary_t* summary, const sentinel_record_t* record) {
+    int i = 0;
+
+    if (summary->records == 0) {
+        summary->min_depth           = record->depth;
+        summary->max_depth           = record->depth;
+        summary->min_po2             = record->po2;
+        summary->max_po2             = record->po2;
+        summary->min_battery[0]      = record->battery[0];
+        summary->min_battery[1]      = record->battery[1];
+        summary->diluent_pressure[0] = record->diluent_pressure;
+        summary->o2_pressure[0]      = record->o2_pressure;
+        summary->max_co2             = record->co2;
+
+        for (i = 0; i < 3; i++) {
+            summary->min_cell_o2[i] = record->cell_o2[i];
+        }
+    }
+
+    summary->records++;
+    summary->depth_sum += record->depth;
+
+    if (record->depth < summary->min_depth) summary->min_depth = record->depth;
+    if (record->depth > summary->max_depth) summary->max_depth = record->depth;
+    if (record->po2 < summary->min_po2) summary->min_po2 = record->po2;
+    if (record->po2 > summary->max_po2) summary->max_po2 = record->po2;
+    if (record->co2 > summary->max_co2) summary->max_co2 = record->co2;
+
+    for (i = 0; i < 3; i++) {
+        if (record->cell_o2[i] < summary->min_cell_o2[i])
+            summary->min_cell_o2[i] = record->cell_o2[i];
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (record->battery[i] < summary->min_battery[i])
+            summary->min_battery[i] = record->battery[i];
+    }
+
+    summary->diluent_pressure[1] = record->diluent_pressure;
+    summary->o2_pressure[1]      = record->o2_pressure;
+
+    for (i = 0; i < 3; i++) {
+        const uint8_t code = record->note[i];
+
+        /* A note repeated on the same line is counted once */
+        if (code == 0 || (i > 0 && code == record->note[0]) || (i > 1 && code == record->note[1]))
+            continue;
+
+        summary->note_count[(code >= 1 && code <= SENTINEL_NOTE_KINDS) ? code - 1 : SENTINEL_NOTE_KINDS]++;
+    }
+}
+
+/**
+ * sentinel_summary_add_line: Adds a parsed log line to the summary. Only the summarized values are
+ *                            converted to the units of the rebreather, the rest of the line is skipped
+ **/
+
+void sentinel_summary_add_line(sentinel_summary_t* summary, const sentinel_dive_log_line_t* line) {
+    sentinel_record_t record;
+    int i = 0;
+
+    record.depth            = sentinel_clamp_u16(lround(line->depth * 64.0 / 6.0));
+    record.po2              = sentinel_clamp_u16(lround(line->po2 * 100.0));
+    record.battery[0]       = sentinel_clamp_u16(lround(line->primary_battery_V * 100.0));
+    record.battery[1]       = sentinel_clamp_u16(lround(line->secondary_battery_V * 100.0));
+    record.diluent_pressure = sentinel_clamp_s16(line->diluent_pressure);
+    record.o2_pressure      = sentinel_clamp_s16(line->o2_pressure);
+    record.co2              = sentinel_clamp_u16(lround(line->co2));
+
+    for (i = 0; i < 3; i++) {
+        record.cell_o2[i] = sentinel_clamp_u16(lround(line->cell_o2[i] * 100.0));
+        record.note[i]    = 0;
+    }
+
+    for (i = 0; i < 3 && line->note != NULL && line->note[i] != NULL; i++) {
+        record.note[i] = (line->note[i]->note != NULL) ?
+                         sentinel_note_code(line->note[i]->note, strlen(line->note[i]->note)) : SENTINEL_NOTE_UNKNOWN;
+    }
+
+    sentinel_summary_add(summary, &record);
+}
+
+/**
+ * sentinel_summary_min_depth: Minimum depth in meters, see sentinel_record_depth
+ **/
+
+double sentinel_summary_min_depth(const sentinel_summary_t* summary) {
+    return((summary->min_depth * 6) / 64.0);
+}
+
+/**
+ * sentinel_summary_max_depth: Maximum depth in meters
+ **/
+
+double sentinel_summary_max_depth(const sentinel_summary_t* summary) {
+    return((summary->max_depth * 6) / 64.0);
+}
+
+/**
+ * sentinel_summary_mean_depth: Mean depth of the records in meters, 0 without records
+ **/
+
+double sentinel_summary_mean_depth(const sentinel_summary_t* summary) {
+    if (summary->records == 0)
+        return(0.0);
+
+    return((summary->depth_sum * 6) / (64.0 * summary->records));
+}
+
+/**
+ * sentinel_summary_diluent_drop: Drop of the diluent cylinder pressure from the first record to the last
+ **/
+
+int sentinel_summary_diluent_drop(const sentinel_summary_t* summary) {
+    return(summary->diluent_pressure[0] - summary->diluent_pressure[1]);
+}
+
+/**
+ * sentinel_summary_o2_drop: Drop of the oxygen cylinder pressure from the first record to the last
+ **/
+
+int sentinel_summary_o2_drop(const sentinel_summary_t* summary) {
+    return(summary->o2_pressure[0] - summary->o2_pressure[1]);
+}
+
+/**
+ * sentinel_summary_events: Notes of all kinds in the records
+ **/
+
+int sentinel_summary_events(const sentinel_summary_t* summary) {
+    int count = 0;
+    int i = 0;
+
+    for (i = 0; i <= SENTINEL_NOTE_KINDS; i++) {
+        count += summary->note_count[i];
+    }
+
+    return(count);
+}
+
+/**
+ * sentinel_summary_index: Sets the summary of a dive of the store from its records and writes it to
+ *                         the summaries file, a line of the hash, the fields and code/count of the notes
+ **/
+
+bool sentinel_summary_index(sentinel_store_t* store, const int dive, const sentinel_record_t* records, const int count) {
+    sentinel_summary_t* summary = &store->entries[dive].summary;
+    bool res = true;
+    int i = 0;
+
+    memset(summary, 0, sizeof(sentinel_summary_t));
+
+    for (i = 0; i < count; i++) {
+        sentinel_summary_add(summary, &records[i]);
+    }
+
+    FILE* out = fopen(store->summaries_path, "a");
+
+    if (out == NULL) {
+        sentinel_error("Could not open %s: %s", store->summaries_path, strerror(errno));
+        return(false);
+    }
+
+    fprintf(out, "%016" PRIx64 " %d %u %u %" PRIu64 " %u %u %u %u %u %u %u %d %d %d %d %u",
+            store->entries[dive].hash, summary->records, summary->min_depth, summary->max_depth, summary->depth_sum,
+            summary->min_po2, summary->max_po2, summary->min_cell_o2[0], summary->min_cell_o2[1],
+            summary->min_cell_o2[2], summary->min_battery[0], summary->min_battery[1],
+            summary->diluent_pressure[0], summary->diluent_pressure[1], summary->o2_pressure[0],
+            summary->o2_pressure[1], summary->max_co2);
+
+    for (i = 0; i <= SENTINEL_NOTE_KINDS; i++) {
+        if (summary->note_count[i] > 0)
+            fprintf(out, " %d/%u", (i < SENTINEL_NOTE_KINDS) ? i + 1 : SENTINEL_NOTE_UNKNOWN, summary->note_count[i]);
+    }
+
+    fputc('\n', out);
+    res &= (fflush(out) == 0 && fsync(fileno(out)) == 0);
+    res &= (fclose(out) == 0);
+
+    return(res);
+}
+
+/**
+ * sentinel_summary_open: Reads the summaries file of the store into the entries. The dives missing
+ *                        from it are set in missing, to be summarized from their files
+ **/
+
+bool sentinel_summary_open(sentinel_store_t* store, bool* missing) {
+    char* line = NULL;
+    size_t line_size = 0;
+    int i = 0;
+
+    if ((store->summaries_path = sentinel_store_file(store, SENTINEL_STORE_SUMMARIES)) == NULL)
+        return(false);
+
+    for (i = 0; i < store->count; i++) {
+        missing[i] = true;
+    }
+
+    FILE* in = fopen(store->summaries_path, "r");
+
+    while (in != NULL && sentinel_store_getline(&line, &line_size, in) > 0) {
+        sentinel_summary_t s;
+        uint64_t hash = 0;
+        unsigned int u[10];
+        int pressure[4];
+        int offset = 0;
+
+        memset(&s, 0, sizeof(sentinel_summary_t));
+
+        if (sscanf(line, "%" SCNx64 " %d %u %u %" SCNu64 " %u %u %u %u %u %u %u %d %d %d %d %u%n", &hash, &s.records,
+                   &u[0], &u[1], &s.depth_sum, &u[2], &u[3], &u[4], &u[5], &u[6], &u[7], &u[8], &pressure[0],
+                   &pressure[1], &pressure[2], &pressure[3], &u[9], &offset) < 17) {
+            sentinel_warn("Skipping a broken line in %s", store->summaries_path);
+            continue;
+        }
+
+        const sentinel_store_entry_t* entry = sentinel_store_find(store, hash);
+
+        /* Lines of dives which did not make it to the index are left out */
+        if (entry == NULL || !missing[entry - store->entries])
+            continue;
+
+        s.min_depth           = u[0];
+        s.max_depth           = u[1];
+        s.min_po2             = u[2];
+        s.max_po2             = u[3];
+        s.min_cell_o2[0]      = u[4];
+        s.min_cell_o2[1]      = u[5];
+        s.min_cell_o2[2]      = u[6];
+        s.min_battery[0]      = u[7];
+        s.min_battery[1]      = u[8];
+        s.diluent_pressure[0] = pressure[0];
+        s.diluent_pressure[1] = pressure[1];
+        s.o2_pressure[0]      = pressure[2];
+        s.o2_pressure[1]      = pressure[3];
+        s.max_co2             = u[9];
+
+        char* p = line + offset;
+        char* q = NULL;
+
+        while (true) {
+            const long code = strtol(p, &q, 10);
+
+            if (q == p || *q != '/')
+                break;
+
+            p = q + 1;
+            const long notes = strtol(p, &q, 10);
+
+            if (q == p)
+                break;
+
+            if (code >= 1 && code <= SENTINEL_NOTE_KINDS)
+                s.note_count[code - 1] = notes;
+            else if (code == SENTINEL_NOTE_UNKNOWN)
+                s.note_count[SENTINEL_NOTE_KINDS] = notes;
+
+            p = q;
+        }
+
+        store->entries[entry - store->entries].summary = s;
+        missing[entry - store->entries] = false;
+    }
+
+    if (in != NULL)
+        fclose(in);
+
+    sentinel_free(line);
+
+    return(true);
+}
+
+/**
+ * sentinel_summary_free: Frees what the store keeps for the summaries, they are in the entries
+ **/
+
+void sentinel_summary_free(sentinel_store_t* store) {
+    sentinel_free(store->summaries_path);
+}
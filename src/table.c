@@ -0,0 +1,139 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#include <limits.h>
+
+#include "libsentinel.h"
+
+const sentinel_header_table_t DEFAULT_HEADER_TABLE = {
+    NULL, /* headers */
+    0,    /* count */
+    NULL  /* by_time */
+};
+
+/**
+ * sentinel_header_table_build: Indexes the given header list, the previous index is freed. The
+ *                              list is indexed as it is, rebuild the table when it changes
+ **/
+
+bool sentinel_header_table_build(sentinel_header_table_t* table, sentinel_header_t** header_list) {
+    int count = 0;
+    int i = 0;
+    int j = 0;
+
+    sentinel_header_table_clear(table);
+
+    while (header_list != NULL && header_list[count] != NULL) {
+        count++;
+    }
+
+    if (count == 0) {
+        table->headers = header_list;
+        return(true);
+    }
+
+    int* by_time = sentinel_malloc(count * sizeof(int));
+
+    if (by_time == NULL)
+        return(false);
+
+    /* The list is mostly newest first already, so an insertion sort from the end is about linear */
+    for (i = 0; i < count; i++) {
+        const int dive_num = count - 1 - i;
+        const int start_s  = header_list[dive_num]->start_s;
+
+        for (j = i; j > 0 && header_list[by_time[j - 1]]->start_s > start_s; j--) {
+            by_time[j] = by_time[j - 1];
+        }
+
+        by_time[j] = dive_num;
+    }
+
+    table->headers = header_list;
+    table->count   = count;
+    table->by_time = by_time;
+
+    return(true);
+}
+
+/**
+ * sentinel_header_table_clear: Frees the index, the headers are not touched
+ **/
+
+void sentinel_header_table_clear(sentinel_header_table_t* table) {
+    if (table->by_time != NULL)
+        sentinel_free(table->by_time);
+
+    *table = DEFAULT_HEADER_TABLE;
+}
+
+/**
+ * sentinel_header_table_get: Returns the header of the given dive number, NULL if there is none
+ **/
+
+sentinel_header_t* sentinel_header_table_get(const sentinel_header_table_t* table, const int dive_num) {
+    if (dive_num < 0 || dive_num >= table->count)
+        return(NULL);
+
+    return(table->headers[dive_num]);
+}
+
+/**
+ * sentinel_header_table_lower: Position of the first dive in by_time which starts at or after
+ *                              the given time
+ **/
+
+static int sentinel_header_table_lower(const sentinel_header_table_t* table, const int start_s) {
+    int low  = 0;
+    int high = table->count;
+
+    while (low < high) {
+        const int mid = low + (high - low) / 2;
+
+        if (table->headers[table->by_time[mid]]->start_s < start_s)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return(low);
+}
+
+/**
+ * sentinel_header_table_range: Returns the dive numbers of the dives starting between from_s and
+ *                              to_s, both included, the oldest first. The count is set to the
+ *                              number of dives, the returned array belongs to the table
+ **/
+
+const int* sentinel_header_table_range(const sentinel_header_table_t* table, const int from_s, const int to_s,
+                                       int* count) {
+    *count = 0;
+
+    if (table->count == 0 || from_s > to_s)
+        return(NULL);
+
+    const int first = sentinel_header_table_lower(table, from_s);
+    const int last  = (to_s == INT_MAX) ? table->count : sentinel_header_table_lower(table, to_s + 1);
+
+    *count = last - first;
+
+    return(table->by_time + first);
+}
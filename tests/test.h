@@ -0,0 +1,143 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#ifndef SENTINEL_TEST_H
+#define SENTINEL_TEST_H
+
+#include <ftw.h>
+
+#include "libsentinel.h"
+
+/* The tests are plain programs, each TEST_CHECK that fails is reported and fails the program */
+static int test_failures = 0;
+
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+/* Allocations made with TEST_ALLOCATOR, the live ones and all of them */
+static int test_live = 0;
+static int test_allocated = 0;
+
+static inline void* test_malloc(size_t size, void* data) {
+    (void) data;
+    test_live++;
+    test_allocated++;
+    return(malloc(size));
+}
+
+static inline void* test_calloc(size_t nmemb, size_t size, void* data) {
+    (void) data;
+    test_live++;
+    test_allocated++;
+    return(calloc(nmemb, size));
+}
+
+static inline void* test_realloc(void* ptr, size_t size, void* data) {
+    (void) data;
+    test_live += (ptr == NULL);
+    test_allocated++;
+    return(realloc(ptr, size));
+}
+
+static inline void test_free(void* ptr, void* data) {
+    (void) data;
+    test_live -= (ptr != NULL);
+    free(ptr);
+}
+
+/* Counts the allocations of a context, to check that they all go through it */
+static const sentinel_allocator_t TEST_ALLOCATOR = {test_malloc, test_calloc, test_realloc, test_free, NULL};
+
+/**
+ * test_remove_file: nftw callback of test_remove_dir
+ **/
+
+static int test_remove_file(const char* path, const struct stat* sb, int flag, struct FTW* ftw) {
+    (void) sb;
+    (void) flag;
+    (void) ftw;
+    return(remove(path));
+}
+
+/**
+ * test_store_dir: Returns a new empty directory for a store, remove it with test_remove_dir
+ **/
+
+static inline char* test_store_dir(void) {
+    static char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/sentinel-test-XXXXXX");
+
+    return(mkdtemp(path));
+}
+
+/**
+ * test_remove_dir: Removes the directory and everything in it
+ **/
+
+static inline void test_remove_dir(const char* path) {
+    nftw(path, test_remove_file, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * test_generate: Returns a generated dive of the given number of records
+ **/
+
+static inline char* test_generate(const int records, const unsigned int seed) {
+    sentinel_generator_t gen = DEFAULT_GENERATOR;
+
+    gen.records = records;
+    gen.seed    = seed;
+    gen.start  += seed * 86400;
+
+    return(sentinel_generate_dive(&gen));
+}
+
+/**
+ * test_read_file: Returns the contents of the file, NUL terminated, with the length in len
+ **/
+
+static inline char* test_read_file(const char* path, size_t* len) {
+    FILE* in = fopen(path, "r");
+    char* text = NULL;
+
+    if (in == NULL)
+        return(NULL);
+
+    fseek(in, 0, SEEK_END);
+    *len = ftell(in);
+    rewind(in);
+
+    if ((text = calloc(*len + 1, sizeof(char))) != NULL && fread(text, 1, *len, in) != *len) {
+        free(text);
+        text = NULL;
+    }
+
+    fclose(in);
+
+    return(text);
+}
+
+#endif  // SENTINEL_TEST_H
@@ -0,0 +1,85 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* mkdtemp, nftw */
+#include <dirent.h>
+
+#include "test.h"
+
+/**
+ * test_open_fds: Returns the number of open descriptors of the process
+ **/
+
+static int test_open_fds(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    int count = 0;
+
+    if (dir == NULL)
+        return(-1);
+
+    while (readdir(dir) != NULL) {
+        count++;
+    }
+
+    closedir(dir);
+
+    return(count);
+}
+
+/**
+ * test_connect_again: Connecting a connected context closes the previous descriptor, a busy
+ *                     context is not connected
+ **/
+
+static void test_connect_again(void) {
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+
+    config.generated_dives  = 1;
+    config.idle_interval_ms = 100;
+
+    sentinel_emulator_t* emu = sentinel_emulator_start_pty(&config);
+    sentinel_ctx_t* ctx = sentinel_ctx_new(NULL);
+
+    TEST_CHECK(emu != NULL && ctx != NULL);
+
+    if (emu != NULL && ctx != NULL) {
+        TEST_CHECK(sentinel_ctx_connect(ctx, emu->client_path, 20));
+
+        const int fds = test_open_fds();
+
+        TEST_CHECK(sentinel_ctx_connect(ctx, emu->client_path, 20));
+        TEST_CHECK(test_open_fds() == fds);
+
+        ctx->busy = true;
+        TEST_CHECK(!sentinel_ctx_connect(ctx, emu->client_path, 20));
+        TEST_CHECK(test_open_fds() == fds);
+        ctx->busy = false;
+    }
+
+    sentinel_ctx_free(ctx);
+    sentinel_emulator_free(emu);
+}
+
+int main(void) {
+    test_connect_again();
+
+    return(test_failures > 0);
+}
@@ -0,0 +1,158 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* mkdtemp, nftw */
+#include "test.h"
+
+#define TEST_DECO_DIVES 13
+
+/**
+ * test_deco_parse: Returns the parsed header of a generated dive of the given number of records
+ **/
+
+static sentinel_header_t* test_deco_parse(const int records, const unsigned int seed) {
+    char* text = test_generate(records, seed);
+    char* buffer = text;
+    sentinel_header_t* header = NULL;
+
+    if (text != NULL && !parse_sentinel_dive(&buffer, &header)) {
+        free_sentinel_header(header);
+        header = NULL;
+    }
+
+    free(text);
+
+    return(header);
+}
+
+/**
+ * test_deco_same: Whether the two results are the same up to rounding
+ **/
+
+static bool test_deco_same(const sentinel_deco_result_t* a, const sentinel_deco_result_t* b) {
+    int i = 0;
+
+    if (a->records != b->records || a->ceiling_mismatches != b->ceiling_mismatches ||
+        fabs(a->max_ceiling - b->max_ceiling) > 1e-9 || fabs(a->final_ceiling - b->final_ceiling) > 1e-9)
+        return(false);
+
+    for (i = 0; i < SENTINEL_DECO_TISSUES; i++) {
+        if (fabs(a->tissue_percentage[i] - b->tissue_percentage[i]) > 1e-9)
+            return(false);
+    }
+
+    return(true);
+}
+
+/**
+ * test_deco_batch: Replaying more dives than the batch steps together, of different lengths and
+ *                  record intervals and with one dive that has no log, gives the same results as
+ *                  replaying each of the dives on its own
+ **/
+
+static void test_deco_batch(void) {
+    sentinel_header_t* header_list[TEST_DECO_DIVES + 1];
+    sentinel_deco_result_t batch[TEST_DECO_DIVES];
+    sentinel_deco_result_t single;
+    const sentinel_deco_params_t params = DEFAULT_DECO_PARAMS;
+    int i = 0;
+
+    for (i = 0; i < TEST_DECO_DIVES; i++) {
+        header_list[i] = test_deco_parse(200 + 700 * (i % 5), i + 1);
+        TEST_CHECK(header_list[i] != NULL);
+
+        if (header_list[i] != NULL && i % 3 == 1)
+            header_list[i]->record_interval = 20;
+    }
+
+    header_list[TEST_DECO_DIVES] = NULL;
+
+    /* The dive without a log is reported and the ones after it are still replayed */
+    free_sentinel_header(header_list[5]);
+    header_list[5] = alloc_sentinel_header();
+    *header_list[5] = DEFAULT_HEADER;
+    header_list[5]->record_interval = 10;
+
+    TEST_CHECK(sentinel_deco_replay_batch(header_list, &params, batch) == TEST_DECO_DIVES - 1);
+
+    for (i = 0; i < TEST_DECO_DIVES; i++) {
+        if (i == 5)
+            continue;
+
+        single.ceiling = NULL;
+        TEST_CHECK(sentinel_deco_replay(header_list[i], &params, &single));
+        TEST_CHECK(batch[i].records > 0 && test_deco_same(&batch[i], &single));
+    }
+
+    for (i = 0; i < TEST_DECO_DIVES; i++) {
+        free_sentinel_header(header_list[i]);
+    }
+}
+
+/**
+ * test_deco_gradient_factor: The ceiling with the gradient factor interpolated from gf_low to
+ *                            gf_high lies between the ceilings with gf_high and with gf_low
+ **/
+
+static void test_deco_gradient_factor(void) {
+    sentinel_header_t* header = test_deco_parse(3000, 4);
+    sentinel_deco_params_t params[3] = {DEFAULT_DECO_PARAMS, DEFAULT_DECO_PARAMS, DEFAULT_DECO_PARAMS};
+    sentinel_deco_state_t state[3];
+    int outside = 0;
+    int i = 0;
+    int j = 0;
+
+    TEST_CHECK(header != NULL);
+
+    if (header == NULL)
+        return;
+
+    params[1].gf_high = params[1].gf_low;
+    params[2].gf_low  = params[2].gf_high;
+
+    for (j = 0; j < 3; j++) {
+        state[j].interval = 0;
+        TEST_CHECK(sentinel_deco_init(&state[j], header, &params[j]));
+    }
+
+    for (i = 0; header->log[i] != NULL; i++) {
+        double ceiling[3];
+
+        for (j = 0; j < 3; j++) {
+            sentinel_deco_step(&state[j], header->log[i]->depth, header->log[i]->po2);
+            ceiling[j] = sentinel_deco_ceiling(&state[j]);
+        }
+
+        if (ceiling[0] > ceiling[1] + 1e-9 || ceiling[0] < ceiling[2] - 1e-9)
+            outside++;
+    }
+
+    TEST_CHECK(outside == 0 && state[1].first_stop > state[1].surface_pressure);
+
+    free_sentinel_header(header);
+}
+
+int main(void) {
+    test_deco_batch();
+    test_deco_gradient_factor();
+
+    return(test_failures > 0);
+}
@@ -0,0 +1,108 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* mkdtemp, nftw */
+#include "test.h"
+
+/**
+ * test_export_count: Exports the store as CSV into a temporary file, returns the number of rows
+ *                    without the header row or -1 if the export fails
+ **/
+
+static int test_export_count(const sentinel_store_t* store, const int threads) {
+    FILE* out = tmpfile();
+    char line[1024];
+    int rows = -1;
+
+    if (out == NULL)
+        return(-1);
+
+    if (sentinel_export_store(store, fileno(out), SENTINEL_EXPORT_CSV, threads)) {
+        rewind(out);
+
+        while (fgets(line, sizeof(line), out) != NULL) {
+            rows++;
+        }
+    }
+
+    fclose(out);
+
+    return(rows);
+}
+
+/**
+ * test_export_long_dive: A dive with more records than the first allocation of a worker, as the
+ *                        first and as a later dive of the worker, in one and in two threads and
+ *                        inside a context
+ **/
+
+static void test_export_long_dive(void) {
+    const int records[] = {4500, 100, 5000};
+    char* path = test_store_dir();
+    int total = 0;
+    int i = 0;
+
+    TEST_CHECK(path != NULL);
+
+    if (path == NULL)
+        return;
+
+    sentinel_store_t* store = sentinel_store_open(path);
+    TEST_CHECK(store != NULL);
+
+    for (i = 0; store != NULL && i < 3; i++) {
+        char* dive = test_generate(records[i], i + 1);
+
+        TEST_CHECK(dive != NULL);
+        TEST_CHECK(sentinel_store_ingest(store, dive, strlen(dive), NULL) == SENTINEL_STORE_ADDED);
+        total += records[i];
+        free(dive);
+    }
+
+    for (i = 1; store != NULL && i <= 2; i++) {
+        TEST_CHECK(test_export_count(store, i) == total);
+    }
+
+    /* The workers allocate in the context of the caller and all of it is freed */
+    sentinel_ctx_t* ctx = sentinel_ctx_new(&TEST_ALLOCATOR);
+    TEST_CHECK(ctx != NULL);
+
+    if (store != NULL && ctx != NULL) {
+        const int live = test_live;
+        const int allocated = test_allocated;
+        sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+
+        TEST_CHECK(test_export_count(store, 2) == total);
+        sentinel_ctx_leave(prev);
+        TEST_CHECK(test_allocated > allocated && test_live == live);
+    }
+
+    sentinel_ctx_free(ctx);
+
+    sentinel_store_close(store);
+    test_remove_dir(path);
+}
+
+int main(void) {
+    test_export_long_dive();
+
+    return(test_failures > 0);
+}
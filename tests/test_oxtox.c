@@ -0,0 +1,113 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* mkdtemp, nftw */
+#include "test.h"
+
+/**
+ * test_oxtox_table: A minute at a time, the exposure adds up to the NOAA limits and to one OTU a
+ *                   minute at 1.0 bar
+ **/
+
+static void test_oxtox_table(void) {
+    sentinel_oxtox_t oxtox;
+    int i = 0;
+
+    sentinel_oxtox_init(&oxtox, 60);
+
+    for (i = 0; i < 45; i++) {
+        sentinel_oxtox_update_raw(&oxtox, 160);
+    }
+
+    TEST_CHECK(fabs(oxtox.cns - 100.0) < 1e-9);
+
+    sentinel_oxtox_init(&oxtox, 60);
+
+    for (i = 0; i < 60; i++) {
+        sentinel_oxtox_update(&oxtox, 1.0);
+    }
+
+    TEST_CHECK(fabs(oxtox.cns - 20.0) < 1e-9 && fabs(oxtox.otu - 60.0) < 1e-9 && oxtox.records == 60);
+
+    /* Below 0.5 bar the CNS is eliminated with a half time of 90 minutes */
+    for (i = 0; i < 90; i++) {
+        sentinel_oxtox_update_raw(&oxtox, 21);
+    }
+
+    TEST_CHECK(fabs(oxtox.cns - 10.0) < 1e-9 && fabs(oxtox.otu - 60.0) < 1e-9);
+}
+
+/**
+ * test_oxtox_record: Record callback which adds the record to the exposure in the data
+ **/
+
+static void test_oxtox_record(const sentinel_record_t* record, void* data) {
+    sentinel_oxtox_update_raw(data, record->po2);
+}
+
+/**
+ * test_oxtox_dump: The exposure of a sample dump, computed from its log and from its records as
+ *                  they are parsed, matches the CNS and OTU of its header
+ **/
+
+static void test_oxtox_dump(const char* dump) {
+    sentinel_fixed_header_t fixed;
+    sentinel_fixed_dive_t dive;
+    sentinel_header_t* header = NULL;
+    sentinel_oxtox_t streamed;
+    sentinel_oxtox_t oxtox;
+    size_t len = 0;
+    char* text = test_read_file(dump, &len);
+    char* buffer = (text != NULL) ? strstr(text, "ver=") : NULL;
+
+    TEST_CHECK(buffer != NULL);
+
+    if (buffer == NULL) {
+        free(text);
+        return;
+    }
+
+    len -= buffer - text;
+
+    /* The record interval of the samples is 10 s, the header is parsed before the records arrive */
+    sentinel_oxtox_init(&streamed, 10);
+    sentinel_fixed_init(&dive, NULL, 0, &fixed, NULL, 0);
+    dive.record_callback = test_oxtox_record;
+    dive.record_data     = &streamed;
+
+    TEST_CHECK(sentinel_fixed_parse(&dive, buffer, len) == SENTINEL_FIXED_OK && fixed.record_interval == 10);
+    TEST_CHECK(parse_sentinel_dive(&buffer, &header) && sentinel_oxtox_dive(header, &oxtox, NULL, NULL));
+    TEST_CHECK(streamed.records == oxtox.records && fabs(streamed.cns - oxtox.cns) < 1e-9 && fabs(streamed.otu - oxtox.otu) < 1e-9);
+
+    /* The rebreather rounds the OTU and follows the elimination of its own model */
+    TEST_CHECK(header != NULL && sentinel_oxtox_matches_header(header, &oxtox, 1.0, 5.0));
+
+    free_sentinel_header(header);
+    free(text);
+}
+
+int main(void) {
+    test_oxtox_table();
+    test_oxtox_dump("mockup/sentinel_serial_emulator/1.txt");
+    test_oxtox_dump("mockup/sentinel_serial_emulator/3.txt");
+
+    return(test_failures > 0);
+}
@@ -0,0 +1,385 @@
+/*
+ * libsentinel
+ *
+ * Copyright (C) 2017 Paul-Erik Törrönen
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE /* mkdtemp, nftw */
+#include <limits.h>
+#include <sys/wait.h>
+
+#include "test.h"
+
+/**
+ * test_stream_child: Streams dive 0 of an emulator with the given seed into the store and exits
+ **/
+
+static void test_stream_child(const char* path, const unsigned int seed) {
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+    static char window[4096];
+    sentinel_fixed_header_t header;
+    sentinel_fixed_dive_t dive;
+
+    config.generated_dives = 1;
+    config.generator.seed  = seed;
+    config.line_rate       = 100000;
+
+    sentinel_emulator_t* emu = sentinel_emulator_start_socketpair(&config);
+    sentinel_store_t* store = sentinel_store_open(path);
+    bool res = false;
+
+    if (emu != NULL && store != NULL) {
+        sentinel_fixed_init(&dive, window, sizeof(window), &header, NULL, 0);
+        res = (sentinel_store_stream(store, emu->client_fd, 0, &dive) == SENTINEL_STORE_ADDED);
+    }
+
+    sentinel_store_close(store);
+    sentinel_emulator_free(emu);
+
+    exit(res ? 0 : 1);
+}
+
+/**
+ * test_stream_concurrent: Two downloads streaming the same dive number into the same store at the
+ *                         same time both end up in it
+ **/
+
+static void test_stream_concurrent(void) {
+    char* path = test_store_dir();
+    pid_t pid[2];
+    int status = 0;
+    int i = 0;
+
+    TEST_CHECK(path != NULL);
+
+    if (path == NULL)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        if ((pid[i] = fork()) == 0)
+            test_stream_child(path, i + 1);
+
+        TEST_CHECK(pid[i] > 0);
+    }
+
+    for (i = 0; i < 2; i++) {
+        TEST_CHECK(pid[i] > 0 && waitpid(pid[i], &status, 0) == pid[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    sentinel_store_t* store = sentinel_store_open(path);
+    sentinel_header_t* header = NULL;
+
+    TEST_CHECK(store != NULL && store->count == 2);
+
+    for (i = 0; store != NULL && i < store->count; i++) {
+        TEST_CHECK(sentinel_store_load(store, &store->entries[i], &header));
+        TEST_CHECK(header != NULL && header->log_lines == store->entries[i].log_lines);
+    }
+
+    free_sentinel_header(header);
+    sentinel_store_close(store);
+    test_remove_dir(path);
+}
+
+/**
+ * test_serial_number: A dive downloaded into the store and the same dive streamed into it are
+ *                     stored under the serial number of the list, in full
+ **/
+
+static void test_serial_number(void) {
+    char* dumps[] = {"mockup/sentinel_serial_emulator/4.txt", NULL};
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+    sentinel_download_report_t report;
+    static char window[4096];
+    sentinel_fixed_header_t header;
+    sentinel_fixed_dive_t dive;
+    char* paths[2] = {NULL, NULL};
+    sentinel_store_t* store[2] = {NULL, NULL};
+    int i = 0;
+
+    config.dump_files = dumps;
+    config.line_rate  = 0;
+
+    sentinel_emulator_t* emu = sentinel_emulator_start_socketpair(&config);
+    sentinel_ctx_t* ctx = sentinel_ctx_new(NULL);
+
+    TEST_CHECK(emu != NULL && ctx != NULL);
+
+    for (i = 0; i < 2; i++) {
+        char* path = test_store_dir();
+
+        paths[i] = (path != NULL) ? strdup(path) : NULL;
+        store[i] = (paths[i] != NULL) ? sentinel_store_open(paths[i]) : NULL;
+        TEST_CHECK(store[i] != NULL);
+    }
+
+    if (emu != NULL && ctx != NULL && store[0] != NULL && store[1] != NULL) {
+        sentinel_ctx_attach(ctx, emu->client_fd, NULL);
+        TEST_CHECK(sentinel_ctx_list(ctx));
+
+        const sentinel_header_t* listed = sentinel_header_table_get(&ctx->table, 0);
+
+        TEST_CHECK(listed != NULL && listed->serial_number != NULL && strcmp(listed->serial_number, "4AAD12245D5B7038") == 0);
+        TEST_CHECK(sentinel_store_download(ctx, store[0], 0, 1, &report) == SENTINEL_STORE_ADDED);
+
+        sentinel_fixed_init(&dive, window, sizeof(window), &header, NULL, 0);
+        TEST_CHECK(sentinel_store_stream(store[1], emu->client_fd, 0, &dive) == SENTINEL_STORE_ADDED);
+
+        TEST_CHECK(store[0]->count == 1 && store[1]->count == 1);
+        TEST_CHECK(store[0]->entries[0].hash == store[1]->entries[0].hash);
+        TEST_CHECK(strcmp(store[0]->entries[0].serial_number, store[1]->entries[0].serial_number) == 0);
+
+        for (i = 0; listed != NULL && i < 2; i++) {
+            TEST_CHECK(sentinel_store_newest(store[i], listed->serial_number) == &store[i]->entries[0]);
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        sentinel_store_close(store[i]);
+
+        if (paths[i] != NULL)
+            test_remove_dir(paths[i]);
+
+        free(paths[i]);
+    }
+
+    sentinel_ctx_free(ctx);
+    sentinel_emulator_free(emu);
+}
+
+/**
+ * test_list_new: Listing the new dives of a rebreather stops at its own newest dive in the store,
+ *                whatever the dives of the other rebreathers in the store
+ **/
+
+static void test_list_new(void) {
+    char* dumps[] = {"mockup/sentinel_serial_emulator/6.txt", "mockup/sentinel_serial_emulator/4.txt",
+                     "mockup/sentinel_serial_emulator/5.txt", NULL};
+    sentinel_emulator_config_t config = DEFAULT_EMULATOR_CONFIG;
+    sentinel_generator_t gen = DEFAULT_GENERATOR;
+    char* path = test_store_dir();
+    size_t len = 0;
+
+    TEST_CHECK(path != NULL);
+
+    if (path == NULL)
+        return;
+
+    config.dump_files = dumps;
+    config.line_rate  = 0;
+
+    sentinel_emulator_t* emu = sentinel_emulator_start_socketpair(&config);
+    sentinel_ctx_t* ctx = sentinel_ctx_new(NULL);
+    sentinel_store_t* store = sentinel_store_open(path);
+    char* stored = test_read_file(dumps[1], &len);
+
+    /* Another rebreather with a dive which started at the same time as the newest one */
+    gen.start = 796835340;
+    char* other = sentinel_generate_dive(&gen);
+
+    TEST_CHECK(emu != NULL && ctx != NULL && store != NULL && stored != NULL && other != NULL);
+
+    if (emu != NULL && ctx != NULL && store != NULL && stored != NULL && other != NULL) {
+        TEST_CHECK(sentinel_store_ingest(store, stored, len, NULL) == SENTINEL_STORE_ADDED);
+        TEST_CHECK(sentinel_store_ingest(store, other, strlen(other), NULL) == SENTINEL_STORE_ADDED);
+
+        sentinel_ctx_attach(ctx, emu->client_fd, NULL);
+        TEST_CHECK(sentinel_store_list_new(ctx, store));
+        TEST_CHECK(ctx->table.count == 1);
+
+        const sentinel_header_t* header = sentinel_header_table_get(&ctx->table, 0);
+
+        TEST_CHECK(header != NULL && header->start_s == sentinel_to_unix_timestamp(796835340));
+        TEST_CHECK(header != NULL && header->serial_number != NULL && strcmp(header->serial_number, "4AAD12245D5B7038") == 0);
+    }
+
+    free(other);
+    free(stored);
+    sentinel_store_close(store);
+    sentinel_ctx_free(ctx);
+    sentinel_emulator_free(emu);
+    test_remove_dir(path);
+}
+
+/**
+ * test_unknown_firmware: A dive of an unknown firmware is not parsed into records nor stored
+ **/
+
+static void test_unknown_firmware(void) {
+    sentinel_record_t records[16];
+    sentinel_record_t* parsed = NULL;
+    sentinel_fixed_header_t header;
+    sentinel_fixed_dive_t dive;
+    char* path = test_store_dir();
+    char* text = test_generate(10, 3);
+
+    TEST_CHECK(path != NULL && text != NULL);
+
+    if (path == NULL || text == NULL) {
+        free(text);
+        return;
+    }
+
+    char* ver = strstr(text, "ver=");
+    TEST_CHECK(ver != NULL);
+
+    if (ver != NULL)
+        memcpy(ver + 4, "V999", 4);
+
+    sentinel_store_t* store = sentinel_store_open(path);
+
+    sentinel_fixed_init(&dive, NULL, 0, &header, records, 16);
+    TEST_CHECK(sentinel_fixed_parse(&dive, text, strlen(text)) == SENTINEL_FIXED_FAILED && dive.count == 0);
+    TEST_CHECK(parse_sentinel_dive_records(text, strlen(text), &parsed) == -1 && parsed == NULL);
+    TEST_CHECK(store != NULL && sentinel_store_ingest(store, text, strlen(text), NULL) == SENTINEL_STORE_ERROR);
+    TEST_CHECK(store != NULL && store->count == 0);
+
+    sentinel_store_close(store);
+    test_remove_dir(path);
+    free(text);
+}
+
+/**
+ * test_store_context: A store keeps its memory in the context it was opened in, also when dives
+ *                     are added and it is closed outside of it
+ **/
+
+static void test_store_context(void) {
+    sentinel_ctx_t* ctx = sentinel_ctx_new(&TEST_ALLOCATOR);
+    char* path = test_store_dir();
+    char* text = test_generate(100, 7);
+
+    TEST_CHECK(ctx != NULL && path != NULL && text != NULL);
+
+    if (ctx != NULL && path != NULL && text != NULL) {
+        const int live = test_live;
+        sentinel_ctx_t* prev = sentinel_ctx_enter(ctx);
+        sentinel_store_t* store = sentinel_store_open(path);
+
+        sentinel_ctx_leave(prev);
+        TEST_CHECK(store != NULL && test_live > live);
+
+        const int allocated = test_allocated;
+
+        TEST_CHECK(sentinel_store_ingest(store, text, strlen(text), NULL) == SENTINEL_STORE_ADDED);
+        TEST_CHECK(test_allocated > allocated);
+
+        sentinel_store_close(store);
+        TEST_CHECK(test_live == live);
+        test_remove_dir(path);
+    }
+
+    free(text);
+    sentinel_ctx_free(ctx);
+}
+
+/**
+ * test_events_check: Compares the events of the dives which started between from_s and to_s with
+ *                    the events of all of the dives, filtered by their start
+ **/
+
+static void test_events_check(const sentinel_store_t* store, const uint8_t* codes, const int code_count,
+                              const sentinel_event_match_t match, const int from_s, const int to_s) {
+    sentinel_event_t* all = NULL;
+    sentinel_event_t* range = NULL;
+    const int all_count = sentinel_store_events(store, codes, code_count, match, 0, 0, &all);
+    const int range_count = sentinel_store_events(store, codes, code_count, match, from_s, to_s, &range);
+    int count = 0;
+    int i = 0;
+
+    TEST_CHECK(all_count > 0 && range_count >= 0);
+
+    for (i = 0; i < all_count; i++) {
+        const int start_s = store->entries[all[i].dive].start_s;
+
+        if (start_s < from_s || start_s > to_s)
+            continue;
+
+        TEST_CHECK(count < range_count && range[count].dive == all[i].dive &&
+                   range[count].time_idx == all[i].time_idx && range[count].code == all[i].code);
+        count++;
+    }
+
+    TEST_CHECK(count == range_count);
+
+    sentinel_free(all);
+    sentinel_free(range);
+}
+
+/**
+ * test_events_range: The events of a time range are the same whether the dives were added in the
+ *                    order they started or in the reverse order, when they are searched in
+ *                    halves, or in another order
+ **/
+
+static void test_events_range(void) {
+    const int order[3][8] = {{1, 2, 3, 4, 5, 6, 7, 8}, {8, 7, 6, 5, 4, 3, 2, 1}, {5, 2, 8, 1, 7, 3, 6, 4}};
+    uint8_t codes[SENTINEL_NOTE_KINDS];
+    const uint8_t generated[2] = {sentinel_note_code("PPO2 HIGH", 9), sentinel_note_code("PPO2 LOW", 8)};
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < SENTINEL_NOTE_KINDS; i++) {
+        codes[i] = i + 1;
+    }
+
+    for (i = 0; i < 3; i++) {
+        char* path = test_store_dir();
+        sentinel_store_t* store = (path != NULL) ? sentinel_store_open(path) : NULL;
+
+        TEST_CHECK(store != NULL);
+
+        if (store == NULL)
+            continue;
+
+        for (j = 0; j < 8; j++) {
+            char* text = test_generate(500, order[i][j]);
+
+            TEST_CHECK(text != NULL && sentinel_store_ingest(store, text, strlen(text), NULL) == SENTINEL_STORE_ADDED);
+            free(text);
+        }
+
+        TEST_CHECK(store->ascending == (i == 0) && store->descending == (i == 1));
+
+        const int day = 86400;
+        const int first = sentinel_to_unix_timestamp(DEFAULT_GENERATOR.start);
+
+        test_events_check(store, codes, SENTINEL_NOTE_KINDS, SENTINEL_EVENTS_ANY, first + 3 * day, first + 6 * day);
+        test_events_check(store, codes, SENTINEL_NOTE_KINDS, SENTINEL_EVENTS_ANY, first + 3 * day - 1, first + 3 * day + 1);
+        test_events_check(store, codes, SENTINEL_NOTE_KINDS, SENTINEL_EVENTS_ANY, first + 9 * day, first + 10 * day);
+        test_events_check(store, generated, 2, SENTINEL_EVENTS_ALL, first + 2 * day, first + 7 * day);
+        test_events_check(store, generated, 2, SENTINEL_EVENTS_ALL, first, first + 8 * day);
+        test_events_check(store, codes, SENTINEL_NOTE_KINDS, SENTINEL_EVENTS_ANY, INT_MIN, INT_MAX);
+        test_events_check(store, codes, SENTINEL_NOTE_KINDS, SENTINEL_EVENTS_ANY, first + 5 * day, INT_MAX);
+        test_events_check(store, generated, 2, SENTINEL_EVENTS_ALL, INT_MIN, first + 4 * day);
+
+        sentinel_store_close(store);
+        test_remove_dir(path);
+    }
+}
+
+int main(void) {
+    test_stream_concurrent();
+    test_serial_number();
+    test_list_new();
+    test_unknown_firmware();
+    test_store_context();
+    test_events_range();
+
+    return(test_failures > 0);
+}